@@ -0,0 +1,34 @@
+#!/bin/bash
+#
+# reactor.c 每条空闲连接的内存开销
+#
+# 启动 reactor -q，用 c1000k_bench 每步增加 STEP 条空闲连接直到 conns 条，每步输出服务器 RSS、
+# 内核 socket 缓冲区和 slab 的增量折算到每条连接的字节数。
+# 用户态字节数超过 BUDGET 时脚本返回 1，用来发现 conn_item 变大之类的内存回退。
+#
+# 连接数受 ulimit -n 限制(客户端和服务器各占一个 fd)，百万连接需要调大 fs.nr_open / ulimit，
+# 并用 NSRC 指定多个源地址。
+#
+# usage: ./bench_c1000k.sh [conns]
+
+CONNS=${1:-18000}
+STEP=${STEP:-3000}
+BUDGET=${BUDGET:-2048}
+NSRC=${NSRC:-1}
+PORT=2048
+
+cd "$(dirname "$0")"
+gcc -O2 reactor.c -o reactor -lpthread || exit 1
+gcc -O2 c1000k_bench.c -o c1000k_bench || exit 1
+
+ulimit -n $(ulimit -Hn)
+./reactor -q > /dev/null &
+server=$!
+sleep 0.5
+
+./c1000k_bench -n $CONNS -s $STEP -b $NSRC -B $BUDGET -P $server 127.0.0.1 $PORT
+ret=$?
+
+kill $server
+wait $server 2>/dev/null
+exit $ret
@@ -0,0 +1,49 @@
+#!/bin/bash
+#
+# 协程版和回调版 echo 的对比
+#
+# 同时启动 coro_echo -m callback 和 -m coro，对每个连接数交替压测 ROUNDS 轮(每轮 seconds 秒)，
+# 取 req/sec 和服务器 cpu/req 的中位数。交替运行是为了让两边经历同样的机器抖动。
+#
+# usage: ./bench_coro.sh [seconds] [conns ...]
+
+SECONDS_PER_RUN=${1:-2}
+shift
+CONNS=${@:-"1 100"}
+ROUNDS=${ROUNDS:-10}
+SIZE=${SIZE:-64}
+PORT_CB=9097
+PORT_CORO=9098
+
+cd "$(dirname "$0")"
+g++ -O2 -std=c++20 coro.cc coro_echo.cc -o coro_echo || exit 1
+gcc -O2 echo_bench.c -o echo_bench || exit 1
+
+./coro_echo -m callback -p $PORT_CB > /dev/null &
+cb=$!
+./coro_echo -m coro -p $PORT_CORO > /dev/null &
+co=$!
+sleep 0.5
+
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { if (NR) print (NR % 2) ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2 }'
+}
+
+printf "%-8s %-10s %-12s %-10s\n" conns mode req/sec cpu_us/req
+for c in $CONNS; do
+    : > /tmp/bench_coro_cb
+    : > /tmp/bench_coro_co
+    for r in $(seq $ROUNDS); do
+        ./echo_bench -c $c -s $SIZE -d $SECONDS_PER_RUN -P $cb 127.0.0.1 $PORT_CB | grep '^RESULT' >> /tmp/bench_coro_cb
+        ./echo_bench -c $c -s $SIZE -d $SECONDS_PER_RUN -P $co 127.0.0.1 $PORT_CORO | grep '^RESULT' >> /tmp/bench_coro_co
+    done
+    for mode in cb co; do
+        rps=$(sed -n 's/.*req_per_sec=\([0-9]*\).*/\1/p' /tmp/bench_coro_$mode | median)
+        cpu=$(sed -n 's/.*cpu_us_per_req=\([0-9.]*\).*/\1/p' /tmp/bench_coro_$mode | median)
+        printf "%-8s %-10s %-12s %-10s\n" $c $([ $mode = cb ] && echo callback || echo coro) "${rps:--}" "${cpu:--}"
+    done
+done
+
+kill $cb $co
+wait $cb $co 2>/dev/null
+rm -f /tmp/bench_coro_cb /tmp/bench_coro_co
@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# kvstore 在 1 / 4 / 16 个 loop 线程下的吞吐和时延
+#
+# 每一格：启动 kvstore -t N，预先写入 key 空间，然后用 kv_bench 跑 set:get = 1:10 的混合负载，
+# 输出 ops/sec 和 p50/p99。PIPELINE 控制每条连接在途的请求数。
+# 客户端和服务器在同一台机器上时，客户端线程(CLIENT_THREADS)也会占用 CPU，结果只用于横向对比。
+#
+# SERVER_OPTS 传给 kvstore 的额外参数，例如 "-a auto -b 50"(绑核 + 忙轮询)。
+#
+# usage: ./bench_kv.sh [seconds] [loop counts ...]
+
+SECONDS_PER_RUN=${1:-10}
+shift
+LOOP_COUNTS=${@:-"1 4 16"}
+CONNS=${CONNS:-64}
+PIPELINE=${PIPELINE:-16}
+CLIENT_THREADS=${CLIENT_THREADS:-4}
+KEYS=${KEYS:-100000}
+SERVER_OPTS=${SERVER_OPTS:-}
+PORT=6399
+
+cd "$(dirname "$0")"
+g++ -O2 -std=c++17 kvstore.cc -o kvstore -lpthread || exit 1
+gcc -O2 kv_bench.c -o kv_bench -lpthread || exit 1
+
+printf "%-6s %-6s %-9s %-12s %-8s %-8s\n" loops conns pipeline ops/sec p50_us p99_us
+for loops in $LOOP_COUNTS; do
+    ./kvstore -q -p $PORT -t $loops $SERVER_OPTS > /dev/null &
+    server=$!
+    sleep 0.5
+
+    line=$(./kv_bench -f -c $CONNS -T $CLIENT_THREADS -P $PIPELINE -r 1:10 -k $KEYS \
+        -d $SECONDS_PER_RUN 127.0.0.1 $PORT | grep '^RESULT')
+
+    kill $server
+    wait $server 2>/dev/null
+
+    qps=$(echo "$line" | sed -n 's/.*ops_per_sec=\([0-9.]*\).*/\1/p')
+    p50=$(echo "$line" | sed -n 's/.*p50_us=\([-0-9]*\).*/\1/p')
+    p99=$(echo "$line" | sed -n 's/.*p99_us=\([-0-9]*\).*/\1/p')
+    printf "%-6s %-6s %-9s %-12s %-8s %-8s\n" $loops $CONNS $PIPELINE "${qps:--}" "${p50:--}" "${p99:--}"
+done
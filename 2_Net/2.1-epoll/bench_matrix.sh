@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# 回显负载在 select / poll / epoll 三种后端、不同连接数下的对比矩阵
+#
+# 每一格：启动 multi-io 的对应后端，用 echo_bench 跑同样的 ping-pong 负载，
+# 输出吞吐(req/sec)和服务器每请求消耗的 CPU(us)。
+# 10 万连接需要 root 调大 fd 上限：ulimit -n 1048576
+#
+# usage: ./bench_matrix.sh [seconds] [conn counts ...]
+
+SECONDS_PER_RUN=${1:-10}
+shift
+CONN_COUNTS=${@:-"100 10000 100000"}
+BACKENDS=${BACKENDS:-"select poll epoll"}   # BACKENDS="pool epoll" 可对比线程池模式
+PORT=9527
+
+cd "$(dirname "$0")"
+gcc -O2 multi-io.c eventloop.c ../../3_pool/thread_pool-master/thrd_pool.c \
+    -I../../3_pool/thread_pool-master -o multi-io -lpthread || exit 1
+gcc -O2 echo_bench.c -o echo_bench || exit 1
+
+ulimit -n 1048576 2>/dev/null || ulimit -n $(ulimit -Hn)
+
+printf "%-8s %-8s %-12s %-12s %-14s\n" backend conns alive req/sec cpu_us/req
+for backend in $BACKENDS; do
+    for conns in $CONN_COUNTS; do
+        ./multi-io -q -p $PORT $backend > /dev/null &
+        server=$!
+        sleep 0.5
+
+        # 每个源地址最多使用 20000 个端口
+        nsrc=$(( (conns + 19999) / 20000 ))
+        line=$(./echo_bench -c $conns -d $SECONDS_PER_RUN -b $nsrc -P $server 127.0.0.1 $PORT | grep '^RESULT')
+
+        kill $server
+        wait $server 2>/dev/null
+
+        alive=$(echo "$line" | sed -n 's/.*established=\([0-9]*\).*/\1/p')
+        qps=$(echo "$line" | sed -n 's/.*req_per_sec=\([0-9.]*\).*/\1/p')
+        cpu=$(echo "$line" | sed -n 's/.*cpu_us_per_req=\([-0-9.]*\).*/\1/p')
+        printf "%-8s %-8s %-12s %-12s %-14s\n" $backend $conns "${alive:--}" "${qps:--}" "${cpu:--}"
+    done
+done
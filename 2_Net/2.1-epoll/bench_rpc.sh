@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+# 单连接 RPC 在 1 / 64 / 1024 个在途调用下的 calls/sec 和时延
+#
+# 启动 rpc_bench server(echo 默认在 IO 线程上执行，POOLED=1 时交给线程池)，
+# 每个在途数用 rpc_bench client 跑一轮，SIZE 为请求体字节数，FUTURES=1 时客户端改用 future。
+#
+# usage: ./bench_rpc.sh [seconds] [outstanding ...]
+
+SECONDS_PER_RUN=${1:-5}
+shift
+OUTSTANDING=${@:-"1 64 1024"}
+SIZE=${SIZE:-64}
+PORT=9096
+
+cd "$(dirname "$0")"
+g++ -O2 -std=c++17 rpc.cc rpc_bench.cc -o rpc_bench -lpthread || exit 1
+
+SERVER_OPTS=""
+[ "$POOLED" = "1" ] && SERVER_OPTS="-w"
+CLIENT_OPTS=""
+[ "$FUTURES" = "1" ] && CLIENT_OPTS="-f"
+
+./rpc_bench server -p $PORT $SERVER_OPTS > /dev/null &
+server=$!
+sleep 0.5
+
+printf "%-12s %-12s %-8s %-8s\n" outstanding calls/sec p50_us p99_us
+for n in $OUTSTANDING; do
+    line=$(./rpc_bench client $CLIENT_OPTS -o $n -s $SIZE -d $SECONDS_PER_RUN 127.0.0.1 $PORT | grep '^RESULT')
+    cps=$(echo "$line" | sed -n 's/.*calls_per_sec=\([0-9]*\).*/\1/p')
+    p50=$(echo "$line" | sed -n 's/.*p50_us=\([0-9]*\).*/\1/p')
+    p99=$(echo "$line" | sed -n 's/.*p99_us=\([0-9]*\).*/\1/p')
+    printf "%-12s %-12s %-8s %-8s\n" $n "${cps:--}" "${p50:--}" "${p99:--}"
+done
+
+kill $server
+wait $server 2>/dev/null
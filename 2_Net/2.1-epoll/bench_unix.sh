@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# 回显负载在回环 TCP 与 AF_UNIX stream / seqpacket 上的时延和吞吐对比
+#
+# 单连接 ping-pong 看时延(p50/p99)，64 连接看吞吐和服务器每请求 CPU。
+#
+# usage: ./bench_unix.sh [seconds] [msgsize]
+
+SECONDS_PER_RUN=${1:-10}
+MSGSIZE=${2:-64}
+
+cd "$(dirname "$0")"
+gcc -O2 reactor.c -o reactor || exit 1
+gcc -O2 echo_bench.c -o echo_bench || exit 1
+
+./reactor -q > /dev/null &
+server=$!
+sleep 0.5
+
+printf "%-10s %-6s %-12s %-8s %-12s\n" transport conns req/sec p99_us cpu_us/req
+for conns in 1 64; do
+    for transport in tcp unix seqpacket; do
+        case $transport in
+        tcp)       target="127.0.0.1 2048" ;;
+        unix)      target="-u /tmp/reactor.sock" ;;
+        seqpacket) target="-S -u /tmp/reactor.seqpacket.sock" ;;
+        esac
+        line=$(./echo_bench -c $conns -d $SECONDS_PER_RUN -s $MSGSIZE -P $server $target | grep '^RESULT')
+        qps=$(echo "$line" | sed -n 's/.*req_per_sec=\([0-9.]*\).*/\1/p')
+        p99=$(echo "$line" | sed -n 's/.*p99_us=\([-0-9]*\).*/\1/p')
+        cpu=$(echo "$line" | sed -n 's/.*cpu_us_per_req=\([-0-9.]*\).*/\1/p')
+        printf "%-10s %-6s %-12s %-8s %-12s\n" $transport $conns "${qps:--}" "${p99:--}" "${cpu:--}"
+    done
+done
+
+kill $server
+wait $server 2>/dev/null
@@ -0,0 +1,888 @@
+#define _GNU_SOURCE
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+
+#include "../../3_pool/queue_design-master/msgqueue.h"
+
+/**
+ * 基于 reactor 的发布/订阅 broker
+ *
+ * 协议(文本命令，以 \n 结尾)：
+ *   SUB topic                 订阅
+ *   UNSUB topic               取消订阅
+ *   PUB topic len\n<payload>  发布 len 字节的消息
+ *   POLICY drop-new|drop-old|disconnect [qlen]
+ *                             写队列满时的处理：丢弃新消息 / 丢弃最旧的消息 / 断开这个慢订阅者
+ * 订阅者收到：MSG topic len\n<payload>
+ *
+ * IO 线程(epoll)负责 accept、读命令、维护订阅关系；一次读到的 PUB 组成一批，
+ * 按发布者 fd 交给一个 worker 的 msgqueue(同一发布者的消息保持顺序)。
+ * worker 把每条消息投递到 topic 的所有订阅者：消息只序列化一次成引用计数的缓冲区，
+ * 各订阅者的写队列里只放指针；一批投完后每个订阅者一次 writev 发出，发不完由 IO 线程的 EPOLLOUT 继续。
+ *
+ * 背压：订阅者写队列有上限(POLICY / -q)，满了按策略处理；
+ * worker 积压的消息超过 PUB_HIGH_WATER 时暂停读取发布者，降到 PUB_LOW_WATER 以下再恢复。
+ *
+ * shell: gcc -O2 broker.c ../../3_pool/queue_design-master/msgqueue.c -o broker -lpthread
+ * usage: ./broker [-p port] [-w workers] [-q qlen] [-o drop-new|drop-old|disconnect]
+ * 压测:  pubsub_bench.c
+ */
+
+#define BROKER_PORT			7000
+#define MAX_CONNECTIONS		131072		// connlist 按 fd 下标
+#define MAX_WORKERS			64
+#define MAX_TOPIC			128			// topic 名字的最大长度
+#define MAX_MESSAGE			(1 << 20)	// 一条消息的最大长度
+#define MAX_LINE			256			// 命令行的最大长度(不含 payload)
+#define BUFFER_INIT			16384		// 连接读缓冲区的初始大小，按需增长
+#define TOPIC_BUCKETS		4096
+#define BATCH_MAX			256			// 一批最多的消息数
+#define SUB_QUEUE_DEFAULT	4096		// 订阅者写队列默认长度(消息条数)
+#define FLUSH_IOV			256			// 一次 writev 最多的消息数
+#define PUB_HIGH_WATER		8192 		// worker 积压的消息数超过这个值时暂停读取发布者
+#define PUB_LOW_WATER		2048
+
+enum { POLICY_DROP_NEW, POLICY_DROP_OLD, POLICY_DISCONNECT };
+
+static const char *policy_names[] = { "drop-new", "drop-old", "disconnect" };
+
+typedef int (*RCALLBACK)(int fd);
+
+int accept_cb(int fd);
+int recv_cb(int fd);
+int send_cb(int fd);
+
+struct topic;
+
+// 序列化好的一条消息 "MSG topic len\n<payload>"，由所有订阅者的写队列共享
+struct pubmsg {
+	int ref;
+	int len;
+	struct topic *topic;
+	char data[];
+};
+
+// IO 线程交给 worker 的一批消息
+struct batch {
+	void *link;                   // msgqueue 内部使用
+	int n;
+	struct pubmsg *msgs[BATCH_MAX];
+};
+
+struct topic {
+	struct topic *next;           // 哈希桶链表，只由 IO 线程修改，topic 创建后不释放
+	pthread_rwlock_t lock;        // worker 投递时读锁，IO 线程修改订阅者列表时写锁
+	struct conn_item **subs;
+	int nsubs;
+	int cap;
+	int len;
+	char name[];
+};
+
+// conn 对象单独分配：worker 可能在连接关闭之后还持有它，按引用计数释放
+struct conn_item {
+	int fd;
+	int ref;                      // IO 线程持有 1，正在给它发送的 worker 各持有 1
+
+	char *rbuffer;
+	int rlen;
+	int rcap;
+	int paused;                   // 积压过高，暂停读取
+
+	// 订阅者写队列，lock 保护，worker 和 IO 线程都会发送
+	pthread_mutex_t lock;
+	struct pubmsg **queue;
+	int qcap;
+	int qhead;
+	int qcount;
+	int qsent;                    // 队首消息已发送的字节数
+	int policy;
+	int want_write;               // 发不完，等 EPOLLOUT
+	int dead;                     // 已关闭或被断开，不再入队
+	unsigned long long mark;      // worker 本批次是否已经记下这个订阅者
+	unsigned long dropped;
+
+	struct topic **topics;        // 订阅的 topic，关闭时逐个退订
+	int ntopics;
+	int tcap;
+
+	union {
+		RCALLBACK accept_callback;
+		RCALLBACK recv_callback;
+	} recv_t;
+	RCALLBACK send_callback;
+};
+
+// 每个线程一份的计数，避免共享缓存行
+struct broker_stats {
+	unsigned long published;      // IO 线程：收到的 PUB
+	unsigned long delivered;      // 完整写出的消息
+	unsigned long dropped;        // 写队列满被丢弃的消息
+	unsigned long disconnected;   // 被断开的慢订阅者
+	char pad[32];
+};
+
+struct worker {
+	pthread_t thread;
+	msgqueue_t *queue;
+	struct broker_stats stats;
+};
+
+
+int epfd = 0;
+int wakefd = -1;                  // worker 积压降下来时唤醒 IO 线程恢复发布者
+struct conn_item *connlist[MAX_CONNECTIONS];
+struct topic *topics[TOPIC_BUCKETS];
+
+struct worker workers[MAX_WORKERS];
+int nworkers = 2;
+int default_qlen = SUB_QUEUE_DEFAULT;
+int default_policy = POLICY_DROP_NEW;
+
+long backlog = 0;                 // 已交给 worker 还未投递完的消息数
+int paused_fds[MAX_CONNECTIONS];
+int npaused = 0;
+unsigned long long next_mark = 0;
+
+struct broker_stats io_stats;
+static __thread struct broker_stats *stats = &io_stats;
+
+// 每份计数只有所属线程写，IO 线程汇总时读
+#define STAT_INC(field, n)	__atomic_store_n(&stats->field, stats->field + (n), __ATOMIC_RELAXED)
+#define STAT_LOAD(s, field)	__atomic_load_n(&(s)->field, __ATOMIC_RELAXED)
+
+
+// ---------------- message / conn refcount ----------------
+
+static void msg_put(struct pubmsg *m) {
+	if (__atomic_sub_fetch(&m->ref, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(m);
+	}
+}
+
+static void conn_get(struct conn_item *conn) {
+	__atomic_add_fetch(&conn->ref, 1, __ATOMIC_RELAXED);
+}
+
+static void conn_put(struct conn_item *conn) {
+	if (__atomic_sub_fetch(&conn->ref, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+	while (conn->qcount > 0) {
+		msg_put(conn->queue[conn->qhead]);
+		conn->qhead = (conn->qhead + 1) % conn->qcap;
+		conn->qcount--;
+	}
+	pthread_mutex_destroy(&conn->lock);
+	free(conn->queue);
+	free(conn->rbuffer);
+	free(conn->topics);
+	free(conn);
+}
+
+// lock 持有时调用：按暂停 / 待发送状态设置关注的事件
+static void conn_update_events(struct conn_item *conn) {
+	struct epoll_event ev;
+	ev.events = (conn->paused ? 0 : EPOLLIN) | (conn->want_write ? EPOLLOUT : 0);
+	ev.data.fd = conn->fd;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+
+// ---------------- subscriber write queue ----------------
+
+// lock 持有时调用：写队列满时按策略处理，返回 1 已入队，0 被丢弃或连接被断开
+static int sub_push(struct conn_item *sub, struct pubmsg *m) {
+
+	if (sub->qcount == sub->qcap) {
+		// 队列只有一格且那条已发出一部分时没有可丢的旧消息，drop-old 退化为 drop-new
+		if (sub->policy == POLICY_DROP_NEW ||
+			(sub->policy == POLICY_DROP_OLD && sub->qcap == 1 && sub->qsent > 0)) {
+			sub->dropped++;
+			STAT_INC(dropped, 1);
+			return 0;
+		}
+		if (sub->policy == POLICY_DISCONNECT) {
+			// 由 IO 线程在读到连接关闭后释放
+			sub->dead = 1;
+			shutdown(sub->fd, SHUT_RDWR);
+			STAT_INC(disconnected, 1);
+			return 0;
+		}
+		// drop-old：丢弃最旧的未发送消息；队首已发出一部分时不能丢，丢它后面那条
+		int victim = sub->qhead;
+		if (sub->qsent > 0) {
+			victim = (sub->qhead + 1) % sub->qcap;
+			msg_put(sub->queue[victim]);
+			sub->queue[victim] = sub->queue[sub->qhead];
+		} else {
+			msg_put(sub->queue[victim]);
+		}
+		sub->qhead = (sub->qhead + 1) % sub->qcap;
+		sub->qcount--;
+		sub->dropped++;
+		STAT_INC(dropped, 1);
+	}
+
+	__atomic_add_fetch(&m->ref, 1, __ATOMIC_RELAXED);
+	sub->queue[(sub->qhead + sub->qcount) % sub->qcap] = m;
+	sub->qcount++;
+	return 1;
+}
+
+// lock 持有时调用：一次 writev 发出尽量多的消息，发不完关注 EPOLLOUT
+static void sub_flush(struct conn_item *sub) {
+
+	while (sub->qcount > 0 && !sub->dead) {
+		struct iovec iov[FLUSH_IOV];
+		int n = 0;
+		while (n < sub->qcount && n < FLUSH_IOV) {
+			struct pubmsg *m = sub->queue[(sub->qhead + n) % sub->qcap];
+			int skip = n == 0 ? sub->qsent : 0;
+			iov[n].iov_base = m->data + skip;
+			iov[n].iov_len = m->len - skip;
+			n++;
+		}
+
+		ssize_t count = writev(sub->fd, iov, n);
+		if (count < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				if (!sub->want_write) {
+					sub->want_write = 1;
+					conn_update_events(sub);
+				}
+				return;
+			}
+			sub->dead = 1;
+			shutdown(sub->fd, SHUT_RDWR);
+			return;
+		}
+
+		// 释放完整发出的消息
+		count += sub->qsent;
+		while (sub->qcount > 0) {
+			struct pubmsg *m = sub->queue[sub->qhead];
+			if (count < m->len) break;
+			count -= m->len;
+			msg_put(m);
+			sub->qhead = (sub->qhead + 1) % sub->qcap;
+			sub->qcount--;
+			STAT_INC(delivered, 1);
+		}
+		sub->qsent = (int)count;
+	}
+
+	// 已关闭的连接 fd 可能已经被复用，不能再改它的事件
+	if (sub->want_write && !sub->dead) {
+		sub->want_write = 0;
+		conn_update_events(sub);
+	}
+}
+
+
+// ---------------- fan-out worker ----------------
+
+static void *fanout_worker(void *arg) {
+
+	struct worker *w = (struct worker *)arg;
+	struct batch *b;
+
+	int dcap = 1024, ndirty = 0;
+	struct conn_item **dirty = (struct conn_item **)malloc(sizeof(struct conn_item *) * dcap);
+
+	stats = &w->stats;
+
+	while ((b = (struct batch *)msgqueue_get(w->queue)) != NULL) {
+
+		unsigned long long mark = __atomic_add_fetch(&next_mark, 1, __ATOMIC_RELAXED);
+		int i, j;
+
+		// 1. 入队：每个订阅者只记一次，一批投完之后再发送
+		for (i = 0;i < b->n;i ++) {
+			struct pubmsg *m = b->msgs[i];
+			struct topic *t = m->topic;
+
+			pthread_rwlock_rdlock(&t->lock);
+			for (j = 0;j < t->nsubs;j ++) {
+				struct conn_item *sub = t->subs[j];
+
+				pthread_mutex_lock(&sub->lock);
+				if (!sub->dead && sub_push(sub, m) && sub->mark != mark) {
+					sub->mark = mark;
+					if (ndirty == dcap) {
+						dcap *= 2;
+						dirty = (struct conn_item **)realloc(dirty, sizeof(struct conn_item *) * dcap);
+					}
+					conn_get(sub);
+					dirty[ndirty++] = sub;
+				}
+				pthread_mutex_unlock(&sub->lock);
+			}
+			pthread_rwlock_unlock(&t->lock);
+
+			msg_put(m);
+		}
+
+		// 2. 每个订阅者一次 writev；已经在等 EPOLLOUT 的由 IO 线程继续
+		for (i = 0;i < ndirty;i ++) {
+			struct conn_item *sub = dirty[i];
+			pthread_mutex_lock(&sub->lock);
+			if (!sub->want_write) {
+				sub_flush(sub);
+			}
+			pthread_mutex_unlock(&sub->lock);
+			conn_put(sub);
+		}
+		ndirty = 0;
+
+		long left = __atomic_sub_fetch(&backlog, b->n, __ATOMIC_RELAXED);
+		if (left < PUB_LOW_WATER && left + b->n >= PUB_LOW_WATER) {
+			uint64_t one = 1;
+			ssize_t ret = write(wakefd, &one, sizeof(one));
+			(void)ret;
+		}
+		free(b);
+	}
+
+	free(dirty);
+	return NULL;
+}
+
+
+// ---------------- topics ----------------
+
+static unsigned int topic_hash(const char *name, int len) {
+	unsigned int h = 2166136261u;
+	int i;
+	for (i = 0;i < len;i ++) {
+		h = (h ^ (unsigned char)name[i]) * 16777619u;
+	}
+	return h % TOPIC_BUCKETS;
+}
+
+// 只在 IO 线程上调用，不加锁
+static struct topic *topic_find(const char *name, int len, int create) {
+
+	unsigned int h = topic_hash(name, len);
+	struct topic *t;
+	for (t = topics[h];t;t = t->next) {
+		if (t->len == len && memcmp(t->name, name, len) == 0) {
+			return t;
+		}
+	}
+	if (!create) return NULL;
+
+	t = (struct topic *)calloc(1, sizeof(struct topic) + len + 1);
+	if (!t) return NULL;
+	pthread_rwlock_init(&t->lock, NULL);
+	t->len = len;
+	memcpy(t->name, name, len);
+	t->next = topics[h];
+	topics[h] = t;
+	return t;
+}
+
+static int topic_subscribe(struct conn_item *conn, struct topic *t) {
+
+	int i;
+	for (i = 0;i < conn->ntopics;i ++) {
+		if (conn->topics[i] == t) return 0;
+	}
+	if (conn->ntopics == conn->tcap) {
+		int ncap = conn->tcap ? conn->tcap * 2 : 4;
+		struct topic **p = (struct topic **)realloc(conn->topics, sizeof(struct topic *) * ncap);
+		if (!p) return -1;
+		conn->topics = p;
+		conn->tcap = ncap;
+	}
+
+	pthread_rwlock_wrlock(&t->lock);
+	if (t->nsubs == t->cap) {
+		int ncap = t->cap ? t->cap * 2 : 16;
+		struct conn_item **p = (struct conn_item **)realloc(t->subs, sizeof(struct conn_item *) * ncap);
+		if (!p) {
+			pthread_rwlock_unlock(&t->lock);
+			return -1;
+		}
+		t->subs = p;
+		t->cap = ncap;
+	}
+	t->subs[t->nsubs++] = conn;
+	pthread_rwlock_unlock(&t->lock);
+
+	conn->topics[conn->ntopics++] = t;
+	return 0;
+}
+
+static void topic_unsubscribe(struct conn_item *conn, struct topic *t) {
+
+	int i;
+	for (i = 0;i < conn->ntopics;i ++) {
+		if (conn->topics[i] == t) break;
+	}
+	if (i == conn->ntopics) return;
+	conn->topics[i] = conn->topics[--conn->ntopics];
+
+	// 取得写锁后没有 worker 还在遍历这个 topic 的订阅者列表
+	pthread_rwlock_wrlock(&t->lock);
+	for (i = 0;i < t->nsubs;i ++) {
+		if (t->subs[i] == conn) {
+			t->subs[i] = t->subs[--t->nsubs];
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&t->lock);
+}
+
+
+// ---------------- connection ----------------
+
+static void conn_close(int fd) {
+
+	struct conn_item *conn = connlist[fd];
+
+	while (conn->ntopics > 0) {
+		topic_unsubscribe(conn, conn->topics[conn->ntopics - 1]);
+	}
+
+	pthread_mutex_lock(&conn->lock);
+	conn->dead = 1;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+	pthread_mutex_unlock(&conn->lock);
+
+	connlist[fd] = NULL;
+	conn_put(conn);
+}
+
+static void batch_dispatch(int fd, struct batch *b) {
+	__atomic_add_fetch(&backlog, b->n, __ATOMIC_RELAXED);
+	msgqueue_put(b, workers[fd % nworkers].queue);
+}
+
+// PUB topic len\n<payload>：序列化成订阅者收到的格式，topic 没有订阅者时直接丢弃
+static int handle_pub(struct conn_item *conn, struct batch **pb, const char *name, int nlen,
+	const char *payload, int len) {
+
+	STAT_INC(published, 1);
+
+	struct topic *t = topic_find(name, nlen, 0);
+	if (!t || t->nsubs == 0) {   // nsubs 只由 IO 线程修改
+		return 0;
+	}
+
+	char header[MAX_LINE];
+	int hlen = snprintf(header, sizeof(header), "MSG %.*s %d\n", nlen, name, len);
+
+	struct pubmsg *m = (struct pubmsg *)malloc(sizeof(struct pubmsg) + hlen + len);
+	if (!m) return -1;
+	m->ref = 1;      // batch 持有，worker 投递完释放
+	m->len = hlen + len;
+	m->topic = t;
+	memcpy(m->data, header, hlen);
+	memcpy(m->data + hlen, payload, len);
+
+	if (!*pb) {
+		*pb = (struct batch *)malloc(sizeof(struct batch));
+		if (!*pb) {
+			free(m);
+			return -1;
+		}
+		(*pb)->n = 0;
+	}
+	(*pb)->msgs[(*pb)->n++] = m;
+	if ((*pb)->n == BATCH_MAX) {
+		batch_dispatch(conn->fd, *pb);
+		*pb = NULL;
+	}
+	return 0;
+}
+
+static int handle_policy(struct conn_item *conn, const char *line) {
+
+	char name[16];
+	int qlen = 0;
+	if (sscanf(line, "POLICY %15s %d", name, &qlen) < 1) return -1;
+
+	int policy;
+	for (policy = 0;policy < 3;policy ++) {
+		if (strcmp(name, policy_names[policy]) == 0) break;
+	}
+	if (policy == 3) return -1;
+
+	pthread_mutex_lock(&conn->lock);
+	conn->policy = policy;
+	if (qlen > 0 && conn->qcount == 0) {
+		struct pubmsg **q = (struct pubmsg **)realloc(conn->queue, sizeof(struct pubmsg *) * qlen);
+		if (q) {
+			conn->queue = q;
+			conn->qcap = qlen;
+			conn->qhead = 0;
+		}
+	}
+	pthread_mutex_unlock(&conn->lock);
+	return 0;
+}
+
+// 解析 rbuffer 中的完整命令，返回 -1 表示协议错误
+static int broker_serve(struct conn_item *conn) {
+
+	struct batch *b = NULL;
+	int pos = 0;
+	int ret = 0;
+
+	while (pos < conn->rlen) {
+		char *line = conn->rbuffer + pos;
+		char *nl = (char *)memchr(line, '\n', conn->rlen - pos);
+		if (!nl) {
+			if (conn->rlen - pos > MAX_LINE) ret = -1;
+			break;
+		}
+		int llen = (int)(nl - line);
+		if (llen > MAX_LINE) {
+			ret = -1;
+			break;
+		}
+		*nl = '\0';     // 命令行按字符串解析，payload 从 nl + 1 开始不受影响
+
+		char name[MAX_TOPIC + 1];
+		int len;
+		if (strncmp(line, "PUB ", 4) == 0) {
+			if (sscanf(line + 4, "%128s %d", name, &len) != 2 || len < 0 || len > MAX_MESSAGE) {
+				ret = -1;
+				break;
+			}
+			if (conn->rlen - pos < llen + 1 + len) {
+				*nl = '\n';  // 下次重新解析这一行；要在 realloc 之前恢复，之后 nl 就失效了
+				// payload 还没收齐，保证缓冲区放得下
+				if (llen + 1 + len > conn->rcap) {
+					char *p = (char *)realloc(conn->rbuffer, llen + 1 + len);
+					if (!p) {
+						ret = -1;
+						break;
+					}
+					conn->rbuffer = p;
+					conn->rcap = llen + 1 + len;
+				}
+				break;
+			}
+			if (handle_pub(conn, &b, name, strlen(name), nl + 1, len) < 0) {
+				ret = -1;
+				break;
+			}
+			pos += llen + 1 + len;
+			continue;
+		}
+
+		if (strncmp(line, "SUB ", 4) == 0 && sscanf(line + 4, "%128s", name) == 1) {
+			struct topic *t = topic_find(name, strlen(name), 1);
+			if (!t || topic_subscribe(conn, t) < 0) ret = -1;
+		} else if (strncmp(line, "UNSUB ", 6) == 0 && sscanf(line + 6, "%128s", name) == 1) {
+			struct topic *t = topic_find(name, strlen(name), 0);
+			if (t) topic_unsubscribe(conn, t);
+		} else if (strncmp(line, "POLICY ", 7) == 0) {
+			if (handle_policy(conn, line) < 0) ret = -1;
+		} else if (llen > 0 && !(llen == 1 && line[0] == '\r')) {
+			ret = -1;
+		}
+		if (ret < 0) break;
+		pos += llen + 1;
+	}
+
+	if (b) {
+		batch_dispatch(conn->fd, b);
+	}
+	if (pos > 0) {
+		memmove(conn->rbuffer, conn->rbuffer + pos, conn->rlen - pos);
+		conn->rlen -= pos;
+	}
+	return ret;
+}
+
+// 积压过高：暂停读取这个连接，worker 把积压降下来后由 resume_publishers 恢复
+static void pause_publisher(struct conn_item *conn) {
+
+	pthread_mutex_lock(&conn->lock);
+	conn->paused = 1;
+	conn_update_events(conn);
+	pthread_mutex_unlock(&conn->lock);
+	paused_fds[npaused++] = conn->fd;
+}
+
+static void resume_publishers(void) {
+
+	uint64_t counter;
+	ssize_t ret = read(wakefd, &counter, sizeof(counter));
+	(void)ret;
+
+	if (__atomic_load_n(&backlog, __ATOMIC_RELAXED) >= PUB_LOW_WATER) {
+		return;
+	}
+	int i;
+	for (i = 0;i < npaused;i ++) {
+		struct conn_item *conn = connlist[paused_fds[i]];
+		if (!conn || !conn->paused) continue;
+
+		pthread_mutex_lock(&conn->lock);
+		conn->paused = 0;
+		conn_update_events(conn);
+		pthread_mutex_unlock(&conn->lock);
+	}
+	npaused = 0;
+}
+
+int recv_cb(int fd) {
+
+	struct conn_item *conn = connlist[fd];
+
+	if (conn->rcap - conn->rlen < BUFFER_INIT / 2) {
+		int ncap = conn->rcap * 2;
+		char *p = (char *)realloc(conn->rbuffer, ncap);
+		if (!p) {
+			conn_close(fd);
+			return -1;
+		}
+		conn->rbuffer = p;
+		conn->rcap = ncap;
+	}
+
+	int count = recv(fd, conn->rbuffer + conn->rlen, conn->rcap - conn->rlen, 0);
+	if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return 0;
+	}
+	if (count <= 0) {
+		conn_close(fd);
+		return -1;
+	}
+	conn->rlen += count;
+
+	if (broker_serve(conn) < 0) {
+		conn_close(fd);
+		return -1;
+	}
+
+	if (!conn->paused && __atomic_load_n(&backlog, __ATOMIC_RELAXED) >= PUB_HIGH_WATER) {
+		pause_publisher(conn);
+		// worker 可能在暂停之前已经把积压降了下来，不会再唤醒
+		if (__atomic_load_n(&backlog, __ATOMIC_RELAXED) < PUB_LOW_WATER) {
+			uint64_t one = 1;
+			ssize_t ret = write(wakefd, &one, sizeof(one));
+			(void)ret;
+		}
+	}
+	return count;
+}
+
+int send_cb(int fd) {
+
+	struct conn_item *conn = connlist[fd];
+
+	pthread_mutex_lock(&conn->lock);
+	sub_flush(conn);
+	pthread_mutex_unlock(&conn->lock);
+
+	return 0;
+}
+
+int accept_cb(int fd) {
+
+	struct sockaddr_in clientaddr;
+	socklen_t len = sizeof(clientaddr);
+
+	int clientfd = accept4(fd, (struct sockaddr*)&clientaddr, &len, SOCK_NONBLOCK);
+	if (clientfd < 0) {
+		return -1;
+	}
+	if (clientfd >= MAX_CONNECTIONS) {
+		close(clientfd);
+		return -1;
+	}
+	int nodelay = 1;
+	setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+	struct conn_item *conn = (struct conn_item *)calloc(1, sizeof(struct conn_item));
+	if (!conn) {
+		close(clientfd);
+		return -1;
+	}
+	conn->fd = clientfd;
+	conn->ref = 1;
+	conn->rcap = BUFFER_INIT;
+	conn->rbuffer = (char *)malloc(conn->rcap);
+	conn->qcap = default_qlen;
+	conn->queue = (struct pubmsg **)malloc(sizeof(struct pubmsg *) * conn->qcap);
+	conn->policy = default_policy;
+	pthread_mutex_init(&conn->lock, NULL);
+	conn->recv_t.recv_callback = recv_cb;
+	conn->send_callback = send_cb;
+	connlist[clientfd] = conn;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = clientfd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, clientfd, &ev);
+
+	return clientfd;
+}
+
+int init_server(unsigned short port) {
+
+	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+	int reuse = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in serveraddr;
+	memset(&serveraddr, 0, sizeof(struct sockaddr_in));
+
+	serveraddr.sin_family = AF_INET;
+	serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	serveraddr.sin_port = htons(port);
+
+	if (-1 == bind(sockfd, (struct sockaddr*)&serveraddr, sizeof(struct sockaddr))) {
+		perror("bind");
+		close(sockfd);
+		return -1;
+	}
+
+	listen(sockfd, 4096);
+
+	return sockfd;
+}
+
+// 每秒打印一次吞吐
+static void report(void) {
+
+	static struct broker_stats last;
+	static long long last_ms = 0;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	long long now_ms = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+	if (now_ms - last_ms < 1000) return;
+
+	struct broker_stats total = io_stats;
+	int i;
+	for (i = 0;i < nworkers;i ++) {
+		total.delivered += STAT_LOAD(&workers[i].stats, delivered);
+		total.dropped += STAT_LOAD(&workers[i].stats, dropped);
+		total.disconnected += STAT_LOAD(&workers[i].stats, disconnected);
+	}
+	if (last_ms && (total.published != last.published || total.delivered != last.delivered)) {
+		double sec = (now_ms - last_ms) / 1000.0;
+		printf("published %.0f/s, delivered %.0f/s, dropped %lu, disconnected %lu, backlog %ld\n",
+			(total.published - last.published) / sec, (total.delivered - last.delivered) / sec,
+			total.dropped, total.disconnected, __atomic_load_n(&backlog, __ATOMIC_RELAXED));
+		fflush(stdout);
+	}
+	last = total;
+	last_ms = now_ms;
+}
+
+int main(int argc, char **argv) {
+
+	unsigned short port = BROKER_PORT;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:w:q:o:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			if (nworkers < 1) nworkers = 1;
+			if (nworkers > MAX_WORKERS) nworkers = MAX_WORKERS;
+			break;
+		case 'q':
+			default_qlen = atoi(optarg);
+			if (default_qlen < 1) default_qlen = SUB_QUEUE_DEFAULT;
+			break;
+		case 'o':
+			for (default_policy = 0;default_policy < 3;default_policy ++) {
+				if (strcmp(optarg, policy_names[default_policy]) == 0) break;
+			}
+			if (default_policy < 3) break;
+			/* fall through */
+		default:
+			printf("usage: %s [-p port] [-w workers] [-q qlen] [-o drop-new|drop-old|disconnect]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	int sockfd = init_server(port);
+	if (sockfd < 0) {
+		return -1;
+	}
+
+	epfd = epoll_create(1);
+	wakefd = eventfd(0, EFD_NONBLOCK);
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = sockfd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev);
+	ev.data.fd = wakefd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+
+	int i;
+	for (i = 0;i < nworkers;i ++) {
+		// 队列长度远大于 PUB_HIGH_WATER 对应的批数，IO 线程的 put 不会阻塞
+		workers[i].queue = msgqueue_create(PUB_HIGH_WATER, 0);
+		pthread_create(&workers[i].thread, NULL, fanout_worker, &workers[i]);
+	}
+	printf("broker on %d, %d fan-out workers, queue %d, policy %s\n",
+		port, nworkers, default_qlen, policy_names[default_policy]);
+	fflush(stdout);
+
+	struct epoll_event events[1024];
+
+	while (1) { // mainloop();
+
+		int nready = epoll_wait(epfd, events, 1024, 1000);
+
+		for (i = 0;i < nready;i ++) {
+
+			int connfd = events[i].data.fd;
+			if (connfd == sockfd) {
+				accept_cb(sockfd);
+				continue;
+			}
+			if (connfd == wakefd) {
+				resume_publishers();
+				continue;
+			}
+			if (!connlist[connfd]) continue;
+
+			int count = 0;
+			if ((events[i].events & EPOLLIN) || !(events[i].events & EPOLLOUT)) {
+				count = connlist[connfd]->recv_t.recv_callback(connfd);
+			}
+			if ((events[i].events & EPOLLOUT) && count >= 0 && connlist[connfd]) {
+				connlist[connfd]->send_callback(connfd);
+			}
+		}
+		report();
+	}
+
+	return 0;
+}
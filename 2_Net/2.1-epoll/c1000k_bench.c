@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/**
+ * 百万连接的内存开销测量
+ *
+ * 按 -s 一步增加空闲连接(建好后不收发数据)，直到 -n 条；每一步等服务器 accept 完(以 /proc/<pid>/fd 的数量为准)，
+ * 然后采样：
+ *   服务器 RSS(/proc/<pid>/status 的 VmRSS)   用户态内存，连接结构体、缓冲区都在这里
+ *   /proc/net/sockstat 的 TCP mem               内核 socket 缓冲区占用的页数
+ *   /proc/meminfo 的 Slab                       struct sock、file、epitem 等内核对象
+ * 都减去建连前的基线，再除以服务器已 accept 的连接数，得到每条连接的字节数。
+ * 回环测试时客户端 socket 也在本机，sockstat 和 Slab 的增量包含两端。
+ *
+ * 连接数达到 -m 以上的每一步，用户态字节数超过 -B 就判定失败，进程返回 1，
+ * 连接结构体变大之类的内存回退可以被脚本发现。
+ *
+ * 连接轮流发往 port ~ port + 连接端口数 - 1(reactor.c 监听 20 个端口)，
+ * -b 指定轮流使用的源地址个数(127.0.0.1, 127.0.0.2 ...)，百万连接需要足够多的四元组。
+ *
+ * shell: gcc -O2 c1000k_bench.c -o c1000k_bench
+ * usage: ./c1000k_bench [-n conns] [-s step] [-p nports] [-b nsrc] [-w settle_ms] [-B budget] [-m min] -P pid ip port
+ */
+
+#define MAX_EVENTS      1024
+#define MAX_INFLIGHT    1000        // 同时在进行的 connect 数，避免打满服务器的 backlog
+
+struct mem_sample {
+	long rss_kb;
+	long fds;
+	long sock_pages;            // sockstat TCP mem，单位页
+	long slab_kb;
+};
+
+static struct sockaddr_in server_addr;
+static int nports = 20, nsrc = 1;
+
+static long long now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 在 path 文件中找以 key 开头的行，返回 key 之后的第 index 个整数
+static long read_field(const char *path, const char *key, int index) {
+	char line[512];
+	long value = -1;
+	FILE *fp = fopen(path, "r");
+	if (!fp) return -1;
+	size_t klen = strlen(key);
+	while (fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, key, klen) != 0) continue;
+		char *p = line + klen;
+		int i;
+		for (i = 0; i <= index && *p; i++) {
+			while (*p && (*p < '0' || *p > '9')) p++;
+			value = strtol(p, &p, 10);
+		}
+		break;
+	}
+	fclose(fp);
+	return value;
+}
+
+static long count_fds(int pid) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+	DIR *dir = opendir(path);
+	if (!dir) return -1;
+	long n = 0;
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] != '.') n++;
+	}
+	closedir(dir);
+	return n;
+}
+
+static void sample(int pid, struct mem_sample *s) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	s->rss_kb = read_field(path, "VmRSS:", 0);
+	s->fds = count_fds(pid);
+	// "TCP: inuse 4 orphan 0 tw 2446 alloc 4 mem 63"
+	s->sock_pages = read_field("/proc/net/sockstat", "TCP:", 4);
+	s->slab_kb = read_field("/proc/meminfo", "Slab:", 0);
+}
+
+static int open_conn(int index) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0) return -1;
+
+	if (nsrc > 1) {
+		struct sockaddr_in local;
+		memset(&local, 0, sizeof(local));
+		local.sin_family = AF_INET;
+		local.sin_addr.s_addr = htonl(0x7f000001 + index % nsrc);
+		if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	struct sockaddr_in addr = server_addr;
+	addr.sin_port = htons(ntohs(server_addr.sin_port) + index % nports);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// 建立 [from, to) 这些连接，返回建立成功的个数
+static int ramp(int epfd, int from, int to) {
+
+	struct epoll_event events[MAX_EVENTS];
+	int next = from, inflight = 0, established = 0, failed = 0;
+
+	while (next < to || inflight > 0) {
+		while (next < to && inflight < MAX_INFLIGHT) {
+			int fd = open_conn(next++);
+			if (fd < 0) {
+				failed++;
+				continue;
+			}
+			struct epoll_event ev;
+			ev.events = EPOLLOUT;
+			ev.data.fd = fd;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+			inflight++;
+		}
+
+		int nready = epoll_wait(epfd, events, MAX_EVENTS, 3000);
+		if (nready == 0) break;     // 3 秒没有任何完成，放弃剩下的
+		int i;
+		for (i = 0; i < nready; i++) {
+			int fd = events[i].data.fd;
+			int err = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+			inflight--;
+			if (err != 0) {
+				epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+				close(fd);
+				failed++;
+				continue;
+			}
+			// 建好后不再关注任何事件，保持空闲；fd 留在 epoll 里只是为了进程退出时一起关闭
+			struct epoll_event ev;
+			ev.events = 0;
+			ev.data.fd = fd;
+			epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+			established++;
+		}
+	}
+	if (failed) fprintf(stderr, "step %d~%d: %d connects failed (%s)\n", from, to, failed, strerror(errno));
+	return established;
+}
+
+int main(int argc, char *argv[]) {
+
+	int total = 10000, step = 2000, settle_ms = 3000, min_conns = 1000, pid = 0;
+	long budget = 2048;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:p:b:w:B:m:P:")) != -1) {
+		switch (opt) {
+		case 'n': total = atoi(optarg); break;
+		case 's': step = atoi(optarg); break;
+		case 'p': nports = atoi(optarg); break;
+		case 'b': nsrc = atoi(optarg); break;
+		case 'w': settle_ms = atoi(optarg); break;
+		case 'B': budget = atol(optarg); break;
+		case 'm': min_conns = atoi(optarg); break;
+		case 'P': pid = atoi(optarg); break;
+		default:
+			optind = argc + 1;
+		}
+	}
+	if (optind + 2 != argc || pid <= 0) {
+		printf("usage: %s [-n conns] [-s step] [-p nports] [-b nsrc] [-w settle_ms] [-B budget] [-m min] -P pid ip port\n",
+			argv[0]);
+		return -1;
+	}
+	if (step < 1) step = 1;
+	if (nports < 1) nports = 1;
+	if (nsrc < 1) nsrc = 1;
+
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	if ((long)total + 16 > (long)rl.rlim_cur) {
+		fprintf(stderr, "fd limit %ld: only %ld connections possible\n", (long)rl.rlim_cur, (long)rl.rlim_cur - 16);
+		total = rl.rlim_cur - 16;
+	}
+
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(atoi(argv[optind + 1]));
+	inet_pton(AF_INET, argv[optind], &server_addr.sin_addr);
+
+	long page_size = sysconf(_SC_PAGESIZE);
+	struct mem_sample base, cur;
+	sample(pid, &base);
+	cur = base;
+	if (base.rss_kb < 0) {
+		fprintf(stderr, "cannot read /proc/%d/status\n", pid);
+		return -1;
+	}
+
+	printf("%-10s %-10s %-10s %-12s %-12s %-14s %-12s %-12s\n",
+		"conns", "accepted", "rss_kb", "user_B/conn", "sockmem_kb", "sockmem_B/conn", "slab_kb", "slab_B/conn");
+
+	int epfd = epoll_create(1);
+	int conns = 0, failed = 0;
+	long worst = 0;
+
+	while (conns < total) {
+		int to = conns + step < total ? conns + step : total;
+		int established = ramp(epfd, conns, to);
+		int want = to - conns;
+		conns += established;
+
+		// 等服务器 accept 完这一步的连接
+		long long deadline = now_ms() + settle_ms;
+		do {
+			usleep(100 * 1000);
+			sample(pid, &cur);
+		} while (cur.fds - base.fds < conns && now_ms() < deadline);
+		usleep(200 * 1000);
+		sample(pid, &cur);
+
+		long accepted = cur.fds - base.fds;
+		long user = accepted > 0 ? (cur.rss_kb - base.rss_kb) * 1024 / accepted : 0;
+		long sockmem = accepted > 0 ? (cur.sock_pages - base.sock_pages) * page_size / accepted : 0;
+		long slab = accepted > 0 ? (cur.slab_kb - base.slab_kb) * 1024 / accepted : 0;
+		printf("%-10d %-10ld %-10ld %-12ld %-12ld %-14ld %-12ld %-12ld\n",
+			conns, accepted, cur.rss_kb, user, cur.sock_pages * page_size / 1024, sockmem, cur.slab_kb, slab);
+		fflush(stdout);
+
+		if (accepted >= min_conns) {
+			if (user > worst) worst = user;
+			if (user > budget) failed = 1;
+		}
+		if (established < want) {
+			fprintf(stderr, "stopped at %d connections\n", conns);
+			break;
+		}
+	}
+
+	printf("RESULT conns=%d accepted=%ld user_bytes_per_conn=%ld budget=%ld %s\n",
+		conns, cur.fds - base.fds, worst, budget, failed ? "FAIL" : "PASS");
+	close(epfd);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,346 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "connector.h"
+
+/**
+ * shell: gcc -O2 -c connector.c eventloop.c
+ * usage: include connector.h & link connector.o eventloop.o
+ */
+
+#define DEFAULT_TIMEOUT_MS      3000
+#define DEFAULT_STAGGER_MS      250
+#define DEFAULT_BACKOFF_MIN_MS  100
+#define DEFAULT_BACKOFF_MAX_MS  30000
+
+// 一个进行中的连接尝试，每个地址一个
+struct conn_attempt {
+    connector_t *c;
+    int fd;                     // -1 表示空闲
+    int index;                  // 地址下标
+    int registered;             // 已注册到 eventloop
+    ev_timer_t *timer;          // 连接超时
+};
+
+struct connector_s {
+    eventloop_t *loop;
+    struct connector_opts opts;
+    CONNCALLBACK cb;
+    void *arg;
+
+    struct sockaddr_storage *addrs;
+    socklen_t *addrlens;
+    struct conn_attempt *attempts;
+    int naddrs;
+
+    int next;                   // 本轮下一个要发起的地址
+    int pending;                // 本轮进行中的尝试数
+    int last_err;
+    int connected;              // 成功连接的地址下标，-1 未连接
+    ev_timer_t *stagger_timer;  // 到期后并行发起下一个地址
+    ev_timer_t *retry_timer;    // 退避结束后开始新一轮
+
+    int failures;               // 连续失败的轮数
+    int backoff_ms;             // 下一次退避的基准时间
+    int retry_ms;               // 本次实际等待时间(含抖动)，-1 表示放弃
+    unsigned int seed;
+};
+
+static void __launch_next(connector_t *c);
+
+// 退避时间在 [d/2, d] 之间随机，然后基准翻倍
+static int
+__backoff_next(connector_t *c) {
+    int d = c->backoff_ms;
+    int wait = d / 2 + (int)(rand_r(&c->seed) % (unsigned int)(d / 2 + 1));
+    c->backoff_ms = d > c->opts.backoff_max_ms / 2 ? c->opts.backoff_max_ms : d * 2;
+    return wait;
+}
+
+static void
+__attempt_close(connector_t *c, struct conn_attempt *a, int keep_fd) {
+    if (a->registered) eventloop_del(c->loop, a->fd);
+    if (!keep_fd) close(a->fd);
+    a->registered = 0;
+    if (a->timer) eventloop_timer_del(c->loop, a->timer);
+    a->timer = NULL;
+    a->fd = -1;
+    c->pending--;
+}
+
+static void
+__cancel_round(connector_t *c) {
+    int i;
+    for (i = 0; i < c->naddrs; i++) {
+        if (c->attempts[i].fd >= 0)
+            __attempt_close(c, &c->attempts[i], 0);
+    }
+    if (c->stagger_timer) eventloop_timer_del(c->loop, c->stagger_timer);
+    c->stagger_timer = NULL;
+}
+
+static void
+__on_retry(eventloop_t *loop, void *arg) {
+    connector_t *c = (connector_t *)arg;
+    (void)loop;
+    c->retry_timer = NULL;
+    connector_start(c);
+}
+
+static void
+__round_failed(connector_t *c) {
+    if (c->stagger_timer) eventloop_timer_del(c->loop, c->stagger_timer);
+    c->stagger_timer = NULL;
+
+    c->failures++;
+    if (c->opts.max_retries >= 0 && c->failures > c->opts.max_retries) {
+        c->retry_ms = -1;
+    } else {
+        c->retry_ms = __backoff_next(c);
+        c->retry_timer = eventloop_timer_add(c->loop, c->retry_ms, __on_retry, c);
+    }
+    // 回调放在最后，回调里可以 connector_destroy
+    c->cb(c, -1, c->last_err, c->arg);
+}
+
+static void
+__succeeded(connector_t *c, struct conn_attempt *a) {
+    int fd = a->fd;
+    c->connected = a->index;
+    __attempt_close(c, a, 1);
+    __cancel_round(c);
+
+    c->failures = 0;
+    c->backoff_ms = c->opts.backoff_min_ms;
+    c->retry_ms = 0;
+    c->cb(c, fd, 0, c->arg);
+}
+
+static void
+__attempt_failed(connector_t *c, struct conn_attempt *a, int err) {
+    c->last_err = err;
+    __attempt_close(c, a, 0);
+    // 失败后不等 stagger，立刻尝试下一个地址
+    __launch_next(c);
+}
+
+static void
+__on_writable(eventloop_t *loop, int fd, int events, void *arg) {
+    struct conn_attempt *a = (struct conn_attempt *)arg;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    (void)loop;
+    (void)events;
+
+    // 事件不属于这个尝试(fd 已经关闭或者换了主人)，不处理
+    if (a->fd != fd) return;
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+    if (err != 0) {
+        __attempt_failed(a->c, a, err);
+        return;
+    }
+    // SO_ERROR 为 0 不代表已连上：还在连接中的 socket 也是 0，用 getpeername 确认
+    struct sockaddr_storage peer;
+    socklen_t plen = sizeof(peer);
+    if (getpeername(fd, (struct sockaddr *)&peer, &plen) < 0) {
+        if (errno == ENOTCONN) return;      // 还在连接中，等下一次可写或超时
+        __attempt_failed(a->c, a, errno);
+        return;
+    }
+    __succeeded(a->c, a);
+}
+
+static void
+__on_timeout(eventloop_t *loop, void *arg) {
+    struct conn_attempt *a = (struct conn_attempt *)arg;
+    (void)loop;
+    a->timer = NULL;
+    __attempt_failed(a->c, a, ETIMEDOUT);
+}
+
+static void
+__on_stagger(eventloop_t *loop, void *arg) {
+    connector_t *c = (connector_t *)arg;
+    (void)loop;
+    c->stagger_timer = NULL;
+    __launch_next(c);
+}
+
+// 返回 1 立即连上，0 进行中，-1 失败
+static int
+__attempt_start(connector_t *c, int index) {
+    struct conn_attempt *a = &c->attempts[index];
+    int fd = socket(c->addrs[index].ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        c->last_err = errno;
+        return -1;
+    }
+    a->fd = fd;
+    a->index = index;
+    a->registered = 0;
+    a->timer = NULL;
+    c->pending++;
+
+    if (connect(fd, (struct sockaddr *)&c->addrs[index], c->addrlens[index]) == 0)
+        return 1;
+    if (errno != EINPROGRESS) {
+        c->last_err = errno;
+        close(fd);
+        a->fd = -1;
+        c->pending--;
+        return -1;
+    }
+    if (eventloop_add(c->loop, fd, EV_WRITE, __on_writable, a) != 0) {
+        c->last_err = errno;
+        close(fd);
+        a->fd = -1;
+        c->pending--;
+        return -1;
+    }
+    a->registered = 1;
+    a->timer = eventloop_timer_add(c->loop, c->opts.timeout_ms, __on_timeout, a);
+    return 0;
+}
+
+static void
+__launch_next(connector_t *c) {
+    if (c->stagger_timer) eventloop_timer_del(c->loop, c->stagger_timer);
+    c->stagger_timer = NULL;
+
+    while (c->next < c->naddrs) {
+        int index = c->next++;
+        int ret = __attempt_start(c, index);
+        if (ret == 1) {
+            __succeeded(c, &c->attempts[index]);
+            return;
+        }
+        if (ret == 0) {
+            if (c->next < c->naddrs)
+                c->stagger_timer = eventloop_timer_add(c->loop, c->opts.stagger_ms, __on_stagger, c);
+            return;
+        }
+        // 立即失败(例如本机没有 IPv6 路由)，继续下一个
+    }
+    if (c->pending == 0)
+        __round_failed(c);
+}
+
+/**
+ * 创建连接管理器
+ *
+ * @param loop 所在的事件循环，回调都在这个循环上执行
+ * @param opts 参数，NULL 或字段为 0 时使用默认值
+ * @param cb 每次连接成功或一轮失败时回调
+ * @return 成功返回指针，内存不足返回NULL
+ */
+connector_t *
+connector_create(eventloop_t *loop, const struct connector_opts *opts, CONNCALLBACK cb, void *arg) {
+    connector_t *c = (connector_t *)calloc(1, sizeof(*c));
+    if (!c) return NULL;
+
+    c->loop = loop;
+    c->cb = cb;
+    c->arg = arg;
+    if (opts) c->opts = *opts;
+    else c->opts.max_retries = -1;
+    if (c->opts.timeout_ms <= 0) c->opts.timeout_ms = DEFAULT_TIMEOUT_MS;
+    if (c->opts.stagger_ms <= 0) c->opts.stagger_ms = DEFAULT_STAGGER_MS;
+    if (c->opts.backoff_min_ms <= 0) c->opts.backoff_min_ms = DEFAULT_BACKOFF_MIN_MS;
+    if (c->opts.backoff_max_ms < c->opts.backoff_min_ms) c->opts.backoff_max_ms = DEFAULT_BACKOFF_MAX_MS;
+
+    c->connected = -1;
+    c->backoff_ms = c->opts.backoff_min_ms;
+    c->seed = (unsigned int)eventloop_now_ms() ^ (unsigned int)(uintptr_t)c;
+    return c;
+}
+
+void
+connector_destroy(connector_t *c) {
+    __cancel_round(c);
+    if (c->retry_timer) eventloop_timer_del(c->loop, c->retry_timer);
+    free(c->addrs);
+    free(c->addrlens);
+    free(c->attempts);
+    free(c);
+}
+
+int
+connector_add_addr(connector_t *c, const char *ip, unsigned short port) {
+    struct sockaddr_storage ss;
+    socklen_t len;
+    memset(&ss, 0, sizeof(ss));
+
+    struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+    if (inet_pton(AF_INET, ip, &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        len = sizeof(*sin);
+    } else if (inet_pton(AF_INET6, ip, &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        len = sizeof(*sin6);
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // 只在 connector_start 之前添加，attempts 重新分配后旧指针失效
+    int n = c->naddrs + 1;
+    struct sockaddr_storage *addrs = (struct sockaddr_storage *)realloc(c->addrs, sizeof(*addrs) * n);
+    if (!addrs) return -1;
+    c->addrs = addrs;
+    socklen_t *addrlens = (socklen_t *)realloc(c->addrlens, sizeof(*addrlens) * n);
+    if (!addrlens) return -1;
+    c->addrlens = addrlens;
+    struct conn_attempt *attempts = (struct conn_attempt *)realloc(c->attempts, sizeof(*attempts) * n);
+    if (!attempts) return -1;
+    c->attempts = attempts;
+
+    c->addrs[c->naddrs] = ss;
+    c->addrlens[c->naddrs] = len;
+    c->attempts[c->naddrs].c = c;
+    c->attempts[c->naddrs].fd = -1;
+    c->attempts[c->naddrs].registered = 0;
+    c->attempts[c->naddrs].timer = NULL;
+    c->naddrs = n;
+    return 0;
+}
+
+int
+connector_start(connector_t *c) {
+    if (c->naddrs == 0) return -1;
+    __cancel_round(c);
+    if (c->retry_timer) eventloop_timer_del(c->loop, c->retry_timer);
+    c->retry_timer = NULL;
+
+    c->connected = -1;
+    c->next = 0;
+    c->pending = 0;
+    __launch_next(c);
+    return 0;
+}
+
+void
+connector_retry(connector_t *c) {
+    c->connected = -1;
+    if (c->retry_timer) eventloop_timer_del(c->loop, c->retry_timer);
+    c->retry_ms = __backoff_next(c);
+    c->retry_timer = eventloop_timer_add(c->loop, c->retry_ms, __on_retry, c);
+}
+
+int
+connector_retry_ms(connector_t *c) {
+    return c->retry_ms;
+}
+
+int
+connector_addr_index(connector_t *c) {
+    return c->connected;
+}
@@ -0,0 +1,66 @@
+#ifndef _CONNECTOR_H
+#define _CONNECTOR_H
+
+/**
+ * 客户端连接管理：在 eventloop 上发起非阻塞连接
+ *
+ * - 地址用数字形式给出(IPv4 / IPv6)，不做 DNS 解析
+ * - 非阻塞 connect 返回 EINPROGRESS 后关注 EV_WRITE，可写时读 SO_ERROR 判断结果
+ * - 配置了多个地址时按 happy eyeballs 的方式并行尝试：先连第一个，stagger_ms 内没有结果就再发起下一个，
+ *   某个尝试失败时立刻发起下一个；最先成功的胜出，其余的关闭
+ * - 每个尝试有独立的 timeout_ms 超时，由 eventloop 的定时器实现
+ * - 一轮全部失败后按指数退避重试，等待时间在 [d/2, d) 之间随机，避免大量客户端同时重连
+ *
+ * 连接成功后 fd(非阻塞)交给使用者，由使用者注册到 eventloop；连接断开后使用者关闭 fd 并调用
+ * connector_retry，connector 按退避时间重新连接。
+ *
+ * shell: gcc -O2 -c connector.c eventloop.c
+ * usage: include connector.h & link connector.o eventloop.o
+ */
+
+#include "eventloop.h"
+
+typedef struct connector_s connector_t;
+
+// fd >= 0 表示连接成功；fd == -1 表示这一轮失败，err 为最后一个错误码，
+// connector_retry_ms 返回下一次重试的等待时间，-1 表示已经放弃
+typedef void (*CONNCALLBACK)(connector_t *c, int fd, int err, void *arg);
+
+struct connector_opts {
+    int timeout_ms;         // 单个尝试的超时，默认 3000
+    int stagger_ms;         // 并行尝试的间隔，默认 250
+    int backoff_min_ms;     // 第一次重试的退避时间，默认 100
+    int backoff_max_ms;     // 退避上限，默认 30000
+    int max_retries;        // 连续失败多少轮后放弃，-1 表示一直重试(默认)
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// opts 为 NULL 时全部使用默认值
+connector_t *connector_create(eventloop_t *loop, const struct connector_opts *opts,
+                              CONNCALLBACK cb, void *arg);
+
+void connector_destroy(connector_t *c);
+
+// 按添加顺序尝试；ip 不是合法的数字地址返回 -1
+int connector_add_addr(connector_t *c, const char *ip, unsigned short port);
+
+// 立即开始一轮连接，成功返回0，没有地址返回-1
+int connector_start(connector_t *c);
+
+// 连接断开后调用：按退避时间重新连接。连接成功过之后退避从 backoff_min_ms 重新开始
+void connector_retry(connector_t *c);
+
+int connector_retry_ms(connector_t *c);
+
+// 成功连接的地址下标(connector_add_addr 的顺序)，未连接返回 -1
+int connector_addr_index(connector_t *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,276 @@
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "coro.h"
+
+/**
+ * shell: g++ -O2 -std=c++20 coro.cc coro_echo.cc -o coro_echo
+ */
+
+#define CORO_MAX_EVENTS		1024
+#define FRAME_ALIGN			64
+#define FRAME_CLASSES		64			// 64B ~ 4KB 分级缓存，更大的帧直接走 operator new
+
+namespace coro {
+
+// 只用零初始化的 POD，thread_local 访问不经过初始化包装函数
+struct FrameCache {
+	void *free[FRAME_CLASSES];
+	uint64_t allocated;
+	uint64_t reused;
+};
+static thread_local FrameCache frame_cache;
+
+void *FramePool::Allocate(size_t size) {
+
+	size_t cls = (size + FRAME_ALIGN - 1) / FRAME_ALIGN;
+	if (cls >= FRAME_CLASSES) return ::operator new(size);
+
+	void *p = frame_cache.free[cls];
+	if (p) {
+		frame_cache.free[cls] = *(void **)p;
+		frame_cache.reused++;
+		return p;
+	}
+	frame_cache.allocated++;
+	return ::operator new(cls * FRAME_ALIGN);
+}
+
+void FramePool::Deallocate(void *p, size_t size) {
+
+	size_t cls = (size + FRAME_ALIGN - 1) / FRAME_ALIGN;
+	if (cls >= FRAME_CLASSES) {
+		::operator delete(p);
+		return;
+	}
+	// 缓存的帧数等于历史上同时存活的最大帧数，不归还系统
+	*(void **)p = frame_cache.free[cls];
+	frame_cache.free[cls] = p;
+}
+
+uint64_t FramePool::Allocated() { return frame_cache.allocated; }
+uint64_t FramePool::Reused() { return frame_cache.reused; }
+
+
+Loop::Loop(int maxfds) : states_(maxfds) {
+	epfd_ = epoll_create(1);
+	UpdateTime();
+}
+
+Loop::~Loop() {
+	if (epfd_ >= 0) close(epfd_);
+}
+
+int Loop::Add(int fd) {
+
+	if (fd < 0 || fd >= (int)states_.size()) return -1;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) return -1;
+
+	IoState &st = states_[fd];
+	st.readable = true;		// 注册前可能已经有数据，第一次 read 先试一次
+	st.writable = true;
+	return 0;
+}
+
+void Loop::Close(int fd) {
+
+	IoState &st = states_[fd];
+	epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+
+	std::coroutine_handle<> reader = st.reader.handle, writer = st.writer.handle;
+	uint32_t gen = st.gen;
+	st = IoState{};
+	st.gen = gen + 1;
+	if (reader) reader.destroy();
+	if (writer) writer.destroy();
+}
+
+void Loop::WatchWrite(int fd, bool on) {
+
+	IoState &st = states_[fd];
+	if (st.watch_write == on) return;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (on ? (uint32_t)EPOLLOUT : 0u);
+	ev.data.fd = fd;
+	epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev);
+	st.watch_write = on;
+}
+
+void Loop::AddTimer(uint64_t delay_ms, std::coroutine_handle<> h) {
+	// 没有定时器时循环不更新时间，这里取一次当前时间
+	UpdateTime();
+	timers_.push(Timer{now_ms_ + delay_ms, timer_seq_++, h});
+}
+
+void Loop::UpdateTime() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now_ms_ = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int Loop::NextTimeout() {
+	if (timers_.empty()) return -1;
+	uint64_t deadline = timers_.top().deadline;
+	return deadline > now_ms_ ? (int)(deadline - now_ms_) : 0;
+}
+
+void Loop::RunTimers() {
+	while (!timers_.empty() && timers_.top().deadline <= now_ms_) {
+		std::coroutine_handle<> h = timers_.top().handle;
+		timers_.pop();
+		h.resume();
+	}
+}
+
+// 边沿到来时先由 Complete 完成 IO，真正完成了才恢复协程；仍是 EAGAIN 就继续挂着
+static inline void wake(Loop::Waiter &w) {
+	if (!w.handle || !w.complete(w.awaiter)) return;
+	std::coroutine_handle<> h = w.handle;
+	w.handle = nullptr;
+	h.resume();
+}
+
+void Loop::Run() {
+
+	struct epoll_event events[CORO_MAX_EVENTS];
+	running_ = true;
+
+	while (running_) {
+		int nready = epoll_wait(epfd_, events, CORO_MAX_EVENTS, NextTimeout());
+		if (nready < 0 && errno != EINTR) break;
+		if (!timers_.empty()) {
+			UpdateTime();
+			RunTimers();
+		}
+
+		int i;
+		for (i = 0;i < nready;i ++) {
+			int fd = events[i].data.fd;
+			uint32_t ev = events[i].events;
+			IoState &st = states_[fd];
+			uint32_t gen = st.gen;
+
+			if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+				st.readable = true;
+				if (ev & (EPOLLRDHUP | EPOLLERR | EPOLLHUP)) st.hup = true;
+				wake(st.reader);
+				// 协程里关了这个 fd，甚至 accept 到的新连接复用了它，剩下的事件不再属于它
+				if (st.gen != gen) continue;
+			}
+			if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+				st.writable = true;
+				if (st.writer.handle && st.writer.complete(st.writer.awaiter)) {
+					// 写完了就不再关心 EPOLLOUT，之后 ACK 释放发送缓冲区时不会再唤醒 epoll_wait
+					WatchWrite(fd, false);
+					std::coroutine_handle<> h = st.writer.handle;
+					st.writer.handle = nullptr;
+					h.resume();
+				}
+			}
+		}
+	}
+}
+
+
+bool ReadAwaiter::Complete(void *self) {
+
+	ReadAwaiter *a = (ReadAwaiter *)self;
+	Loop::IoState &st = a->loop->State(a->fd);
+
+	ssize_t count;
+	do {
+		count = recv(a->fd, a->buf, a->len, 0);
+	} while (count < 0 && errno == EINTR);
+	if (count < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			st.readable = false;
+			return false;
+		}
+	} else if (count > 0 && (size_t)count < a->len && !st.hup) {
+		// 短读：接收队列已经读空，之后的数据一定会带来新的边沿。
+		// FIN 和数据一起到达时边沿已经用掉了，要一直读到返回 0
+		st.readable = false;
+	}
+	a->result = count;
+	return true;
+}
+
+bool ReadAwaiter::await_ready() noexcept {
+	if (!loop->State(fd).readable) return false;
+	return Complete(this);
+}
+
+
+bool WriteAwaiter::Complete(void *self) {
+
+	WriteAwaiter *a = (WriteAwaiter *)self;
+
+	while (a->sent < a->len) {
+		ssize_t count = send(a->fd, a->buf + a->sent, a->len - a->sent, MSG_NOSIGNAL);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				a->loop->State(a->fd).writable = false;
+				a->loop->WatchWrite(a->fd, true);
+				return false;
+			}
+			a->result = -1;
+			return true;
+		}
+		a->sent += count;
+	}
+	a->result = (ssize_t)a->len;
+	return true;
+}
+
+bool WriteAwaiter::await_ready() noexcept {
+	if (!loop->State(fd).writable) return false;
+	return Complete(this);
+}
+
+
+bool AcceptAwaiter::Complete(void *self) {
+
+	AcceptAwaiter *a = (AcceptAwaiter *)self;
+
+	while (true) {
+		int clientfd = accept4(a->fd, NULL, NULL, SOCK_NONBLOCK);
+		if (clientfd >= 0) {
+			a->result = clientfd;
+			return true;
+		}
+		// 连接在 accept 前被对端重置，继续取下一个
+		if (errno == EINTR || errno == ECONNABORTED) continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			a->loop->State(a->fd).readable = false;
+			return false;
+		}
+		a->result = -1;
+		return true;
+	}
+}
+
+bool AcceptAwaiter::await_ready() noexcept {
+	if (!loop->State(fd).readable) return false;
+	return Complete(this);
+}
+
+
+void Conn::close() {
+	if (fd_ < 0) return;
+	loop_->Close(fd_);
+	fd_ = -1;
+}
+
+} // namespace coro
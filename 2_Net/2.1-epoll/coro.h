@@ -0,0 +1,216 @@
+#pragma once
+
+/**
+ * 基于 C++20 无栈协程的 reactor
+ *
+ * 回调式 reactor 把一个请求的处理拆成 accept_cb / recv_cb / send_cb，状态全靠 conn_item 里的字段传递；
+ * 协议一复杂(先读请求行，再读头，再读 body，写不完还要接着写)，就要手写状态机。
+ * 这里让 epoll 循环去恢复协程，处理函数可以按顺序写：
+ *
+ *   coro::Task echo(coro::Conn conn) {
+ *       char buf[512];
+ *       while (true) {
+ *           ssize_t n = co_await conn.read(buf, sizeof(buf));
+ *           if (n <= 0) break;
+ *           if (co_await conn.write(buf, n) < 0) break;
+ *       }
+ *       conn.close();
+ *   }
+ *
+ * 每个 fd 以 EPOLLIN | EPOLLRDHUP | EPOLLET 注册：
+ *   read  只有在 fd 可读标记为真时才调 recv，读到的比缓冲区少说明内核接收队列已经读空，
+ *         清掉标记，下次直接挂起等边沿，不会多出一次返回 EAGAIN 的 recv；
+ *   write 先直接 send，写不完(EAGAIN)才 MOD 加上 EPOLLOUT 挂起，写完再去掉。
+ *         EPOLLOUT 不能常驻：每个释放了发送缓冲区的 ACK 都会触发一次写空间唤醒，
+ *         单连接 ping-pong 时 epoll_wait 被多唤醒一倍。
+ * 所以一次 echo 的系统调用和回调版一样：epoll_wait + recv + send。
+ *
+ * 协程帧由 promise_type 的 operator new/delete 从线程本地的分级空闲链表分配，
+ * 连接建立/断开不走 malloc。
+ *
+ * Loop 只在一个线程上运行，所有协程都在这个线程上恢复；多核时每个线程一个 Loop。
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <coroutine>
+#include <exception>
+#include <queue>
+#include <vector>
+
+namespace coro {
+
+// 协程帧分配器：按 64 字节分级，每级一条空闲链表，线程本地
+class FramePool {
+public:
+	static void *Allocate(size_t size);
+	static void Deallocate(void *p, size_t size);
+
+	static uint64_t Allocated();		// 本线程从系统分配过的帧数
+	static uint64_t Reused();			// 本线程从空闲链表复用的次数
+};
+
+
+// 即发即忘的协程：创建后立即运行，结束时自动销毁帧
+struct Task {
+	struct promise_type {
+		Task get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+
+		static void *operator new(size_t size) { return FramePool::Allocate(size); }
+		static void operator delete(void *p, size_t size) { FramePool::Deallocate(p, size); }
+	};
+};
+
+
+class Loop {
+public:
+	explicit Loop(int maxfds = 65536);
+	~Loop();
+
+	void Run();					// 运行直到 Stop
+	void Stop() { running_ = false; }
+
+	// 以 EPOLLET 注册 fd(必须已是非阻塞)，返回 -1 失败
+	int Add(int fd);
+	// 写遇到 EAGAIN 时打开 EPOLLOUT，写完关闭
+	void WatchWrite(int fd, bool on);
+	// 取消注册并关闭 fd，仍挂在这个 fd 上的其它协程被销毁
+	void Close(int fd);
+
+	// 以下由 awaiter 调用
+	// 挂起的读/写：complete 尝试完成 IO，返回 false 表示仍是 EAGAIN，继续等下一个边沿
+	struct Waiter {
+		std::coroutine_handle<> handle;
+		bool (*complete)(void *awaiter) = nullptr;
+		void *awaiter = nullptr;
+	};
+	struct IoState {
+		Waiter reader;
+		Waiter writer;
+		bool readable = false;
+		bool writable = false;
+		bool hup = false;			// 已收到 RDHUP/HUP/ERR，不再因为短读清掉 readable
+		bool watch_write = false;	// 当前是否注册了 EPOLLOUT
+		uint32_t gen = 0;		// Close 后加一，恢复 reader 之后据此判断 fd 是否已经换了主人
+	};
+	IoState &State(int fd) { return states_[fd]; }
+	void AddTimer(uint64_t delay_ms, std::coroutine_handle<> h);
+
+private:
+	struct Timer {
+		uint64_t deadline;
+		uint64_t seq;
+		std::coroutine_handle<> handle;
+		bool operator>(const Timer &o) const {
+			return deadline != o.deadline ? deadline > o.deadline : seq > o.seq;
+		}
+	};
+
+	void UpdateTime();
+	int NextTimeout();
+	void RunTimers();
+
+	int epfd_ = -1;
+	bool running_ = false;
+	uint64_t now_ms_ = 0;
+	uint64_t timer_seq_ = 0;
+	std::vector<IoState> states_;		// 按 fd 下标
+	std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+};
+
+
+// read/write/accept 的 awaiter：await_ready 里能完成就不挂起，否则由 Loop 在边沿到来时调 Complete 完成 IO 再恢复
+struct ReadAwaiter {
+	Loop *loop;
+	int fd;
+	void *buf;
+	size_t len;
+	ssize_t result;
+
+	static bool Complete(void *self);
+	bool await_ready() noexcept;
+	void await_suspend(std::coroutine_handle<> h) noexcept {
+		loop->State(fd).reader = Loop::Waiter{h, Complete, this};
+	}
+	ssize_t await_resume() const noexcept { return result; }
+};
+
+struct WriteAwaiter {
+	Loop *loop;
+	int fd;
+	const char *buf;
+	size_t len;
+	size_t sent;
+	ssize_t result;
+
+	static bool Complete(void *self);
+	bool await_ready() noexcept;
+	void await_suspend(std::coroutine_handle<> h) noexcept {
+		loop->State(fd).writer = Loop::Waiter{h, Complete, this};
+	}
+	ssize_t await_resume() const noexcept { return result; }
+};
+
+struct AcceptAwaiter {
+	Loop *loop;
+	int fd;
+	int result;
+
+	static bool Complete(void *self);
+	bool await_ready() noexcept;
+	void await_suspend(std::coroutine_handle<> h) noexcept {
+		loop->State(fd).reader = Loop::Waiter{h, Complete, this};
+	}
+	int await_resume() const noexcept { return result; }
+};
+
+struct SleepAwaiter {
+	Loop *loop;
+	uint64_t ms;
+
+	bool await_ready() const noexcept { return ms == 0; }
+	void await_suspend(std::coroutine_handle<> h) { loop->AddTimer(ms, h); }
+	void await_resume() const noexcept {}
+};
+
+
+// 一条已注册到 Loop 的连接，按值传给处理协程
+class Conn {
+public:
+	Conn(Loop &loop, int fd) : loop_(&loop), fd_(fd) {}
+
+	int fd() const { return fd_; }
+	Loop &loop() const { return *loop_; }
+
+	// 读最多 len 字节：返回读到的字节数，0 对端关闭，-1 出错
+	ReadAwaiter read(void *buf, size_t len) { return ReadAwaiter{loop_, fd_, buf, len, 0}; }
+	// 写完 len 字节才返回：返回 len，-1 出错
+	WriteAwaiter write(const void *buf, size_t len) {
+		return WriteAwaiter{loop_, fd_, (const char *)buf, len, 0, 0};
+	}
+	void close();
+
+private:
+	Loop *loop_;
+	int fd_;
+};
+
+// 监听 socket：co_await accept() 返回新连接的 fd(非阻塞)，-1 出错
+class Listener {
+public:
+	Listener(Loop &loop, int fd) : loop_(&loop), fd_(fd) {}
+	AcceptAwaiter accept() { return AcceptAwaiter{loop_, fd_, -1}; }
+
+private:
+	Loop *loop_;
+	int fd_;
+};
+
+inline SleepAwaiter sleep(Loop &loop, uint64_t ms) { return SleepAwaiter{&loop, ms}; }
+
+} // namespace coro
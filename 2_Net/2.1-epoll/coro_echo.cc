@@ -0,0 +1,289 @@
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "coro.h"
+
+/**
+ * 协程 reactor 的 echo / http 服务，以及同一套 socket 设置下的回调版 echo，用 echo_bench 对比开销
+ *
+ *   -m coro      每条连接一个协程，read/write 按顺序写(默认)
+ *   -m callback  connlist + recv_callback/send_callback，收到就地 send，写不完才等 EPOLLOUT
+ *   -m http      协程写的 HTTP/1.1 keep-alive 处理，GET /sleep/<ms> 先 co_await sleep 再响应
+ *   -i secs      每隔 secs 秒打印一次协程帧的分配/复用次数(用 sleep 协程实现)
+ *
+ * shell: g++ -O2 -std=c++20 coro.cc coro_echo.cc -o coro_echo
+ * usage: ./coro_echo [-m coro|callback|http] [-p port] [-i secs]
+ *        ./echo_bench -c 100 -d 10 -P <pid> 127.0.0.1 2048
+ */
+
+#define BUFFER_LENGTH		512
+#define HTTP_BUFFER			2048
+#define MAX_FDS				65536
+#define MAX_EVENTS			1024
+
+
+static int init_server(unsigned short port) {
+
+	int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	int reuse = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in serveraddr;
+	memset(&serveraddr, 0, sizeof(struct sockaddr_in));
+	serveraddr.sin_family = AF_INET;
+	serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	serveraddr.sin_port = htons(port);
+
+	if (-1 == bind(sockfd, (struct sockaddr*)&serveraddr, sizeof(struct sockaddr))) {
+		perror("bind");
+		return -1;
+	}
+	listen(sockfd, 1024);
+	return sockfd;
+}
+
+static void set_nodelay(int fd) {
+	int nodelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+}
+
+
+// ---------------- 协程版 ----------------
+
+static coro::Task echo_handler(coro::Conn conn) {
+
+	char buf[BUFFER_LENGTH];
+	while (true) {
+		ssize_t n = co_await conn.read(buf, sizeof(buf));
+		if (n <= 0) break;
+		if (co_await conn.write(buf, n) < 0) break;
+	}
+	conn.close();
+}
+
+static coro::Task http_handler(coro::Conn conn) {
+
+	char buf[HTTP_BUFFER];
+	size_t len = 0;
+
+	while (true) {
+		// 读到一个完整的请求头
+		char *end;
+		while ((end = (char *)memmem(buf, len, "\r\n\r\n", 4)) == NULL) {
+			if (len == sizeof(buf)) goto done;
+			ssize_t n = co_await conn.read(buf + len, sizeof(buf) - len);
+			if (n <= 0) goto done;
+			len += n;
+		}
+		{
+			size_t reqlen = end + 4 - buf;
+			int delay = 0;
+			if (len > 11 && memcmp(buf, "GET /sleep/", 11) == 0) delay = atoi(buf + 11);
+			if (delay > 0) co_await coro::sleep(conn.loop(), delay);
+
+			char resp[256];
+			int body = delay > 0 ? snprintf(NULL, 0, "slept %dms\n", delay) : 6;
+			int rlen = snprintf(resp, sizeof(resp),
+				"HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n", body);
+			if (delay > 0) rlen += snprintf(resp + rlen, sizeof(resp) - rlen, "slept %dms\n", delay);
+			else rlen += snprintf(resp + rlen, sizeof(resp) - rlen, "hello\n");
+			if (co_await conn.write(resp, rlen) < 0) goto done;
+
+			// 流水线上的下一个请求留在缓冲区开头
+			memmove(buf, buf + reqlen, len - reqlen);
+			len -= reqlen;
+		}
+	}
+done:
+	conn.close();
+}
+
+static coro::Task acceptor(coro::Loop &loop, int listenfd, bool http) {
+
+	coro::Listener listener(loop, listenfd);
+	while (true) {
+		int clientfd = co_await listener.accept();
+		if (clientfd < 0) {
+			// EMFILE 之类：让出一会儿再试，不让 accept 队列一直触发
+			perror("accept");
+			co_await coro::sleep(loop, 10);
+			continue;
+		}
+		set_nodelay(clientfd);
+		if (loop.Add(clientfd) < 0) {
+			close(clientfd);
+			continue;
+		}
+		if (http) http_handler(coro::Conn(loop, clientfd));
+		else echo_handler(coro::Conn(loop, clientfd));
+	}
+}
+
+static coro::Task stats_reporter(coro::Loop &loop, int seconds) {
+	while (true) {
+		co_await coro::sleep(loop, seconds * 1000);
+		printf("frames: allocated %lu, reused %lu\n",
+			(unsigned long)coro::FramePool::Allocated(), (unsigned long)coro::FramePool::Reused());
+		fflush(stdout);
+	}
+}
+
+
+// ---------------- 回调版 ----------------
+
+typedef int (*RCALLBACK)(int fd);
+
+struct conn_item {
+	int fd;
+	char buffer[BUFFER_LENGTH];
+	int wlen;
+	int wsent;
+	RCALLBACK recv_callback;
+	RCALLBACK send_callback;
+};
+
+static int epfd;
+static std::vector<conn_item> connlist(MAX_FDS);
+
+static void set_event(int fd, uint32_t event, int flag) {
+	struct epoll_event ev;
+	ev.events = event;
+	ev.data.fd = fd;
+	epoll_ctl(epfd, flag ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+}
+
+static int close_cb(int fd) {
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+	return -1;
+}
+
+static int send_cb(int fd) {
+
+	conn_item *c = &connlist[fd];
+	while (c->wsent < c->wlen) {
+		int count = send(fd, c->buffer + c->wsent, c->wlen - c->wsent, MSG_NOSIGNAL);
+		if (count < 0) {
+			if (errno == EAGAIN) {
+				set_event(fd, EPOLLOUT, 0);
+				return 0;
+			}
+			return close_cb(fd);
+		}
+		c->wsent += count;
+	}
+	set_event(fd, EPOLLIN, 0);
+	return 0;
+}
+
+static int recv_cb(int fd) {
+
+	conn_item *c = &connlist[fd];
+	int count = recv(fd, c->buffer, BUFFER_LENGTH, 0);
+	if (count <= 0) {
+		if (count < 0 && errno == EAGAIN) return 0;
+		return close_cb(fd);
+	}
+
+	// 就地发送，只有写不完才改成等 EPOLLOUT
+	int sent = send(fd, c->buffer, count, MSG_NOSIGNAL);
+	if (sent == count) return sent;
+	if (sent < 0) {
+		if (errno != EAGAIN) return close_cb(fd);
+		sent = 0;
+	}
+	c->wlen = count;
+	c->wsent = sent;
+	set_event(fd, EPOLLOUT, 0);
+	return sent;
+}
+
+static int accept_cb(int fd) {
+
+	while (true) {
+		int clientfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK);
+		if (clientfd < 0) return 0;
+		if (clientfd >= MAX_FDS) {
+			close(clientfd);
+			continue;
+		}
+		set_nodelay(clientfd);
+		connlist[clientfd].fd = clientfd;
+		connlist[clientfd].recv_callback = recv_cb;
+		connlist[clientfd].send_callback = send_cb;
+		set_event(clientfd, EPOLLIN, 1);
+	}
+}
+
+static void callback_loop(int listenfd) {
+
+	epfd = epoll_create(1);
+	connlist[listenfd].fd = listenfd;
+	connlist[listenfd].recv_callback = accept_cb;
+	set_event(listenfd, EPOLLIN, 1);
+
+	struct epoll_event events[MAX_EVENTS];
+	while (1) {
+		int nready = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		int i;
+		for (i = 0;i < nready;i ++) {
+			int connfd = events[i].data.fd;
+			int count = 0;
+			if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+				count = connlist[connfd].recv_callback(connfd);
+			}
+			if ((events[i].events & EPOLLOUT) && count >= 0) {
+				connlist[connfd].send_callback(connfd);
+			}
+		}
+	}
+}
+
+
+int main(int argc, char *argv[]) {
+
+	const char *mode = "coro";
+	unsigned short port = 2048;
+	int interval = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "m:p:i:")) != -1) {
+		switch (opt) {
+		case 'm': mode = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'i': interval = atoi(optarg); break;
+		default:
+			printf("usage: %s [-m coro|callback|http] [-p port] [-i secs]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	int listenfd = init_server(port);
+	if (listenfd < 0) return -1;
+	printf("%s server listening on %d\n", mode, port);
+	fflush(stdout);
+
+	if (strcmp(mode, "callback") == 0) {
+		callback_loop(listenfd);
+		return 0;
+	}
+
+	coro::Loop loop(MAX_FDS);
+	loop.Add(listenfd);
+	acceptor(loop, listenfd, strcmp(mode, "http") == 0);
+	if (interval > 0) stats_reporter(loop, interval);
+	loop.Run();
+	return 0;
+}
@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/un.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/**
+ * 回显压测客户端
+ *
+ * 先建立 -c 条连接，然后每条连接做 ping-pong：发送 -s 字节，收齐回显后再发下一条，
+ * 统计 -d 秒内完成的请求数。指定 -P 服务器进程号时，从 /proc/<pid>/stat 读取
+ * 服务器在测量区间内消耗的 CPU 时间，折算为每个请求的 CPU 微秒数。
+ *
+ * 单个源地址只有约 28K 个临时端口，-b 指定轮流使用的源地址个数
+ * (127.0.0.1, 127.0.0.2 ...)，10 万连接需要 -b 4 以上。
+ *
+ * -u path 改为连接 AF_UNIX 地址(默认 stream，加 -S 为 seqpacket)，用于和回环 TCP 对比。
+ * 每个请求的往返时延记入直方图，结束时输出 p50/p99/p999。
+ *
+ * shell: gcc -O2 echo_bench.c -o echo_bench
+ * usage: ./echo_bench [-c conns] [-d seconds] [-s msgsize] [-b nsrc] [-P pid] ip port
+ *        ./echo_bench [-c conns] [-d seconds] [-s msgsize] [-P pid] -u path [-S]
+ */
+
+#define MAX_MSG         1024
+#define MAX_EVENTS      1024
+#define LAT_BUCKETS     100000      // 时延直方图：1us 一格，最多 100ms
+
+#define TIME_SUB_MS(tv1, tv2)  ((tv1.tv_sec - tv2.tv_sec) * 1000 + (tv1.tv_usec - tv2.tv_usec) / 1000)
+
+struct bench_conn {
+	int fd;
+	int connected;
+	int rlen;               // 本轮已收到的回显字节数
+	long long sent_ns;      // 本轮请求的发送时间
+};
+
+static struct bench_conn *conns;
+static char message[MAX_MSG];
+static int msgsize = 64;
+static unsigned int latency_hist[LAT_BUCKETS + 1];
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void latency_record(long long ns) {
+	long long us = ns / 1000;
+	latency_hist[us < LAT_BUCKETS ? us : LAT_BUCKETS]++;
+}
+
+// 返回第 pct 百分位的时延(us)
+static int latency_percentile(long long total, double pct) {
+	long long target = (long long)(total * pct / 100), seen = 0;
+	int i;
+	for (i = 0; i <= LAT_BUCKETS; i++) {
+		seen += latency_hist[i];
+		if (seen > target) return i;
+	}
+	return LAT_BUCKETS;
+}
+
+static int ntySetNonblock(int fd) {
+	int flags;
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0) return flags;
+	flags |= O_NONBLOCK;
+	if (fcntl(fd, F_SETFL, flags) < 0) return -1;
+	return 0;
+}
+
+// 读取进程的 utime + stime，单位为 clock tick
+static long long proc_cpu_ticks(int pid) {
+	char path[64], buf[1024];
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	FILE *fp = fopen(path, "r");
+	if (!fp) return -1;
+	if (!fgets(buf, sizeof(buf), fp)) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	// 第2个字段 (comm) 可能含空格，从最后一个 ')' 之后开始数
+	char *p = strrchr(buf, ')');
+	if (!p) return -1;
+	long long utime = 0, stime = 0;
+	// ") state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime"
+	if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lld %lld",
+			&utime, &stime) != 2)
+		return -1;
+	return utime + stime;
+}
+
+static int open_unix_conn(const char *path, int type) {
+	int fd = socket(AF_UNIX, type, 0);
+	if (fd < 0) return -1;
+
+	ntySetNonblock(fd);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int open_conn(struct sockaddr_in *addr, int src_index) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	ntySetNonblock(fd);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (src_index > 0) {
+		// 只绑定源地址，端口推迟到 connect 时按四元组分配
+		struct sockaddr_in src;
+		memset(&src, 0, sizeof(src));
+		src.sin_family = AF_INET;
+		src.sin_addr.s_addr = htonl(INADDR_LOOPBACK + src_index);
+#ifdef IP_BIND_ADDRESS_NO_PORT
+		setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+#endif
+		if (bind(fd, (struct sockaddr *)&src, sizeof(src)) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0 && errno != EINPROGRESS) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char **argv) {
+	int nconns = 100, seconds = 10, nsrc = 1, server_pid = 0;
+	const char *unix_path = NULL;
+	int unix_type = SOCK_STREAM;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:d:s:b:P:u:S")) != -1) {
+		switch (opt) {
+		case 'c': nconns = atoi(optarg); break;
+		case 'd': seconds = atoi(optarg); break;
+		case 's': msgsize = atoi(optarg); break;
+		case 'b': nsrc = atoi(optarg); break;
+		case 'P': server_pid = atoi(optarg); break;
+		case 'u': unix_path = optarg; break;
+		case 'S': unix_type = SOCK_SEQPACKET; break;
+		default: goto usage;
+		}
+	}
+	if (!unix_path && argc - optind < 2) goto usage;
+	if (msgsize <= 0 || msgsize > MAX_MSG) msgsize = 64;
+	if (nsrc < 1) nsrc = 1;
+	memset(message, 'x', sizeof(message));
+
+	// 连接数超过默认的 1024 时需要更大的 fd 上限
+	struct rlimit rl = { nconns + 64, nconns + 64 };
+	setrlimit(RLIMIT_NOFILE, &rl);
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	if (!unix_path) {
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = inet_addr(argv[optind]);
+		addr.sin_port = htons(atoi(argv[optind + 1]));
+	}
+
+	int epfd = epoll_create(1);
+	conns = (struct bench_conn *)calloc(nconns, sizeof(struct bench_conn));
+	struct epoll_event ev, events[MAX_EVENTS];
+
+	// 1. 建连阶段：建立所有连接，连接成功(EPOLLOUT)后发出第一条请求
+	struct timeval tv_begin, tv_cur;
+	gettimeofday(&tv_begin, NULL);
+
+	int i, opened = 0, established = 0, failed = 0;
+	for (i = 0; i < nconns; i++) {
+		int fd = unix_path ? open_unix_conn(unix_path, unix_type)
+			: open_conn(&addr, nsrc > 1 ? i % nsrc : 0);
+		if (fd < 0) {
+			failed++;
+			continue;
+		}
+		conns[i].fd = fd;
+		ev.events = EPOLLOUT;
+		ev.data.u32 = i;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+		opened++;
+
+		// 边建连边处理完成事件，避免 backlog 被打满
+		if ((opened % 1000) == 0 || i == nconns - 1) {
+			int spins = 0;
+			while (established + failed < opened && spins++ < 100) {
+				int nready = epoll_wait(epfd, events, MAX_EVENTS, 10);
+				int k;
+				for (k = 0; k < nready; k++) {
+					struct bench_conn *c = &conns[events[k].data.u32];
+					int err = 0;
+					socklen_t elen = sizeof(err);
+					getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &elen);
+					if (err != 0 || (events[k].events & (EPOLLERR | EPOLLHUP))) {
+						epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+						close(c->fd);
+						c->fd = -1;
+						failed++;
+						continue;
+					}
+					c->connected = 1;
+					established++;
+					ev.events = EPOLLIN;
+					ev.data.u32 = events[k].data.u32;
+					epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+				}
+				if (nready == 0) break;
+			}
+		}
+	}
+	gettimeofday(&tv_cur, NULL);
+	printf("connections: %d established, %d failed, connect time_used: %ldms\n",
+		established, nconns - established, TIME_SUB_MS(tv_cur, tv_begin));
+	if (established == 0) return -1;
+
+	// 2. 测量阶段：所有连接同时开始 ping-pong
+	for (i = 0; i < nconns; i++) {
+		if (conns[i].connected) {
+			conns[i].sent_ns = now_ns();
+			send(conns[i].fd, message, msgsize, 0);
+		}
+	}
+
+	long long requests = 0;
+	int closed = 0;
+	long long cpu_begin = server_pid ? proc_cpu_ticks(server_pid) : -1;
+	gettimeofday(&tv_begin, NULL);
+
+	while (1) {
+		gettimeofday(&tv_cur, NULL);
+		if (TIME_SUB_MS(tv_cur, tv_begin) >= seconds * 1000) break;
+
+		int nready = epoll_wait(epfd, events, MAX_EVENTS, 100);
+		int k;
+		for (k = 0; k < nready; k++) {
+			struct bench_conn *c = &conns[events[k].data.u32];
+			char rbuf[MAX_MSG];
+			ssize_t n = recv(c->fd, rbuf, msgsize - c->rlen, 0);
+			if (n <= 0) {
+				if (n < 0 && errno == EAGAIN) continue;
+				// 服务器主动断开(例如 select 后端超出 FD_SETSIZE)
+				epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+				close(c->fd);
+				c->fd = -1;
+				c->connected = 0;
+				closed++;
+				continue;
+			}
+			c->rlen += n;
+			if (c->rlen == msgsize) {
+				long long ns = now_ns();
+				latency_record(ns - c->sent_ns);
+				c->rlen = 0;
+				requests++;
+				c->sent_ns = ns;
+				send(c->fd, message, msgsize, 0);
+			}
+		}
+	}
+
+	gettimeofday(&tv_cur, NULL);
+	long long cpu_end = server_pid ? proc_cpu_ticks(server_pid) : -1;
+	long elapsed = TIME_SUB_MS(tv_cur, tv_begin);
+
+	double qps = elapsed > 0 ? (double)requests * 1000 / elapsed : 0;
+	printf("requests: %lld, closed by server: %d, time_used: %ldms, req/sec: %.0f\n",
+		requests, closed, elapsed, qps);
+	if (requests > 0) {
+		printf("latency p50: %dus, p99: %dus, p999: %dus\n",
+			latency_percentile(requests, 50), latency_percentile(requests, 99),
+			latency_percentile(requests, 99.9));
+	}
+	if (cpu_begin >= 0 && cpu_end >= 0 && requests > 0) {
+		double cpu_us = (double)(cpu_end - cpu_begin) * 1000000 / sysconf(_SC_CLK_TCK);
+		printf("server cpu: %.0fms, cpu/req: %.2fus\n", cpu_us / 1000, cpu_us / requests);
+	}
+
+	// 机器可读的汇总行，供 bench_matrix.sh 汇总
+	printf("RESULT conns=%d established=%d req_per_sec=%.0f p99_us=%d cpu_us_per_req=%.2f\n",
+		nconns, established - closed, qps, requests > 0 ? latency_percentile(requests, 99) : -1,
+		(cpu_begin >= 0 && cpu_end >= 0 && requests > 0)
+			? (double)(cpu_end - cpu_begin) * 1000000 / sysconf(_SC_CLK_TCK) / requests : -1.0);
+
+	for (i = 0; i < nconns; i++) {
+		if (conns[i].fd > 0) close(conns[i].fd);
+	}
+	free(conns);
+	close(epfd);
+	return 0;
+
+usage:
+	printf("Usage: %s [-c conns] [-d seconds] [-s msgsize] [-b nsrc] [-P pid] ip port\n"
+		"       %s [-c conns] [-d seconds] [-s msgsize] [-P pid] -u path [-S]\n", argv[0], argv[0]);
+	return 0;
+}
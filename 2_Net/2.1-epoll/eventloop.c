@@ -0,0 +1,522 @@
+#include <sys/select.h>
+#include <sys/poll.h>
+#include <sys/epoll.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "eventloop.h"
+
+/**
+ * shell: gcc -O2 -c eventloop.c
+ * usage: include eventloop.h & link eventloop.o
+ */
+
+#define MAX_FIRED       1024    // 每轮最多分发的事件数
+
+// fd 索引表中的一项：和 reactor.c 的 connlist 一样，以 fd 为下标
+struct ev_handler {
+    EVCALLBACK cb;
+    void *arg;
+    int events;                 // 当前关注的事件
+    unsigned int gen;           // eventloop_del 时加一，fd 被关闭后复用也能区分新旧注册
+};
+
+struct ev_fired {
+    int fd;
+    int events;
+    unsigned int gen;           // 分发前记下的 gen
+};
+
+// 定时器按 (expire, seq) 放在最小堆里；取消只打标记，到堆顶时再释放
+struct ev_timer_s {
+    long long expire;
+    unsigned long long seq;
+    EVTIMERCB cb;
+    void *arg;
+    int cancelled;
+};
+
+// 后端操作表：每种多路复用只需实现这几个函数
+struct ev_backend_ops {
+    const char *name;
+    int  (*init)(eventloop_t *loop);
+    // old_events == 0 表示新增，new_events == 0 表示删除
+    int  (*ctl)(eventloop_t *loop, int fd, int old_events, int new_events);
+    // 等待事件，把就绪的 fd 写入 loop->fired，返回个数
+    int  (*wait)(eventloop_t *loop, int timeout_ms);
+    void (*destroy)(eventloop_t *loop);
+};
+
+struct eventloop_s {
+    const struct ev_backend_ops *ops;
+    void *backend;              // 后端私有数据
+    int maxfds;
+    int maxfd;                  // 已注册的最大 fd，select/poll 扫描用
+    int stop;
+    struct ev_handler *handlers;
+    struct ev_fired fired[MAX_FIRED];
+
+    ev_timer_t **timers;        // 最小堆
+    int ntimers;
+    int timer_cap;
+    unsigned long long timer_seq;
+};
+
+/*
+ * select 后端
+ * 特点：fd_set 是固定大小的位图，fd 不能超过 FD_SETSIZE(1024)
+ * 每次调用都要把整个集合拷贝进内核，返回后再从 0 扫描到 maxfd
+ */
+struct select_state {
+    fd_set rfds, wfds;          // 关注的集合
+    fd_set rset, wset;          // select 修改后的结果集合
+};
+
+static int
+__select_init(eventloop_t *loop) {
+    struct select_state *st = (struct select_state *)malloc(sizeof(*st));
+    if (!st) return -1;
+    FD_ZERO(&st->rfds);
+    FD_ZERO(&st->wfds);
+    loop->backend = st;
+    return 0;
+}
+
+static int
+__select_ctl(eventloop_t *loop, int fd, int old_events, int new_events) {
+    struct select_state *st = (struct select_state *)loop->backend;
+    (void)old_events;
+    if (fd >= FD_SETSIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (new_events & EV_READ) FD_SET(fd, &st->rfds); else FD_CLR(fd, &st->rfds);
+    if (new_events & EV_WRITE) FD_SET(fd, &st->wfds); else FD_CLR(fd, &st->wfds);
+    return 0;
+}
+
+static int
+__select_wait(eventloop_t *loop, int timeout_ms) {
+    struct select_state *st = (struct select_state *)loop->backend;
+    struct timeval tv, *ptv = NULL;
+    if (timeout_ms >= 0) {
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        ptv = &tv;
+    }
+
+    st->rset = st->rfds;
+    st->wset = st->wfds;
+    int nready = select(loop->maxfd + 1, &st->rset, &st->wset, NULL, ptv);
+    if (nready <= 0) return nready;
+
+    int i, n = 0;
+    for (i = 0; i <= loop->maxfd && n < MAX_FIRED; i++) {
+        int events = 0;
+        if (FD_ISSET(i, &st->rset)) events |= EV_READ;
+        if (FD_ISSET(i, &st->wset)) events |= EV_WRITE;
+        if (events) {
+            loop->fired[n].fd = i;
+            loop->fired[n].events = events;
+            n++;
+        }
+    }
+    return n;
+}
+
+static void
+__select_destroy(eventloop_t *loop) {
+    free(loop->backend);
+}
+
+/*
+ * poll 后端
+ * 特点：没有 FD_SETSIZE 限制，但每次仍要把整个 pollfd 数组拷贝进内核并线性扫描
+ * pollfd 数组保持紧凑，slots[fd] 记录 fd 在数组中的位置，删除时与末尾交换
+ */
+struct poll_state {
+    struct pollfd *fds;
+    int *slots;
+    int nfds;
+};
+
+static int
+__poll_init(eventloop_t *loop) {
+    struct poll_state *st = (struct poll_state *)malloc(sizeof(*st));
+    if (st) {
+        st->fds = (struct pollfd *)malloc(sizeof(struct pollfd) * loop->maxfds);
+        if (st->fds) {
+            st->slots = (int *)malloc(sizeof(int) * loop->maxfds);
+            if (st->slots) {
+                st->nfds = 0;
+                loop->backend = st;
+                return 0;
+            }
+            free(st->fds);
+        }
+        free(st);
+    }
+    return -1;
+}
+
+static int
+__poll_ctl(eventloop_t *loop, int fd, int old_events, int new_events) {
+    struct poll_state *st = (struct poll_state *)loop->backend;
+    short pev = 0;
+    if (new_events & EV_READ) pev |= POLLIN;
+    if (new_events & EV_WRITE) pev |= POLLOUT;
+
+    if (old_events == 0) {
+        st->slots[fd] = st->nfds;
+        st->fds[st->nfds].fd = fd;
+        st->fds[st->nfds].events = pev;
+        st->fds[st->nfds].revents = 0;
+        st->nfds++;
+    } else if (new_events == 0) {
+        int slot = st->slots[fd];
+        st->nfds--;
+        if (slot != st->nfds) {
+            st->fds[slot] = st->fds[st->nfds];
+            st->slots[st->fds[slot].fd] = slot;
+        }
+    } else {
+        st->fds[st->slots[fd]].events = pev;
+    }
+    return 0;
+}
+
+static int
+__poll_wait(eventloop_t *loop, int timeout_ms) {
+    struct poll_state *st = (struct poll_state *)loop->backend;
+    int nready = poll(st->fds, st->nfds, timeout_ms);
+    if (nready <= 0) return nready;
+
+    int i, n = 0;
+    for (i = 0; i < st->nfds && n < nready && n < MAX_FIRED; i++) {
+        short rev = st->fds[i].revents;
+        if (rev == 0) continue;
+        int events = 0;
+        if (rev & POLLIN) events |= EV_READ;
+        if (rev & POLLOUT) events |= EV_WRITE;
+        // 错误和挂断同时报告为可读可写，让回调从 recv/send 的返回值中得到具体原因
+        if (rev & (POLLERR | POLLHUP)) events |= EV_READ | EV_WRITE;
+        loop->fired[n].fd = st->fds[i].fd;
+        loop->fired[n].events = events;
+        n++;
+    }
+    return n;
+}
+
+static void
+__poll_destroy(eventloop_t *loop) {
+    struct poll_state *st = (struct poll_state *)loop->backend;
+    free(st->slots);
+    free(st->fds);
+    free(st);
+}
+
+/*
+ * epoll 后端
+ * 特点：关注集合保存在内核中，epoll_wait 只返回就绪的 fd，开销与连接总数无关
+ */
+struct epoll_state {
+    int epfd;
+    struct epoll_event events[MAX_FIRED];
+};
+
+static int
+__epoll_init(eventloop_t *loop) {
+    struct epoll_state *st = (struct epoll_state *)malloc(sizeof(*st));
+    if (!st) return -1;
+    st->epfd = epoll_create(1);
+    if (st->epfd < 0) {
+        free(st);
+        return -1;
+    }
+    loop->backend = st;
+    return 0;
+}
+
+static int
+__epoll_ctl(eventloop_t *loop, int fd, int old_events, int new_events) {
+    struct epoll_state *st = (struct epoll_state *)loop->backend;
+    struct epoll_event ev;
+    int op;
+
+    if (old_events == 0) op = EPOLL_CTL_ADD;
+    else if (new_events == 0) op = EPOLL_CTL_DEL;
+    else op = EPOLL_CTL_MOD;
+
+    ev.events = 0;
+    if (new_events & EV_READ) ev.events |= EPOLLIN;
+    if (new_events & EV_WRITE) ev.events |= EPOLLOUT;
+    ev.data.fd = fd;
+    return epoll_ctl(st->epfd, op, fd, &ev);
+}
+
+static int
+__epoll_wait(eventloop_t *loop, int timeout_ms) {
+    struct epoll_state *st = (struct epoll_state *)loop->backend;
+    int nready = epoll_wait(st->epfd, st->events, MAX_FIRED, timeout_ms);
+    int i;
+    for (i = 0; i < nready; i++) {
+        uint32_t rev = st->events[i].events;
+        int events = 0;
+        if (rev & EPOLLIN) events |= EV_READ;
+        if (rev & EPOLLOUT) events |= EV_WRITE;
+        if (rev & (EPOLLERR | EPOLLHUP)) events |= EV_READ | EV_WRITE;
+        loop->fired[i].fd = st->events[i].data.fd;
+        loop->fired[i].events = events;
+    }
+    return nready;
+}
+
+static void
+__epoll_destroy(eventloop_t *loop) {
+    struct epoll_state *st = (struct epoll_state *)loop->backend;
+    close(st->epfd);
+    free(st);
+}
+
+static const struct ev_backend_ops backends[] = {
+    { "select", __select_init, __select_ctl, __select_wait, __select_destroy },
+    { "poll",   __poll_init,   __poll_ctl,   __poll_wait,   __poll_destroy   },
+    { "epoll",  __epoll_init,  __epoll_ctl,  __epoll_wait,  __epoll_destroy  },
+};
+
+/**
+ * 创建事件循环
+ *
+ * @param backend 后端名字，NULL 表示 epoll
+ * @param maxfds fd 索引表大小
+ * @return 成功返回事件循环指针，后端名字未知或资源不足返回NULL
+ */
+eventloop_t *
+eventloop_create(const char *backend, int maxfds) {
+    const struct ev_backend_ops *ops = NULL;
+    size_t i;
+
+    if (backend == NULL) backend = "epoll";
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (strcmp(backends[i].name, backend) == 0) {
+            ops = &backends[i];
+            break;
+        }
+    }
+    if (!ops) return NULL;
+
+    eventloop_t *loop = (eventloop_t *)malloc(sizeof(*loop));
+    if (loop) {
+        loop->handlers = (struct ev_handler *)calloc(maxfds, sizeof(struct ev_handler));
+        if (loop->handlers) {
+            loop->ops = ops;
+            loop->maxfds = maxfds;
+            loop->maxfd = -1;
+            loop->stop = 0;
+            loop->timers = NULL;
+            loop->ntimers = 0;
+            loop->timer_cap = 0;
+            loop->timer_seq = 0;
+            if (ops->init(loop) == 0)
+                return loop;
+            free(loop->handlers);
+        }
+        free(loop);
+    }
+    return NULL;
+}
+
+void
+eventloop_destroy(eventloop_t *loop) {
+    int i;
+    for (i = 0; i < loop->ntimers; i++)
+        free(loop->timers[i]);
+    free(loop->timers);
+    loop->ops->destroy(loop);
+    free(loop->handlers);
+    free(loop);
+}
+
+int
+eventloop_add(eventloop_t *loop, int fd, int events, EVCALLBACK cb, void *arg) {
+    if (fd < 0 || fd >= loop->maxfds || events == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (loop->ops->ctl(loop, fd, 0, events) != 0)
+        return -1;
+    loop->handlers[fd].cb = cb;
+    loop->handlers[fd].arg = arg;
+    loop->handlers[fd].events = events;
+    if (fd > loop->maxfd) loop->maxfd = fd;
+    return 0;
+}
+
+int
+eventloop_mod(eventloop_t *loop, int fd, int events) {
+    if (fd < 0 || fd >= loop->maxfds) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct ev_handler *h = &loop->handlers[fd];
+    if (h->events == events) return 0;
+    if (loop->ops->ctl(loop, fd, h->events, events) != 0)
+        return -1;
+    h->events = events;
+    return 0;
+}
+
+int
+eventloop_del(eventloop_t *loop, int fd) {
+    if (fd < 0 || fd >= loop->maxfds) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct ev_handler *h = &loop->handlers[fd];
+    if (h->events == 0) return 0;
+    loop->ops->ctl(loop, fd, h->events, 0);
+    h->cb = NULL;
+    h->arg = NULL;
+    h->events = 0;
+    h->gen++;
+    while (loop->maxfd >= 0 && loop->handlers[loop->maxfd].events == 0)
+        loop->maxfd--;
+    return 0;
+}
+
+long long
+eventloop_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+__timer_before(const ev_timer_t *a, const ev_timer_t *b) {
+    return a->expire != b->expire ? a->expire < b->expire : a->seq < b->seq;
+}
+
+static void
+__timer_sift_up(eventloop_t *loop, int i) {
+    ev_timer_t *t = loop->timers[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!__timer_before(t, loop->timers[parent])) break;
+        loop->timers[i] = loop->timers[parent];
+        i = parent;
+    }
+    loop->timers[i] = t;
+}
+
+static void
+__timer_sift_down(eventloop_t *loop, int i) {
+    ev_timer_t *t = loop->timers[i];
+    int n = loop->ntimers;
+    while (2 * i + 1 < n) {
+        int child = 2 * i + 1;
+        if (child + 1 < n && __timer_before(loop->timers[child + 1], loop->timers[child]))
+            child++;
+        if (!__timer_before(loop->timers[child], t)) break;
+        loop->timers[i] = loop->timers[child];
+        i = child;
+    }
+    loop->timers[i] = t;
+}
+
+ev_timer_t *
+eventloop_timer_add(eventloop_t *loop, int ms, EVTIMERCB cb, void *arg) {
+    if (loop->ntimers == loop->timer_cap) {
+        int cap = loop->timer_cap ? loop->timer_cap * 2 : 64;
+        ev_timer_t **timers = (ev_timer_t **)realloc(loop->timers, sizeof(ev_timer_t *) * cap);
+        if (!timers) return NULL;
+        loop->timers = timers;
+        loop->timer_cap = cap;
+    }
+    ev_timer_t *t = (ev_timer_t *)malloc(sizeof(*t));
+    if (!t) return NULL;
+    t->expire = eventloop_now_ms() + (ms > 0 ? ms : 0);
+    t->seq = loop->timer_seq++;
+    t->cb = cb;
+    t->arg = arg;
+    t->cancelled = 0;
+
+    loop->timers[loop->ntimers++] = t;
+    __timer_sift_up(loop, loop->ntimers - 1);
+    return t;
+}
+
+void
+eventloop_timer_del(eventloop_t *loop, ev_timer_t *timer) {
+    (void)loop;
+    if (timer) timer->cancelled = 1;
+}
+
+// 距最近一个定时器到期的毫秒数，与调用者给的超时取小
+static int
+__timer_timeout(eventloop_t *loop, int timeout_ms) {
+    while (loop->ntimers > 0 && loop->timers[0]->cancelled) {
+        free(loop->timers[0]);
+        loop->timers[0] = loop->timers[--loop->ntimers];
+        if (loop->ntimers > 0) __timer_sift_down(loop, 0);
+    }
+    if (loop->ntimers == 0) return timeout_ms;
+
+    long long wait = loop->timers[0]->expire - eventloop_now_ms();
+    if (wait < 0) wait = 0;
+    if (timeout_ms >= 0 && timeout_ms < wait) return timeout_ms;
+    return (int)wait;
+}
+
+static void
+__timer_run(eventloop_t *loop) {
+    if (loop->ntimers == 0) return;
+    long long now = eventloop_now_ms();
+    while (loop->ntimers > 0 && loop->timers[0]->expire <= now) {
+        ev_timer_t *t = loop->timers[0];
+        loop->timers[0] = loop->timers[--loop->ntimers];
+        if (loop->ntimers > 0) __timer_sift_down(loop, 0);
+        // 先出堆再回调，回调里可以添加或取消其它定时器
+        if (!t->cancelled) t->cb(loop, t->arg);
+        free(t);
+    }
+}
+
+int
+eventloop_once(eventloop_t *loop, int timeout_ms) {
+    int n = loop->ops->wait(loop, __timer_timeout(loop, timeout_ms));
+    int i;
+    for (i = 0; i < n; i++)
+        loop->fired[i].gen = loop->handlers[loop->fired[i].fd].gen;
+    for (i = 0; i < n; i++) {
+        int fd = loop->fired[i].fd;
+        struct ev_handler *h = &loop->handlers[fd];
+        // 同一轮中前面的回调可能已经删除了这个 fd，甚至关闭后又用同一个 fd 注册了新的连接，
+        // 这个事件属于旧的注册，丢掉
+        if (h->gen != loop->fired[i].gen) continue;
+        int events = loop->fired[i].events & h->events;
+        if (events && h->cb)
+            h->cb(loop, fd, events, h->arg);
+    }
+    __timer_run(loop);
+    return n;
+}
+
+void
+eventloop_run(eventloop_t *loop) {
+    while (!loop->stop) {
+        if (eventloop_once(loop, -1) < 0 && errno != EINTR)
+            break;
+    }
+}
+
+void
+eventloop_stop(eventloop_t *loop) {
+    loop->stop = 1;
+}
+
+const char *
+eventloop_backend(eventloop_t *loop) {
+    return loop->ops->name;
+}
@@ -0,0 +1,69 @@
+#ifndef _EVENTLOOP_H
+#define _EVENTLOOP_H
+
+/**
+ * 统一的事件循环接口
+ *
+ * select / poll / epoll 三种多路复用实现同一套接口，运行时按名字选择后端，
+ * 这样同一份业务代码（回显、http ...）可以直接在不同后端之间对比。
+ *
+ * shell: gcc -O2 -c eventloop.c
+ */
+
+#define EV_READ     0x01    // 可读
+#define EV_WRITE    0x02    // 可写
+
+typedef struct eventloop_s eventloop_t;
+
+// 事件回调：events 为实际就绪的 EV_READ / EV_WRITE 组合
+typedef void (*EVCALLBACK)(eventloop_t *loop, int fd, int events, void *arg);
+
+// 定时器：到期后在 eventloop_once 里回调一次，回调返回后句柄失效
+typedef struct ev_timer_s ev_timer_t;
+typedef void (*EVTIMERCB)(eventloop_t *loop, void *arg);
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// backend: "select" / "poll" / "epoll"，NULL 表示默认(epoll)
+// maxfds:  可注册的最大文件描述符(不含)，用作 fd 索引表大小
+eventloop_t *eventloop_create(const char *backend, int maxfds);
+
+void eventloop_destroy(eventloop_t *loop);
+
+// 成功返回0，失败返回-1(例如 select 后端下 fd >= FD_SETSIZE)
+int eventloop_add(eventloop_t *loop, int fd, int events, EVCALLBACK cb, void *arg);
+
+// fd 超出 [0, maxfds) 时返回 -1，errno 为 EINVAL
+int eventloop_mod(eventloop_t *loop, int fd, int events);
+
+int eventloop_del(eventloop_t *loop, int fd);
+
+// ms 毫秒后回调 cb，资源不足返回 NULL
+ev_timer_t *eventloop_timer_add(eventloop_t *loop, int ms, EVTIMERCB cb, void *arg);
+
+// 取消未到期的定时器；已经回调过的句柄不能再传入
+void eventloop_timer_del(eventloop_t *loop, ev_timer_t *timer);
+
+// 单调时钟，毫秒
+long long eventloop_now_ms(void);
+
+// 等待一轮事件并分发，再执行到期的定时器，返回处理的事件数；
+// timeout_ms = -1 表示永久阻塞，有定时器时最多等到最近一个到期
+int eventloop_once(eventloop_t *loop, int timeout_ms);
+
+// 循环调用 eventloop_once 直到 eventloop_stop
+void eventloop_run(eventloop_t *loop);
+
+void eventloop_stop(eventloop_t *loop);
+
+// 当前使用的后端名字
+const char *eventloop_backend(eventloop_t *loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
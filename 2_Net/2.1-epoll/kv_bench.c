@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/**
+ * kvstore 的 memtier 风格压测客户端(RESP 协议，也可以压 redis-server)
+ *
+ * -T 个客户端线程，共 -c 条连接；每条连接保持 -P 个请求在途(流水线)，
+ * 收到一个回复就补发一个请求。请求按 -r set:get 的比例混合，key 在 -k 个 key 中均匀随机，
+ * value 为 -s 字节。-f 时先按顺序 SET 整个 key 空间，GET 不会落空。
+ * 每个请求从发出到收到回复的时延记入直方图，结束时输出 ops/sec 和 p50/p99/p999。
+ *
+ * shell: gcc -O2 kv_bench.c -o kv_bench -lpthread
+ * usage: ./kv_bench [-c conns] [-T threads] [-P pipeline] [-r set:get] [-k keys]
+ *                   [-s valuesize] [-d seconds] [-f] ip port
+ */
+
+#define MAX_PIPELINE    1024
+#define MAX_THREADS     64
+#define MAX_VALUE       65536
+#define MAX_EVENTS      1024
+#define LAT_BUCKETS     100000      // 时延直方图：1us 一格，最多 100ms
+
+struct bench_conn {
+	int fd;
+	char *rbuf;
+	int rlen;
+	long long sent_ns[MAX_PIPELINE];    // 在途请求的发送时间，回复按顺序到达
+	int head;
+	int inflight;
+	unsigned int seed;
+};
+
+struct bench_thread {
+	pthread_t tid;
+	int nconns;
+	struct bench_conn *conns;
+	long long ops;
+	long long errors;
+	unsigned int hist[LAT_BUCKETS + 1];
+};
+
+static struct sockaddr_in server;
+static int pipeline = 1, set_ratio = 1, get_ratio = 10, keyspace = 100000, valsize = 32;
+static int seconds = 10;
+static char value[MAX_VALUE];
+static volatile int running = 1;
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int open_conn(void) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	return fd;
+}
+
+// 生成一条 SET 或 GET 请求
+static int build_request(char *buf, int is_set, int key) {
+	char k[32];
+	int klen = snprintf(k, sizeof(k), "key:%010d", key);
+	if (is_set) {
+		int n = sprintf(buf, "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%d\r\n", klen, k, valsize);
+		memcpy(buf + n, value, valsize);
+		memcpy(buf + n + valsize, "\r\n", 2);
+		return n + valsize + 2;
+	}
+	return sprintf(buf, "*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n", klen, k);
+}
+
+// 解析一个完整的回复，返回消耗的字节数，0 表示不完整；*error 标记错误回复
+static int parse_reply(const char *buf, int len, int *error) {
+	const char *crlf = memchr(buf, '\n', len);
+	if (!crlf) return 0;
+	int line = crlf + 1 - buf;
+	*error = buf[0] == '-';
+	if (buf[0] != '$') return line;
+	int blen = atoi(buf + 1);
+	if (blen < 0) return line;
+	if (len < line + blen + 2) return 0;
+	return line + blen + 2;
+}
+
+// 写满发送缓冲区时直接丢弃会打乱流水线，这里阻塞式地发完一条请求
+static int send_all(int fd, const char *buf, int len) {
+	while (len > 0) {
+		int n = send(fd, buf, len, 0);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR) continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int send_next(struct bench_conn *c) {
+	char buf[MAX_VALUE + 128];
+	int total = set_ratio + get_ratio;
+	int is_set = (int)(rand_r(&c->seed) % total) < set_ratio;
+	int key = rand_r(&c->seed) % keyspace;
+	int len = build_request(buf, is_set, key);
+
+	c->sent_ns[(c->head + c->inflight) % MAX_PIPELINE] = now_ns();
+	c->inflight++;
+	return send_all(c->fd, buf, len);
+}
+
+static void *bench_worker(void *arg) {
+	struct bench_thread *t = (struct bench_thread *)arg;
+	int epfd = epoll_create(1);
+	struct epoll_event ev, events[MAX_EVENTS];
+	int i, k;
+
+	for (i = 0; i < t->nconns; i++) {
+		struct bench_conn *c = &t->conns[i];
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+		for (k = 0; k < pipeline; k++) send_next(c);
+	}
+
+	while (running) {
+		int nready = epoll_wait(epfd, events, MAX_EVENTS, 100);
+		for (k = 0; k < nready; k++) {
+			struct bench_conn *c = events[k].data.ptr;
+			int n = recv(c->fd, c->rbuf + c->rlen, MAX_VALUE * 2 - c->rlen, 0);
+			if (n <= 0) {
+				if (n < 0 && errno == EAGAIN) continue;
+				epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+				continue;
+			}
+			c->rlen += n;
+
+			int pos = 0, error, used;
+			long long ns = now_ns();
+			while (c->inflight > 0 && (used = parse_reply(c->rbuf + pos, c->rlen - pos, &error)) > 0) {
+				pos += used;
+				long long us = (ns - c->sent_ns[c->head]) / 1000;
+				t->hist[us < LAT_BUCKETS ? us : LAT_BUCKETS]++;
+				c->head = (c->head + 1) % MAX_PIPELINE;
+				c->inflight--;
+				t->ops++;
+				if (error) t->errors++;
+				if (running) send_next(c);
+			}
+			memmove(c->rbuf, c->rbuf + pos, c->rlen - pos);
+			c->rlen -= pos;
+		}
+	}
+	close(epfd);
+	return NULL;
+}
+
+// 预先写入整个 key 空间：一条连接，按流水线批量发送
+static void prefill(void) {
+	int fd = open_conn();
+	if (fd < 0) return;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+
+	static char buf[(MAX_VALUE + 128) * 16];
+	static char rbuf[65536];
+	int key = 0, acked = 0, rlen = 0;
+	while (acked < keyspace) {
+		if (key < keyspace && key - acked < 1024) {
+			int len = 0, n;
+			for (n = 0; n < 16 && key < keyspace; n++) {
+				len += build_request(buf + len, 1, key++);
+			}
+			send_all(fd, buf, len);
+			continue;
+		}
+		int n = recv(fd, rbuf + rlen, sizeof(rbuf) - rlen, 0);
+		if (n <= 0) break;
+		rlen += n;
+		int pos = 0, error, used;
+		while ((used = parse_reply(rbuf + pos, rlen - pos, &error)) > 0) {
+			pos += used;
+			acked++;
+		}
+		memmove(rbuf, rbuf + pos, rlen - pos);
+		rlen -= pos;
+	}
+	close(fd);
+}
+
+int main(int argc, char **argv) {
+	int nconns = 50, nthreads = 4, fill = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:T:P:r:k:s:d:f")) != -1) {
+		switch (opt) {
+		case 'c': nconns = atoi(optarg); break;
+		case 'T': nthreads = atoi(optarg); break;
+		case 'P': pipeline = atoi(optarg); break;
+		case 'r': sscanf(optarg, "%d:%d", &set_ratio, &get_ratio); break;
+		case 'k': keyspace = atoi(optarg); break;
+		case 's': valsize = atoi(optarg); break;
+		case 'd': seconds = atoi(optarg); break;
+		case 'f': fill = 1; break;
+		default: goto usage;
+		}
+	}
+	if (argc - optind < 2) goto usage;
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+	if (nconns < nthreads) nconns = nthreads;
+	if (pipeline < 1 || pipeline > MAX_PIPELINE) pipeline = 1;
+	if (valsize < 0 || valsize > MAX_VALUE) valsize = 32;
+	if (keyspace < 1) keyspace = 1;
+	if (set_ratio + get_ratio <= 0) set_ratio = 1;
+	memset(value, 'v', sizeof(value));
+
+	struct rlimit rl = { nconns + 64, nconns + 64 };
+	setrlimit(RLIMIT_NOFILE, &rl);
+
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_addr.s_addr = inet_addr(argv[optind]);
+	server.sin_port = htons(atoi(argv[optind + 1]));
+
+	if (fill) {
+		long long begin = now_ns();
+		prefill();
+		printf("prefill: %d keys, %lldms\n", keyspace, (now_ns() - begin) / 1000000);
+	}
+
+	struct bench_thread *threads = calloc(nthreads, sizeof(struct bench_thread));
+	int i, j, established = 0;
+	for (i = 0; i < nthreads; i++) {
+		struct bench_thread *t = &threads[i];
+		t->nconns = nconns / nthreads + (i < nconns % nthreads);
+		t->conns = calloc(t->nconns, sizeof(struct bench_conn));
+		for (j = 0; j < t->nconns; j++) {
+			t->conns[j].fd = open_conn();
+			if (t->conns[j].fd < 0) {
+				fprintf(stderr, "connect failed\n");
+				return -1;
+			}
+			t->conns[j].rbuf = malloc(MAX_VALUE * 2);
+			t->conns[j].seed = i * 100003 + j;
+			established++;
+		}
+	}
+
+	long long begin = now_ns();
+	for (i = 0; i < nthreads; i++) {
+		pthread_create(&threads[i].tid, NULL, bench_worker, &threads[i]);
+	}
+	sleep(seconds);
+	running = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].tid, NULL);
+	}
+	long long elapsed_us = (now_ns() - begin) / 1000;
+
+	// 汇总各线程的直方图
+	static unsigned int hist[LAT_BUCKETS + 1];
+	long long ops = 0, errors = 0;
+	for (i = 0; i < nthreads; i++) {
+		ops += threads[i].ops;
+		errors += threads[i].errors;
+		for (j = 0; j <= LAT_BUCKETS; j++) hist[j] += threads[i].hist[j];
+	}
+	int pct[3] = { -1, -1, -1 };
+	double targets[3] = { 50, 99, 99.9 };
+	for (i = 0; i < 3; i++) {
+		long long target = (long long)(ops * targets[i] / 100), seen = 0;
+		for (j = 0; j <= LAT_BUCKETS; j++) {
+			seen += hist[j];
+			if (seen > target) {
+				pct[i] = j;
+				break;
+			}
+		}
+	}
+
+	double qps = elapsed_us > 0 ? (double)ops * 1000000 / elapsed_us : 0;
+	printf("threads: %d, conns: %d, pipeline: %d, set:get %d:%d, keys: %d, value: %d bytes\n",
+		nthreads, established, pipeline, set_ratio, get_ratio, keyspace, valsize);
+	printf("ops: %lld, errors: %lld, time_used: %lldms, ops/sec: %.0f\n",
+		ops, errors, elapsed_us / 1000, qps);
+	printf("latency p50: %dus, p99: %dus, p999: %dus\n", pct[0], pct[1], pct[2]);
+	printf("RESULT conns=%d pipeline=%d ops_per_sec=%.0f p50_us=%d p99_us=%d\n",
+		established, pipeline, qps, pct[0], pct[1]);
+	return 0;
+
+usage:
+	printf("Usage: %s [-c conns] [-T threads] [-P pipeline] [-r set:get] [-k keys] [-s valuesize] [-d seconds] [-f] ip port\n", argv[0]);
+	return 0;
+}
@@ -0,0 +1,941 @@
+#include <sys/socket.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+
+#include <atomic>
+#include <mutex>
+#include <new>
+
+#include "../../3_pool/atomic_and_lock-master/skiplist.h"
+
+/**
+ * 基于 reactor 和跳表的内存 KV 服务器，兼容 Redis 协议(RESP)
+ *
+ * 每个 loop 线程有自己的 epoll 和 SO_REUSEPORT 监听 socket，连接由内核分配到各线程，
+ * 连接只在所属线程上处理。所有线程共享一个有序的跳表：
+ *   读(GET/SCAN/RANGE)不加锁；
+ *   SET 已存在的 key 只原子替换 value 指针；只有插入新 key 时拿写锁(跳表要求单写者)。
+ * 跳表节点从不删除，DEL 把 value 置空作为墓碑。key/value 从各线程的 arena 分配，
+ * 被替换的旧 value 留在 arena 中(读者可能仍在读，不能立即释放)，和 memtable 一样只增不减。
+ *
+ * 命令: GET key / SET key value / DEL key... / SCAN cursor [COUNT n] /
+ *       RANGE start end [LIMIT n] / DBSIZE / INFO / PING / QUIT
+ * 一次读到的多个命令(流水线)依次执行，回复攒在写缓冲区中一次发出。
+ *
+ * 线程放置：
+ *   -a 把 loop 线程绑到 CPU 上("auto" 依次绑到可用的 CPU，或给出 "0,2,4" 这样的列表)，
+ *      每个 loop 的连接表在绑核之后分配，优先使用该 CPU 所在的 NUMA 节点；
+ *      accept 到的连接按 SO_INCOMING_CPU(处理它收包的 CPU)转给绑在那个 CPU 上的 loop。
+ *   -b 忙轮询预算(us)：没有事件时先以 0 超时反复 epoll_wait，预算用完才阻塞，
+ *      同时给连接设置 SO_BUSY_POLL。用 CPU 换尾延迟，0 关闭。
+ *
+ * shell: g++ -O2 -std=c++17 kvstore.cc -o kvstore -lpthread
+ * usage: ./kvstore [-q] [-p port] [-t loops] [-a auto|cpu,cpu...] [-b busy_poll_us]
+ */
+
+#define KV_PORT				6379
+#define KV_MAX_LOOPS		64
+#define KV_MAX_KEY			4096		// key 的最大长度
+#define KV_MAX_ARGS			1024		// 一条命令能执行的最大参数个数，超过的回复 -ERR，不断开连接
+#define KV_MAX_MULTIBULK	(1 << 20)	// multibulk 的最大元素个数，超过视为协议错误(同 redis)
+#define KV_MAX_BULK			(64 << 20)	// 一个参数的最大长度
+#define KV_BUFFER_INIT		16384		// 连接读写缓冲区的初始大小，按需增长
+#define KV_WBUFFER_HIGH		(4 << 20)	// 写缓冲区积压超过这个值时暂停解析，等对端读走
+#define KV_SCAN_DEFAULT		10
+#define ARENA_BLOCK_SIZE	(4 << 20)
+#define KV_BUSY_POLL_FLOOR	8			// 自适应忙轮询预算的下限为 -b 的 1/8
+
+#define MAX_CONNECTIONS		1048576
+
+
+// ---------------- arena ----------------
+
+// 按块分配、只增不减的内存池，每个 loop 线程一个，分配不加锁
+struct Arena {
+	char *ptr = nullptr;
+	size_t remain = 0;
+
+	void *allocate(size_t bytes);
+};
+
+std::atomic<size_t> arena_bytes{0};        // 所有 arena 向系统申请的字节数
+
+void *Arena::allocate(size_t bytes) {
+	bytes = (bytes + 7) & ~(size_t)7;
+	if (bytes > ARENA_BLOCK_SIZE / 4) {
+		// 大对象单独分配，不浪费当前块的剩余空间
+		arena_bytes.fetch_add(bytes, std::memory_order_relaxed);
+		return malloc(bytes);
+	}
+	if (bytes > remain) {
+		ptr = (char *)malloc(ARENA_BLOCK_SIZE);
+		if (!ptr) {
+			remain = 0;
+			return nullptr;
+		}
+		remain = ARENA_BLOCK_SIZE;
+		arena_bytes.fetch_add(ARENA_BLOCK_SIZE, std::memory_order_relaxed);
+	}
+	void *p = ptr;
+	ptr += bytes;
+	remain -= bytes;
+	return p;
+}
+
+static thread_local Arena arena;
+
+
+// ---------------- store ----------------
+
+struct kv_value {
+	uint32_t len;
+	char data[];
+};
+
+// 跳表的 key 是指向 kv_entry 的指针，entry 插入后 key 不再变化，value 指针可以原子替换
+struct kv_entry {
+	std::atomic<kv_value *> value;     // nullptr 表示已删除
+	uint32_t klen;
+	char key[];
+};
+
+struct EntryComparator {
+	int operator()(const kv_entry *a, const kv_entry *b) const {
+		uint32_t n = a->klen < b->klen ? a->klen : b->klen;
+		int cmp = memcmp(a->key, b->key, n);
+		if (cmp != 0) return cmp;
+		return a->klen < b->klen ? -1 : (a->klen > b->klen ? 1 : 0);
+	}
+};
+
+using KVList = ROCKSDB_NAMESPACE::SkipList<kv_entry *, EntryComparator>;
+
+KVList kvlist{EntryComparator{}, 16, 4};
+std::mutex kvlist_write;                   // 跳表只允许一个写者：插入新 key 时持有
+std::atomic<long> kv_keys{0};              // 未删除的 key 个数
+
+
+// 查找用的临时 entry，只用来和跳表中的 entry 比较
+struct kv_probe {
+	kv_entry *entry;
+	alignas(kv_entry) char buf[sizeof(kv_entry) + KV_MAX_KEY];
+
+	kv_probe(const char *key, size_t klen) {
+		entry = (kv_entry *)buf;
+		entry->klen = klen;
+		memcpy(entry->key, key, klen);
+	}
+};
+
+static kv_entry *kv_find(const char *key, size_t klen) {
+	kv_probe probe(key, klen);
+	KVList::Iterator it(&kvlist);
+	it.Seek(probe.entry);
+	if (it.Valid() && EntryComparator()(it.key(), probe.entry) == 0) {
+		return it.key();
+	}
+	return nullptr;
+}
+
+static kv_value *kv_value_new(const char *val, size_t vlen) {
+	kv_value *v = (kv_value *)arena.allocate(sizeof(kv_value) + vlen);
+	if (!v) return nullptr;
+	v->len = vlen;
+	memcpy(v->data, val, vlen);
+	return v;
+}
+
+// 替换 entry 的 value，维护存活 key 计数
+static void kv_store(kv_entry *e, kv_value *v) {
+	kv_value *old = e->value.exchange(v, std::memory_order_acq_rel);
+	if (!old && v) kv_keys.fetch_add(1, std::memory_order_relaxed);
+	else if (old && !v) kv_keys.fetch_sub(1, std::memory_order_relaxed);
+}
+
+static kv_value *kv_get(const char *key, size_t klen) {
+	kv_entry *e = kv_find(key, klen);
+	return e ? e->value.load(std::memory_order_acquire) : nullptr;
+}
+
+static int kv_set(const char *key, size_t klen, const char *val, size_t vlen) {
+	kv_value *v = kv_value_new(val, vlen);
+	if (!v) return -1;
+
+	// 已存在的 key(包括墓碑)不需要写锁
+	kv_entry *e = kv_find(key, klen);
+	if (e) {
+		kv_store(e, v);
+		return 0;
+	}
+
+	std::lock_guard<std::mutex> guard{kvlist_write};
+	// 拿到锁之前可能已被其它线程插入
+	e = kv_find(key, klen);
+	if (!e) {
+		e = (kv_entry *)arena.allocate(sizeof(kv_entry) + klen);
+		if (!e) return -1;
+		new (&e->value) std::atomic<kv_value *>(nullptr);
+		e->klen = klen;
+		memcpy(e->key, key, klen);
+		kv_store(e, v);
+		kvlist.Insert(e);
+		return 0;
+	}
+	kv_store(e, v);
+	return 0;
+}
+
+static int kv_del(const char *key, size_t klen) {
+	kv_entry *e = kv_find(key, klen);
+	if (!e || !e->value.load(std::memory_order_acquire)) return 0;
+	kv_value *old = e->value.exchange(nullptr, std::memory_order_acq_rel);
+	if (!old) return 0;
+	kv_keys.fetch_sub(1, std::memory_order_relaxed);
+	return 1;
+}
+
+
+// ---------------- connection ----------------
+
+typedef int (*RCALLBACK)(int fd);
+
+int accept_cb(int fd);
+int recv_cb(int fd);
+int send_cb(int fd);
+
+struct conn_item {
+	int fd;
+
+	char *rbuffer;      // 按需增长，容纳一条完整命令
+	size_t rlen;
+	size_t rcap;
+	char *wbuffer;      // 一批流水线命令的回复
+	size_t wlen;
+	size_t wsent;
+	size_t wcap;
+	int closing;        // QUIT：回复发完后关闭
+
+	union {
+		RCALLBACK accept_callback;
+		RCALLBACK recv_callback;
+	} recv_t;
+	RCALLBACK send_callback;
+};
+
+// 每个 loop 线程一份。连接表按 fd 下标，每个 loop 一张，连接只出现在所属 loop 的表中
+struct kv_loop {
+	int id;
+	int cpu;                        // 绑定的 CPU，-1 不绑定
+	int node;                       // 所在的 NUMA 节点
+	int epfd;
+	struct conn_item *conns;
+	unsigned long busy_budget;      // 当前的忙轮询预算(us)，在 [-b / 8, -b] 之间自适应
+
+	std::atomic<unsigned long> accepted{0};
+	std::atomic<unsigned long> handoffs{0};     // 按 SO_INCOMING_CPU 转给其它 loop 的连接
+	std::atomic<unsigned long> spin_hits{0};    // 忙轮询期间等到了事件
+	std::atomic<unsigned long> spin_misses{0};  // 预算用完仍没有事件，转入阻塞
+};
+
+static struct kv_loop loops[KV_MAX_LOOPS];
+static int nloops = 1;
+static int cpu_loop[CPU_SETSIZE];          // CPU -> 绑在这个 CPU 上的 loop，-1 没有
+static int cpu_match = 0;                  // 有 loop 绑核时按 SO_INCOMING_CPU 分配连接
+static int busy_poll = 0;                  // -b，0 关闭
+static unsigned short kv_port = KV_PORT;
+static pthread_barrier_t loops_ready;      // 所有 loop 的 epoll 和连接表就绪后才开始 accept
+
+static thread_local struct kv_loop *self;
+static thread_local struct conn_item *connlist;    // 当前 loop 的连接表
+static thread_local int epfd = 0;          // 每个 loop 线程自己的 epoll，连接只在所属线程处理
+int verbose = 1;
+
+
+int set_event(int fd, int event, int flag) {
+
+	struct epoll_event ev;
+	ev.events = event;
+	ev.data.fd = fd;
+	return epoll_ctl(epfd, flag ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+}
+
+static void conn_close(int fd) {
+	struct conn_item *conn = &connlist[fd];
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+	free(conn->rbuffer);
+	free(conn->wbuffer);
+	conn->rbuffer = conn->wbuffer = NULL;
+	close(fd);
+}
+
+static int buffer_reserve(char **buf, size_t *cap, size_t need) {
+	if (need <= *cap) return 0;
+	size_t ncap = *cap ? *cap : KV_BUFFER_INIT;
+	while (ncap < need) ncap *= 2;
+	char *p = (char *)realloc(*buf, ncap);
+	if (!p) return -1;
+	*buf = p;
+	*cap = ncap;
+	return 0;
+}
+
+
+// ---------------- RESP ----------------
+
+struct kv_arg {
+	const char *ptr;
+	size_t len;
+};
+
+// 解析一条命令，返回消耗的字节数，0 表示还不完整，-1 表示协议错误。
+// 参数超过 KV_MAX_ARGS 时照样消耗整条命令，*argc 置为 -1
+static long resp_parse(const char *buf, size_t len, struct kv_arg *argv, int *argc) {
+
+	const char *end = buf + len;
+	const char *crlf = (const char *)memchr(buf, '\n', len);
+	if (!crlf) return len > 65536 ? -1 : 0;
+
+	if (buf[0] != '*') {
+		// inline 命令: GET key\r\n，方便 telnet / nc 调试
+		int n = 0;
+		const char *p = buf;
+		const char *line_end = (crlf > buf && crlf[-1] == '\r') ? crlf - 1 : crlf;
+		while (p < line_end) {
+			while (p < line_end && *p == ' ') p++;
+			if (p == line_end) break;
+			const char *q = p;
+			while (q < line_end && *q != ' ') q++;
+			if (n < KV_MAX_ARGS) {
+				argv[n].ptr = p;
+				argv[n].len = q - p;
+			}
+			n++;
+			p = q;
+		}
+		*argc = n <= KV_MAX_ARGS ? n : -1;
+		return crlf + 1 - buf;
+	}
+
+	long n = strtol(buf + 1, NULL, 10);
+	if (n <= 0 || n > KV_MAX_MULTIBULK) return -1;
+	const char *p = crlf + 1;
+	int i;
+	for (i = 0; i < n; i++) {
+		if (p >= end) return 0;
+		if (*p != '$') return -1;
+		crlf = (const char *)memchr(p, '\n', end - p);
+		if (!crlf) return 0;
+		long blen = strtol(p + 1, NULL, 10);
+		if (blen < 0 || blen > KV_MAX_BULK) return -1;
+		p = crlf + 1;
+		if ((size_t)(end - p) < (size_t)blen + 2) return 0;
+		if (i < KV_MAX_ARGS) {
+			argv[i].ptr = p;
+			argv[i].len = blen;
+		}
+		p += blen + 2;
+	}
+	*argc = n <= KV_MAX_ARGS ? (int)n : -1;
+	return p - buf;
+}
+
+static int reply_raw(struct conn_item *conn, const char *data, size_t len) {
+	if (buffer_reserve(&conn->wbuffer, &conn->wcap, conn->wlen + len) < 0) return -1;
+	memcpy(conn->wbuffer + conn->wlen, data, len);
+	conn->wlen += len;
+	return 0;
+}
+
+static int reply_fmt(struct conn_item *conn, const char *fmt, long long n) {
+	char line[64];
+	int len = snprintf(line, sizeof(line), fmt, n);
+	return reply_raw(conn, line, len);
+}
+
+static int reply_bulk(struct conn_item *conn, const char *data, size_t len) {
+	if (reply_fmt(conn, "$%lld\r\n", (long long)len) < 0) return -1;
+	if (buffer_reserve(&conn->wbuffer, &conn->wcap, conn->wlen + len + 2) < 0) return -1;
+	memcpy(conn->wbuffer + conn->wlen, data, len);
+	memcpy(conn->wbuffer + conn->wlen + len, "\r\n", 2);
+	conn->wlen += len + 2;
+	return 0;
+}
+
+#define reply_str(conn, s)	reply_raw(conn, s, sizeof(s) - 1)
+
+static int arg_is(const struct kv_arg *arg, const char *name) {
+	return arg->len == strlen(name) && strncasecmp(arg->ptr, name, arg->len) == 0;
+}
+
+static long arg_long(const struct kv_arg *arg) {
+	char num[32];
+	size_t n = arg->len < sizeof(num) - 1 ? arg->len : sizeof(num) - 1;
+	memcpy(num, arg->ptr, n);
+	num[n] = '\0';
+	return strtol(num, NULL, 10);
+}
+
+// SCAN cursor [COUNT n]
+// 游标 "0" 表示从头开始，返回 "0" 表示结束；否则游标是 ">" 加上下一个要返回的 key
+static int cmd_scan(struct conn_item *conn, struct kv_arg *argv, int argc) {
+
+	long count = KV_SCAN_DEFAULT;
+	if (argc >= 4 && arg_is(&argv[2], "COUNT")) count = arg_long(&argv[3]);
+	if (count <= 0) count = KV_SCAN_DEFAULT;
+
+	const char *start = "";
+	size_t slen = 0;
+	if (argv[1].len > 0 && argv[1].ptr[0] == '>') {
+		start = argv[1].ptr + 1;
+		slen = argv[1].len - 1;
+	}
+	if (slen > KV_MAX_KEY) return reply_str(conn, "-ERR invalid cursor\r\n");
+
+	kv_probe probe(start, slen);
+	KVList::Iterator it(&kvlist);
+	const kv_entry *keys[1024];
+	long n = 0;
+	if (count > 1024) count = 1024;
+
+	for (it.Seek(probe.entry); it.Valid() && n < count; it.Next()) {
+		if (it.key()->value.load(std::memory_order_acquire)) keys[n++] = it.key();
+	}
+	// 跳过墓碑，找到下一个存活的 key 作为游标
+	while (it.Valid() && !it.key()->value.load(std::memory_order_acquire)) it.Next();
+
+	reply_str(conn, "*2\r\n");
+	if (it.Valid()) {
+		const kv_entry *next = it.key();
+		reply_fmt(conn, "$%lld\r\n>", next->klen + 1);
+		reply_raw(conn, next->key, next->klen);
+		reply_str(conn, "\r\n");
+	} else {
+		reply_bulk(conn, "0", 1);
+	}
+	reply_fmt(conn, "*%lld\r\n", n);
+	long i;
+	for (i = 0; i < n; i++) {
+		reply_bulk(conn, keys[i]->key, keys[i]->klen);
+	}
+	return 0;
+}
+
+// RANGE start end [LIMIT n]: start <= key <= end 的 key/value 对，按 key 有序
+static int cmd_range(struct conn_item *conn, struct kv_arg *argv, int argc) {
+
+	long limit = 1000;
+	if (argc >= 5 && arg_is(&argv[3], "LIMIT")) limit = arg_long(&argv[4]);
+	if (limit <= 0) limit = 1000;
+	if (argv[1].len > KV_MAX_KEY || argv[2].len > KV_MAX_KEY) {
+		return reply_str(conn, "-ERR key too long\r\n");
+	}
+
+	kv_probe first(argv[1].ptr, argv[1].len);
+	kv_probe last(argv[2].ptr, argv[2].len);
+	EntryComparator cmp;
+
+	// 结果个数事先不知道，先预留数组头的位置，结束后回填
+	size_t header = conn->wlen;
+	reply_str(conn, "*0000000000\r\n");
+	long n = 0;
+
+	KVList::Iterator it(&kvlist);
+	for (it.Seek(first.entry); it.Valid() && n < limit; it.Next()) {
+		const kv_entry *e = it.key();
+		if (cmp(e, last.entry) > 0) break;
+		kv_value *v = e->value.load(std::memory_order_acquire);
+		if (!v) continue;
+		reply_bulk(conn, e->key, e->klen);
+		reply_bulk(conn, v->data, v->len);
+		n++;
+	}
+	if (conn->wbuffer) {
+		// "*" 之后是 10 位宽的数字，前导 0 符合 RESP 的整数格式
+		char count[24];
+		snprintf(count, sizeof(count), "%010ld", n * 2);
+		memcpy(conn->wbuffer + header + 1, count, 10);
+	}
+	return 0;
+}
+
+static int kv_execute(struct conn_item *conn, struct kv_arg *argv, int argc) {
+
+	if (argc == 0) return 0;
+	if (argc < 0) return reply_str(conn, "-ERR too many arguments\r\n");
+
+	if (arg_is(&argv[0], "GET") && argc == 2) {
+		if (argv[1].len > KV_MAX_KEY) return reply_str(conn, "$-1\r\n");
+		kv_value *v = kv_get(argv[1].ptr, argv[1].len);
+		if (!v) return reply_str(conn, "$-1\r\n");
+		return reply_bulk(conn, v->data, v->len);
+
+	} else if (arg_is(&argv[0], "SET") && argc >= 3) {
+		// 没有过期和条件写，EX/PX/NX/XX 等选项不能静默忽略
+		if (argc > 3) return reply_str(conn, "-ERR SET options are not supported\r\n");
+		if (argv[1].len > KV_MAX_KEY) return reply_str(conn, "-ERR key too long\r\n");
+		if (kv_set(argv[1].ptr, argv[1].len, argv[2].ptr, argv[2].len) < 0) {
+			return reply_str(conn, "-ERR out of memory\r\n");
+		}
+		return reply_str(conn, "+OK\r\n");
+
+	} else if (arg_is(&argv[0], "DEL") && argc >= 2) {
+		long n = 0;
+		int i;
+		for (i = 1; i < argc; i++) {
+			if (argv[i].len <= KV_MAX_KEY) n += kv_del(argv[i].ptr, argv[i].len);
+		}
+		return reply_fmt(conn, ":%lld\r\n", n);
+
+	} else if (arg_is(&argv[0], "SCAN") && argc >= 2) {
+		return cmd_scan(conn, argv, argc);
+
+	} else if (arg_is(&argv[0], "RANGE") && argc >= 3) {
+		return cmd_range(conn, argv, argc);
+
+	} else if (arg_is(&argv[0], "DBSIZE")) {
+		return reply_fmt(conn, ":%lld\r\n", kv_keys.load(std::memory_order_relaxed));
+
+	} else if (arg_is(&argv[0], "INFO")) {
+		char info[128 + KV_MAX_LOOPS * 160];
+		int len = snprintf(info, sizeof(info), "keys:%ld\r\narena_bytes:%zu\r\n",
+			kv_keys.load(std::memory_order_relaxed), arena_bytes.load(std::memory_order_relaxed));
+		int i;
+		for (i = 0; i < nloops; i++) {
+			struct kv_loop *lp = &loops[i];
+			len += snprintf(info + len, sizeof(info) - len,
+				"loop%d:cpu=%d,node=%d,accepted=%lu,handoffs=%lu,spin_hits=%lu,spin_misses=%lu\r\n",
+				i, lp->cpu, lp->node, lp->accepted.load(std::memory_order_relaxed),
+				lp->handoffs.load(std::memory_order_relaxed), lp->spin_hits.load(std::memory_order_relaxed),
+				lp->spin_misses.load(std::memory_order_relaxed));
+		}
+		return reply_bulk(conn, info, len);
+
+	} else if (arg_is(&argv[0], "PING")) {
+		return reply_str(conn, "+PONG\r\n");
+
+	} else if (arg_is(&argv[0], "COMMAND")) {
+		// redis-cli 启动时查询命令表
+		return reply_str(conn, "*0\r\n");
+
+	} else if (arg_is(&argv[0], "QUIT")) {
+		conn->closing = 1;
+		return reply_str(conn, "+OK\r\n");
+	}
+
+	return reply_str(conn, "-ERR unknown command or wrong number of arguments\r\n");
+}
+
+// 执行 rbuffer 中所有完整的命令(流水线)，返回 -1 表示协议错误
+static int kv_process(struct conn_item *conn) {
+
+	size_t pos = 0;
+	while (pos < conn->rlen && !conn->closing && conn->wlen < KV_WBUFFER_HIGH) {
+		struct kv_arg argv[KV_MAX_ARGS];
+		int argc = 0;
+		long n = resp_parse(conn->rbuffer + pos, conn->rlen - pos, argv, &argc);
+		if (n < 0) {
+			reply_str(conn, "-ERR protocol error\r\n");
+			conn->closing = 1;
+			break;
+		}
+		if (n == 0) break;
+		if (kv_execute(conn, argv, argc) < 0) return -1;
+		pos += n;
+	}
+	memmove(conn->rbuffer, conn->rbuffer + pos, conn->rlen - pos);
+	conn->rlen -= pos;
+	return 0;
+}
+
+// 把写缓冲区尽量发出去，返回 0 发完，1 还有剩余，-1 出错
+static int kv_flush(int fd) {
+
+	struct conn_item *conn = &connlist[fd];
+	while (conn->wsent < conn->wlen) {
+		ssize_t count = send(fd, conn->wbuffer + conn->wsent, conn->wlen - conn->wsent, 0);
+		if (count < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 1;
+			return -1;
+		}
+		conn->wsent += count;
+	}
+	conn->wlen = conn->wsent = 0;
+	return 0;
+}
+
+// 执行缓冲区中的命令并发送回复
+static int kv_serve(int fd) {
+
+	struct conn_item *conn = &connlist[fd];
+	while (1) {
+		if (kv_process(conn) < 0) {
+			conn_close(fd);
+			return -1;
+		}
+		int ret = kv_flush(fd);
+		if (ret < 0 || (ret == 0 && conn->closing)) {
+			conn_close(fd);
+			return -1;
+		}
+		if (ret == 1) {
+			// 对端读得慢：停止读新命令，等 EPOLLOUT
+			set_event(fd, EPOLLOUT, 0);
+			return 0;
+		}
+		// kv_process 因写缓冲区积压提前停下时，发完之后继续处理剩下的命令
+		if (conn->rlen == 0 || conn->closing) break;
+		struct kv_arg argv[KV_MAX_ARGS];
+		int argc;
+		if (resp_parse(conn->rbuffer, conn->rlen, argv, &argc) == 0) break;
+	}
+	return 0;
+}
+
+int recv_cb(int fd) {
+
+	struct conn_item *conn = &connlist[fd];
+
+	if (buffer_reserve(&conn->rbuffer, &conn->rcap, conn->rlen + KV_BUFFER_INIT / 2) < 0) {
+		conn_close(fd);
+		return -1;
+	}
+	ssize_t count = recv(fd, conn->rbuffer + conn->rlen, conn->rcap - conn->rlen, 0);
+	if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return 0;
+	}
+	if (count <= 0) {
+		conn_close(fd);
+		return -1;
+	}
+	conn->rlen += count;
+
+	if (kv_serve(fd) < 0) return -1;
+	return count;
+}
+
+int send_cb(int fd) {
+
+	int ret = kv_flush(fd);
+	if (ret < 0 || (ret == 0 && connlist[fd].closing)) {
+		conn_close(fd);
+		return -1;
+	}
+	if (ret == 1) return 0;
+
+	set_event(fd, EPOLLIN, 0);
+	// 积压期间没有解析的命令
+	return kv_serve(fd);
+}
+
+int accept_cb(int fd) {
+
+	struct sockaddr_in clientaddr;
+	socklen_t len = sizeof(clientaddr);
+
+	int clientfd = accept(fd, (struct sockaddr*)&clientaddr, &len);
+	if (clientfd < 0) {
+		return -1;
+	}
+	if (clientfd >= MAX_CONNECTIONS) {
+		close(clientfd);
+		return -1;
+	}
+	if (verbose) printf("accept clientfd: %d\n", clientfd);
+
+	fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL, 0) | O_NONBLOCK);
+	int nodelay = 1;
+	setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	if (busy_poll > 0) {
+		setsockopt(clientfd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll));
+	}
+
+	// SO_REUSEPORT 按四元组哈希选监听 socket，不看收包的 CPU；
+	// 这里把连接交给绑在收包 CPU 上的 loop，协议栈和业务处理在同一个 CPU 的缓存里
+	struct kv_loop *owner = self;
+	if (cpu_match) {
+		int cpu = -1;
+		socklen_t optlen = sizeof(cpu);
+		if (getsockopt(clientfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &optlen) == 0 &&
+			cpu >= 0 && cpu < CPU_SETSIZE && cpu_loop[cpu] >= 0) {
+			owner = &loops[cpu_loop[cpu]];
+		}
+	}
+
+	// 目标 loop 在注册到它的 epoll 之前看不到这个 fd，可以在这里初始化它的连接表
+	struct conn_item *conn = &owner->conns[clientfd];
+	conn->fd = clientfd;
+	conn->rbuffer = conn->wbuffer = NULL;
+	conn->rlen = conn->rcap = 0;
+	conn->wlen = conn->wsent = conn->wcap = 0;
+	conn->closing = 0;
+	conn->recv_t.recv_callback = recv_cb;
+	conn->send_callback = send_cb;
+
+	owner->accepted.fetch_add(1, std::memory_order_relaxed);
+	if (owner != self) {
+		self->handoffs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = clientfd;
+	epoll_ctl(owner->epfd, EPOLL_CTL_ADD, clientfd, &ev);
+	return clientfd;
+}
+
+int init_server(unsigned short port) {
+
+	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+	// 每个 loop 线程绑定同一个端口，由内核按四元组哈希分配连接
+	int reuse = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+
+	struct sockaddr_in serveraddr;
+	memset(&serveraddr, 0, sizeof(struct sockaddr_in));
+
+	serveraddr.sin_family = AF_INET;
+	serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	serveraddr.sin_port = htons(port);
+
+	if (-1 == bind(sockfd, (struct sockaddr*)&serveraddr, sizeof(struct sockaddr))) {
+		perror("bind");
+		close(sockfd);
+		return -1;
+	}
+
+	listen(sockfd, 4096);
+
+	return sockfd;
+}
+
+#ifndef EPIOCSPARAMS
+// linux 6.9 的 epoll 忙轮询参数，旧头文件里没有
+struct epoll_params {
+	uint32_t busy_poll_usecs;
+	uint16_t busy_poll_budget;
+	uint8_t prefer_busy_poll;
+	uint8_t __pad;
+};
+#define EPIOCSPARAMS		_IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+static unsigned long long now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// 连接表只保留虚拟地址，页面在第一次写入时分配；按 loop 所在的 NUMA 节点设置首选策略，
+// 其它 loop 转交连接时写入的页也落在这个节点上
+static struct conn_item *conn_table_alloc(int node) {
+
+	size_t size = sizeof(struct conn_item) * MAX_CONNECTIONS;
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+	if (node >= 0 && node < 64) {
+		unsigned long mask = 1UL << node;
+		syscall(SYS_mbind, p, size, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0);
+	}
+	return (struct conn_item *)p;
+}
+
+// 没有就绪事件时在预算内以 0 超时反复 epoll_wait，避免阻塞后被唤醒的调度延迟。
+// 预算内等到了事件说明负载足够密集，预算加倍；否则减半，不低于 -b 的 1/8
+static int kv_busy_wait(struct epoll_event *events, int maxevents) {
+
+	unsigned long long start = now_us();
+	while (now_us() - start < self->busy_budget) {
+		int nready = epoll_wait(epfd, events, maxevents, 0);
+		if (nready > 0) {
+			self->spin_hits.fetch_add(1, std::memory_order_relaxed);
+			self->busy_budget = self->busy_budget * 2 > (unsigned long)busy_poll ?
+				busy_poll : self->busy_budget * 2;
+			return nready;
+		}
+	}
+	self->spin_misses.fetch_add(1, std::memory_order_relaxed);
+	if (self->busy_budget / 2 >= (unsigned long)busy_poll / KV_BUSY_POLL_FLOOR) {
+		self->busy_budget /= 2;
+	}
+	return epoll_wait(epfd, events, maxevents, -1);
+}
+
+static void *kv_loop(void *arg) {
+
+	struct kv_loop *lp = &loops[(long)arg];
+	self = lp;
+
+	if (lp->cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(lp->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+			fprintf(stderr, "loop %d: cannot bind to cpu %d\n", lp->id, lp->cpu);
+		}
+	}
+	unsigned int cpu, node;
+	lp->node = getcpu(&cpu, &node) == 0 ? (int)node : -1;
+	lp->conns = conn_table_alloc(lp->cpu >= 0 ? lp->node : -1);
+	if (!lp->conns) {
+		perror("mmap");
+		exit(1);
+	}
+	connlist = lp->conns;
+	epfd = lp->epfd;
+
+	if (busy_poll > 0) {
+		// 网卡驱动支持 NAPI 忙轮询时由内核在 epoll_wait 里直接轮询网卡队列
+		struct epoll_params params;
+		memset(&params, 0, sizeof(params));
+		params.busy_poll_usecs = busy_poll;
+		params.busy_poll_budget = 64;
+		ioctl(epfd, EPIOCSPARAMS, &params);
+		lp->busy_budget = busy_poll;
+	}
+	pthread_barrier_wait(&loops_ready);
+
+	int sockfd = init_server(kv_port);
+	if (sockfd < 0) {
+		return NULL;
+	}
+	if (lp->cpu >= 0) {
+		setsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &lp->cpu, sizeof(lp->cpu));
+	}
+	connlist[sockfd].fd = sockfd;
+	connlist[sockfd].recv_t.accept_callback = accept_cb;
+	set_event(sockfd, EPOLLIN, 1);
+
+	struct epoll_event events[1024];
+
+	while (1) { // mainloop();
+
+		int nready = epoll_wait(epfd, events, 1024, busy_poll > 0 ? 0 : -1);
+		if (nready == 0) {
+			nready = kv_busy_wait(events, 1024);
+		}
+
+		int i = 0;
+		for (i = 0;i < nready;i ++) {
+
+			int connfd = events[i].data.fd;
+			if ((events[i].events & EPOLLIN) || !(events[i].events & EPOLLOUT)) {
+				connlist[connfd].recv_t.recv_callback(connfd);
+			} else if (events[i].events & EPOLLOUT) {
+				connlist[connfd].send_callback(connfd);
+			}
+		}
+	}
+	return NULL;
+}
+
+// "auto" 或 "0,2,4"：loop i 绑到列表中第 i % n 个 CPU
+static int parse_cpus(const char *spec) {
+
+	int cpus[CPU_SETSIZE];
+	int ncpus = 0;
+
+	if (strcmp(spec, "auto") == 0) {
+		cpu_set_t set;
+		if (sched_getaffinity(0, sizeof(set), &set) < 0) return -1;
+		int c;
+		for (c = 0; c < CPU_SETSIZE; c++) {
+			if (CPU_ISSET(c, &set)) cpus[ncpus++] = c;
+		}
+	} else {
+		const char *p = spec;
+		while (*p && ncpus < CPU_SETSIZE) {
+			char *end;
+			long c = strtol(p, &end, 10);
+			if (end == p || c < 0 || c >= CPU_SETSIZE) return -1;
+			cpus[ncpus++] = (int)c;
+			p = *end == ',' ? end + 1 : end;
+		}
+	}
+	if (ncpus == 0) return -1;
+
+	int i;
+	for (i = 0; i < KV_MAX_LOOPS; i++) {
+		loops[i].cpu = cpus[i % ncpus];
+	}
+	cpu_match = 1;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+
+	const char *cpus = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:t:a:b:q")) != -1) {
+		switch (opt) {
+		case 'p': kv_port = atoi(optarg); break;
+		case 't': nloops = atoi(optarg); break;
+		case 'a': cpus = optarg; break;
+		case 'b': busy_poll = atoi(optarg); break;
+		case 'q': verbose = 0; break;
+		default:
+			printf("usage: %s [-q] [-p port] [-t loops] [-a auto|cpu,cpu...] [-b busy_poll_us]\n", argv[0]);
+			return -1;
+		}
+	}
+	if (nloops < 1) nloops = 1;
+	if (nloops > KV_MAX_LOOPS) nloops = KV_MAX_LOOPS;
+	if (busy_poll < 0) busy_poll = 0;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	int i;
+	for (i = 0; i < KV_MAX_LOOPS; i++) {
+		loops[i].id = i;
+		loops[i].cpu = -1;
+		loops[i].node = -1;
+	}
+	if (cpus && parse_cpus(cpus) < 0) {
+		fprintf(stderr, "invalid cpu list: %s\n", cpus);
+		return -1;
+	}
+	// 同一个 CPU 上有多个 loop 时，SO_INCOMING_CPU 匹配到第一个
+	for (i = 0; i < CPU_SETSIZE; i++) cpu_loop[i] = -1;
+	for (i = nloops - 1; i >= 0; i--) {
+		if (loops[i].cpu >= 0) cpu_loop[loops[i].cpu] = i;
+	}
+	// epoll 在启动线程前创建，accept 可以把连接转给任何一个 loop
+	for (i = 0; i < nloops; i++) {
+		loops[i].epfd = epoll_create(1);
+	}
+	pthread_barrier_init(&loops_ready, NULL, nloops);
+
+	pthread_t threads[KV_MAX_LOOPS];
+	for (i = 0; i < nloops; i++) {
+		pthread_create(&threads[i], NULL, kv_loop, (void *)(long)i);
+	}
+	printf("kvstore: port %d, %d loop threads, cpus %s, busy poll %dus\n",
+		kv_port, nloops, cpus ? cpus : "unbound", busy_poll);
+
+	for (i = 0; i < nloops; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	return 0;
+}
@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/**
+ * webserver 限流的测试客户端
+ *
+ * -m conn : 依次建立 -n 条连接并保持，稍后检查每条连接是否被服务器拒绝(收到 503 或被关闭)，
+ *           输出接受 / 拒绝的连接数
+ * -m req  : 一条 keep-alive 连接上顺序发送 -n 个 GET -P path，统计 200 / 429 / 503
+ * -m flood: -d 秒内不断建立连接并立即 RST 关闭，输出每秒建立的连接数；
+ *           配合 -c / -m 让服务器在 accept 处拒绝，服务器每 1 万次拒绝打印平均耗时
+ * -B 绑定源地址，回环上可以用 127.0.0.2 之类的地址模拟不同的客户端 IP
+ *
+ * shell: gcc -O2 limit_bench.c -o limit_bench
+ * usage: ./limit_bench [-m conn|req|flood] [-n count] [-P path] [-d seconds] [-B srcip] ip port
+ */
+
+static struct sockaddr_in server_addr;
+static const char *bind_ip = NULL;
+
+static double now_sec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_conn(void) {
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	if (bind_ip) {
+		struct sockaddr_in local;
+		memset(&local, 0, sizeof(local));
+		local.sin_family = AF_INET;
+		inet_pton(AF_INET, bind_ip, &local.sin_addr);
+		if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+	if (connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int bench_conn(int n) {
+
+	int *fds = calloc(n, sizeof(int));
+	int opened = 0, i = 0;
+	double start = now_sec();
+
+	for (i = 0;i < n;i ++) {
+		fds[i] = open_conn();
+		if (fds[i] < 0) {
+			perror("connect");
+			break;
+		}
+		opened++;
+	}
+	double elapsed = now_sec() - start;
+	usleep(300 * 1000);   // 等服务器 accept 完
+
+	int accepted = 0, rejected_503 = 0, rejected_close = 0;
+	char buf[256];
+	for (i = 0;i < opened;i ++) {
+		ssize_t count = recv(fds[i], buf, sizeof(buf) - 1, MSG_DONTWAIT);
+		if (count > 0) {
+			buf[count] = '\0';
+			if (strncmp(buf, "HTTP/1.1 503", 12) == 0) rejected_503++;
+			else accepted++;
+		} else if (count == 0 || errno == ECONNRESET) {
+			rejected_close++;
+		} else {
+			accepted++;   // EAGAIN: 服务器保持着连接，等待请求
+		}
+		close(fds[i]);
+	}
+	free(fds);
+
+	printf("conn: %d opened in %.3fs, accepted %d, rejected %d (503 %d, closed %d)\n",
+		opened, elapsed, accepted, rejected_503 + rejected_close, rejected_503, rejected_close);
+	printf("RESULT accepted=%d rejected=%d\n", accepted, rejected_503 + rejected_close);
+	return 0;
+}
+
+// 读一个响应，返回状态码，-1 连接断开
+static int read_response(int fd) {
+
+	static char buf[65536];
+	int len = 0;
+	char *end = NULL;
+
+	while (!end) {
+		ssize_t count = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+		if (count <= 0) return -1;
+		len += count;
+		buf[len] = '\0';
+		end = strstr(buf, "\r\n\r\n");
+	}
+
+	int status = 0;
+	long body = 0;
+	sscanf(buf, "HTTP/1.1 %d", &status);
+	char *cl = strcasestr(buf, "Content-Length:");
+	if (cl && cl < end) body = atol(cl + 15);
+
+	long remain = body - (len - (end + 4 - buf));
+	while (remain > 0) {
+		ssize_t count = recv(fd, buf, remain < (long)sizeof(buf) ? remain : (long)sizeof(buf), 0);
+		if (count <= 0) return -1;
+		remain -= count;
+	}
+	return status;
+}
+
+static int bench_req(int n, const char *path) {
+
+	int fd = open_conn();
+	if (fd < 0) {
+		perror("connect");
+		return -1;
+	}
+	int nodelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+	char req[512];
+	int reqlen = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+
+	int ok = 0, limited_conn = 0, limited_route = 0, other = 0, i = 0;
+	double start = now_sec();
+	for (i = 0;i < n;i ++) {
+		if (send(fd, req, reqlen, 0) != reqlen) break;
+		int status = read_response(fd);
+		if (status < 0) break;
+		if (status == 200) ok++;
+		else if (status == 429) limited_conn++;
+		else if (status == 503) limited_route++;
+		else other++;
+	}
+	double elapsed = now_sec() - start;
+	close(fd);
+
+	printf("req: %d requests in %.3fs, 200 %d, 429 %d, 503 %d, other %d\n",
+		i, elapsed, ok, limited_conn, limited_route, other);
+	printf("RESULT ok=%d limited=%d\n", ok, limited_conn + limited_route);
+	return 0;
+}
+
+static int bench_flood(int seconds) {
+
+	long connects = 0, failures = 0;
+	double start = now_sec(), deadline = start + seconds;
+	struct linger lg = {1, 0};
+
+	while (now_sec() < deadline) {
+		int fd = open_conn();
+		if (fd < 0) {
+			failures++;
+			continue;
+		}
+		// RST 关闭，客户端不留 TIME_WAIT，端口可以马上复用
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+		close(fd);
+		connects++;
+	}
+	double elapsed = now_sec() - start;
+
+	printf("flood: %ld connects in %.3fs, %.0f conn/sec, %ld failed\n",
+		connects, elapsed, connects / elapsed, failures);
+	printf("RESULT conn_per_sec=%.0f\n", connects / elapsed);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+	const char *mode = "conn", *path = "/";
+	int n = 1000, seconds = 5;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "m:n:P:d:B:")) != -1) {
+		switch (opt) {
+		case 'm': mode = optarg; break;
+		case 'n': n = atoi(optarg); break;
+		case 'P': path = optarg; break;
+		case 'd': seconds = atoi(optarg); break;
+		case 'B': bind_ip = optarg; break;
+		default:
+			optind = argc + 1;
+		}
+	}
+	if (optind + 2 != argc) {
+		printf("usage: %s [-m conn|req|flood] [-n count] [-P path] [-d seconds] [-B srcip] ip port\n", argv[0]);
+		return -1;
+	}
+
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(atoi(argv[optind + 1]));
+	inet_pton(AF_INET, argv[optind], &server_addr.sin_addr);
+
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	if (strcmp(mode, "req") == 0) return bench_req(n, path);
+	if (strcmp(mode, "flood") == 0) return bench_flood(seconds);
+	return bench_conn(n);
+}
@@ -1,157 +1,217 @@
 
 
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/epoll.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <errno.h>
+#include <unistd.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
-#include <netdb.h>
 #include <fcntl.h>
 
+#include "eventloop.h"
+#include "connector.h"
+
+/**
+ * 多端口并发连接客户端
+ *
+ * 连接由 connector.c 以非阻塞方式发起，最多 -p 个同时在进行，完成一个再发起下一个；
+ * 第 i 条连接连向 port + i % MAX_PORT。ip 可以用逗号给出多个地址，每条连接在这些地址间并行尝试。
+ * 连接失败或被服务器断开后按抖动退避自动重连，不再因为一次失败就结束整个测试。
+ *
+ * shell: gcc -O2 mul_port_client_epoll.c connector.c eventloop.c -o mul_port_client_epoll
+ * usage: ./mul_port_client_epoll [-n conns] [-p inflight] [-t timeout_ms] [-q] ip[,ip...] port
+ */
 
 #define MAX_BUFFER		128
 #define MAX_EPOLLSIZE	(384*1024)
 #define MAX_PORT		20
+#define MAX_ADDRS		8
 
 #define TIME_SUB_MS(tv1, tv2)  ((tv1.tv_sec - tv2.tv_sec) * 1000 + (tv1.tv_usec - tv2.tv_usec) / 1000)
 
-int isContinue = 0;
+struct client_conn {
+	connector_t *connector;
+	int id;
+	int fd;
+	int ever_connected;
+};
 
-static int ntySetNonblock(int fd) {
-	int flags;
+static eventloop_t *loop;
+static struct client_conn *clients;
+static struct connector_opts opts = { 3000, 250, 100, 30000, -1 };
 
-	flags = fcntl(fd, F_GETFL, 0);
-	if (flags < 0) return flags;
-	flags |= O_NONBLOCK;
-	if (fcntl(fd, F_SETFL, flags) < 0) return -1;
-	return 0;
+static char *ips[MAX_ADDRS];
+static int nips = 0;
+static int port = 0;
+static int total = 340000, max_inflight = 1000, verbose = 1;
+
+static int started = 0;         // 已创建的 connector
+static int inflight = 0;        // 第一次连接还没有结果的 connector
+static int connections = 0;     // 当前已建立的连接
+static unsigned long failures = 0, reconnects = 0;
+static int last_err = 0;
+static struct timeval tv_begin;
+
+
+static void start_next(void);
+
+static void client_read_cb(eventloop_t *loop, int fd, int events, void *arg) {
+
+	struct client_conn *cc = (struct client_conn *)arg;
+	char rBuffer[MAX_BUFFER] = {0};
+	(void)events;
+
+	ssize_t length = recv(fd, rBuffer, MAX_BUFFER - 1, 0);
+	if (length > 0) {
+		if (verbose) printf(" RecvBuffer:%s\n", rBuffer);
+		return;
+	}
+	if (length < 0 && (errno == EAGAIN || errno == EINTR)) return;
+
+	if (length == 0) {
+		if (verbose) printf(" Disconnect clientfd:%d\n", fd);
+	} else {
+		printf(" Error clientfd:%d, errno:%d\n", fd, errno);
+	}
+	eventloop_del(loop, fd);
+	close(fd);
+	cc->fd = -1;
+	connections --;
+	reconnects ++;
+	connector_retry(cc->connector);
 }
 
-static int ntySetReUseAddr(int fd) {
-	int reuse = 1;
-	return setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse, sizeof(reuse));
+static void print_progress(int sockfd) {
+
+	struct timeval tv_cur;
+	memcpy(&tv_cur, &tv_begin, sizeof(struct timeval));
+	gettimeofday(&tv_begin, NULL);
+
+	int time_used = TIME_SUB_MS(tv_begin, tv_cur);
+	printf("connections: %d, sockfd:%d, time_used:%d\n", connections, sockfd, time_used);
 }
 
+static void client_connect_cb(connector_t *c, int fd, int err, void *arg) {
 
+	struct client_conn *cc = (struct client_conn *)arg;
 
-int main(int argc, char **argv) {
-	if (argc <= 2) {
-		printf("Usage: %s ip port\n", argv[0]);
-		exit(0);
+	if (fd < 0) {
+		failures ++;
+		last_err = err;
+		if (!cc->ever_connected && connector_retry_ms(c) < 0) {
+			// 放弃了，让出名额
+			inflight --;
+			start_next();
+		}
+		return;
 	}
 
-	const char *ip = argv[1];
-	int port = atoi(argv[2]);
-	int connections = 0;
-	char buffer[128] = {0};
-	int i = 0, index = 0;
-
-	struct epoll_event events[MAX_EPOLLSIZE];
-	
-	int epoll_fd = epoll_create(MAX_EPOLLSIZE);
-	
-	strcpy(buffer, " Data From MulClient\n");
-		
-	struct sockaddr_in addr;
-	memset(&addr, 0, sizeof(struct sockaddr_in));
-	
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = inet_addr(ip);
-
-	struct timeval tv_begin;
-	gettimeofday(&tv_begin, NULL);
+	char buffer[MAX_BUFFER];
+	int nodelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	if (eventloop_add(loop, fd, EV_READ, client_read_cb, cc) != 0) {
+		close(fd);
+		connector_retry(c);
+		return;
+	}
+	cc->fd = fd;
+	connections ++;
+
+	snprintf(buffer, sizeof(buffer), "Hello Server: client --> %d\n", cc->id);
+	send(fd, buffer, strlen(buffer), MSG_NOSIGNAL);
+
+	if (!cc->ever_connected) {
+		cc->ever_connected = 1;
+		inflight --;
+		if (connections % 1000 == 999 || connections == total) print_progress(fd);
+		start_next();
+	}
+}
+
+// 补足在途的连接，直到发起了 total 条
+static void start_next(void) {
 
-	while (1) {
-		if (++index >= MAX_PORT) index = 0;
-		
-		struct epoll_event ev;
-		int sockfd = 0;
-
-		if (connections < 340000 && !isContinue) {
-			sockfd = socket(AF_INET, SOCK_STREAM, 0);
-			if (sockfd == -1) {
-				perror("socket");
-				goto err;
-			}
-
-			//ntySetReUseAddr(sockfd);
-			addr.sin_port = htons(port+index);
-
-			if (connect(sockfd, (struct sockaddr*)&addr, sizeof(struct sockaddr_in)) < 0) {
-				perror("connect");
-				goto err;
-			}
-			ntySetNonblock(sockfd);
-			ntySetReUseAddr(sockfd);
-
-			sprintf(buffer, "Hello Server: client --> %d\n", connections);
-			send(sockfd, buffer, strlen(buffer), 0);
-
-			ev.data.fd = sockfd;
-			ev.events = EPOLLIN | EPOLLOUT;
-			epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockfd, &ev);
-		
-			connections ++;
+	while (inflight < max_inflight && started < total) {
+		struct client_conn *cc = &clients[started];
+		int i;
+
+		cc->id = started;
+		cc->fd = -1;
+		cc->connector = connector_create(loop, &opts, client_connect_cb, cc);
+		if (!cc->connector) {
+			perror("connector_create");
+			total = started;
+			return;
 		}
-		//connections ++;
-		if (connections % 1000 == 999 || connections >= 340000) {
-			struct timeval tv_cur;
-			memcpy(&tv_cur, &tv_begin, sizeof(struct timeval));
-			
-			gettimeofday(&tv_begin, NULL);
-
-			int time_used = TIME_SUB_MS(tv_begin, tv_cur);
-			printf("connections: %d, sockfd:%d, time_used:%d\n", connections, sockfd, time_used);
-
-			int nfds = epoll_wait(epoll_fd, events, connections, 100);
-			for (i = 0;i < nfds;i ++) {
-				int clientfd = events[i].data.fd;
-
-				if (events[i].events & EPOLLOUT) {
-					sprintf(buffer, "data from %d\n", clientfd);
-					send(sockfd, buffer, strlen(buffer), 0);
-				} else if (events[i].events & EPOLLIN) {
-					char rBuffer[MAX_BUFFER] = {0};				
-					ssize_t length = recv(sockfd, rBuffer, MAX_BUFFER, 0);
-					if (length > 0) {
-						printf(" RecvBuffer:%s\n", rBuffer);
-
-						if (!strcmp(rBuffer, "quit")) {
-							isContinue = 0;
-						}
-						
-					} else if (length == 0) {
-						printf(" Disconnect clientfd:%d\n", clientfd);
-						connections --;
-						close(clientfd);
-					} else {
-						if (errno == EINTR) continue;
-
-						printf(" Error clientfd:%d, errno:%d\n", clientfd, errno);
-						close(clientfd);
-					}
-				} else {
-					printf(" clientfd:%d, errno:%d\n", clientfd, errno);
-					close(clientfd);
-				}
-			}
+		for (i = 0;i < nips;i ++) {
+			connector_add_addr(cc->connector, ips[i], port + started % MAX_PORT);
 		}
+		started ++;
+		inflight ++;
+		connector_start(cc->connector);
+	}
+}
 
-		usleep(500);
+// 每秒输出一次状态，连接卡住(例如服务器没开)时也能看到失败原因
+static void status_timer_cb(eventloop_t *loop, void *arg) {
+	(void)arg;
+	printf("status: connected %d, started %d, connecting %d, failed attempts %lu, reconnects %lu%s%s\n",
+		connections, started, inflight, failures, reconnects,
+		last_err ? ", last error: " : "", last_err ? strerror(last_err) : "");
+	fflush(stdout);
+	eventloop_timer_add(loop, 1000, status_timer_cb, NULL);
+}
+
+int main(int argc, char **argv) {
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:p:t:q")) != -1) {
+		switch (opt) {
+		case 'n': total = atoi(optarg); break;
+		case 'p': max_inflight = atoi(optarg); break;
+		case 't': opts.timeout_ms = atoi(optarg); break;
+		case 'q': verbose = 0; break;
+		default:
+			optind = argc + 1;
+		}
 	}
+	if (optind + 2 != argc) {
+		printf("Usage: %s [-n conns] [-p inflight] [-t timeout_ms] [-q] ip[,ip...] port\n", argv[0]);
+		exit(0);
+	}
+	if (max_inflight < 1) max_inflight = 1;
 
-	return 0;
+	char *ip = strtok(argv[optind], ",");
+	while (ip && nips < MAX_ADDRS) {
+		ips[nips++] = ip;
+		ip = strtok(NULL, ",");
+	}
+	port = atoi(argv[optind + 1]);
 
-err:
-	printf("error : %s\n", strerror(errno));
-	return 0;
-	
-}
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
 
+	loop = eventloop_create("epoll", MAX_EPOLLSIZE);
+	clients = (struct client_conn *)calloc(total, sizeof(struct client_conn));
+	if (!loop || !clients) {
+		printf("error : %s\n", strerror(errno));
+		return 0;
+	}
 
+	gettimeofday(&tv_begin, NULL);
+	start_next();
+	eventloop_timer_add(loop, 1000, status_timer_cb, NULL);
+	eventloop_run(loop);
 
+	return 0;
+}
@@ -8,36 +8,64 @@
 #include <pthread.h>        // 线程相关定义
 #include <sys/poll.h>       // poll函数相关定义  
 #include <sys/epoll.h>      // epoll函数相关定义
+#include <stdlib.h>         // atoi
+#include <fcntl.h>          // fcntl
+#include <stdint.h>         // intptr_t
+#include <stdatomic.h>      // 线程池模式的连接计数
+#include <signal.h>         // 线程池模式的退出信号
+#include "eventloop.h"      // select/poll/epoll 统一事件循环
+#include "thrd_pool.h"      // 3_pool/thread_pool-master 的线程池
+
+/**
+ * shell: gcc -O2 multi-io.c eventloop.c ../../3_pool/thread_pool-master/thrd_pool.c
+ *        -I../../3_pool/thread_pool-master -o multi-io -lpthread
+ * usage: ./multi-io [-q] [-p port] [-t threads] [-Q queue] [blocking|thread|pool|select|poll|epoll]
+ */
+
+#define BUFFER_LENGTH   1024
+#define MAX_FDS         (1024 * 1024)   // 事件循环 fd 索引表大小，与 reactor.c 的 connlist 一致
+
+static int verbose = 1;     // -q 关闭逐条打印，压测时打印会成为瓶颈
+
+#define POOL_THREADS        8       // 线程池模式默认工作线程数
+#define POOL_QUEUE          1024    // 线程池模式默认排队连接上限
+#define POOL_IDLE_TIMEOUT   30      // 空闲连接最多占用工作线程的秒数
+#define POOL_DRAIN_TIMEOUT  5000    // 退出时等排队连接处理完的毫秒数，超时的连接直接关闭
 
 
 // 线程处理函数：处理单个客户端连接的数据收发
 void *client_thread(void *arg) {
     // 从参数中获取客户端socket描述符
-    int clientfd = *(int*)arg;
+    // fd 按值传入：传 &clientfd 会和下一次 accept 覆盖同一个栈变量发生竞争
+    int clientfd = (int)(intptr_t)arg;
 
     while(1) {
         char buf[128] = {0};  // 初始化接收缓冲区
         // 接收客户端数据
         int count = recv(clientfd, buf, sizeof(buf), 0);
-        if(count == 0) {  // 客户端断开连接
+        if(count <= 0) {  // 客户端断开连接或出错
             break;
         }
         // 将接收到的数据发送回客户端（回显服务）
         send(clientfd, buf, count, 0);
-        printf("收到数据 - clientfd: %d, count: %d, buf: %s\n", clientfd, count, buf);
+        if (verbose)
+            printf("收到数据 - clientfd: %d, count: %d, buf: %s\n", clientfd, count, buf);
     }
     close(clientfd);  // 关闭客户端连接
     return NULL;
 }
 
-// TCP服务器示例程序
-int main() {
+static int init_server(unsigned short port) {
     // 创建TCP socket
     // AF_INET: IPv4协议族
     // SOCK_STREAM: 面向连接的TCP协议
     // 0: 使用默认协议
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
 
+    // 压测时频繁重启服务器，避免 TIME_WAIT 导致 bind 失败
+    int reuse = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     // 定义服务器地址结构体并初始化为0
     struct sockaddr_in serveraddr;
     memset(&serveraddr, 0, sizeof(struct sockaddr_in));
@@ -45,28 +73,31 @@ int main() {
     // 配置服务器地址信息
     serveraddr.sin_family = AF_INET;                // 使用IPv4地址
     serveraddr.sin_addr.s_addr = htonl(INADDR_ANY); // 监听所有网卡接口
-    serveraddr.sin_port = htons(2048);              // 监听2048端口，需要转换为网络字节序
+    serveraddr.sin_port = htons(port);              // 监听端口，需要转换为网络字节序
 
     // 绑定socket与地址
     // 如果绑定失败，打印错误信息并退出
     if (-1 == bind(sockfd, (struct sockaddr*)&serveraddr, sizeof(struct sockaddr))) {
         perror("bind");    // 输出错误原因
+        close(sockfd);
         return -1;
     }
 
     // 开始监听连接请求
-    // 10表示待处理连接请求队列的最大长度
-    listen(sockfd, 10);
-#if 0
+    // 第二个参数是待处理连接请求队列的最大长度，压测建连时 10 太小，会大量丢 SYN
+    listen(sockfd, 4096);
+    return sockfd;
+}
+
 // 方案1：基础阻塞式单线程处理
 // 特点：一次只能处理一个客户端连接，其他客户端需要等待
-
+static void serve_blocking(int sockfd) {
 	while(1) {
 		struct sockaddr_in clientaddr;
 		socklen_t len = sizeof(clientaddr);
 		
 		int clientfd = accept(sockfd, (struct sockaddr*)&clientaddr, &len);
-		printf("新客户端连接成功\n");
+		if (verbose) printf("新客户端连接成功\n");
 	
 		// 添加内层循环，持续接收当前客户端的数据
 		while(1) {
@@ -75,13 +106,14 @@ int main() {
 			
 			if(count > 0) {
 				// 正常接收到数据
-				printf("收到数据 - sockfd:%d, clientfd: %d, count: %d, buf: %s\n", 
-					   sockfd, clientfd, count, buf);
+				if (verbose)
+					printf("收到数据 - sockfd:%d, clientfd: %d, count: %d, buf: %s\n", 
+						   sockfd, clientfd, count, buf);
 				send(clientfd, buf, count, 0);  // 原样返回数据
 			}
 			else if(count == 0) {
 				// 客户端主动断开连接
-				printf("客户端断开连接\n");
+				if (verbose) printf("客户端断开连接\n");
 				break;
 			}
 			else {
@@ -93,211 +125,217 @@ int main() {
 	
 		close(clientfd);  // 内层循环结束后关闭客户端连接
 	}
+}
 
-
-	
-#elif 0  
 // 方案2：多线程并发处理
 // 特点：每个客户端连接都由独立线程处理，支持并发连接
 // 缺点：线程资源开销大，并发量受限于系统线程数
-
-while(1){
+static void serve_thread(int sockfd) {
+	while(1){
 
 		struct sockaddr_in clientaddr;
 		socklen_t len = sizeof(clientaddr);
 
 		int clientfd = accept(sockfd, (struct sockaddr*)&clientaddr, &len);
 
+		if (clientfd < 0) continue;
+
 		pthread_t thid;
-		pthread_create(&thid, NULL, client_thread, &clientfd);
+		pthread_create(&thid, NULL, client_thread, (void *)(intptr_t)clientfd);
 		/*
 		&thid：指向线程标识符的指针，用于存储新创建线程的ID
 		NULL：线程属性，NULL表示使用默认属性
 		client_thread：线程将要执行的函数
-		&clientfd：传递给线程函数的参数
+		clientfd：按值传递给线程函数的参数
 		*/
+		// 没有人 join，分离线程让它退出时自动回收资源
+		pthread_detach(thid);
 	}
+}
 
+// 方案2.5：线程池处理
+// 特点：线程预先创建，连接作为任务投递给 thrdpool，线程创建开销不再出现在每个短连接上
+// 排队的连接数有上限：工作线程全忙且队列已满时直接关闭新连接(准入控制)，而不是无限堆积
+static atomic_int pool_pending;     // 正在处理 + 排队中的连接数
+static volatile sig_atomic_t pool_quit;     // 收到 SIGINT/SIGTERM
 
+static void pool_quit_handler(int sig) {
+    (void)sig;
+    pool_quit = 1;
+}
 
+// 每个工作线程一份接收缓冲区，线程创建时即分配，所有连接复用
+static __thread char pool_buffer[BUFFER_LENGTH];
 
-#elif 0 
-// 方案3：select多路复用
-// 特点：单线程同时处理多个连接，最大支持1024个文件描述符
-// 原理：通过fd_set数据结构来跟踪多个文件描述符的状态
-// int nready = select(maxfd, rset, wset, eset, timeout);
-/* 		正值 - 代表已准备好的文件描述符数量（即：返回发生了状态变化的文件描述符个数）
-		0 - 超时时间到达，但没有任何文件描述符准备就绪
-		-1 - 发生错误，此时应该检查 errno 来确定具体的错误原因	
-*/
-
-	fd_set rfds,rset;   //定义读文件描述符集合
-	FD_ZERO(&rfds);
-	FD_SET(sockfd, &rfds);  //将sockfd加入到rfds中
-	int maxfd = sockfd;   //最大文件描述符3
-	
-	while(1){
-
-		rset = rfds;
-		int nready = select(maxfd+1, &rset, NULL, NULL, NULL);
-
-		if(FD_ISSET(sockfd, &rset)){
-
-			struct sockaddr_in clientaddr;
-			socklen_t len = sizeof(clientaddr);
-			int clientfd = accept(sockfd, (struct sockaddr*)&clientaddr, &len);
-			
-			FD_SET(clientfd, &rfds);
-			maxfd = clientfd;
-		
-
-		}
-
-		int i = 0;
-		for(i = sockfd+1; i <= maxfd; i++){
-			if(FD_ISSET(i, &rset)){
-				char buf[128] = {0};  
-				int count = recv(i, buf, sizeof(buf), 0);
-				if(count == 0 ){
-					printf("disconnect - clientfd: %d\n", i);
-					FD_CLR(i, &rfds);
-					close(i);
-				}
-				else{
-					send(i, buf, count, 0);
-					printf("收到数据 - clientfd: %d, count: %d, buf: %s\n", i, count, buf);
-				}
-			}
-		}
-			
-
-	}
-
-
-
-#elif 0	
-// 方案4：poll多路复用
-// 特点：功能与select类似，但没有文件描述符数量限制
-// 优势：性能比select略好，不需要重新设置监听集合
-// int poll(struct pollfd *fds, nfds_t nfds, int timeout);
-/*
-	fds：pollfd结构体数组
-	nfds：数组中的元素个数
-	timeout：超时时间（毫秒），-1表示永久阻塞
-*/
-
-	struct pollfd fds[1024];
-
-	fds[sockfd].fd = sockfd;
-	fds[sockfd].events = POLLIN;   //POLLIN: 监听文件描述符的读事件。
-
-	int maxfd = sockfd;
-	
-	while(1){
+static void pool_client_task(void *arg) {
+    int clientfd = (int)(intptr_t)arg;
 
-		int nready = poll(fds, maxfd+1, -1);
+    // 空闲连接不能无限期占用工作线程
+    struct timeval tv = { POOL_IDLE_TIMEOUT, 0 };
+    setsockopt(clientfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
-		//使用位与运算(&)检查 revents 中是否包含 POLLIN 事件
-		if(fds[sockfd].revents & POLLIN){    
-			
-			struct sockaddr_in clientaddr;
-			socklen_t len = sizeof(clientaddr);
-			int clientfd = accept(sockfd, (struct sockaddr*)&clientaddr, &len);
+    while (1) {
+        int count = recv(clientfd, pool_buffer, sizeof(pool_buffer), 0);
+        if (count <= 0) break;
+        send(clientfd, pool_buffer, count, 0);
+        if (verbose)
+            printf("收到数据 - clientfd: %d, count: %d, buf: %.*s\n", clientfd, count, count, pool_buffer);
+    }
+    close(clientfd);
+    atomic_fetch_sub(&pool_pending, 1);
+}
 
-			fds[clientfd].fd = clientfd;
-			fds[clientfd].events = POLLIN;
-			maxfd = clientfd;
-		}
-		
-		int i = 0;
-		for(i = sockfd+1; i <= maxfd; i++){
-
-			if(fds[i].revents & POLLIN){
-				char buf[128] = {0};  
-				int count = recv(i, buf, sizeof(buf), 0);
-				if(count == 0 ){
-					printf("disconnect - clientfd: %d\n", i);
-					fds[i].fd = -1;
-					close(i);
-					continue;
-				}
-				else {
-					send(i, buf, count, 0);
-					printf("收到数据 - clientfd: %d, count: %d, buf: %s\n", i, count, buf);
-				}
-			}
-				
+// 线程池退出时还没轮到处理的连接：关闭，不泄漏 fd
+static void pool_client_cancel(void *arg) {
+    close((int)(intptr_t)arg);
+    atomic_fetch_sub(&pool_pending, 1);
+}
 
-		}
+static int serve_pool(int sockfd, int thrd_count, int queue_max) {
+    thrdpool_t *pool = thrdpool_create(thrd_count);
+    if (pool == NULL) {
+        perror("thrdpool_create");
+        return -1;
+    }
+    atomic_init(&pool_pending, 0);
+    int limit = thrd_count + queue_max;
+    long rejected = 0;
+
+    // 不设 SA_RESTART：信号打断阻塞的 accept，返回 EINTR 后检查 pool_quit
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = pool_quit_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!pool_quit) {
+        struct sockaddr_in clientaddr;
+        socklen_t len = sizeof(clientaddr);
+        int clientfd = accept(sockfd, (struct sockaddr*)&clientaddr, &len);
+        if (clientfd < 0) continue;
+
+        // 准入控制：饱和时立即拒绝，连接还没有占用任何缓冲区
+        if (atomic_load(&pool_pending) >= limit) {
+            close(clientfd);
+            if ((++rejected % 1000) == 1)
+                fprintf(stderr, "pool saturated, rejected: %ld\n", rejected);
+            continue;
+        }
 
+        atomic_fetch_add(&pool_pending, 1);
+        if (thrdpool_post_ex(pool, pool_client_task, (void *)(intptr_t)clientfd,
+                             THRDPOOL_PRIO_NORMAL, 0, pool_client_cancel) != 0) {
+            atomic_fetch_sub(&pool_pending, 1);
+            close(clientfd);
+        }
+    }
 
+    // 不再接受新连接；排队的连接最多再等 POOL_DRAIN_TIMEOUT，超时的由 pool_client_cancel 关闭。
+    // 正在处理的连接不会被打断，最长要等 POOL_IDLE_TIMEOUT 的空闲超时
+    close(sockfd);
+    fprintf(stderr, "shutting down, %d connections pending\n", atomic_load(&pool_pending));
+    struct thrdpool_done done;
+    thrdpool_drain(pool, POOL_DRAIN_TIMEOUT);
+    thrdpool_waitdone(pool, &done);
+    fprintf(stderr, "served %llu connections, closed %llu queued, rejected %ld\n",
+            (unsigned long long)done.completed, (unsigned long long)done.cancelled, rejected);
+    return 0;
+}
 
-	}
+// 方案3/4/5：select / poll / epoll 多路复用
+// 三种实现的差异都收敛在 eventloop.c 的后端里，业务回调只写一份，
+// 所以同一个回显负载可以在运行时切换后端直接对比（见 bench_matrix.sh）
+
+// 已连接客户端有数据可读：回显
+static void echo_cb(eventloop_t *loop, int fd, int events, void *arg) {
+    char buf[BUFFER_LENGTH];
+    (void)events;
+    (void)arg;
+    int count = recv(fd, buf, sizeof(buf), 0);
+
+    if (count <= 0) {  // 客户端断开连接或出错
+        if (count < 0 && errno == EAGAIN) return;
+        if (verbose) printf("disconnect - clientfd: %d\n", fd);
+        eventloop_del(loop, fd);
+        close(fd);
+        return;
+    }
 
+    // 回显数据给客户端
+    send(fd, buf, count, 0);
+    if (verbose)
+        printf("收到数据 - clientfd: %d, count: %d, buf: %.*s\n", fd, count, count, buf);
+}
 
-#elif 1
-// 方案5：epoll多路复用
-// 特点：Linux特有的高性能I/O多路复用机制
-// 优势：支持高并发、不受文件描述符限制、性能最优
+// 监听socket可读：一次把积压的连接全部接受
+static void accept_cb(eventloop_t *loop, int sockfd, int events, void *arg) {
+    (void)events;
+    (void)arg;
+    while (1) {
+        struct sockaddr_in clientaddr;
+        socklen_t len = sizeof(clientaddr);
+        int clientfd = accept(sockfd, (struct sockaddr*)&clientaddr, &len);
+        if (clientfd < 0) break;
+
+        // select 后端下 fd >= FD_SETSIZE 注册会失败，只能拒绝这个连接
+        if (eventloop_add(loop, clientfd, EV_READ, echo_cb, NULL) != 0) {
+            close(clientfd);
+            continue;
+        }
+        if (verbose) printf("新客户端连接 - clientfd: %d\n", clientfd);
+    }
+}
 
-    // 创建epoll实例，参数值只需>0即可
-    int epfd = epoll_create(1); 
+static int serve_eventloop(int sockfd, const char *backend) {
+    eventloop_t *loop = eventloop_create(backend, MAX_FDS);
+    if (!loop) {
+        fprintf(stderr, "unknown backend: %s\n", backend);
+        return -1;
+    }
 
-    // 配置事件结构体
-    struct epoll_event ev;
-    ev.events = EPOLLIN;  // 监听读事件
-    ev.data.fd = sockfd;  // 设置监听的文件描述符
+    // 监听socket设为非阻塞，accept_cb 才能循环 accept 到 EAGAIN
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+    eventloop_add(loop, sockfd, EV_READ, accept_cb, NULL);
 
-    // 将监听socket添加到epoll实例
-    epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev);
+    printf("backend: %s\n", eventloop_backend(loop));
+    eventloop_run(loop);
+    eventloop_destroy(loop);
+    return 0;
+}
 
-    // 事件数组，用于接收发生的事件
-    struct epoll_event events[1024] = {0};
-    
-    while (1) {
-        // 等待事件发生，-1表示永久阻塞
-        int nready = epoll_wait(epfd, events, 1024, -1);
-
-        // 处理所有就绪的事件
-        for (int i = 0; i < nready; i++) {
-            int connfd = events[i].data.fd;
-            
-            if (sockfd == connfd) { 
-				//基于IO事件驱动，也可设计基于不同的IO类型
-
-
-                // 接受新连接
-                struct sockaddr_in clientaddr;
-                socklen_t len = sizeof(clientaddr);
-                int clientfd = accept(sockfd, (struct sockaddr*)&clientaddr, &len);
-
-                // 设置新连接为边缘触发模式
-                ev.events = EPOLLIN | EPOLLET;  
-                ev.data.fd = clientfd;
-                epoll_ctl(epfd, EPOLL_CTL_ADD, clientfd, &ev);
-
-                printf("新客户端连接 - clientfd: %d\n", clientfd);
-
-            } else if (events[i].events & EPOLLIN) {  // 已连接客户端有数据可读
-                // 读取客户端数据（这里故意使用小缓冲区来演示触发机制的区别）
-                char buffer[5] = {0};
-                int count = recv(connfd, buffer, 5, 0);
-
-                if (count == 0) {  // 客户端断开连接
-                    printf("客户端断开连接\n");
-                    epoll_ctl(epfd, EPOLL_CTL_DEL, connfd, NULL);		
-                    close(i);
-                    continue;
-                }
-                
-                // 回显数据给客户端
-                send(connfd, buffer, count, 0);
-                printf("收到数据 - clientfd: %d, count: %d, buffer: %s\n", 
-                       connfd, count, buffer);
-            }
+// TCP服务器示例程序
+int main(int argc, char **argv) {
+    unsigned short port = 2048;
+    const char *mode = "epoll";
+    int thrd_count = POOL_THREADS, queue_max = POOL_QUEUE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "qp:t:Q:")) != -1) {
+        switch (opt) {
+        case 'q': verbose = 0; break;
+        case 'p': port = (unsigned short)atoi(optarg); break;
+        case 't': thrd_count = atoi(optarg); break;
+        case 'Q': queue_max = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-q] [-p port] [-t threads] [-Q queue] "
+                "[blocking|thread|pool|select|poll|epoll]\n", argv[0]);
+            return -1;
         }
     }
-#endif
+    if (optind < argc) mode = argv[optind];
+
+    int sockfd = init_server(port);
+    if (sockfd < 0) return -1;
+
+    if (strcmp(mode, "blocking") == 0) {
+        serve_blocking(sockfd);
+    } else if (strcmp(mode, "thread") == 0) {
+        serve_thread(sockfd);
+    } else if (strcmp(mode, "pool") == 0) {
+        if (serve_pool(sockfd, thrd_count, queue_max) != 0) return -1;
+    } else if (serve_eventloop(sockfd, mode) != 0) {
+        return -1;
+    }
     return 0;
 }
-
@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/**
+ * broker.c 的发布/订阅压测
+ *
+ * -S 个订阅者连接，第 i 个订阅 topic (i % -T)，由 -t 个线程用 epoll 接收；
+ * -P 个发布者线程各一条连接，轮流向各 topic 发布 -s 字节的消息，每次 send 攒 -b 条，
+ * -r 限制每个发布者每秒的消息数(0 不限，由 broker 的背压限速)。
+ * payload 开头是发布时刻，订阅者收到时计算时延。
+ * 结束时输出发布和投递的 msgs/sec、p50/p99 时延、预期投递数和实际投递数。
+ *
+ * -L size 不压测，只检查大消息分两次到达的情况：先发 PUB 行和前 1000 字节，停一会再发剩下的，
+ * 订阅者必须原样收到整条消息，否则进程返回 1。
+ *
+ * shell: gcc -O2 pubsub_bench.c -o pubsub_bench -lpthread
+ * usage: ./pubsub_bench [-P pubs] [-S subs] [-T topics] [-t threads] [-s size] [-b batch]
+ *                       [-r rate] [-d seconds] [-o policy] [-L size] ip port
+ */
+
+#define MAX_THREADS     64
+#define MAX_MSG         65536
+#define READ_BUFFER     (256 * 1024)
+#define MAX_EVENTS      1024
+#define LAT_BUCKETS     1000000     // 时延直方图：1us 一格，最多 1s
+
+struct sub_conn {
+	int fd;
+	char *buf;
+	int len;
+};
+
+struct sub_thread {
+	pthread_t thread;
+	int epfd;
+	struct sub_conn *conns;
+	int nconns;
+	unsigned long received;
+	unsigned int *hist;
+};
+
+struct pub_thread {
+	pthread_t thread;
+	int id;
+	unsigned long published;
+};
+
+static struct sockaddr_in server_addr;
+static int npubs = 1, nsubs = 100, ntopics = 1, nthreads = 1;
+static int msgsize = 64, batch = 64, seconds = 5;
+static long rate = 0;
+static const char *policy = NULL;
+static volatile int running = 1, publishing = 1;
+
+static struct sub_thread sub_threads[MAX_THREADS];
+static struct pub_thread *pub_threads;
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int connect_broker(void) {
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	int nodelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	return fd;
+}
+
+static int send_all(int fd, const char *buf, int len) {
+	while (len > 0) {
+		int count = send(fd, buf, len, 0);
+		if (count <= 0) return -1;
+		buf += count;
+		len -= count;
+	}
+	return 0;
+}
+
+// 解析 "MSG topic len\n<payload>"，返回消耗的字节数，0 表示不完整
+static int parse_msg(struct sub_thread *st, const char *buf, int len, long long now) {
+
+	const char *nl = memchr(buf, '\n', len);
+	if (!nl) return 0;
+
+	const char *sp = nl;
+	while (sp > buf && sp[-1] != ' ') sp--;
+	int plen = atoi(sp);
+	int total = (int)(nl - buf) + 1 + plen;
+	if (len < total) return 0;
+
+	long long sent;
+	memcpy(&sent, nl + 1, sizeof(sent));
+	long long us = (now - sent) / 1000;
+	if (us < 0) us = 0;
+	st->hist[us < LAT_BUCKETS ? us : LAT_BUCKETS]++;
+	st->received++;
+	return total;
+}
+
+static void *sub_loop(void *arg) {
+
+	struct sub_thread *st = (struct sub_thread *)arg;
+	struct epoll_event events[MAX_EVENTS];
+
+	while (running) {
+		int nready = epoll_wait(st->epfd, events, MAX_EVENTS, 100);
+		long long now = now_ns();
+		int i;
+		for (i = 0;i < nready;i ++) {
+			struct sub_conn *c = &st->conns[events[i].data.u32];
+			int count = recv(c->fd, c->buf + c->len, READ_BUFFER - c->len, 0);
+			if (count <= 0) {
+				if (count < 0 && errno == EAGAIN) continue;
+				fprintf(stderr, "subscriber disconnected\n");
+				epoll_ctl(st->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+				continue;
+			}
+			c->len += count;
+
+			int pos = 0, used;
+			while ((used = parse_msg(st, c->buf + pos, c->len - pos, now)) > 0) {
+				pos += used;
+			}
+			memmove(c->buf, c->buf + pos, c->len - pos);
+			c->len -= pos;
+		}
+	}
+	return NULL;
+}
+
+static void *pub_loop(void *arg) {
+
+	struct pub_thread *pt = (struct pub_thread *)arg;
+
+	int fd = connect_broker();
+	if (fd < 0) {
+		perror("publisher connect");
+		return NULL;
+	}
+
+	char *buf = malloc((size_t)batch * (msgsize + 64));
+	char *payload = calloc(1, msgsize);
+	int topic = pt->id % ntopics;
+	long long start = now_ns();
+
+	while (publishing) {
+		long long now = now_ns();
+		memcpy(payload, &now, sizeof(now));
+
+		int len = 0, i;
+		for (i = 0;i < batch;i ++) {
+			len += sprintf(buf + len, "PUB t%d %d\n", topic, msgsize);
+			memcpy(buf + len, payload, msgsize);
+			len += msgsize;
+			topic = (topic + 1) % ntopics;
+		}
+		if (send_all(fd, buf, len) < 0) {
+			perror("publisher send");
+			break;
+		}
+		pt->published += batch;
+
+		if (rate > 0) {
+			// 按 rate 匀速发送
+			long long due = start + pt->published * 1000000000LL / rate;
+			long long wait = due - now_ns();
+			if (wait > 0) usleep(wait / 1000);
+		}
+	}
+
+	free(buf);
+	free(payload);
+	close(fd);
+	return NULL;
+}
+
+// 一条 size 字节的消息分两次发送，检查订阅者收到的内容
+static int check_split_pub(int size) {
+
+	int sub = connect_broker(), pub = connect_broker();
+	if (sub < 0 || pub < 0) {
+		perror("connect");
+		return -1;
+	}
+	send_all(sub, "SUB big\n", 8);
+	usleep(100 * 1000);
+
+	char header[64];
+	int hlen = sprintf(header, "PUB big %d\n", size);
+	int first = size < 1000 ? size : 1000;
+	char *payload = malloc(size);
+	int i;
+	for (i = 0;i < size;i ++) payload[i] = (char)('a' + i % 26);
+	send_all(pub, header, hlen);
+	send_all(pub, payload, first);
+	usleep(100 * 1000);
+	send_all(pub, payload + first, size - first);
+
+	// 期望收到 "MSG big size\n<payload>"
+	char expect[64];
+	int elen = sprintf(expect, "MSG big %d\n", size);
+	int want = elen + size, got = 0;
+	char *buf = malloc(want);
+	struct timeval tv = { 3, 0 };
+	setsockopt(sub, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	while (got < want) {
+		int count = recv(sub, buf + got, want - got, 0);
+		if (count <= 0) break;
+		got += count;
+	}
+	int ok = got == want && memcmp(buf, expect, elen) == 0 && memcmp(buf + elen, payload, size) == 0;
+	// broker 断开发布者也算失败
+	char c;
+	if (ok && recv(pub, &c, 1, MSG_DONTWAIT) == 0) ok = 0;
+
+	printf("RESULT split PUB %d bytes: received %d of %d %s\n", size, got, want, ok ? "PASS" : "FAIL");
+	free(buf);
+	free(payload);
+	close(pub);
+	close(sub);
+	return ok ? 0 : 1;
+}
+
+static unsigned long percentile(unsigned int *hist, unsigned long total, double p) {
+	unsigned long target = (unsigned long)(total * p), seen = 0;
+	int i;
+	for (i = 0;i <= LAT_BUCKETS;i ++) {
+		seen += hist[i];
+		if (seen > target) return i;
+	}
+	return LAT_BUCKETS;
+}
+
+int main(int argc, char *argv[]) {
+
+	int opt, split = 0;
+	while ((opt = getopt(argc, argv, "P:S:T:t:s:b:r:d:o:L:")) != -1) {
+		switch (opt) {
+		case 'P': npubs = atoi(optarg); break;
+		case 'S': nsubs = atoi(optarg); break;
+		case 'T': ntopics = atoi(optarg); break;
+		case 't': nthreads = atoi(optarg); break;
+		case 's': msgsize = atoi(optarg); break;
+		case 'b': batch = atoi(optarg); break;
+		case 'r': rate = atol(optarg); break;
+		case 'd': seconds = atoi(optarg); break;
+		case 'o': policy = optarg; break;
+		case 'L': split = atoi(optarg); break;
+		default:
+			optind = argc + 1;
+		}
+	}
+	if (optind + 2 != argc) {
+		printf("usage: %s [-P pubs] [-S subs] [-T topics] [-t threads] [-s size] [-b batch]\n"
+			"          [-r rate] [-d seconds] [-o policy] [-L size] ip port\n", argv[0]);
+		return -1;
+	}
+	if (msgsize < (int)sizeof(long long)) msgsize = sizeof(long long);
+	if (msgsize > MAX_MSG) msgsize = MAX_MSG;
+	if (ntopics < 1) ntopics = 1;
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+	if (batch < 1) batch = 1;
+
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(atoi(argv[optind + 1]));
+	inet_pton(AF_INET, argv[optind], &server_addr.sin_addr);
+	if (split > 0) return check_split_pub(split);
+
+	// 1. 订阅者：连接、设置策略、订阅，按线程分组
+	int i;
+	for (i = 0;i < nthreads;i ++) {
+		struct sub_thread *st = &sub_threads[i];
+		st->epfd = epoll_create(1);
+		st->conns = calloc(nsubs / nthreads + 1, sizeof(struct sub_conn));
+		st->hist = calloc(LAT_BUCKETS + 1, sizeof(unsigned int));
+	}
+	for (i = 0;i < nsubs;i ++) {
+		struct sub_thread *st = &sub_threads[i % nthreads];
+		struct sub_conn *c = &st->conns[st->nconns];
+
+		c->fd = connect_broker();
+		if (c->fd < 0) {
+			perror("subscriber connect");
+			return -1;
+		}
+		char cmd[128];
+		int len = 0;
+		if (policy) len += sprintf(cmd + len, "POLICY %s\n", policy);
+		len += sprintf(cmd + len, "SUB t%d\n", i % ntopics);
+		send_all(c->fd, cmd, len);
+
+		fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK);
+		c->buf = malloc(READ_BUFFER);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u32 = st->nconns;
+		epoll_ctl(st->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+		st->nconns++;
+	}
+	for (i = 0;i < nthreads;i ++) {
+		pthread_create(&sub_threads[i].thread, NULL, sub_loop, &sub_threads[i]);
+	}
+	usleep(300 * 1000);   // 等 broker 处理完订阅
+
+	// 2. 发布者
+	pub_threads = calloc(npubs, sizeof(struct pub_thread));
+	long long start = now_ns();
+	for (i = 0;i < npubs;i ++) {
+		pub_threads[i].id = i;
+		pthread_create(&pub_threads[i].thread, NULL, pub_loop, &pub_threads[i]);
+	}
+	sleep(seconds);
+
+	// 发布窗口内的投递量，之后再等积压投递完
+	unsigned long received = 0;
+	for (i = 0;i < nthreads;i ++) received += sub_threads[i].received;
+	long long elapsed = now_ns() - start;
+
+	publishing = 0;
+	unsigned long published = 0;
+	for (i = 0;i < npubs;i ++) {
+		pthread_join(pub_threads[i].thread, NULL);
+		published += pub_threads[i].published;
+	}
+	unsigned long total = 0, last = (unsigned long)-1;
+	while (total != last) {
+		last = total;
+		usleep(500 * 1000);
+		total = 0;
+		for (i = 0;i < nthreads;i ++) total += sub_threads[i].received;
+	}
+	running = 0;
+
+	unsigned int *hist = sub_threads[0].hist;
+	for (i = 0;i < nthreads;i ++) {
+		pthread_join(sub_threads[i].thread, NULL);
+		if (i > 0) {
+			int j;
+			for (j = 0;j <= LAT_BUCKETS;j ++) hist[j] += sub_threads[i].hist[j];
+		}
+	}
+
+	// 每个 topic 的订阅者数 * 发到这个 topic 的消息数；发布者轮流发各 topic，按平均估算
+	double fanout = (double)nsubs / ntopics;
+	unsigned long expected = (unsigned long)(published * fanout);
+	double sec = elapsed / 1e9;
+	unsigned long p50 = percentile(hist, total, 0.50), p99 = percentile(hist, total, 0.99);
+
+	printf("%d pubs, %d subs, %d topics, %d bytes: published %.0f msgs/sec, delivered %.0f msgs/sec\n",
+		npubs, nsubs, ntopics, msgsize, published / sec, received / sec);
+	printf("latency p50 %luus, p99 %luus, delivered %lu of %lu expected (%.2f%%)\n",
+		p50, p99, total, expected, expected ? total * 100.0 / expected : 0.0);
+	printf("RESULT pub_per_sec=%.0f delivered_per_sec=%.0f p50_us=%lu p99_us=%lu delivered=%lu expected=%lu\n",
+		published / sec, received / sec, p50, p99, total, expected);
+	return 0;
+}
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE         // recvmmsg / sendmmsg
+
 #include <sys/socket.h>     // socket相关API
 #include <errno.h>          // 错误码定义
 #include <netinet/in.h>     // 网络地址结构体
@@ -10,6 +12,18 @@
 #include <sys/poll.h>       // poll多路复用
 #include <sys/epoll.h>      // epoll多路复用
 #include <sys/time.h>       // 时间相关函数
+#include <netinet/udp.h>    // UDP_SEGMENT / UDP_GRO
+#include <fcntl.h>          // fcntl
+#include <stdlib.h>         // malloc
+#include <sys/un.h>         // AF_UNIX 地址结构体
+#include <signal.h>         // signal
+
+
+#define ENABLE_UDP			1      // UDP 报文监听(recvmmsg/sendmmsg 批量收发)
+#define ENABLE_UNIX			1      // AF_UNIX stream/seqpacket 监听，支持 SCM_RIGHTS 传递 fd
+
+#define UNIX_STREAM_PATH	"/tmp/reactor.sock"
+#define UNIX_SEQPACKET_PATH	"/tmp/reactor.seqpacket.sock"
 
 
 #define BUFFER_LENGTH		512    // 缓冲区大小定义
@@ -48,6 +62,7 @@ int epfd = 0;                                      // epoll实例描述符
 struct conn_item connlist[1048576] = {0};          // 连接列表，使用文件描述符作为索引
                                                    // 1048576 = 2^20，支持百万级连接
 struct timeval zvoice_king;                        // 性能测试用的时间戳
+int verbose = 1;                                   // -q 关闭逐条打印，压测时打印会成为瓶颈
 
 // 计算两个时间差(毫秒)的宏
 // 1000000
@@ -74,18 +89,8 @@ int set_event(int fd, int event, int flag) {
 
 }
 
-int accept_cb(int fd) {
-
-	struct sockaddr_in clientaddr;
-	socklen_t len = sizeof(clientaddr);
-
-	int clientfd = accept(fd, (struct sockaddr*)&clientaddr, &len);
-	
-	if (clientfd < 0) {
-		return -1;
-	}
-
-	printf("accept clientfd: %d\n", clientfd);
+// 把一个已连接的 fd 纳入 connlist 管理：accept 得到的，或者通过 SCM_RIGHTS 收到的
+int conn_register(int clientfd) {
 
 	set_event(clientfd, EPOLLIN, 1);
 
@@ -98,6 +103,25 @@ int accept_cb(int fd) {
 	connlist[clientfd].recv_t.recv_callback = recv_cb;
 	connlist[clientfd].send_callback = send_cb;
 
+	return clientfd;
+}
+
+int accept_cb(int fd) {
+
+	// sockaddr_storage 可以容纳 AF_INET / AF_UNIX 任意一种地址
+	struct sockaddr_storage clientaddr;
+	socklen_t len = sizeof(clientaddr);
+
+	int clientfd = accept(fd, (struct sockaddr*)&clientaddr, &len);
+	
+	if (clientfd < 0) {
+		return -1;
+	}
+
+	if (verbose) printf("accept clientfd: %d\n", clientfd);
+
+	conn_register(clientfd);
+
 	if ((clientfd % 1000) == 999) {
 		struct timeval tv_cur;
 		gettimeofday(&tv_cur, NULL);
@@ -119,8 +143,8 @@ int recv_cb(int fd) { // fd --> EPOLLIN
 	// buffer+idx: 讲新数据追加在buffer的尾部
 	// BUFFER_LENGTH-idx: 剩余空间大小
 	int count = recv(fd, buffer+idx, BUFFER_LENGTH-idx, 0);
-	if (count == 0) {
-		printf("clientfd: %d close\n", fd);
+	if (count <= 0) {
+		if (verbose) printf("clientfd: %d close\n", fd);
 
 		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);		
 		close(fd);
@@ -129,7 +153,7 @@ int recv_cb(int fd) { // fd --> EPOLLIN
 	}
 	connlist[fd].rlen += count;
 
-    printf("socketfd: %d recv count: %d --> buffer: %s\n", fd, count, buffer);
+    if (verbose) printf("socketfd: %d recv count: %d --> buffer: %s\n", fd, count, buffer);
 
 	memcpy(connlist[fd].wbuffer, connlist[fd].rbuffer, connlist[fd].rlen);
 	connlist[fd].wlen = connlist[fd].rlen;
@@ -155,6 +179,331 @@ int send_cb(int fd) {
 }
 
 
+#if ENABLE_UDP
+
+// UDP 监听：一次系统调用收发一批报文，而不是每个报文一次 recvfrom/sendto
+// 回显场景下收到的一批报文直接用 sendmmsg 原样发回；发送缓冲区满(EAGAIN)时
+// 剩余报文保留在 pending 中，改为关注 EPOLLOUT，在 udp_send_cb 中继续发送
+
+#define UDP_BATCH			64		// 每次 recvmmsg/sendmmsg 的最大报文数
+#define MAX_UDP_LISTENERS	16
+
+#if defined(UDP_GRO) && defined(UDP_SEGMENT)
+// GRO 会把同一对端的多个报文合并成一个最大 64K 的报文交给用户态，
+// 回显时用 GSO 按原来的段大小交给内核拆分，一次拷贝处理一整串报文
+#define UDP_ENABLE_GSO		1
+#define UDP_BUFFER_SIZE		65536
+#else
+#define UDP_ENABLE_GSO		0
+#define UDP_BUFFER_SIZE		2048
+#endif
+
+#define UDP_POOL_SIZE		(UDP_BATCH * 2)
+
+// 报文缓冲区：从缓冲池中取出，发送完成后归还
+struct udp_buf {
+	struct udp_buf *next;
+	struct sockaddr_in addr;            // 对端地址，回显时作为目的地址
+	int len;
+	int gso_size;                       // GRO 合并后每段的大小，0 表示单个报文
+	char control[CMSG_SPACE(sizeof(int))];
+	char data[UDP_BUFFER_SIZE];
+};
+
+struct udp_listener {
+	int fd;
+	int gso;                            // 是否成功开启了 GRO/GSO
+	struct udp_buf *pending[UDP_BATCH]; // 等待发送的报文
+	int npending;
+	unsigned long datagrams;            // 收到的报文数(GRO 合并的按段计算)
+	unsigned long recv_calls;           // recvmmsg 调用次数
+};
+
+static struct udp_buf *udp_freelist = NULL;
+static struct udp_listener udp_listeners[MAX_UDP_LISTENERS];
+static int udp_listener_count = 0;
+
+static int udp_pool_init(void) {
+	int i;
+	for (i = 0;i < UDP_POOL_SIZE;i ++) {
+		struct udp_buf *buf = (struct udp_buf *)malloc(sizeof(struct udp_buf));
+		if (!buf) return -1;
+		buf->next = udp_freelist;
+		udp_freelist = buf;
+	}
+	return 0;
+}
+
+static struct udp_buf *udp_buf_get(void) {
+	struct udp_buf *buf = udp_freelist;
+	if (buf) udp_freelist = buf->next;
+	return buf;
+}
+
+static void udp_buf_put(struct udp_buf *buf) {
+	buf->next = udp_freelist;
+	udp_freelist = buf;
+}
+
+static struct udp_listener *udp_find(int fd) {
+	int i;
+	for (i = 0;i < udp_listener_count;i ++) {
+		if (udp_listeners[i].fd == fd) return &udp_listeners[i];
+	}
+	return NULL;
+}
+
+// 把 pending 中的报文尽量发出去，返回剩余未发送的个数
+static int udp_flush(struct udp_listener *ul) {
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iovs[UDP_BATCH];
+	int i;
+
+	while (ul->npending > 0) {
+		memset(msgs, 0, sizeof(struct mmsghdr) * ul->npending);
+		for (i = 0;i < ul->npending;i ++) {
+			struct udp_buf *buf = ul->pending[i];
+			iovs[i].iov_base = buf->data;
+			iovs[i].iov_len = buf->len;
+			msgs[i].msg_hdr.msg_name = &buf->addr;
+			msgs[i].msg_hdr.msg_namelen = sizeof(buf->addr);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+#if UDP_ENABLE_GSO
+			if (buf->gso_size > 0 && buf->gso_size < buf->len) {
+				// 复用接收时的 control 缓冲区，写入 UDP_SEGMENT
+				struct cmsghdr *cm;
+				msgs[i].msg_hdr.msg_control = buf->control;
+				msgs[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+				cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+				cm->cmsg_level = SOL_UDP;
+				cm->cmsg_type = UDP_SEGMENT;
+				cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+				*(uint16_t *)CMSG_DATA(cm) = (uint16_t)buf->gso_size;
+			}
+#endif
+		}
+
+		int sent = sendmmsg(ul->fd, msgs, ul->npending, MSG_DONTWAIT);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+			// 对端不可达等错误只影响第一个报文，丢弃它避免卡住整批
+			sent = 1;
+		}
+
+		for (i = 0;i < sent;i ++) {
+			udp_buf_put(ul->pending[i]);
+		}
+		memmove(ul->pending, ul->pending + sent, sizeof(struct udp_buf *) * (ul->npending - sent));
+		ul->npending -= sent;
+	}
+	return ul->npending;
+}
+
+int udp_recv_cb(int fd) {
+	struct udp_listener *ul = udp_find(fd);
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iovs[UDP_BATCH];
+	struct udp_buf *bufs[UDP_BATCH];
+	int i, n = 0;
+
+	// 上一批还没发完，先不读新的(背压)
+	if (ul->npending > 0) return 0;
+
+	memset(msgs, 0, sizeof(msgs));
+	while (n < UDP_BATCH && (bufs[n] = udp_buf_get()) != NULL) {
+		iovs[n].iov_base = bufs[n]->data;
+		iovs[n].iov_len = UDP_BUFFER_SIZE;
+		msgs[n].msg_hdr.msg_name = &bufs[n]->addr;
+		msgs[n].msg_hdr.msg_namelen = sizeof(bufs[n]->addr);
+		msgs[n].msg_hdr.msg_iov = &iovs[n];
+		msgs[n].msg_hdr.msg_iovlen = 1;
+		msgs[n].msg_hdr.msg_control = bufs[n]->control;
+		msgs[n].msg_hdr.msg_controllen = sizeof(bufs[n]->control);
+		n ++;
+	}
+	if (n == 0) return 0;
+
+	int count = recvmmsg(fd, msgs, n, MSG_DONTWAIT, NULL);
+	if (count < 0) count = 0;
+
+	for (i = 0;i < count;i ++) {
+		struct udp_buf *buf = bufs[i];
+		buf->len = msgs[i].msg_len;
+		buf->gso_size = 0;
+#if UDP_ENABLE_GSO
+		struct cmsghdr *cm;
+		for (cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm; cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)) {
+			if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+				buf->gso_size = *(int *)CMSG_DATA(cm);
+			}
+		}
+#endif
+		ul->datagrams += buf->gso_size > 0 ? (buf->len + buf->gso_size - 1) / buf->gso_size : 1;
+		ul->pending[ul->npending++] = buf;
+	}
+	for (i = count;i < n;i ++) {
+		udp_buf_put(bufs[i]);
+	}
+	if (count == 0) return 0;
+
+	if ((++ul->recv_calls % 100000) == 0) {
+		printf("udp fd: %d, datagrams: %lu, datagrams per recvmmsg: %.1f\n",
+			fd, ul->datagrams, (double)ul->datagrams / ul->recv_calls);
+	}
+
+	if (udp_flush(ul) > 0) {
+		set_event(fd, EPOLLOUT, 0);
+	}
+	return count;
+}
+
+int udp_send_cb(int fd) {
+	struct udp_listener *ul = udp_find(fd);
+
+	if (udp_flush(ul) == 0) {
+		set_event(fd, EPOLLIN, 0);
+	}
+	return 0;
+}
+
+int init_udp_server(unsigned short port) {
+
+	if (udp_listener_count >= MAX_UDP_LISTENERS) return -1;
+	if (udp_freelist == NULL && udp_pool_init() != 0) return -1;
+
+	int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	struct sockaddr_in serveraddr;
+	memset(&serveraddr, 0, sizeof(struct sockaddr_in));
+
+	serveraddr.sin_family = AF_INET;
+	serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	serveraddr.sin_port = htons(port);
+
+	if (-1 == bind(sockfd, (struct sockaddr*)&serveraddr, sizeof(struct sockaddr))) {
+		perror("bind");
+		close(sockfd);
+		return -1;
+	}
+	fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+
+	struct udp_listener *ul = &udp_listeners[udp_listener_count++];
+	memset(ul, 0, sizeof(*ul));
+	ul->fd = sockfd;
+#if UDP_ENABLE_GSO
+	int on = 1;
+	// 老内核不支持 UDP_GRO，失败时退回逐个报文收发
+	ul->gso = (setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0);
+#endif
+
+	return sockfd;
+}
+
+#endif
+
+#if ENABLE_UNIX
+
+// AF_UNIX 监听：同机的 sidecar 不经过 TCP 协议栈(校验和、拥塞控制、回环网卡)
+// stream 与 TCP 语义相同；seqpacket 面向连接但保留消息边界，一次 recv 恰好是一条消息
+// 连接上收到的消息如果携带 SCM_RIGHTS，里面的 fd 会被当作新连接纳入 connlist，
+// 例如 sidecar 接受外部 TCP 连接后把 fd 转交给本服务处理(见 unix_sidecar.c)
+
+#define UNIX_MAX_FDS		16		// 一条消息最多携带的 fd 个数
+
+int unix_recv_cb(int fd) {
+
+	char *buffer = connlist[fd].rbuffer;
+	char control[CMSG_SPACE(sizeof(int) * UNIX_MAX_FDS)];
+	struct iovec iov = { buffer, BUFFER_LENGTH };
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	int count = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	if (count <= 0) {
+		if (verbose) printf("unix clientfd: %d close\n", fd);
+
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+		close(fd);
+
+		return -1;
+	}
+
+	int passed = 0;
+	struct cmsghdr *cm;
+	for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+		if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+
+		int *fds = (int *)CMSG_DATA(cm);
+		int nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		int k;
+		for (k = 0;k < nfds;k ++) {
+			if (verbose) printf("unix clientfd: %d pass fd: %d\n", fd, fds[k]);
+			conn_register(fds[k]);
+			passed ++;
+		}
+	}
+	if (msg.msg_flags & MSG_CTRUNC) {
+		fprintf(stderr, "unix clientfd: %d, too many fds in one message\n", fd);
+	}
+
+	// 携带 fd 的消息是控制消息，不回显
+	if (passed > 0) return count;
+
+	memcpy(connlist[fd].wbuffer, buffer, count);
+	connlist[fd].wlen = count;
+
+	set_event(fd, EPOLLOUT, 0);
+
+	return count;
+}
+
+int unix_accept_cb(int fd) {
+
+	int clientfd = accept(fd, NULL, NULL);
+	if (clientfd < 0) {
+		return -1;
+	}
+
+	if (verbose) printf("unix accept clientfd: %d\n", clientfd);
+
+	conn_register(clientfd);
+	connlist[clientfd].recv_t.recv_callback = unix_recv_cb;
+
+	return clientfd;
+}
+
+// type: SOCK_STREAM 或 SOCK_SEQPACKET
+int init_unix_server(const char *path, int type) {
+
+	int sockfd = socket(AF_UNIX, type, 0);
+
+	struct sockaddr_un serveraddr;
+	memset(&serveraddr, 0, sizeof(struct sockaddr_un));
+
+	serveraddr.sun_family = AF_UNIX;
+	strncpy(serveraddr.sun_path, path, sizeof(serveraddr.sun_path) - 1);
+
+	// 上次运行留下的 socket 文件会导致 bind 失败
+	unlink(path);
+	if (-1 == bind(sockfd, (struct sockaddr*)&serveraddr, sizeof(struct sockaddr_un))) {
+		perror("bind");
+		close(sockfd);
+		return -1;
+	}
+
+	listen(sockfd, 128);
+
+	return sockfd;
+}
+
+#endif
+
 int init_server(unsigned short port) {
 
 	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -177,22 +526,57 @@ int init_server(unsigned short port) {
 }
 
 // ip:43.133.211.95
-int main() {
+int main(int argc, char **argv) {
 
 	int port_count = 20;
 	unsigned short port = 2048;
 	int i = 0;
 
+	if (argc > 1 && strcmp(argv[1], "-q") == 0) {
+		verbose = 0;
+	}
+
+	// 对端关闭后继续 send 会收到 SIGPIPE，默认动作是终止整个进程
+	signal(SIGPIPE, SIG_IGN);
+
 	
 	epfd = epoll_create(1); // int size
 
 	for (i = 0;i < port_count;i ++) {
 		int sockfd = init_server(port + i);  // 2048, 2049, 2050, 2051 ... 2057
+		if (sockfd < 0) continue;
 		connlist[sockfd].fd = sockfd;
 		connlist[sockfd].recv_t.accept_callback = accept_cb;
 		set_event(sockfd, EPOLLIN, 1);
 	}
 
+#if ENABLE_UDP
+	{
+		// UDP 与 TCP 端口空间互不影响，同样使用 2048
+		int sockfd = init_udp_server(port);
+		if (sockfd >= 0) {
+			connlist[sockfd].fd = sockfd;
+			connlist[sockfd].recv_t.recv_callback = udp_recv_cb;
+			connlist[sockfd].send_callback = udp_send_cb;
+			set_event(sockfd, EPOLLIN, 1);
+		}
+	}
+#endif
+
+#if ENABLE_UNIX
+	{
+		const char *paths[2] = { UNIX_STREAM_PATH, UNIX_SEQPACKET_PATH };
+		int types[2] = { SOCK_STREAM, SOCK_SEQPACKET };
+		for (i = 0;i < 2;i ++) {
+			int sockfd = init_unix_server(paths[i], types[i]);
+			if (sockfd < 0) continue;
+			connlist[sockfd].fd = sockfd;
+			connlist[sockfd].recv_t.accept_callback = unix_accept_cb;
+			set_event(sockfd, EPOLLIN, 1);
+		}
+	}
+#endif
+
 	gettimeofday(&zvoice_king, NULL);
 
 	struct epoll_event events[1024] = {0};
@@ -216,7 +600,7 @@ int main() {
 				//printf("recv count: %d <-- buffer: %s\n", count, connlist[connfd].rbuffer);
 
 			} else if (events[i].events & EPOLLOUT) { 
-				printf("send --> buffer: %s\n",  connlist[connfd].wbuffer);
+				if (verbose) printf("send --> buffer: %s\n",  connlist[connfd].wbuffer);
 				
 				int count = connlist[connfd].send_callback(connfd);
 			}
@@ -0,0 +1,530 @@
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rpc.h"
+
+/**
+ * shell: g++ -O2 -std=c++17 rpc.cc rpc_bench.cc -o rpc_bench -lpthread
+ */
+
+#define RPC_READ_SIZE		65536
+#define RPC_MAX_EVENTS		1024
+
+
+void rpc_encode(std::string &out, const rpc_header &hdr, const char *body, size_t len) {
+
+	char buf[RPC_HEADER_SIZE];
+	uint16_t magic = htons(RPC_MAGIC), method = htons(hdr.method), status = htons(hdr.status);
+	uint32_t id = htonl(hdr.id), length = htonl((uint32_t)len);
+
+	memcpy(buf, &magic, 2);
+	buf[2] = RPC_VERSION;
+	buf[3] = hdr.type;
+	memcpy(buf + 4, &method, 2);
+	memcpy(buf + 6, &status, 2);
+	memcpy(buf + 8, &id, 4);
+	memcpy(buf + 12, &length, 4);
+
+	out.append(buf, RPC_HEADER_SIZE);
+	out.append(body, len);
+}
+
+// 返回 1 解析出帧头，0 不足一个帧头，-1 非法
+int rpc_decode_header(const char *buf, size_t len, rpc_header *hdr) {
+
+	if (len < RPC_HEADER_SIZE) return 0;
+
+	uint16_t magic, method, status;
+	uint32_t id, length;
+	memcpy(&magic, buf, 2);
+	memcpy(&method, buf + 4, 2);
+	memcpy(&status, buf + 6, 2);
+	memcpy(&id, buf + 8, 4);
+	memcpy(&length, buf + 12, 4);
+
+	hdr->magic = ntohs(magic);
+	hdr->version = buf[2];
+	hdr->type = buf[3];
+	hdr->method = ntohs(method);
+	hdr->status = ntohs(status);
+	hdr->id = ntohl(id);
+	hdr->length = ntohl(length);
+
+	if (hdr->magic != RPC_MAGIC || hdr->version != RPC_VERSION || hdr->length > RPC_MAX_BODY) {
+		return -1;
+	}
+	return 1;
+}
+
+static int epoll_set(int epfd, int op, int fd, uint32_t events) {
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.fd = fd;
+	return epoll_ctl(epfd, op, fd, &ev);
+}
+
+
+// ---------------- server ----------------
+
+RpcServer::RpcServer(size_t workers) : pool_(new ThreadPool(workers)) {
+	epfd_ = epoll_create1(0);
+	eventfd_ = eventfd(0, EFD_NONBLOCK);
+	epoll_set(epfd_, EPOLL_CTL_ADD, eventfd_, EPOLLIN);
+}
+
+RpcServer::~RpcServer() {
+	Stop();
+	pool_.reset();
+	for (auto &conn : conns_) {
+		if (conn) close(conn->fd);
+	}
+	if (listenfd_ >= 0) close(listenfd_);
+	close(eventfd_);
+	close(epfd_);
+}
+
+void RpcServer::Register(uint16_t method, RpcHandler handler, bool inline_call) {
+	methods_[method] = Method{std::move(handler), inline_call};
+}
+
+int RpcServer::Listen(unsigned short port) {
+
+	int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	int reuse = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		close(sockfd);
+		return -1;
+	}
+	listen(sockfd, 4096);
+
+	listenfd_ = sockfd;
+	epoll_set(epfd_, EPOLL_CTL_ADD, sockfd, EPOLLIN);
+	return 0;
+}
+
+void RpcServer::Stop() {
+	running_ = false;
+}
+
+void RpcServer::Run() {
+
+	struct epoll_event events[RPC_MAX_EVENTS];
+	running_ = true;
+
+	while (running_) {
+		int nready = epoll_wait(epfd_, events, RPC_MAX_EVENTS, 100);
+		for (int i = 0; i < nready; i++) {
+			int fd = events[i].data.fd;
+			if (fd == listenfd_) {
+				OnAccept();
+				continue;
+			}
+			if (fd == eventfd_) {
+				OnCompletion();
+				continue;
+			}
+			if (fd >= (int)conns_.size() || !conns_[fd]) continue;
+
+			Conn *conn = conns_[fd].get();
+			if ((events[i].events & EPOLLIN) || !(events[i].events & EPOLLOUT)) {
+				if (OnRead(conn) < 0) continue;
+			}
+			if (events[i].events & EPOLLOUT) {
+				OnWrite(conn);
+			}
+		}
+	}
+}
+
+void RpcServer::OnAccept() {
+
+	while (1) {
+		int fd = accept4(listenfd_, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0) return;
+
+		int nodelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+		if (fd >= (int)conns_.size()) conns_.resize(fd + 1);
+
+		conns_[fd].reset(new Conn());
+		conns_[fd]->fd = fd;
+		conns_[fd]->gen = ++next_gen_;
+		epoll_set(epfd_, EPOLL_CTL_ADD, fd, EPOLLIN);
+	}
+}
+
+// 读到的所有完整帧依次分发，内联方法的响应攒在 wbuf 中，最后一次发出
+int RpcServer::OnRead(Conn *conn) {
+
+	char buf[RPC_READ_SIZE];
+	ssize_t count = recv(conn->fd, buf, sizeof(buf), 0);
+	if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return 0;
+	}
+	if (count <= 0) {
+		CloseConn(conn);
+		return -1;
+	}
+	conn->rbuf.append(buf, count);
+
+	size_t pos = 0;
+	while (1) {
+		rpc_header hdr;
+		int ret = rpc_decode_header(conn->rbuf.data() + pos, conn->rbuf.size() - pos, &hdr);
+		if (ret < 0) {
+			CloseConn(conn);
+			return -1;
+		}
+		if (ret == 0 || conn->rbuf.size() - pos < RPC_HEADER_SIZE + hdr.length) break;
+
+		Dispatch(conn, hdr, conn->rbuf.substr(pos + RPC_HEADER_SIZE, hdr.length));
+		pos += RPC_HEADER_SIZE + hdr.length;
+	}
+	conn->rbuf.erase(0, pos);
+
+	return OnWrite(conn);
+}
+
+void RpcServer::Dispatch(Conn *conn, const rpc_header &hdr, std::string body) {
+
+	if (hdr.type != RPC_REQUEST) return;
+
+	rpc_header resp_hdr = hdr;
+	resp_hdr.type = RPC_RESPONSE;
+
+	auto it = methods_.find(hdr.method);
+	if (it == methods_.end()) {
+		resp_hdr.status = RPC_ERR_NO_METHOD;
+		rpc_encode(conn->wbuf, resp_hdr, NULL, 0);
+		return;
+	}
+
+	const Method *m = &it->second;
+	if (m->inline_call) {
+		std::string resp;
+		// 和线程池路径一样：异常不能穿过 OnRead 结束整个 IO 线程
+		try {
+			resp_hdr.status = m->handler(body, resp);
+		} catch (...) {
+			resp_hdr.status = RPC_ERR_EXCEPTION;
+			resp.clear();
+		}
+		rpc_encode(conn->wbuf, resp_hdr, resp.data(), resp.size());
+		return;
+	}
+
+	// 线程池执行，完成后放入 completions_ 并通过 eventfd 唤醒 IO 线程；
+	// enqueue 返回的 future 不需要：结果由 IO 线程按 request_id 发回
+	int fd = conn->fd;
+	uint64_t gen = conn->gen;
+	pool_->enqueue([this, m, fd, gen, resp_hdr, body = std::move(body)]() mutable {
+		std::string resp;
+		try {
+			resp_hdr.status = m->handler(body, resp);
+		} catch (...) {
+			resp_hdr.status = RPC_ERR_EXCEPTION;
+			resp.clear();
+		}
+
+		Completion done{fd, gen, std::string()};
+		rpc_encode(done.frame, resp_hdr, resp.data(), resp.size());
+		bool wake;
+		{
+			std::lock_guard<std::mutex> guard(completion_mutex_);
+			wake = completions_.empty();
+			completions_.push_back(std::move(done));
+		}
+		if (wake) {
+			uint64_t one = 1;
+			ssize_t n = write(eventfd_, &one, sizeof(one));
+			(void)n;
+		}
+	});
+}
+
+// 线程池完成的响应：按连接追加到 wbuf，再逐个连接发送
+void RpcServer::OnCompletion() {
+
+	uint64_t counter;
+	ssize_t n = read(eventfd_, &counter, sizeof(counter));
+	(void)n;
+
+	std::vector<Completion> done;
+	{
+		std::lock_guard<std::mutex> guard(completion_mutex_);
+		done.swap(completions_);
+	}
+
+	std::vector<Completion *> touched;
+	for (auto &c : done) {
+		if (c.fd >= (int)conns_.size() || !conns_[c.fd] || conns_[c.fd]->gen != c.gen) {
+			continue;   // 连接已经关闭
+		}
+		Conn *conn = conns_[c.fd].get();
+		if (conn->wbuf.empty()) touched.push_back(&c);
+		conn->wbuf.append(c.frame);
+	}
+	for (auto *c : touched) {
+		if (conns_[c->fd] && conns_[c->fd]->gen == c->gen) {
+			OnWrite(conns_[c->fd].get());
+		}
+	}
+}
+
+int RpcServer::OnWrite(Conn *conn) {
+
+	while (conn->wsent < conn->wbuf.size()) {
+		ssize_t count = send(conn->fd, conn->wbuf.data() + conn->wsent, conn->wbuf.size() - conn->wsent, 0);
+		if (count < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				if (!conn->want_write) {
+					conn->want_write = true;
+					epoll_set(epfd_, EPOLL_CTL_MOD, conn->fd, EPOLLIN | EPOLLOUT);
+				}
+				return 0;
+			}
+			CloseConn(conn);
+			return -1;
+		}
+		conn->wsent += count;
+	}
+	conn->wbuf.clear();
+	conn->wsent = 0;
+	if (conn->want_write) {
+		conn->want_write = false;
+		epoll_set(epfd_, EPOLL_CTL_MOD, conn->fd, EPOLLIN);
+	}
+	return 0;
+}
+
+void RpcServer::CloseConn(Conn *conn) {
+	int fd = conn->fd;
+	epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+	conns_[fd].reset();
+}
+
+
+// ---------------- client ----------------
+
+RpcClient::RpcClient() {
+}
+
+RpcClient::~RpcClient() {
+	Close();
+}
+
+int RpcClient::Connect(const char *ip, unsigned short port) {
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, ip, &addr.sin_addr);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	int nodelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+	fd_ = fd;
+	epfd_ = epoll_create1(0);
+	eventfd_ = eventfd(0, EFD_NONBLOCK);
+	epoll_set(epfd_, EPOLL_CTL_ADD, fd_, EPOLLIN);
+	epoll_set(epfd_, EPOLL_CTL_ADD, eventfd_, EPOLLIN);
+
+	running_ = true;
+	io_thread_ = std::thread(&RpcClient::Loop, this);
+	return 0;
+}
+
+void RpcClient::Close() {
+	if (running_.exchange(false)) {
+		uint64_t one = 1;
+		ssize_t n = write(eventfd_, &one, sizeof(one));
+		(void)n;
+	}
+	if (io_thread_.joinable()) {
+		io_thread_.join();
+	}
+	FailAll();
+	if (fd_ >= 0) close(fd_);
+	if (eventfd_ >= 0) close(eventfd_);
+	if (epfd_ >= 0) close(epfd_);
+	fd_ = eventfd_ = epfd_ = -1;
+}
+
+void RpcClient::Call(uint16_t method, const std::string &req, RpcCallback cb) {
+
+	rpc_header hdr;
+	hdr.type = RPC_REQUEST;
+	hdr.method = method;
+	hdr.status = 0;
+	hdr.id = next_id_.fetch_add(1, std::memory_order_relaxed);
+
+	bool wake = false, closed;
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		closed = closed_;
+		if (!closed) {
+			pending_.emplace(hdr.id, std::move(cb));
+			// outbuf_ 非空说明已经唤醒过 IO 线程，这次的请求会被一起发出
+			wake = outbuf_.empty();
+			rpc_encode(outbuf_, hdr, req.data(), req.size());
+		}
+	}
+	if (closed) {
+		cb(RPC_ERR_CLOSED, std::string());
+		return;
+	}
+	if (wake) {
+		uint64_t one = 1;
+		ssize_t n = write(eventfd_, &one, sizeof(one));
+		(void)n;
+	}
+}
+
+std::future<RpcResult> RpcClient::Call(uint16_t method, const std::string &req) {
+
+	auto promise = std::make_shared<std::promise<RpcResult>>();
+	std::future<RpcResult> result = promise->get_future();
+	Call(method, req, [promise](int status, const std::string &body) {
+		promise->set_value(RpcResult{status, body});
+	});
+	return result;
+}
+
+uint64_t RpcClient::Pending() {
+	std::lock_guard<std::mutex> guard(mutex_);
+	return pending_.size();
+}
+
+// 把 Call 积累的请求取到 sendbuf_ 中发送，返回 -1 表示连接出错
+int RpcClient::Flush() {
+
+	while (1) {
+		if (sent_ == sendbuf_.size()) {
+			sendbuf_.clear();
+			sent_ = 0;
+			std::lock_guard<std::mutex> guard(mutex_);
+			sendbuf_.swap(outbuf_);
+		}
+		if (sendbuf_.empty()) break;
+
+		ssize_t count = send(fd_, sendbuf_.data() + sent_, sendbuf_.size() - sent_, MSG_NOSIGNAL);
+		if (count < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				if (!want_write_) {
+					want_write_ = true;
+					epoll_set(epfd_, EPOLL_CTL_MOD, fd_, EPOLLIN | EPOLLOUT);
+				}
+				return 0;
+			}
+			return -1;
+		}
+		sent_ += count;
+	}
+	if (want_write_) {
+		want_write_ = false;
+		epoll_set(epfd_, EPOLL_CTL_MOD, fd_, EPOLLIN);
+	}
+	return 0;
+}
+
+void RpcClient::FailAll() {
+
+	std::unordered_map<uint32_t, RpcCallback> pending;
+	{
+		std::lock_guard<std::mutex> guard(mutex_);
+		closed_ = true;
+		pending.swap(pending_);
+	}
+	for (auto &p : pending) {
+		p.second(RPC_ERR_CLOSED, std::string());
+	}
+}
+
+void RpcClient::Loop() {
+
+	struct epoll_event events[2];
+	char buf[RPC_READ_SIZE];
+
+	while (running_) {
+		int nready = epoll_wait(epfd_, events, 2, 100);
+		for (int i = 0; i < nready; i++) {
+			if (events[i].data.fd == eventfd_) {
+				uint64_t counter;
+				ssize_t n = read(eventfd_, &counter, sizeof(counter));
+				(void)n;
+				if (Flush() < 0) {
+					FailAll();
+					return;
+				}
+				continue;
+			}
+
+			if (events[i].events & EPOLLOUT) {
+				if (Flush() < 0) {
+					FailAll();
+					return;
+				}
+			}
+			if (!(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) continue;
+
+			ssize_t count = recv(fd_, buf, sizeof(buf), 0);
+			if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+			if (count <= 0) {
+				FailAll();
+				return;
+			}
+			rbuf_.append(buf, count);
+
+			size_t pos = 0;
+			while (1) {
+				rpc_header hdr;
+				int ret = rpc_decode_header(rbuf_.data() + pos, rbuf_.size() - pos, &hdr);
+				if (ret < 0) {
+					FailAll();
+					return;
+				}
+				if (ret == 0 || rbuf_.size() - pos < RPC_HEADER_SIZE + hdr.length) break;
+
+				RpcCallback cb;
+				{
+					std::lock_guard<std::mutex> guard(mutex_);
+					auto it = pending_.find(hdr.id);
+					if (it != pending_.end()) {
+						cb = std::move(it->second);
+						pending_.erase(it);
+					}
+				}
+				if (cb && hdr.type == RPC_RESPONSE) {
+					cb(hdr.status, rbuf_.substr(pos + RPC_HEADER_SIZE, hdr.length));
+				}
+				pos += RPC_HEADER_SIZE + hdr.length;
+			}
+			rbuf_.erase(0, pos);
+		}
+	}
+}
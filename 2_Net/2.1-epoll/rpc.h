@@ -0,0 +1,161 @@
+#pragma once
+
+/**
+ * 基于 reactor 连接模型的轻量 RPC
+ *
+ * 帧格式：16 字节固定头(网络字节序) + body
+ *   magic(2) version(1) type(1) method(2) status(2) request_id(4) length(4)
+ * 一条连接上可以同时有任意多个未完成的调用，响应按 request_id 匹配，顺序不必与请求一致。
+ *
+ * 服务端：一个 epoll IO 线程，按 method 查分发表；短方法在 IO 线程上直接执行，
+ *         其它方法交给 ThreadPool(1_CPBase/threadPool/tp.h)，完成后经 eventfd 通知 IO 线程发送响应。
+ * 客户端：一个 epoll IO 线程负责收发，Call 可以在任意线程调用，返回 std::future 或在 IO 线程上回调。
+ */
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../../1_CPBase/threadPool/tp.h"
+
+#define RPC_MAGIC			0x5250			// "RP"
+#define RPC_VERSION			1
+#define RPC_HEADER_SIZE		16
+#define RPC_MAX_BODY		(16 << 20)		// 超过的帧视为协议错误，关闭连接
+
+enum {
+	RPC_REQUEST = 0,
+	RPC_RESPONSE = 1,
+};
+
+// 响应状态码，方法自己的错误码从 RPC_ERR_USER 开始
+enum {
+	RPC_OK = 0,
+	RPC_ERR_NO_METHOD = 1,      // 服务端没有注册这个 method
+	RPC_ERR_CLOSED = 2,         // 连接断开，调用没有得到响应
+	RPC_ERR_EXCEPTION = 3,      // 方法抛出了异常
+	RPC_ERR_USER = 100,
+};
+
+struct rpc_header {
+	uint16_t magic;
+	uint8_t version;
+	uint8_t type;
+	uint16_t method;
+	uint16_t status;
+	uint32_t id;
+	uint32_t length;
+};
+
+// 编码一帧追加到 out；解析 buf 开头的帧头，完整返回 1，不足 16 字节返回 0，非法返回 -1
+void rpc_encode(std::string &out, const rpc_header &hdr, const char *body, size_t len);
+int rpc_decode_header(const char *buf, size_t len, rpc_header *hdr);
+
+
+// 服务端方法：req 为请求体，resp 填写响应体，返回状态码
+typedef std::function<int(const std::string &req, std::string &resp)> RpcHandler;
+
+class RpcServer {
+public:
+	explicit RpcServer(size_t workers = 4);
+	~RpcServer();
+
+	// inline_call: 在 IO 线程上直接执行，只适合不阻塞的短方法
+	void Register(uint16_t method, RpcHandler handler, bool inline_call = false);
+	int Listen(unsigned short port);
+	void Run();                 // 运行 IO 循环直到 Stop
+	void Stop();
+
+private:
+	struct Method {
+		RpcHandler handler;
+		bool inline_call;
+	};
+	struct Conn {
+		int fd;
+		uint64_t gen;           // fd 复用后区分新旧连接，线程池的迟到响应按它丢弃
+		std::string rbuf;
+		std::string wbuf;
+		size_t wsent = 0;
+		bool want_write = false;
+	};
+	struct Completion {
+		int fd;
+		uint64_t gen;
+		std::string frame;
+	};
+
+	void OnAccept();
+	int OnRead(Conn *conn);
+	int OnWrite(Conn *conn);
+	void OnCompletion();
+	void Dispatch(Conn *conn, const rpc_header &hdr, std::string body);
+	void CloseConn(Conn *conn);
+
+	int epfd_ = -1;
+	int listenfd_ = -1;
+	int eventfd_ = -1;
+	std::atomic<bool> running_{false};
+	uint64_t next_gen_ = 0;
+	std::vector<std::unique_ptr<Conn>> conns_;     // 按 fd 下标
+	std::unordered_map<uint16_t, Method> methods_;
+
+	std::mutex completion_mutex_;
+	std::vector<Completion> completions_;
+	std::unique_ptr<ThreadPool> pool_;              // 析构时最先销毁，等工作线程退出后再释放其它成员
+};
+
+
+struct RpcResult {
+	int status;
+	std::string body;
+};
+
+typedef std::function<void(int status, const std::string &body)> RpcCallback;
+
+class RpcClient {
+public:
+	RpcClient();
+	~RpcClient();
+
+	int Connect(const char *ip, unsigned short port);
+	void Close();
+
+	// 异步调用：返回 future，或在客户端 IO 线程上执行回调(回调里可以继续发起调用)
+	std::future<RpcResult> Call(uint16_t method, const std::string &req);
+	void Call(uint16_t method, const std::string &req, RpcCallback cb);
+
+	uint64_t Pending();
+
+private:
+	void Loop();
+	int Flush();
+	void FailAll();
+
+	int fd_ = -1;
+	int epfd_ = -1;
+	int eventfd_ = -1;
+	std::thread io_thread_;
+	std::atomic<bool> running_{false};
+	std::atomic<uint32_t> next_id_{1};
+
+	// Call 写入 outbuf_，IO 线程取走后发送；pending_ 按 request_id 保存回调
+	std::mutex mutex_;
+	std::string outbuf_;
+	std::unordered_map<uint32_t, RpcCallback> pending_;
+	bool closed_ = false;
+
+	// 只在 IO 线程上访问
+	std::string sendbuf_;
+	size_t sent_ = 0;
+	std::string rbuf_;
+	bool want_write_ = false;
+};
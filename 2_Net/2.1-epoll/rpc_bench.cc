@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include <deque>
+#include <vector>
+
+#include "rpc.h"
+
+/**
+ * rpc 的服务端示例和单连接压测客户端
+ *
+ * server: 注册 echo 方法(method 1)，默认在 IO 线程上执行，-w 时交给 -t 个工作线程的线程池
+ * client: 在一条连接上保持 -o 个调用在途，每完成一个就补发一个，校验响应体与请求一致；
+ *         默认用回调(在客户端 IO 线程上补发)，-f 时由主线程通过 future 等待和补发。
+ *         结束时输出 calls/sec 和 p50/p99。
+ *
+ * shell: g++ -O2 -std=c++17 rpc.cc rpc_bench.cc -o rpc_bench -lpthread
+ * usage: ./rpc_bench server [-p port] [-t workers] [-w]
+ *        ./rpc_bench client [-o outstanding] [-d seconds] [-s size] [-f] ip port
+ */
+
+#define METHOD_ECHO     1
+#define LAT_BUCKETS     100000      // 时延直方图：1us 一格，最多 100ms
+
+static RpcServer *server;
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void stop_server(int sig) {
+	(void)sig;
+	server->Stop();
+}
+
+static int run_server(int argc, char *argv[]) {
+
+	unsigned short port = 9096;
+	size_t workers = 4;
+	bool pooled = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:t:w")) != -1) {
+		switch (opt) {
+		case 'p': port = atoi(optarg); break;
+		case 't': workers = atoi(optarg); break;
+		case 'w': pooled = true; break;
+		default:
+			fprintf(stderr, "usage: %s server [-p port] [-t workers] [-w]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	RpcServer srv(workers);
+	srv.Register(METHOD_ECHO, [](const std::string &req, std::string &resp) {
+		resp = req;
+		return (int)RPC_OK;
+	}, !pooled);
+
+	if (srv.Listen(port) < 0) return 1;
+	server = &srv;
+	signal(SIGINT, stop_server);
+	signal(SIGTERM, stop_server);
+
+	printf("rpc server on %d, echo %s\n", port, pooled ? "in thread pool" : "inline");
+	fflush(stdout);
+	srv.Run();
+	return 0;
+}
+
+
+struct bench_state {
+	RpcClient client;
+	std::string payload;
+	std::atomic<bool> running{true};
+	uint64_t calls = 0;
+	uint64_t errors = 0;
+	std::vector<uint64_t> lat = std::vector<uint64_t>(LAT_BUCKETS + 1);
+
+	void record(uint64_t start, int status, const std::string &body) {
+		uint64_t us = now_us() - start;
+		lat[us < LAT_BUCKETS ? us : LAT_BUCKETS]++;
+		calls++;
+		if (status != RPC_OK || body != payload) errors++;
+	}
+};
+
+// 回调模式：回调在客户端 IO 线程上执行，统计只在这个线程上修改
+static void issue(bench_state *st) {
+	uint64_t start = now_us();
+	st->client.Call(METHOD_ECHO, st->payload, [st, start](int status, const std::string &body) {
+		st->record(start, status, body);
+		if (st->running.load(std::memory_order_relaxed)) issue(st);
+	});
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &lat, uint64_t total, double p) {
+	uint64_t target = (uint64_t)(total * p), seen = 0;
+	for (size_t i = 0; i < lat.size(); i++) {
+		seen += lat[i];
+		if (seen > target) return i;
+	}
+	return lat.size() - 1;
+}
+
+static int run_client(int argc, char *argv[]) {
+
+	int outstanding = 1, seconds = 5, size = 64;
+	bool futures = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "o:d:s:f")) != -1) {
+		switch (opt) {
+		case 'o': outstanding = atoi(optarg); break;
+		case 'd': seconds = atoi(optarg); break;
+		case 's': size = atoi(optarg); break;
+		case 'f': futures = true; break;
+		default:
+			optind = argc + 1;
+		}
+	}
+	if (optind + 2 != argc || outstanding <= 0) {
+		fprintf(stderr, "usage: %s client [-o outstanding] [-d seconds] [-s size] [-f] ip port\n", argv[0]);
+		return 1;
+	}
+
+	bench_state *st = new bench_state();
+	st->payload.assign(size, 'x');
+	if (st->client.Connect(argv[optind], atoi(argv[optind + 1])) < 0) {
+		perror("connect");
+		return 1;
+	}
+
+	uint64_t begin = now_us(), deadline = begin + seconds * 1000000ULL;
+	if (futures) {
+		std::deque<std::pair<std::future<RpcResult>, uint64_t>> inflight;
+		for (int i = 0; i < outstanding; i++) {
+			inflight.emplace_back(st->client.Call(METHOD_ECHO, st->payload), now_us());
+		}
+		while (!inflight.empty()) {
+			RpcResult res = inflight.front().first.get();
+			st->record(inflight.front().second, res.status, res.body);
+			inflight.pop_front();
+			if (now_us() < deadline) {
+				inflight.emplace_back(st->client.Call(METHOD_ECHO, st->payload), now_us());
+			}
+		}
+	} else {
+		for (int i = 0; i < outstanding; i++) issue(st);
+		usleep(seconds * 1000000);
+		st->running = false;
+		while (st->client.Pending() > 0) usleep(1000);
+	}
+	uint64_t elapsed = now_us() - begin;
+	st->client.Close();
+
+	double cps = st->calls * 1e6 / elapsed;
+	uint64_t p50 = percentile(st->lat, st->calls, 0.50);
+	uint64_t p99 = percentile(st->lat, st->calls, 0.99);
+	printf("%s, %d outstanding, %d bytes: %llu calls in %.2fs, %.0f calls/sec, p50 %lluus, p99 %lluus, errors %llu\n",
+		futures ? "future" : "callback", outstanding, size, (unsigned long long)st->calls, elapsed / 1e6,
+		cps, (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)st->errors);
+	printf("RESULT outstanding=%d calls_per_sec=%.0f p50_us=%llu p99_us=%llu errors=%llu\n",
+		outstanding, cps, (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)st->errors);
+
+	int ret = st->errors ? 1 : 0;
+	delete st;
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+
+	if (argc >= 2 && strcmp(argv[1], "server") == 0) {
+		return run_server(argc - 1, argv + 1);
+	}
+	if (argc >= 2 && strcmp(argv[1], "client") == 0) {
+		return run_client(argc - 1, argv + 1);
+	}
+	fprintf(stderr, "usage: %s server [-p port] [-t workers] [-w]\n"
+		"       %s client [-o outstanding] [-d seconds] [-s size] [-f] ip port\n", argv[0], argv[0]);
+	return 1;
+}
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+/**
+ * webserver.c 的 TLS 压测客户端
+ *
+ * -m handshake  每次新建 TCP 连接完成一次 TLS 握手和一个小请求后关闭，统计 handshakes/sec；
+ *               -r 时复用上一次拿到的会话(session ticket / session id)，测量会话复用的收益
+ * -m bulk       在一条 keep-alive 连接上反复 GET -f 指定的文件，统计 MB/s；
+ *               -p 时改为明文 HTTP，作为对照
+ *
+ * shell: gcc -O2 tls_bench.c -o tls_bench -lssl -lcrypto
+ * usage: ./tls_bench [-m handshake|bulk] [-d seconds] [-r] [-p] [-f /path] ip port
+ */
+
+#define TIME_SUB_MS(tv1, tv2)  ((tv1.tv_sec - tv2.tv_sec) * 1000 + (tv1.tv_usec - tv2.tv_usec) / 1000)
+
+static struct sockaddr_in server;
+
+static int tcp_connect(void) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// TLS1.3 的 ticket 在握手之后才到达，新会话回调里保存最近的一个
+static SSL_SESSION *saved_session = NULL;
+
+static int new_session_cb(SSL *ssl, SSL_SESSION *sess) {
+	(void)ssl;
+	if (saved_session) SSL_SESSION_free(saved_session);
+	saved_session = sess;
+	return 1;   // 返回 1 表示接管了 sess 的引用
+}
+
+static int bench_handshake(SSL_CTX *ctx, int seconds, int resume) {
+	long long handshakes = 0, resumed = 0, failed = 0;
+	struct timeval tv_begin, tv_cur;
+	gettimeofday(&tv_begin, NULL);
+
+	while (1) {
+		gettimeofday(&tv_cur, NULL);
+		if (TIME_SUB_MS(tv_cur, tv_begin) >= seconds * 1000) break;
+
+		int fd = tcp_connect();
+		if (fd < 0) {
+			failed++;
+			continue;
+		}
+		SSL *ssl = SSL_new(ctx);
+		SSL_set_fd(ssl, fd);
+		if (resume && saved_session) SSL_set_session(ssl, saved_session);
+
+		if (SSL_connect(ssl) == 1) {
+			handshakes++;
+			if (SSL_session_reused(ssl)) resumed++;
+			// 每条连接发一个小请求：同时让客户端处理服务器在握手后发来的 NewSessionTicket，
+			// TLS1.3 的 ticket 只应使用一次，下一条连接复用的是这次新拿到的
+			SSL_write(ssl, "GET / HTTP/1.1\r\n\r\n", 18);
+			char buf[1024];
+			SSL_read(ssl, buf, sizeof(buf));
+			SSL_shutdown(ssl);
+		} else {
+			failed++;
+		}
+		SSL_free(ssl);
+		close(fd);
+	}
+
+	long elapsed = TIME_SUB_MS(tv_cur, tv_begin);
+	printf("handshakes: %lld (resumed %lld), failed: %lld, time_used: %ldms, handshakes/sec: %.0f\n",
+		handshakes, resumed, failed, elapsed, elapsed > 0 ? (double)handshakes * 1000 / elapsed : 0.0);
+	return 0;
+}
+
+static int io_write(SSL *ssl, int fd, const char *buf, int len) {
+	return ssl ? SSL_write(ssl, buf, len) : send(fd, buf, len, 0);
+}
+
+static int io_read(SSL *ssl, int fd, char *buf, int len) {
+	return ssl ? SSL_read(ssl, buf, len) : recv(fd, buf, len, 0);
+}
+
+static int bench_bulk(SSL_CTX *ctx, int seconds, const char *path) {
+	int fd = tcp_connect();
+	if (fd < 0) {
+		perror("connect");
+		return -1;
+	}
+	SSL *ssl = NULL;
+	if (ctx) {
+		ssl = SSL_new(ctx);
+		SSL_set_fd(ssl, fd);
+		if (SSL_connect(ssl) != 1) {
+			ERR_print_errors_fp(stderr);
+			return -1;
+		}
+	}
+
+	char request[512];
+	int reqlen = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: bench\r\n\r\n", path);
+	static char buf[256 * 1024];
+	long long bytes = 0, responses = 0;
+	struct timeval tv_begin, tv_cur;
+	gettimeofday(&tv_begin, NULL);
+
+	while (1) {
+		gettimeofday(&tv_cur, NULL);
+		if (TIME_SUB_MS(tv_cur, tv_begin) >= seconds * 1000) break;
+
+		if (io_write(ssl, fd, request, reqlen) != reqlen) break;
+
+		// 读响应头，找到 Content-Length 和头部结束位置
+		int hlen = 0;
+		char *body = NULL;
+		while (!body) {
+			int n = io_read(ssl, fd, buf + hlen, sizeof(buf) - hlen - 1);
+			if (n <= 0) goto done;
+			hlen += n;
+			buf[hlen] = '\0';
+			body = strstr(buf, "\r\n\r\n");
+		}
+		char *cl = strstr(buf, "Content-Length:");
+		long long length = cl ? atoll(cl + 15) : 0;
+		long long got = hlen - (body + 4 - buf);
+
+		while (got < length) {
+			int n = io_read(ssl, fd, buf, sizeof(buf));
+			if (n <= 0) goto done;
+			got += n;
+		}
+		bytes += got;
+		responses++;
+	}
+
+done:
+	gettimeofday(&tv_cur, NULL);
+	long elapsed = TIME_SUB_MS(tv_cur, tv_begin);
+	printf("%s: responses: %lld, bytes: %lld, time_used: %ldms, throughput: %.1f MB/s\n",
+		ssl ? "tls" : "plain", responses, bytes, elapsed,
+		elapsed > 0 ? (double)bytes / 1048576 * 1000 / elapsed : 0.0);
+
+	if (ssl) SSL_free(ssl);
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *mode = "handshake";
+	const char *path = "/";
+	int seconds = 10, resume = 0, plain = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:d:f:rp")) != -1) {
+		switch (opt) {
+		case 'm': mode = optarg; break;
+		case 'd': seconds = atoi(optarg); break;
+		case 'f': path = optarg; break;
+		case 'r': resume = 1; break;
+		case 'p': plain = 1; break;
+		default: goto usage;
+		}
+	}
+	if (argc - optind < 2) goto usage;
+
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_addr.s_addr = inet_addr(argv[optind]);
+	server.sin_port = htons(atoi(argv[optind + 1]));
+
+	SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+	// 自签名证书，压测不校验
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, new_session_cb);
+
+	if (strcmp(mode, "handshake") == 0) {
+		bench_handshake(ctx, seconds, resume);
+	} else if (strcmp(mode, "bulk") == 0) {
+		bench_bulk(plain ? NULL : ctx, seconds, path);
+	} else {
+		goto usage;
+	}
+
+	SSL_CTX_free(ctx);
+	return 0;
+
+usage:
+	printf("Usage: %s [-m handshake|bulk] [-d seconds] [-r] [-p] [-f /path] ip port\n", argv[0]);
+	return 0;
+}
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/poll.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+/**
+ * UDP 回显 pps 压测客户端
+ *
+ * 保持最多 -w 个报文在途，每次用 sendmmsg 发出 -B 个报文，用 recvmmsg 批量收回显。
+ * -g N 时每个 sendmmsg 项是一个带 UDP_SEGMENT 的 GSO 报文，由内核拆成 N 个报文，
+ * 用来在回环上触发服务器端的 GRO 合并。一段时间没有回显时把在途报文计为丢失。
+ *
+ * shell: gcc -O2 udp_bench.c -o udp_bench
+ * usage: ./udp_bench [-d seconds] [-s size] [-B batch] [-w window] [-g segs] ip port
+ */
+
+#define MAX_BATCH		64
+#define MAX_SEGS		64
+#define MAX_PAYLOAD		65507
+
+#define TIME_SUB_MS(tv1, tv2)  ((tv1.tv_sec - tv2.tv_sec) * 1000 + (tv1.tv_usec - tv2.tv_usec) / 1000)
+
+static char sendbuf[MAX_PAYLOAD];
+static char recvbuf[MAX_BATCH][2048];
+
+int main(int argc, char **argv) {
+	int seconds = 10, size = 64, batch = 32, window = 256, segs = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:s:B:w:g:")) != -1) {
+		switch (opt) {
+		case 'd': seconds = atoi(optarg); break;
+		case 's': size = atoi(optarg); break;
+		case 'B': batch = atoi(optarg); break;
+		case 'w': window = atoi(optarg); break;
+		case 'g': segs = atoi(optarg); break;
+		default: goto usage;
+		}
+	}
+	if (argc - optind < 2) goto usage;
+	if (size <= 0 || size > 2048) size = 64;
+	if (batch <= 0 || batch > MAX_BATCH) batch = 32;
+	if (segs <= 0 || segs > MAX_SEGS || segs * size > MAX_PAYLOAD) segs = 1;
+	memset(sendbuf, 'u', sizeof(sendbuf));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(argv[optind]);
+	addr.sin_port = htons(atoi(argv[optind + 1]));
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	int rcvbuf = 4 * 1024 * 1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("connect");
+		return -1;
+	}
+
+	// 发送侧：batch 个项，每项 segs 个报文
+	struct mmsghdr smsgs[MAX_BATCH];
+	struct iovec siovs[MAX_BATCH];
+	char scontrol[MAX_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+	int i;
+	memset(smsgs, 0, sizeof(smsgs));
+	for (i = 0; i < batch; i++) {
+		siovs[i].iov_base = sendbuf;
+		siovs[i].iov_len = size * segs;
+		smsgs[i].msg_hdr.msg_iov = &siovs[i];
+		smsgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef UDP_SEGMENT
+		if (segs > 1) {
+			smsgs[i].msg_hdr.msg_control = scontrol[i];
+			smsgs[i].msg_hdr.msg_controllen = sizeof(scontrol[i]);
+			struct cmsghdr *cm = CMSG_FIRSTHDR(&smsgs[i].msg_hdr);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			*(uint16_t *)CMSG_DATA(cm) = (uint16_t)size;
+		}
+#endif
+	}
+
+	// 接收侧：一次最多收 MAX_BATCH 个报文
+	struct mmsghdr rmsgs[MAX_BATCH];
+	struct iovec riovs[MAX_BATCH];
+	memset(rmsgs, 0, sizeof(rmsgs));
+	for (i = 0; i < MAX_BATCH; i++) {
+		riovs[i].iov_base = recvbuf[i];
+		riovs[i].iov_len = sizeof(recvbuf[i]);
+		rmsgs[i].msg_hdr.msg_iov = &riovs[i];
+		rmsgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	long long sent = 0, received = 0, lost = 0, send_calls = 0, recv_calls = 0;
+	long long outstanding = 0;
+	struct timeval tv_begin, tv_cur;
+	gettimeofday(&tv_begin, NULL);
+
+	while (1) {
+		gettimeofday(&tv_cur, NULL);
+		if (TIME_SUB_MS(tv_cur, tv_begin) >= seconds * 1000) break;
+
+		while (outstanding + batch * segs <= window) {
+			int n = sendmmsg(fd, smsgs, batch, MSG_DONTWAIT);
+			if (n <= 0) break;
+			send_calls++;
+			sent += (long long)n * segs;
+			outstanding += (long long)n * segs;
+		}
+
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 20) <= 0) {
+			// 回显超时：在途报文视为丢失，重新开始发送
+			lost += outstanding;
+			outstanding = 0;
+			continue;
+		}
+
+		int n;
+		while ((n = recvmmsg(fd, rmsgs, MAX_BATCH, MSG_DONTWAIT, NULL)) > 0) {
+			recv_calls++;
+			received += n;
+			outstanding -= n;
+			if (outstanding < 0) outstanding = 0;
+			if (n < MAX_BATCH) break;
+		}
+	}
+
+	gettimeofday(&tv_cur, NULL);
+	long elapsed = TIME_SUB_MS(tv_cur, tv_begin);
+	if (elapsed <= 0) elapsed = 1;
+
+	printf("sent: %lld, received: %lld, lost: %lld, time_used: %ldms\n",
+		sent, received, lost, elapsed);
+	printf("send pps: %.0f, echo pps: %.0f\n",
+		(double)sent * 1000 / elapsed, (double)received * 1000 / elapsed);
+	printf("datagrams per sendmmsg: %.1f, per recvmmsg: %.1f\n",
+		send_calls ? (double)sent / send_calls : 0.0,
+		recv_calls ? (double)received / recv_calls : 0.0);
+
+	close(fd);
+	return 0;
+
+usage:
+	printf("Usage: %s [-d seconds] [-s size] [-B batch] [-w window] [-g segs] ip port\n", argv[0]);
+	return 0;
+}
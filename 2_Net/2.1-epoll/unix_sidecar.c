@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+/**
+ * SCM_RIGHTS 传递 fd 示例：sidecar 在 TCP 端口上接受外部连接，
+ * 不自己处理数据，而是通过 AF_UNIX 连接把 fd 交给 reactor，由 reactor 直接收发。
+ *
+ * shell: gcc -O2 unix_sidecar.c -o unix_sidecar
+ * usage: ./unix_sidecar [tcp_port] [unix_path]     默认 9000 /tmp/reactor.sock
+ */
+
+// 发送一个 fd；stream 套接字上至少要带 1 字节普通数据，辅助数据才会被发送
+static int send_fd(int sock, int fd) {
+	char data = 'F';
+	struct iovec iov = { &data, 1 };
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+	return sendmsg(sock, &msg, 0) == 1 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+	unsigned short port = argc > 1 ? atoi(argv[1]) : 9000;
+	const char *path = argc > 2 ? argv[2] : "/tmp/reactor.sock";
+
+	int unixfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un uaddr;
+	memset(&uaddr, 0, sizeof(uaddr));
+	uaddr.sun_family = AF_UNIX;
+	strncpy(uaddr.sun_path, path, sizeof(uaddr.sun_path) - 1);
+	if (connect(unixfd, (struct sockaddr *)&uaddr, sizeof(uaddr)) < 0) {
+		perror("connect");
+		return -1;
+	}
+
+	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in serveraddr;
+	memset(&serveraddr, 0, sizeof(serveraddr));
+	serveraddr.sin_family = AF_INET;
+	serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	serveraddr.sin_port = htons(port);
+	if (-1 == bind(sockfd, (struct sockaddr *)&serveraddr, sizeof(serveraddr))) {
+		perror("bind");
+		return -1;
+	}
+	listen(sockfd, 128);
+
+	while (1) {
+		int clientfd = accept(sockfd, NULL, NULL);
+		if (clientfd < 0) continue;
+
+		if (send_fd(unixfd, clientfd) != 0) {
+			perror("sendmsg");
+			close(clientfd);
+			break;
+		}
+		// fd 已经复制到 reactor 进程，本进程的副本可以关闭
+		printf("pass clientfd: %d\n", clientfd);
+		close(clientfd);
+	}
+
+	close(sockfd);
+	close(unixfd);
+	return 0;
+}
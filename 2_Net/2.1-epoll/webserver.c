@@ -1,11 +1,13 @@
-
-
+#define _GNU_SOURCE
 
 #include <sys/socket.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -15,53 +17,521 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <time.h>
 
 #define ENABLE_HTTP_RESPONSE	1
-
+#define ENABLE_TLS				1	// https 监听，握手由 EPOLLIN/EPOLLOUT 驱动
+#define ENABLE_WEBSOCKET		1	// HTTP Upgrade 到 WebSocket，收到的消息广播给所有订阅者
+#define ENABLE_UPSTREAM			1	// 反向代理：请求转发给 -u 指定的后端，上游连接保持 keep-alive
+#define ENABLE_RATE_LIMIT		1	// 每个客户端 IP 的连接数上限、请求令牌桶、过载时在 accept 处拒绝
+
+/**
+ * shell: gcc -O2 webserver.c -o webserver -lssl -lcrypto
+ * usage: ./webserver [-p port] [-u ip:port]... [-b rr|lc] [-t proxy_timeout]
+ *                    [-c per_ip_conns] [-m max_conns] [-r rate[:burst]] [-l /prefix=rate[:burst]]... [root_dir]
+ *        -u 可以重复，指定后在 2080 端口做反向代理，-b 选择轮询或最少连接数均衡，
+ *        -t 代理连接的空闲超时(秒，默认 30)
+ *        -c 每个客户端 IP 的连接数上限，-m 总连接数上限(过载)，-r 每条连接每秒的请求数，
+ *        -l 按路径前缀限速(所有连接共享)，可以重复
+ * 证书: openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj /CN=localhost
+ *        -keyout server.key -out server.crt
+ */
+
+#if ENABLE_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#define TLS_PORT				2443
+#define TLS_CERT_FILE			"server.crt"
+#define TLS_KEY_FILE			"server.key"
+#define TLS_SESSION_CACHE_SIZE	20480	// 服务端会话缓存条目数(TLS1.2 session id 复用)
+#define TLS_SESSION_TIMEOUT		300		// 会话/ticket 有效期(秒)
+#endif
 
 
 #define BUFFER_LENGTH		1024
+#define MAX_CONNECTIONS		131072	// connlist 按 fd 下标，WebSocket 推送需要容纳 10 万级长连接
+
+#if ENABLE_RATE_LIMIT
+#define RATE_IP_BITS			16		// 客户端地址哈希表 2^16 个槽位
+#define RATE_IP_PROBE			16		// 线性探测的最大距离，窗口内没有空位时不按 IP 计数
+#define RATE_ROUTE_MAX			16		// -l 路径前缀限速的条数上限
+#define RATE_REJECT_RESPONSE	1		// accept 处拒绝时先回一个静态 503 再关闭；0 时直接 RST
+#define RATE_REPORT_REJECTS		10000	// 每拒绝这么多次打印一次统计
+
+// 令牌桶：每秒补充 rate 个，最多积攒 burst 个，每个请求取一个
+struct token_bucket {
+	double tokens;
+	double rate;                  // 0 表示不限速
+	double burst;
+	unsigned long long last_us;
+};
+#endif
 
 typedef int (*RCALLBACK)(int fd);
 
 // listenfd
-// EPOLLIN --> 
+// EPOLLIN -->
 int accept_cb(int fd);
 // clientfd
-// 
+//
 int recv_cb(int fd);
 int send_cb(int fd);
 
+#if ENABLE_WEBSOCKET
+struct ws_conn;
+#endif
+
 // conn, fd, buffer, callback
 struct conn_item {
 	int fd;
-	
+
 	char rbuffer[BUFFER_LENGTH];
 	int rlen;
 	char wbuffer[BUFFER_LENGTH];
 	int wlen;
+	int wsent;                    // wbuffer 中已发送的字节数
 
 	char resource[BUFFER_LENGTH]; // /abc.html
 
+	int filefd;                   // 正在发送的静态文件，-1 表示没有
+	off_t offset;                 // 文件已发送到的位置
+	off_t filesize;
+
+#if ENABLE_TLS
+	SSL *ssl;                     // NULL 表示明文连接
+	int ktls;                     // 握手后内核接管了发送方向的加密，可以直接 sendfile
+#endif
+#if ENABLE_WEBSOCKET
+	struct ws_conn *ws;           // 升级为 WebSocket 后的帧解析状态和写队列，NULL 表示普通 HTTP
+#endif
+#if ENABLE_UPSTREAM
+	int peer;                     // 代理的另一端：客户端连接上是上游 fd，上游连接上是客户端 fd，-1 表示没有
+	int pevents;                  // 代理连接当前在 epoll 中关注的事件，0 表示不在 epoll 中
+	int pstate;                   // 客户端连接上的代理状态
+	int reqlen;                   // rbuffer 中请求头和已读到的 body 的长度
+	long long remain;             // 还需 splice 转发的 body 字节数，-1 表示直到上游关闭
+	int pipefd[2];                // splice 中转用的管道，-1 表示尚未创建
+	int pipelen;                  // 管道中还未转发出去的字节数
+	int retry;                    // 请求完整地在 rbuffer 中，复用的上游连接失效时可以重发
+	int head_request;             // HEAD 请求的响应没有 body
+	int backend;                  // 上游连接所属的后端
+	int reused;                   // 上游连接取自连接池
+	int connecting;               // 上游连接的非阻塞 connect 还未确认完成
+	int keepalive;                // 这次响应之后上游连接可以放回连接池
+	int interim;                  // wbuffer 中是 1xx 中间响应，写完后继续读同一上游的最终响应头
+	int ptimed;                   // 客户端连接在超时链表中
+	int tprev, tnext;             // 超时链表，按最后一次读写事件的时间排序
+	unsigned long long tactive;   // 最后一次读写事件的时间(毫秒)
+#endif
+#if ENABLE_RATE_LIMIT
+	int ipslot;                   // 客户端地址在 ip_table 中的槽位；-1 不是 accept 得到的连接，-2 未按 IP 计数
+	struct token_bucket bucket;   // 这条连接的请求令牌桶
+#endif
+
 	union {
 		RCALLBACK accept_callback;
 		RCALLBACK recv_callback;
 	} recv_t;
 	RCALLBACK send_callback;
 };
-// libevent --> 
+// libevent -->
 
 
 int epfd = 0;
-struct conn_item connlist[1024] = {0};
+struct conn_item connlist[MAX_CONNECTIONS] = {0};
 // 1000000
 
+const char *root_dir = "./";       // 静态文件根目录，可由命令行参数指定
 
-#if ENABLE_HTTP_RESPONSE
+#if ENABLE_TLS
+SSL_CTX *ssl_ctx = NULL;
+#endif
+
+
+int set_event(int fd, int event, int flag) {
+
+	if (flag) { // 1 add, 0 mod
+		struct epoll_event ev;
+		ev.events = event ;
+		ev.data.fd = fd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	} else {
+
+		struct epoll_event ev;
+		ev.events = event;
+		ev.data.fd = fd;
+		epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+	}
+
+
+
+}
+
+
+// 连接的读写统一经过下面几个函数，明文与 TLS 只在这里有区别
+// 返回值: >0 读写的字节数，0 对端关闭，-1 暂时不能读写(EAGAIN / WANT_READ / WANT_WRITE)，-2 出错
+
+static int conn_read(struct conn_item *conn, char *buf, int len) {
+#if ENABLE_TLS
+	if (conn->ssl) {
+		int count = SSL_read(conn->ssl, buf, len);
+		if (count > 0) return count;
+		int err = SSL_get_error(conn->ssl, count);
+		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return -1;
+		return err == SSL_ERROR_ZERO_RETURN ? 0 : -2;
+	}
+#endif
+	int count = recv(conn->fd, buf, len, 0);
+	if (count >= 0) return count;
+	return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? -1 : -2;
+}
+
+static int conn_write(struct conn_item *conn, const char *buf, int len) {
+#if ENABLE_TLS
+	if (conn->ssl) {
+		int count = SSL_write(conn->ssl, buf, len);
+		if (count > 0) return count;
+		int err = SSL_get_error(conn->ssl, count);
+		return (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) ? -1 : -2;
+	}
+#endif
+	int count = send(conn->fd, buf, len, 0);
+	if (count >= 0) return count;
+	return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? -1 : -2;
+}
+
+// 发送静态文件的下一段，文件内容尽量不经过用户态
+static int conn_sendfile(struct conn_item *conn) {
+	size_t remain = conn->filesize - conn->offset;
+#if ENABLE_TLS
+	if (conn->ssl && conn->ktls) {
+		// kTLS: 记录加密在内核完成，SSL_sendfile 内部就是 sendfile
+		ossl_ssize_t count = SSL_sendfile(conn->ssl, conn->filefd, conn->offset, remain, 0);
+		if (count > 0) {
+			conn->offset += count;
+			return (int)count;
+		}
+		int err = SSL_get_error(conn->ssl, (int)count);
+		return (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) ? -1 : -2;
+	}
+	if (conn->ssl) {
+		// 没有 kTLS 只能读到用户态加密；重试时按同一 offset 重新读出相同内容
+		char chunk[16384];
+		ssize_t n = pread(conn->filefd, chunk, remain < sizeof(chunk) ? remain : sizeof(chunk), conn->offset);
+		if (n <= 0) return -2;
+		int count = conn_write(conn, chunk, (int)n);
+		if (count > 0) conn->offset += count;
+		return count;
+	}
+#endif
+	ssize_t count = sendfile(conn->fd, conn->filefd, &conn->offset, remain);
+	if (count > 0) return (int)count;
+	if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return -1;
+	return -2;
+}
+
+#if ENABLE_RATE_LIMIT
+
+// 客户端地址 -> 当前连接数。每个槽位是一个 64 位字：高 32 位 IPv4 地址，低 32 位连接数，
+// 用 CAS 更新，不需要锁(多个 accept 线程可以共享)。连接数降到 0 的槽位保留地址，
+// 可以被其它地址回收，但从不清零，所以探测遇到全 0 的槽位就可以停止。
+// 同一个新地址在两个线程上同时登记时可能占两个槽位，上限只是近似，单线程下是精确的。
+static unsigned long long ip_table[1 << RATE_IP_BITS];
+
+int ip_conn_max = 0;              // -c，0 不限
+int conn_max = 0;                 // -m，0 不限
+int nconns = 0;                   // accept 得到的、还未关闭的连接数
+double conn_rate = 0, conn_burst = 0;   // -r
+
+struct route_limit {
+	char prefix[128];
+	int len;
+	struct token_bucket bucket;
+};
+struct route_limit routes[RATE_ROUTE_MAX];
+int nroutes = 0;
+
+struct {
+	unsigned long ip;             // 超过单 IP 连接数
+	unsigned long overload;       // 超过总连接数
+	unsigned long conn;           // 连接的令牌桶为空(429)
+	unsigned long route;          // 路径的令牌桶为空(503)
+	unsigned long long check_ns;  // accept 处拒绝的累计耗时：查表判断部分
+	unsigned long long reject_ns; // 同上，从 accept 返回到 close 返回，包括 send / close 系统调用
+} rate_stats;
+
+static const char rate_503[] =
+	"HTTP/1.1 503 Service Unavailable\r\n"
+	"Retry-After: 1\r\n"
+	"Content-Length: 0\r\n\r\n";
+static const char rate_429[] =
+	"HTTP/1.1 429 Too Many Requests\r\n"
+	"Retry-After: 1\r\n"
+	"Content-Length: 0\r\n\r\n";
+
+static unsigned long long rate_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bucket_init(struct token_bucket *b, double rate, double burst) {
+	b->rate = rate;
+	b->burst = burst > 0 ? burst : (rate > 1 ? rate : 1);
+	b->tokens = b->burst;
+	b->last_us = rate_now_ns() / 1000;
+}
+
+// 取一个令牌，返回 0 成功，-1 桶空
+static int bucket_take(struct token_bucket *b, unsigned long long now_us) {
+	if (b->rate <= 0) return 0;
+
+	b->tokens += (now_us - b->last_us) * b->rate / 1e6;
+	if (b->tokens > b->burst) b->tokens = b->burst;
+	b->last_us = now_us;
+
+	if (b->tokens < 1) return -1;
+	b->tokens -= 1;
+	return 0;
+}
+
+// 给 addr 的连接数加一，返回槽位；超过上限返回 -1，探测窗口内没有空位返回 -2(放行，不计数)
+static int ip_acquire(unsigned int addr) {
+
+	unsigned int h = (addr * 2654435761u) >> (32 - RATE_IP_BITS);
+
+	while (1) {
+		int free_slot = -1;
+		unsigned long long free_old = 0;
+		int i = 0;
+
+		for (i = 0;i < RATE_IP_PROBE;i ++) {
+			int slot = (h + i) & ((1 << RATE_IP_BITS) - 1);
+			unsigned long long v = __atomic_load_n(&ip_table[slot], __ATOMIC_ACQUIRE);
+
+			if ((unsigned int)(v >> 32) == addr) {
+				while ((unsigned int)(v >> 32) == addr) {
+					if ((unsigned int)v >= (unsigned int)ip_conn_max) return -1;
+					if (__atomic_compare_exchange_n(&ip_table[slot], &v, v + 1, 0,
+							__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+						return slot;
+					}
+				}
+				break;  // 槽位刚被其它地址回收，重新探测
+			}
+			if (free_slot < 0 && (unsigned int)v == 0) {
+				free_slot = slot;
+				free_old = v;
+			}
+			if (v == 0) {
+				// 从未使用过的槽位：addr 不会出现在更后面
+				if (!__atomic_compare_exchange_n(&ip_table[free_slot], &free_old,
+						((unsigned long long)addr << 32) | 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+					break;
+				}
+				return free_slot;
+			}
+		}
+		if (i < RATE_IP_PROBE) continue;   // CAS 失败，重新探测
+
+		// 窗口内都被占用：回收其中连接数为 0 的槽位，没有就不计数
+		if (free_slot < 0) return -2;
+		if (__atomic_compare_exchange_n(&ip_table[free_slot], &free_old,
+				((unsigned long long)addr << 32) | 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			return free_slot;
+		}
+	}
+}
+
+static void ip_release(int slot) {
+	__atomic_fetch_sub(&ip_table[slot], 1, __ATOMIC_RELEASE);
+}
+
+// accept 之后、conn_init 之前检查，返回 -1 时连接应当立即拒绝
+static int rate_accept(struct sockaddr_in *addr, int *slot) {
+
+	*slot = -2;
+	if (conn_max > 0 && nconns >= conn_max) {
+		rate_stats.overload++;
+		return -1;
+	}
+	if (ip_conn_max > 0) {
+		*slot = ip_acquire(addr->sin_addr.s_addr);
+		if (*slot == -1) {
+			rate_stats.ip++;
+			return -1;
+		}
+	}
+	nconns++;
+	return 0;
+}
+
+// 拒绝：不分配任何连接状态，只有一两个系统调用
+static void rate_reject(int clientfd, unsigned long long start_ns) {
+	rate_stats.check_ns += rate_now_ns() - start_ns;
+#if RATE_REJECT_RESPONSE
+	send(clientfd, rate_503, sizeof(rate_503) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+	struct linger lg = {1, 0};  // RST，不留 TIME_WAIT
+	setsockopt(clientfd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+#endif
+	close(clientfd);
+
+	rate_stats.reject_ns += rate_now_ns() - start_ns;
+	unsigned long rejects = rate_stats.ip + rate_stats.overload;
+	if ((rejects % RATE_REPORT_REJECTS) == 0) {
+		printf("rate limit: rejected ip %lu, overload %lu, conn %lu, route %lu, "
+			"avg accept reject: check %llu ns, total %llu ns\n",
+			rate_stats.ip, rate_stats.overload, rate_stats.conn, rate_stats.route,
+			rate_stats.check_ns / rejects, rate_stats.reject_ns / rejects);
+	}
+}
+
+// 请求级检查：先检查连接的令牌桶，再检查匹配的路径前缀。返回 0 放行，否则是应答状态码
+static int rate_check_request(struct conn_item *conn) {
+
+	unsigned long long now_us = rate_now_ns() / 1000;
+
+	if (bucket_take(&conn->bucket, now_us) < 0) {
+		rate_stats.conn++;
+		return 429;
+	}
+	if (nroutes == 0) return 0;
+
+	// GET /path HTTP/1.1
+	const char *path = memchr(conn->rbuffer, ' ', conn->rlen);
+	if (!path) return 0;
+	path++;
+	int len = conn->rlen - (int)(path - conn->rbuffer);
+
+	int i = 0;
+	for (i = 0;i < nroutes;i ++) {
+		if (routes[i].len <= len && memcmp(path, routes[i].prefix, routes[i].len) == 0) {
+			if (bucket_take(&routes[i].bucket, now_us) < 0) {
+				rate_stats.route++;
+				return 503;
+			}
+			break;
+		}
+	}
+	return 0;
+}
+
+// rate[:burst]
+static int rate_parse(const char *spec, double *rate, double *burst) {
+	*burst = 0;
+	if (sscanf(spec, "%lf:%lf", rate, burst) < 1 || *rate < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+// /prefix=rate[:burst]
+static int rate_route_add(const char *spec) {
+
+	const char *eq = strchr(spec, '=');
+	double rate, burst;
+	if (nroutes >= RATE_ROUTE_MAX || !eq || eq == spec || eq - spec >= (int)sizeof(routes[0].prefix) ||
+		rate_parse(eq + 1, &rate, &burst) < 0) {
+		return -1;
+	}
+	struct route_limit *r = &routes[nroutes++];
+	memcpy(r->prefix, spec, eq - spec);
+	r->prefix[eq - spec] = '\0';
+	r->len = eq - spec;
+	bucket_init(&r->bucket, rate, burst);
+	return 0;
+}
+
+#endif
+
+#if ENABLE_WEBSOCKET
+static void ws_release(struct conn_item *conn);
+#endif
+
+#if ENABLE_UPSTREAM
+// 代理客户端连接的空闲超时：所有连接超时时长相同，按最后活动时间排成链表，
+// 有事件时移到表尾，只需检查表头就能找到最早到期的连接
+int proxy_timer_head = -1, proxy_timer_tail = -1;
+unsigned long long proxy_clock;    // 毫秒，每轮 epoll_wait 返回后更新
+
+static unsigned long long proxy_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void proxy_timer_del(int fd) {
+	struct conn_item *conn = &connlist[fd];
+	if (!conn->ptimed) return;
+
+	if (conn->tprev >= 0) connlist[conn->tprev].tnext = conn->tnext;
+	else proxy_timer_head = conn->tnext;
+	if (conn->tnext >= 0) connlist[conn->tnext].tprev = conn->tprev;
+	else proxy_timer_tail = conn->tprev;
+	conn->ptimed = 0;
+}
+
+static void proxy_timer_touch(int fd) {
+	struct conn_item *conn = &connlist[fd];
+
+	proxy_timer_del(fd);
+	conn->tactive = proxy_clock;
+	conn->tprev = proxy_timer_tail;
+	conn->tnext = -1;
+	if (proxy_timer_tail >= 0) connlist[proxy_timer_tail].tnext = fd;
+	else proxy_timer_head = fd;
+	proxy_timer_tail = fd;
+	conn->ptimed = 1;
+}
+#endif
+
+static void conn_close(int fd) {
+	struct conn_item *conn = &connlist[fd];
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+#if ENABLE_RATE_LIMIT
+	if (conn->ipslot != -1) {
+		if (conn->ipslot >= 0) {
+			ip_release(conn->ipslot);
+		}
+		conn->ipslot = -1;
+		nconns--;
+	}
+#endif
+#if ENABLE_WEBSOCKET
+	if (conn->ws) {
+		ws_release(conn);
+	}
+#endif
+#if ENABLE_TLS
+	if (conn->ssl) {
+		SSL_free(conn->ssl);
+		conn->ssl = NULL;
+	}
+#endif
+	if (conn->filefd >= 0) {
+		close(conn->filefd);
+		conn->filefd = -1;
+	}
+#if ENABLE_UPSTREAM
+	if (conn->pipefd[0] >= 0) {
+		close(conn->pipefd[0]);
+		close(conn->pipefd[1]);
+		conn->pipefd[0] = conn->pipefd[1] = -1;
+	}
+	conn->pevents = 0;
+	proxy_timer_del(fd);
+#endif
+	close(fd);
+}
 
-#define ROOT_DIR	"/home/king/share/0voice2310/2.1.1-multi-io/"
 
+#if ENABLE_HTTP_RESPONSE
 
 typedef struct conn_item connection_t;
 
@@ -73,10 +543,21 @@ typedef struct conn_item connection_t;
 // GET /abc.html HTTP/1.1
 int http_request(connection_t *conn) { //
 // GET /index.html HTTP/1.1
-	
-	// conn->rbuffer
-	// conn->wlen
-	
+	char method[16] = {0}, path[256] = {0};
+
+	conn->resource[0] = '\0';
+	if (sscanf(conn->rbuffer, "%15s %255s", method, path) != 2) {
+		return -1;
+	}
+	// 不允许访问根目录之外的文件
+	if (strstr(path, "..")) {
+		return -1;
+	}
+	if (strcmp(path, "/") == 0) {
+		strcpy(path, "/index.html");
+	}
+	snprintf(conn->resource, BUFFER_LENGTH, "%s%s", root_dir, path);
+
 	return 0;
 }
 
@@ -85,181 +566,1575 @@ int http_request(connection_t *conn) { //
 它只是一个生成 HTTP 响应的函数，作为整个 WebServer 的一部分，
 用于处理客户端请求并返回相应的 HTML 内容。
 
+请求的文件存在时只生成响应头，文件内容由 send_cb 用 sendfile 发送；
+否则返回固定页面。
 */
 int http_response(connection_t *conn) {
-#if 1
-	conn->wlen = sprintf(conn->wbuffer, 
-		"HTTP/1.1 200 OK\r\n"
-		"Accept-Ranges: bytes\r\n"
-		"Content-Length: 82\r\n"
-		"Content-Type: text/html\r\n"
-		"Date: Sat, 06 Aug 2023 13:16:46 GMT\r\n\r\n"
-		"<html><head><title>0voice.king</title></head><body><h1>King</h1></body></html>\r\n\r\n");
-#else
 
-	int filefd = open("index.html", O_RDONLY);
+	int filefd = conn->resource[0] ? open(conn->resource, O_RDONLY) : -1;
 
 	struct stat stat_buf;
-	fstat(filefd, &stat_buf);
+	if (filefd < 0 || fstat(filefd, &stat_buf) < 0 || !S_ISREG(stat_buf.st_mode)) {
+		if (filefd >= 0) close(filefd);
+
+		conn->wlen = sprintf(conn->wbuffer,
+			"HTTP/1.1 200 OK\r\n"
+			"Accept-Ranges: bytes\r\n"
+			"Content-Length: 82\r\n"
+			"Content-Type: text/html\r\n"
+			"Date: Sat, 06 Aug 2023 13:16:46 GMT\r\n\r\n"
+			"<html><head><title>0voice.king</title></head><body><h1>King</h1></body></html>\r\n\r\n");
+		return conn->wlen;
+	}
 
-	conn->wlen = sprintf(conn->wbuffer, 
+	conn->wlen = sprintf(conn->wbuffer,
 		"HTTP/1.1 200 OK\r\n"
 		"Accept-Ranges: bytes\r\n"
 		"Content-Length: %ld\r\n"
 		"Content-Type: text/html\r\n"
-		"Date: Sat, 06 Aug 2023 13:16:46 GMT\r\n\r\n", stat_buf.st_size);
-
-	int count = read(filefd, conn->wbuffer + conn->wlen, BUFFER_LENGTH-conn->wlen);
-	conn->wlen += count;
+		"Date: Sat, 06 Aug 2023 13:16:46 GMT\r\n\r\n", (long)stat_buf.st_size);
 
-// sendfile
+	// sendfile
+	conn->filefd = filefd;
+	conn->offset = 0;
+	conn->filesize = stat_buf.st_size;
 
-#endif
 	return conn->wlen;
 }
 
 #endif
 
 
+// 初始化一个新连接的状态
+static void conn_init(int clientfd) {
 
+	// 非阻塞：大文件和 TLS 记录都可能一次发不完，由 EPOLLOUT 继续
+	fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL, 0) | O_NONBLOCK);
+	// 响应头、TLS 握手消息都是小包，不能被 Nagle 攒包拖到对端的延迟 ACK
+	int nodelay = 1;
+	setsockopt(clientfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
 
-int set_event(int fd, int event, int flag) {
-
-	if (flag) { // 1 add, 0 mod
-		struct epoll_event ev;
-		ev.events = event ;
-		ev.data.fd = fd;
-		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
-	} else {
-	
-		struct epoll_event ev;
-		ev.events = event;
-		ev.data.fd = fd;
-		epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
-	}
-
-	
+	connlist[clientfd].fd = clientfd;
+	memset(connlist[clientfd].rbuffer, 0, BUFFER_LENGTH);
+	connlist[clientfd].rlen = 0;
+	memset(connlist[clientfd].wbuffer, 0, BUFFER_LENGTH);
+	connlist[clientfd].wlen = 0;
+	connlist[clientfd].wsent = 0;
+	connlist[clientfd].filefd = -1;
+#if ENABLE_TLS
+	connlist[clientfd].ssl = NULL;
+	connlist[clientfd].ktls = 0;
+#endif
+#if ENABLE_WEBSOCKET
+	connlist[clientfd].ws = NULL;
+#endif
+#if ENABLE_UPSTREAM
+	connlist[clientfd].peer = -1;
+	connlist[clientfd].pevents = 0;
+	connlist[clientfd].pstate = 0;
+	connlist[clientfd].pipefd[0] = connlist[clientfd].pipefd[1] = -1;
+	connlist[clientfd].pipelen = 0;
+	connlist[clientfd].reused = 0;
+	connlist[clientfd].connecting = 1;
+	connlist[clientfd].keepalive = 0;
+	connlist[clientfd].interim = 0;
+	connlist[clientfd].ptimed = 0;
+#endif
+#if ENABLE_RATE_LIMIT
+	connlist[clientfd].ipslot = -1;
+	bucket_init(&connlist[clientfd].bucket, conn_rate, conn_burst);
+#endif
 
+	connlist[clientfd].recv_t.recv_callback = recv_cb;
+	connlist[clientfd].send_callback = send_cb;
 }
 
 int accept_cb(int fd) {
 
 	struct sockaddr_in clientaddr;
 	socklen_t len = sizeof(clientaddr);
-	
+
 	int clientfd = accept(fd, (struct sockaddr*)&clientaddr, &len);
 	if (clientfd < 0) {
 		return -1;
 	}
+	if (clientfd >= (int)(sizeof(connlist) / sizeof(connlist[0]))) {
+		close(clientfd);
+		return -1;
+	}
 
+#if ENABLE_RATE_LIMIT
+	// 超限的连接在初始化任何状态之前关闭，洪水时每个拒绝只花 accept 之外的一两个系统调用
+	int ipslot;
+	unsigned long long start_ns = rate_now_ns();
+	if (rate_accept(&clientaddr, &ipslot) < 0) {
+		rate_reject(clientfd, start_ns);
+		return -1;
+	}
+	conn_init(clientfd);
+	connlist[clientfd].ipslot = ipslot;
+#else
+	conn_init(clientfd);
+#endif
 	set_event(clientfd, EPOLLIN, 1);
 
-	connlist[clientfd].fd = clientfd;
-	memset(connlist[clientfd].rbuffer, 0, BUFFER_LENGTH);
-	connlist[clientfd].rlen = 0;
-	memset(connlist[clientfd].wbuffer, 0, BUFFER_LENGTH);
-	connlist[clientfd].wlen = 0;
-	
-	connlist[clientfd].recv_t.recv_callback = recv_cb;
-	connlist[clientfd].send_callback = send_cb;
-
 	return clientfd;
 }
 
-int recv_cb(int fd) { // fd --> EPOLLIN
 
-	char *buffer = connlist[fd].rbuffer;
-	int idx = connlist[fd].rlen;
-	
-	int count = recv(fd, buffer+idx, BUFFER_LENGTH-idx, 0);
-	if (count == 0) {
-		//printf("disconnect\n");
+#if ENABLE_TLS
 
-		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);		
-		close(fd);
-		
+// 握手阶段 EPOLLIN 和 EPOLLOUT 都进入这里，
+// 按 SSL_do_handshake 的要求(WANT_READ / WANT_WRITE)切换关注的事件
+int tls_handshake_cb(int fd) {
+
+	struct conn_item *conn = &connlist[fd];
+
+	int ret = SSL_do_handshake(conn->ssl);
+	if (ret == 1) {
+		// 握手完成：如果内核接管了发送方向的加密，静态文件可以走 sendfile
+		conn->ktls = BIO_get_ktls_send(SSL_get_wbio(conn->ssl));
+		conn->recv_t.recv_callback = recv_cb;
+		conn->send_callback = send_cb;
+		set_event(fd, EPOLLIN, 0);
+		// 请求可能和握手的最后一段一起到达，已经被读进 SSL 缓冲区，epoll 不会再通知
+		if (SSL_pending(conn->ssl) > 0) {
+			return recv_cb(fd);
+		}
+		return 0;
+	}
+
+	int err = SSL_get_error(conn->ssl, ret);
+	if (err == SSL_ERROR_WANT_READ) {
+		set_event(fd, EPOLLIN, 0);
+	} else if (err == SSL_ERROR_WANT_WRITE) {
+		set_event(fd, EPOLLOUT, 0);
+	} else {
+		conn_close(fd);
 		return -1;
 	}
-	connlist[fd].rlen += count;
+	return 0;
+}
 
-#if 0 //echo: need to send
-	memcpy(connlist[fd].wbuffer, connlist[fd].rbuffer, connlist[fd].rlen);
-	connlist[fd].wlen = connlist[fd].rlen;
-#else
+int tls_accept_cb(int fd) {
 
-	http_request(&connlist[fd]);
-	http_response(&connlist[fd]);
+	int clientfd = accept_cb(fd);
+	if (clientfd < 0) {
+		return -1;
+	}
 
-#endif
+	SSL *ssl = SSL_new(ssl_ctx);
+	if (!ssl) {
+		conn_close(clientfd);
+		return -1;
+	}
+	SSL_set_fd(ssl, clientfd);
+	SSL_set_accept_state(ssl);
 
-	set_event(fd, EPOLLOUT, 0);
+	connlist[clientfd].ssl = ssl;
+	connlist[clientfd].recv_t.recv_callback = tls_handshake_cb;
+	connlist[clientfd].send_callback = tls_handshake_cb;
 
-	
-	return count;
+	static unsigned long handshakes = 0;
+	if ((++handshakes % 10000) == 0) {
+		printf("tls accept: %ld, session resumed: %ld\n",
+			SSL_CTX_sess_accept(ssl_ctx), SSL_CTX_sess_hits(ssl_ctx));
+	}
+
+	return clientfd;
 }
 
-int send_cb(int fd) {
+static SSL_CTX *tls_ctx_create(const char *cert, const char *key) {
 
-	char *buffer = connlist[fd].wbuffer;
-	int idx = connlist[fd].wlen;
+	SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+	if (!ctx) return NULL;
 
-	int count = send(fd, buffer, idx, 0);
+	if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+		SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1) {
+		ERR_print_errors_fp(stderr);
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
 
-	set_event(fd, EPOLLIN, 0);
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
 
-	return count;
-}
+	// 会话复用：TLS1.2 的 session id 查服务端缓存，TLS1.3 发放加密的 session ticket，
+	// 复用时跳过证书签名和密钥交换，握手只剩一次对称运算
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(ctx, TLS_SESSION_CACHE_SIZE);
+	SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"webserver", 9);
+	SSL_CTX_set_timeout(ctx, TLS_SESSION_TIMEOUT);
+	SSL_CTX_set_num_tickets(ctx, 1);
 
-// tcp 
-int main() {
+	// 允许 TLS 写入时更换缓冲区地址(非 kTLS 的文件发送用栈上缓冲区重试)
+	SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
-	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+#ifdef SSL_OP_ENABLE_KTLS
+	// 内核支持时(需要 tls 模块)握手后把密钥交给内核，之后 SSL_sendfile 走零拷贝
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
 
-	struct sockaddr_in serveraddr;
-	memset(&serveraddr, 0, sizeof(struct sockaddr_in));
+	return ctx;
+}
 
-	serveraddr.sin_family = AF_INET;
-	serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
-	serveraddr.sin_port = htons(2048);
+#endif
 
-	if (-1 == bind(sockfd, (struct sockaddr*)&serveraddr, sizeof(struct sockaddr))) {
-		perror("bind");
-		return -1;
-	}
 
-	listen(sockfd, 10);
+#if ENABLE_WEBSOCKET
 
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
 
-	// 
-	connlist[sockfd].fd = sockfd;
-	connlist[sockfd].recv_t.accept_callback = accept_cb;
+#define WS_GUID				"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_QUEUE_LENGTH		64			// 每个订阅者写队列最多排队的帧数，满了丢弃新的广播
+#define WS_MAX_MESSAGE		(1 << 20)	// 分片重组后的消息上限，超过按 1009 关闭
+#define WS_REPORT_SUBS		1000		// 订阅者达到这个数量时打印每次广播的耗时
 
-	epfd = epoll_create(1); // int size
-	
-	set_event(sockfd, EPOLLIN, 1);
+enum {
+	WS_OP_CONT = 0x0, WS_OP_TEXT = 0x1, WS_OP_BINARY = 0x2,
+	WS_OP_CLOSE = 0x8, WS_OP_PING = 0x9, WS_OP_PONG = 0xA,
+};
 
-	struct epoll_event events[1024] = {0};
-	
-	while (1) { // mainloop();
+// 编码好的一段待发送数据(一个完整的帧，或 101 响应)。
+// 广播时同一个 ws_buf 挂到所有订阅者的写队列上，最后一个引用释放时 free；
+// 只在 epoll 线程里使用，引用计数不需要原子操作
+struct ws_buf {
+	int ref;
+	size_t len;
+	unsigned char data[];
+};
 
-		int nready = epoll_wait(epfd, events, 1024, -1); // 
+struct ws_conn {
+	// 写队列：环形数组只存 ws_buf 指针，队头已经发出 qsent 字节
+	struct ws_buf *queue[WS_QUEUE_LENGTH];
+	int qhead;
+	int qcount;
+	size_t qsent;
+
+	// 正在解析的帧
+	int in_frame;                 // 帧头已解析，正在收负载
+	int fin;
+	int opcode;
+	uint64_t remain;              // 负载还差多少字节
+	uint64_t unmasked;            // 负载已解掩码的字节数，决定掩码下标
+	unsigned char mask[4];
+
+	// 分片消息重组，控制帧可以夹在数据分片之间，单独存放
+	int msg_opcode;               // 0 表示没有未完成的消息
+	unsigned char *msg;
+	size_t msglen;
+	size_t msgcap;
+	unsigned char ctrl[125];
+	size_t ctrllen;
+
+	int sub;                      // 在 ws_subs 中的下标
+	int closing;                  // 已发出 close 帧，写队列发完后关闭连接
+	unsigned long dropped;        // 写队列满时丢弃的广播帧数
+};
 
-		int i = 0;
-		for (i = 0;i < nready;i ++) {
+// 所有 WebSocket 连接(订阅者)的 fd，连接关闭时用最后一个元素填补空位
+int ws_subs[MAX_CONNECTIONS];
+int ws_nsubs = 0;
 
-			int connfd = events[i].data.fd;
-			if (events[i].events & EPOLLIN) { //
+int ws_recv_cb(int fd);
+int ws_send_cb(int fd);
 
-				int count = connlist[connfd].recv_t.recv_callback(connfd);
-				//printf("recv count: %d <-- buffer: %s\n", count, connlist[connfd].rbuffer);
 
-			} else if (events[i].events & EPOLLOUT) { 
-				//printf("send --> buffer: %s\n",  connlist[connfd].wbuffer);
-				
-				int count = connlist[connfd].send_callback(connfd);
-			}
-		}
-	}
+static struct ws_buf *ws_buf_new(size_t len) {
+	struct ws_buf *buf = malloc(sizeof(struct ws_buf) + len);
+	if (!buf) return NULL;
+	buf->ref = 1;
+	buf->len = len;
+	return buf;
+}
+
+static void ws_buf_put(struct ws_buf *buf) {
+	if (--buf->ref == 0) {
+		free(buf);
+	}
+}
+
+// 服务器发出的帧不带掩码，整帧(头 + 负载)只编码这一次
+static struct ws_buf *ws_frame_encode(int opcode, const void *payload, size_t len) {
+	unsigned char header[10];
+	size_t hlen = 2;
+
+	header[0] = 0x80 | opcode;  // FIN
+	if (len < 126) {
+		header[1] = len;
+	} else if (len <= 0xFFFF) {
+		header[1] = 126;
+		header[2] = len >> 8;
+		header[3] = len & 0xFF;
+		hlen = 4;
+	} else {
+		int i;
+		header[1] = 127;
+		for (i = 0; i < 8; i++) {
+			header[2 + i] = (uint64_t)len >> (56 - 8 * i);
+		}
+		hlen = 10;
+	}
+
+	struct ws_buf *buf = ws_buf_new(hlen + len);
+	if (!buf) return NULL;
+	memcpy(buf->data, header, hlen);
+	if (len) memcpy(buf->data + hlen, payload, len);
+	return buf;
+}
+
+static int ws_enqueue(struct ws_conn *ws, struct ws_buf *buf) {
+	if (ws->qcount == WS_QUEUE_LENGTH) {
+		// 慢订阅者：丢弃整帧，已经排队的帧不受影响，对端看到的仍是完整的帧序列
+		ws->dropped++;
+		return -1;
+	}
+	ws->queue[(ws->qhead + ws->qcount) % WS_QUEUE_LENGTH] = buf;
+	ws->qcount++;
+	buf->ref++;
+	return 0;
+}
+
+// 把写队列尽量发出去
+// 返回值: 0 全部发完，1 发送缓冲区满、还有剩余，-1 出错
+static int ws_flush(struct conn_item *conn) {
+	struct ws_conn *ws = conn->ws;
+
+	while (ws->qcount > 0) {
+		ssize_t count;
+#if ENABLE_TLS
+		if (conn->ssl) {
+			// TLS 每个连接的密文不同，只能逐帧 SSL_write；明文仍是共享的那一份
+			struct ws_buf *buf = ws->queue[ws->qhead];
+			count = conn_write(conn, (const char *)buf->data + ws->qsent, buf->len - ws->qsent);
+			if (count == -1) return 1;
+			if (count < 0) return -1;
+		} else
+#endif
+		{
+			// 明文：一次 writev 把排队的帧都交给内核，队头从 qsent 开始
+			struct iovec iov[WS_QUEUE_LENGTH];
+			int i;
+			for (i = 0; i < ws->qcount; i++) {
+				struct ws_buf *buf = ws->queue[(ws->qhead + i) % WS_QUEUE_LENGTH];
+				size_t skip = i == 0 ? ws->qsent : 0;
+				iov[i].iov_base = buf->data + skip;
+				iov[i].iov_len = buf->len - skip;
+			}
+			count = writev(conn->fd, iov, ws->qcount);
+			if (count < 0) {
+				return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 1 : -1;
+			}
+		}
+
+		// 按发出的字节数推进队头，发完的帧释放引用
+		ws->qsent += count;
+		while (ws->qcount > 0 && ws->qsent >= ws->queue[ws->qhead]->len) {
+			ws->qsent -= ws->queue[ws->qhead]->len;
+			ws_buf_put(ws->queue[ws->qhead]);
+			ws->qhead = (ws->qhead + 1) % WS_QUEUE_LENGTH;
+			ws->qcount--;
+		}
+	}
+	ws->qsent = 0;
+	return 0;
+}
+
+// 发送一个 buf：先入队再立即尝试发送，发不完才关注 EPOLLOUT
+// 返回 -1 表示连接已关闭
+static int ws_send(int fd, struct ws_buf *buf) {
+	struct conn_item *conn = &connlist[fd];
+	struct ws_conn *ws = conn->ws;
+
+	int pending = ws->qcount;
+	if (ws_enqueue(ws, buf) < 0) {
+		return 0;
+	}
+	if (pending > 0) {
+		return 0;   // 已经在等 EPOLLOUT，由 ws_send_cb 一起发送
+	}
+
+	int ret = ws_flush(conn);
+	if (ret < 0 || (ret == 0 && ws->closing)) {
+		conn_close(fd);
+		return -1;
+	}
+	if (ret == 1) {
+		set_event(fd, EPOLLIN | EPOLLOUT, 0);
+	}
+	return 0;
+}
+
+// 广播：帧只编码一次，每个订阅者的写队列持有同一个 ws_buf 的引用，之后各做一次 writev
+int ws_broadcast(int opcode, const void *payload, size_t len) {
+	struct timeval tv_begin, tv_end;
+	gettimeofday(&tv_begin, NULL);
+
+	struct ws_buf *buf = ws_frame_encode(opcode, payload, len);
+	if (!buf) return -1;
+
+	int nsubs = ws_nsubs;
+	int i;
+	// 从后往前遍历：发送失败的连接被关闭时，用最后一个元素填补当前位置，已经处理过
+	for (i = ws_nsubs - 1; i >= 0; i--) {
+		int fd = ws_subs[i];
+		if (!connlist[fd].ws->closing) {
+			ws_send(fd, buf);
+		}
+	}
+	ws_buf_put(buf);
+
+	if (nsubs >= WS_REPORT_SUBS) {
+		gettimeofday(&tv_end, NULL);
+		long us = (tv_end.tv_sec - tv_begin.tv_sec) * 1000000 + (tv_end.tv_usec - tv_begin.tv_usec);
+		printf("ws broadcast: %zu bytes --> %d subscribers, %ld us\n", len, nsubs, us);
+	}
+	return nsubs;
+}
+
+static void ws_release(struct conn_item *conn) {
+	struct ws_conn *ws = conn->ws;
+
+	// 从订阅者数组中移除
+	int last = ws_subs[--ws_nsubs];
+	ws_subs[ws->sub] = last;
+	connlist[last].ws->sub = ws->sub;
+
+	while (ws->qcount > 0) {
+		ws_buf_put(ws->queue[ws->qhead]);
+		ws->qhead = (ws->qhead + 1) % WS_QUEUE_LENGTH;
+		ws->qcount--;
+	}
+	free(ws->msg);
+	free(ws);
+	conn->ws = NULL;
+}
+
+// 发送 close 帧并进入关闭状态，写队列发完后关闭连接
+static int ws_fail(int fd, int status) {
+	struct ws_conn *ws = connlist[fd].ws;
+	unsigned char code[2] = { status >> 8, status & 0xFF };
+
+	ws->closing = 1;
+	struct ws_buf *buf = ws_frame_encode(WS_OP_CLOSE, code, sizeof(code));
+	if (!buf) {
+		conn_close(fd);
+		return -1;
+	}
+	// 关闭帧不能被写队列满丢掉
+	if (ws->qcount == WS_QUEUE_LENGTH) {
+		ws_buf_put(buf);
+		conn_close(fd);
+		return -1;
+	}
+	int ret = ws_send(fd, buf);
+	ws_buf_put(buf);
+	return ret;
+}
+
+// 一条完整的消息：广播给所有订阅者
+static int ws_on_message(int fd, int opcode, const unsigned char *msg, size_t len) {
+	ws_broadcast(opcode, msg, len);
+	// 广播中本连接可能因为发送失败被关闭
+	return connlist[fd].ws ? 0 : -1;
+}
+
+// 一帧负载收齐
+static int ws_frame_done(int fd) {
+	struct ws_conn *ws = connlist[fd].ws;
+
+	switch (ws->opcode) {
+	case WS_OP_CLOSE: {
+		// 回应同样的状态码，没有状态码时回 1000
+		int status = ws->ctrllen >= 2 ? (ws->ctrl[0] << 8) | ws->ctrl[1] : 1000;
+		return ws_fail(fd, status);
+	}
+	case WS_OP_PING: {
+		struct ws_buf *buf = ws_frame_encode(WS_OP_PONG, ws->ctrl, ws->ctrllen);
+		if (!buf) return 0;
+		int ret = ws_send(fd, buf);
+		ws_buf_put(buf);
+		return ret;
+	}
+	case WS_OP_PONG:
+		return 0;
+	default:
+		break;
+	}
+
+	if (!ws->fin) {
+		return 0;   // 后面还有 continuation 帧
+	}
+	int opcode = ws->msg_opcode;
+	size_t len = ws->msglen;
+	ws->msg_opcode = 0;
+	ws->msglen = 0;
+	int ret = ws_on_message(fd, opcode, ws->msg, len);
+	if (ret == 0 && ws->msgcap > BUFFER_LENGTH * 4) {
+		// 偶尔的大消息不长期占着内存
+		free(ws->msg);
+		ws->msg = NULL;
+		ws->msgcap = 0;
+	}
+	return ret;
+}
+
+// 解析 rbuffer 中的帧，不完整的帧头留在 rbuffer 里等下次，负载边收边解掩码
+// 返回 -1 表示连接已关闭
+static int ws_parse(int fd) {
+	struct conn_item *conn = &connlist[fd];
+	unsigned char *p = (unsigned char *)conn->rbuffer;
+	int pos = 0;
+
+	while (pos < conn->rlen && conn->ws && !conn->ws->closing) {
+		struct ws_conn *ws = conn->ws;
+
+		if (!ws->in_frame) {
+			int avail = conn->rlen - pos;
+			if (avail < 2) break;
+
+			int fin = p[pos] & 0x80;
+			int opcode = p[pos] & 0x0F;
+			int masked = p[pos + 1] & 0x80;
+			uint64_t plen = p[pos + 1] & 0x7F;
+			int hlen = 2 + (plen == 126 ? 2 : plen == 127 ? 8 : 0) + (masked ? 4 : 0);
+			if (avail < hlen) break;
+
+			if (plen == 126) {
+				plen = (p[pos + 2] << 8) | p[pos + 3];
+			} else if (plen == 127) {
+				int i;
+				plen = 0;
+				for (i = 0; i < 8; i++) {
+					plen = (plen << 8) | p[pos + 2 + i];
+				}
+			}
+
+			// 客户端的帧必须带掩码，没有协商扩展时 RSV 必须为 0；
+			// 控制帧不能分片，负载不超过 125 字节
+			int control = opcode & 0x08;
+			if (!masked || (p[pos] & 0x70) ||
+				(control && (!fin || plen > 125 || opcode > WS_OP_PONG)) ||
+				(!control && opcode > WS_OP_BINARY) ||
+				(!control && (opcode == WS_OP_CONT) != (ws->msg_opcode != 0))) {
+				return ws_fail(fd, 1002);
+			}
+			if (!control && ws->msglen + plen > WS_MAX_MESSAGE) {
+				return ws_fail(fd, 1009);
+			}
+
+			if (!control && opcode != WS_OP_CONT) {
+				ws->msg_opcode = opcode;
+			}
+			if (control) {
+				ws->ctrllen = 0;
+			} else if (ws->msglen + plen > ws->msgcap) {
+				size_t cap = ws->msgcap ? ws->msgcap : 256;
+				while (cap < ws->msglen + plen) cap *= 2;
+				unsigned char *msg = realloc(ws->msg, cap);
+				if (!msg) return ws_fail(fd, 1011);
+				ws->msg = msg;
+				ws->msgcap = cap;
+			}
+
+			ws->in_frame = 1;
+			ws->fin = fin;
+			ws->opcode = opcode;
+			ws->remain = plen;
+			ws->unmasked = 0;
+			memcpy(ws->mask, p + pos + hlen - 4, 4);
+			pos += hlen;
+		}
+
+		// 负载：解掩码后追加到消息或控制帧缓冲
+		size_t n = conn->rlen - pos;
+		if (n > ws->remain) n = ws->remain;
+		unsigned char *dst;
+		if (ws->opcode & 0x08) {
+			dst = ws->ctrl + ws->ctrllen;
+			ws->ctrllen += n;
+		} else {
+			dst = ws->msg + ws->msglen;
+			ws->msglen += n;
+		}
+		size_t i;
+		for (i = 0; i < n; i++) {
+			dst[i] = p[pos + i] ^ ws->mask[(ws->unmasked + i) & 3];
+		}
+		ws->unmasked += n;
+		ws->remain -= n;
+		pos += n;
+
+		if (ws->remain == 0) {
+			ws->in_frame = 0;
+			if (ws_frame_done(fd) < 0) {
+				return -1;
+			}
+		}
+	}
+
+	if (!conn->ws) {
+		return -1;
+	}
+	if (conn->ws->closing) {
+		conn->rlen = 0;     // 已经在关闭，后续数据丢弃
+		return 0;
+	}
+	memmove(conn->rbuffer, conn->rbuffer + pos, conn->rlen - pos);
+	conn->rlen -= pos;
+	return 0;
+}
+
+int ws_recv_cb(int fd) {
+
+	struct conn_item *conn = &connlist[fd];
+	int total = 0;
+
+	do {
+		int count = conn_read(conn, conn->rbuffer + conn->rlen, BUFFER_LENGTH - conn->rlen);
+		if (count == -1) {
+			return total;
+		}
+		if (count <= 0) {
+			conn_close(fd);
+			return -1;
+		}
+		conn->rlen += count;
+		total += count;
+
+		if (ws_parse(fd) < 0) {
+			return -1;
+		}
+#if ENABLE_TLS
+		// SSL 缓冲区里已解密的数据不会再触发 EPOLLIN
+	} while (conn->ssl && SSL_pending(conn->ssl) > 0);
+#else
+	} while (0);
+#endif
+
+	return total;
+}
+
+int ws_send_cb(int fd) {
+
+	struct conn_item *conn = &connlist[fd];
+
+	int ret = ws_flush(conn);
+	if (ret < 0 || (ret == 0 && conn->ws->closing)) {
+		conn_close(fd);
+		return -1;
+	}
+	if (ret == 0) {
+		set_event(fd, EPOLLIN, 0);
+	}
+	return 0;
+}
+
+// 检查请求是否为 WebSocket 握手，是则回复 101 并把连接转为 WebSocket
+// 返回 -1 表示不是 Upgrade 请求，按普通 HTTP 处理
+static int ws_upgrade(int fd) {
+
+	struct conn_item *conn = &connlist[fd];
+	char *end = strstr(conn->rbuffer, "\r\n\r\n");
+	char *upgrade = strcasestr(conn->rbuffer, "\r\nUpgrade:");
+	char *key = strcasestr(conn->rbuffer, "\r\nSec-WebSocket-Key:");
+	if (!end || !upgrade || !key || upgrade > end || key > end) {
+		return -1;
+	}
+	upgrade += 10;
+	while (*upgrade == ' ') upgrade++;
+	if (strncasecmp(upgrade, "websocket", 9) != 0) {
+		return -1;
+	}
+
+	// Sec-WebSocket-Accept = base64(SHA1(key + GUID))
+	key += 20;
+	while (*key == ' ') key++;
+	int keylen = strcspn(key, " \r\n");
+	char src[128];
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	char accept[64];
+	if (keylen == 0 || keylen > 64) {
+		return -1;
+	}
+	int srclen = snprintf(src, sizeof(src), "%.*s%s", keylen, key, WS_GUID);
+	SHA1((const unsigned char *)src, srclen, digest);
+	EVP_EncodeBlock((unsigned char *)accept, digest, SHA_DIGEST_LENGTH);
+
+	struct ws_conn *ws = calloc(1, sizeof(struct ws_conn));
+	if (!ws) {
+		return -1;
+	}
+	char response[256];
+	int len = snprintf(response, sizeof(response),
+		"HTTP/1.1 101 Switching Protocols\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+	struct ws_buf *buf = ws_buf_new(len);
+	if (!buf) {
+		free(ws);
+		return -1;
+	}
+	memcpy(buf->data, response, len);
+
+	conn->ws = ws;
+	ws->sub = ws_nsubs;
+	ws_subs[ws_nsubs++] = fd;
+	conn->recv_t.recv_callback = ws_recv_cb;
+	conn->send_callback = ws_send_cb;
+
+	// 握手请求之后紧跟的帧留在 rbuffer 里继续解析
+	int consumed = end + 4 - conn->rbuffer;
+	memmove(conn->rbuffer, end + 4, conn->rlen - consumed);
+	conn->rlen -= consumed;
+
+	int ret = ws_send(fd, buf);
+	ws_buf_put(buf);
+	if (ret < 0) {
+		return 0;   // 已关闭，但请求已经被 WebSocket 处理
+	}
+	ws_parse(fd);
+	return 0;
+}
+
+#endif
+
+
+#if ENABLE_UPSTREAM
+
+#define PROXY_PORT			2080	// 反向代理监听端口，设置了 -u 后端时启用
+#define UPSTREAM_MAX		16		// 后端个数上限
+#define UPSTREAM_IDLE_MAX	64		// 每个后端保持的 keep-alive 空闲连接数
+#define PROXY_SPLICE_CHUNK	65536	// 每次 splice 的最大字节数(管道默认容量)
+#define PROXY_TIMEOUT		30		// 代理连接多少秒没有读写事件就关闭，-t 修改
+
+enum { BALANCE_ROUND_ROBIN, BALANCE_LEAST_CONN };
+
+// 客户端连接上的代理状态
+enum {
+	PROXY_IDLE,          // 等待请求
+	PROXY_REQ_HEADER,    // 把请求头(和已读到的 body)写给上游，包括等待非阻塞 connect 完成
+	PROXY_REQ_BODY,      // 剩余的请求 body: 客户端 --splice--> 上游
+	PROXY_RESP_HEADER,   // 读上游的响应头
+	PROXY_RESP_WRITE,    // 把响应头(和已读到的 body)写给客户端
+	PROXY_RESP_BODY,     // 剩余的响应 body: 上游 --splice--> 客户端
+};
+
+struct upstream {
+	struct sockaddr_in addr;
+	int active;                       // 正在处理的请求数，最少连接数均衡按它选择
+	int idle[UPSTREAM_IDLE_MAX];      // 空闲 keep-alive 连接，后进先出
+	int nidle;
+	unsigned long requests;
+	unsigned long connects;           // 新建的 TCP 连接数，远小于 requests 说明连接在复用
+};
+
+struct upstream backends[UPSTREAM_MAX];
+int nbackends = 0;
+int balance = BALANCE_ROUND_ROBIN;
+int proxy_timeout = PROXY_TIMEOUT * 1000;  // 毫秒
+
+int upstream_cb(int fd);
+static int proxy_step(int fd);
+
+
+// 只在需要的方向上关注事件：不需要时从 epoll 中移除，避免对端 HUP 时空转
+static void proxy_set_event(int fd, int event) {
+	struct conn_item *conn = &connlist[fd];
+
+	if (event == conn->pevents) return;
+	if (event == 0) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+	} else {
+		set_event(fd, event, conn->pevents == 0);
+	}
+	conn->pevents = event;
+}
+
+static int upstream_pick(void) {
+	static unsigned int next = 0;
+	int i, best = next++ % nbackends;
+
+	if (balance == BALANCE_LEAST_CONN) {
+		// 从轮询位置开始找，活跃数相同时仍然轮流分配
+		for (i = 1; i < nbackends; i++) {
+			int b = (best + i) % nbackends;
+			if (backends[b].active < backends[best].active) best = b;
+		}
+	}
+	return best;
+}
+
+static int upstream_connect(int b) {
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (fd >= MAX_CONNECTIONS) {
+		close(fd);
+		return -1;
+	}
+
+	conn_init(fd);  // 非阻塞 + TCP_NODELAY
+	connlist[fd].recv_t.recv_callback = upstream_cb;
+	connlist[fd].send_callback = upstream_cb;
+	connlist[fd].backend = b;
+
+	// 非阻塞 connect：完成前写入返回 EAGAIN，由 EPOLLOUT 继续，失败在 SO_ERROR 里
+	if (connect(fd, (struct sockaddr *)&backends[b].addr, sizeof(struct sockaddr_in)) < 0 &&
+		errno != EINPROGRESS) {
+		close(fd);
+		return -1;
+	}
+	backends[b].connects++;
+	return fd;
+}
+
+// 优先取连接池中的空闲连接，没有时新建
+static int upstream_get(int b, int pooled) {
+
+	struct upstream *u = &backends[b];
+	int fd;
+
+	if (pooled && u->nidle > 0) {
+		fd = u->idle[--u->nidle];
+		connlist[fd].reused = 1;
+		return fd;
+	}
+	fd = upstream_connect(b);
+	if (fd >= 0) {
+		connlist[fd].reused = 0;
+	}
+	return fd;
+}
+
+static void upstream_pool_remove(int fd) {
+	struct upstream *u = &backends[connlist[fd].backend];
+	int i;
+	for (i = 0; i < u->nidle; i++) {
+		if (u->idle[i] == fd) {
+			u->idle[i] = u->idle[--u->nidle];
+			return;
+		}
+	}
+}
+
+// 一个请求结束：上游连接放回连接池或关闭，客户端等待下一个请求
+static void proxy_finish(int fd, int reuse) {
+
+	struct conn_item *client = &connlist[fd];
+	int ufd = client->peer;
+	struct upstream *u = &backends[connlist[ufd].backend];
+
+	u->active--;
+	if (++u->requests % 10000 == 0) {
+		printf("upstream %s:%d requests: %lu, connects: %lu\n", inet_ntoa(u->addr.sin_addr),
+			ntohs(u->addr.sin_port), u->requests, u->connects);
+	}
+
+	connlist[ufd].peer = -1;
+	if (reuse && u->nidle < UPSTREAM_IDLE_MAX) {
+		// 空闲连接关注 EPOLLIN：后端关闭连接时及时从池中移除
+		u->idle[u->nidle++] = ufd;
+		proxy_set_event(ufd, EPOLLIN);
+	} else {
+		conn_close(ufd);
+	}
+
+	client->peer = -1;
+	client->pstate = PROXY_IDLE;
+	client->rlen = 0;
+	proxy_set_event(fd, EPOLLIN);
+}
+
+// 客户端或转发中途出错：上游连接的状态未知，不能放回连接池
+static void proxy_abort(int fd) {
+
+	int ufd = connlist[fd].peer;
+	if (ufd >= 0) {
+		backends[connlist[ufd].backend].active--;
+		conn_close(ufd);
+	}
+	conn_close(fd);
+}
+
+// 上游出错或超时且还没有向客户端发出最终响应：回复 status 后关闭客户端
+static int proxy_error(int fd, const char *status) {
+
+	struct conn_item *client = &connlist[fd];
+	int ufd = client->peer;
+	if (ufd >= 0) {
+		backends[connlist[ufd].backend].active--;
+		conn_close(ufd);
+		client->peer = -1;
+	}
+
+	client->wlen = sprintf(client->wbuffer,
+		"HTTP/1.1 %s\r\n"
+		"Content-Length: 0\r\n"
+		"Connection: close\r\n\r\n", status);
+	client->wsent = 0;
+	client->interim = 0;
+	client->pstate = PROXY_RESP_WRITE;
+	return proxy_step(fd);
+}
+
+static int proxy_bad_gateway(int fd) {
+	return proxy_error(fd, "502 Bad Gateway");
+}
+
+// 在 src 和 dst 之间经过管道 splice 转发 remain 字节(-1 表示直到 src 关闭)，数据不进入用户态
+// 返回值: 0 完成，1 等待 src 可读，2 等待 dst 可写，-1 src 关闭，-2 出错
+static int proxy_relay(struct conn_item *client, int src, int dst, long long *remain) {
+
+	if (client->pipefd[0] < 0 && pipe2(client->pipefd, O_NONBLOCK) < 0) {
+		return -2;
+	}
+
+	while (1) {
+		while (client->pipelen > 0) {
+			ssize_t n = splice(client->pipefd[0], NULL, dst, NULL, client->pipelen,
+				SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0) {
+				return (errno == EAGAIN || errno == EINTR) ? 2 : -2;
+			}
+			client->pipelen -= n;
+		}
+		if (*remain == 0) {
+			return 0;
+		}
+
+		size_t len = (*remain < 0 || *remain > PROXY_SPLICE_CHUNK) ? PROXY_SPLICE_CHUNK : *remain;
+		ssize_t n = splice(src, NULL, client->pipefd[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n == 0) {
+			return -1;
+		}
+		if (n < 0) {
+			return (errno == EAGAIN || errno == EINTR) ? 1 : -2;
+		}
+		client->pipelen += n;
+		if (*remain > 0) {
+			*remain -= n;
+		}
+	}
+}
+
+// 解析上游响应头，决定 body 长度和连接能否复用
+static void proxy_parse_response(struct conn_item *client, struct conn_item *up, int hdrlen) {
+
+	int status = 0;
+	sscanf(up->rbuffer, "HTTP/1.%*d %d", &status);
+
+	if (status >= 100 && status < 200 && status != 101) {
+		// 1xx 中间响应(100 Continue、103 Early Hints)后面还有最终响应：原样转给客户端，
+		// 后面已读到的字节留在 rbuffer 里，同一条上游连接上继续解析最终响应头
+		memcpy(client->wbuffer, up->rbuffer, hdrlen);
+		client->wlen = hdrlen;
+		client->wsent = 0;
+		up->rlen -= hdrlen;
+		memmove(up->rbuffer, up->rbuffer + hdrlen, up->rlen + 1);
+		client->interim = 1;
+		client->retry = 0;   // 客户端已经收到了这条上游连接的数据，不能换连接重发
+		return;
+	}
+
+	char *cl = strcasestr(up->rbuffer, "\r\nContent-Length:");
+	char *conn_close_hdr = strcasestr(up->rbuffer, "\r\nConnection: close");
+	long long body = up->rlen - hdrlen;
+
+	up->keepalive = !(conn_close_hdr && conn_close_hdr < up->rbuffer + hdrlen);
+	if (status == 101) {
+		// 升级后不再是 HTTP：只转发到上游关闭为止，连接不复用
+		client->remain = -1;
+		up->keepalive = 0;
+	} else if (client->head_request || status == 204 || status == 304) {
+		client->remain = 0;
+		body = 0;
+	} else if (cl && cl < up->rbuffer + hdrlen) {
+		long long length = atoll(cl + 17);
+		if (body > length) body = length;
+		client->remain = length - body;
+	} else {
+		// 没有 Content-Length(例如 chunked)：转发到上游关闭为止，连接不复用
+		client->remain = -1;
+		up->keepalive = 0;
+	}
+
+	memcpy(client->wbuffer, up->rbuffer, hdrlen + body);
+	client->wlen = hdrlen + body;
+	client->wsent = 0;
+}
+
+// 代理状态机：客户端和上游两个 fd 上的事件都进入这里，尽量向前推进，
+// 需要等待时只关注下一步需要的那一个事件
+static int proxy_step(int fd) {
+
+	struct conn_item *client = &connlist[fd];
+	int ufd = client->peer;
+	struct conn_item *up = ufd >= 0 ? &connlist[ufd] : NULL;
+	int ret;
+
+	switch (client->pstate) {
+	case PROXY_REQ_HEADER:
+		if (up->connecting) {
+			int err = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(ufd, SOL_SOCKET, SO_ERROR, &err, &len);
+			if (err != 0) {
+				return proxy_bad_gateway(fd);
+			}
+		}
+		while (client->wsent < client->reqlen) {
+			ssize_t n = send(ufd, client->rbuffer + client->wsent, client->reqlen - client->wsent, 0);
+			if (n < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+					proxy_set_event(ufd, EPOLLOUT);
+					return 0;
+				}
+				return proxy_bad_gateway(fd);
+			}
+			up->connecting = 0;
+			client->wsent += n;
+		}
+		client->pstate = PROXY_REQ_BODY;
+		/* fallthrough */
+
+	case PROXY_REQ_BODY:
+		ret = proxy_relay(client, fd, ufd, &client->remain);
+		if (ret == 1) {
+			proxy_set_event(ufd, 0);
+			proxy_set_event(fd, EPOLLIN);
+			return 0;
+		}
+		if (ret == 2) {
+			proxy_set_event(fd, 0);
+			proxy_set_event(ufd, EPOLLOUT);
+			return 0;
+		}
+		if (ret < 0) {
+			proxy_abort(fd);
+			return -1;
+		}
+		client->pstate = PROXY_RESP_HEADER;
+		up->rlen = 0;
+		up->rbuffer[0] = '\0';
+		proxy_set_event(fd, 0);
+		proxy_set_event(ufd, EPOLLIN);
+		/* fallthrough */
+
+	case PROXY_RESP_HEADER: {
+		// 1xx 中间响应之后，最终响应头可能已经完整地在 rbuffer 里，先解析再读
+		char *end;
+		while (!(end = strstr(up->rbuffer, "\r\n\r\n"))) {
+			if (up->rlen >= BUFFER_LENGTH - 1) {
+				return proxy_bad_gateway(fd);
+			}
+			int count = recv(ufd, up->rbuffer + up->rlen, BUFFER_LENGTH - up->rlen - 1, 0);
+			if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+				return 0;
+			}
+			if (count <= 0) {
+				// 连接池里的连接可能恰好被后端关闭：还没收到任何响应、请求完整地在 rbuffer 中时，
+				// 换一条新连接重发一次
+				if (up->reused && up->rlen == 0 && client->retry) {
+					int b = up->backend;
+					conn_close(ufd);
+					ufd = upstream_get(b, 0);
+					if (ufd < 0) {
+						client->peer = -1;
+						backends[b].active--;
+						return proxy_bad_gateway(fd);
+					}
+					client->peer = ufd;
+					connlist[ufd].peer = fd;
+					client->retry = 0;
+					client->wsent = 0;
+					client->pstate = PROXY_REQ_HEADER;
+					return proxy_step(fd);
+				}
+				return proxy_bad_gateway(fd);
+			}
+			up->rlen += count;
+			up->rbuffer[up->rlen] = '\0';
+		}
+		proxy_parse_response(client, up, end + 4 - up->rbuffer);
+		client->pstate = PROXY_RESP_WRITE;
+		proxy_set_event(ufd, 0);
+	}
+		/* fallthrough */
+
+	case PROXY_RESP_WRITE:
+		while (client->wsent < client->wlen) {
+			int count = conn_write(client, client->wbuffer + client->wsent, client->wlen - client->wsent);
+			if (count == -1) {
+				proxy_set_event(fd, EPOLLOUT);
+				return 0;
+			}
+			if (count < 0) {
+				proxy_abort(fd);
+				return -1;
+			}
+			client->wsent += count;
+		}
+		if (ufd < 0) {
+			// 502 / 504 已发出
+			conn_close(fd);
+			return -1;
+		}
+		if (client->interim) {
+			client->interim = 0;
+			client->pstate = PROXY_RESP_HEADER;
+			proxy_set_event(fd, 0);
+			proxy_set_event(ufd, EPOLLIN);
+			return proxy_step(fd);
+		}
+		client->pstate = PROXY_RESP_BODY;
+		/* fallthrough */
+
+	case PROXY_RESP_BODY:
+		ret = proxy_relay(client, ufd, fd, &client->remain);
+		if (ret == 1) {
+			proxy_set_event(fd, 0);
+			proxy_set_event(ufd, EPOLLIN);
+			return 0;
+		}
+		if (ret == 2) {
+			proxy_set_event(ufd, 0);
+			proxy_set_event(fd, EPOLLOUT);
+			return 0;
+		}
+		if (ret == -1 && client->remain < 0) {
+			// 读到上游关闭为止的响应：客户端也只能靠关闭连接判断结束
+			proxy_finish(fd, 0);
+			conn_close(fd);
+			return -1;
+		}
+		if (ret < 0) {
+			proxy_abort(fd);
+			return -1;
+		}
+		proxy_finish(fd, up->keepalive);
+		return 0;
+
+	default:
+		break;
+	}
+	return 0;
+}
+
+// 上游连接的读写事件
+int upstream_cb(int fd) {
+
+	struct conn_item *up = &connlist[fd];
+	if (up->peer < 0) {
+		// 连接池中的空闲连接变为可读：后端关闭了连接(或发来了意外的数据)
+		upstream_pool_remove(fd);
+		conn_close(fd);
+		return -1;
+	}
+	proxy_timer_touch(up->peer);
+	return proxy_step(up->peer);
+}
+
+// 代理端口上客户端的读事件：空闲时读取新请求，否则推进状态机
+int proxy_recv_cb(int fd) {
+
+	struct conn_item *client = &connlist[fd];
+	proxy_timer_touch(fd);
+	if (client->pstate != PROXY_IDLE) {
+		return proxy_step(fd);
+	}
+
+	int count = conn_read(client, client->rbuffer + client->rlen, BUFFER_LENGTH - client->rlen - 1);
+	if (count == -1) {
+		return 0;
+	}
+	if (count <= 0) {
+		conn_close(fd);
+		return -1;
+	}
+	client->rlen += count;
+	client->rbuffer[client->rlen] = '\0';
+
+	char *end = strstr(client->rbuffer, "\r\n\r\n");
+	if (!end) {
+		if (client->rlen >= BUFFER_LENGTH - 1) {
+			conn_close(fd);
+			return -1;
+		}
+		return count;
+	}
+	int hdrlen = end + 4 - client->rbuffer;
+
+	// 请求 body 只支持 Content-Length，chunked 请求直接拒绝
+	char *te = strcasestr(client->rbuffer, "\r\nTransfer-Encoding:");
+	if (te && te < end) {
+		client->wlen = sprintf(client->wbuffer,
+			"HTTP/1.1 411 Length Required\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+		conn_write(client, client->wbuffer, client->wlen);
+		conn_close(fd);
+		return -1;
+	}
+	char *cl = strcasestr(client->rbuffer, "\r\nContent-Length:");
+	long long length = (cl && cl < end) ? atoll(cl + 17) : 0;
+	long long body = client->rlen - hdrlen;
+	if (body > length) body = length;      // 不支持流水线，多余的字节丢弃
+
+	client->reqlen = hdrlen + body;
+	client->remain = length - body;
+	client->retry = client->remain == 0;   // 请求完整地在 rbuffer 中，可以重发
+	client->head_request = strncmp(client->rbuffer, "HEAD ", 5) == 0;
+
+	int b = upstream_pick();
+	int ufd = upstream_get(b, 1);
+	if (ufd < 0) {
+		client->peer = -1;
+		return proxy_bad_gateway(fd);
+	}
+	backends[b].active++;
+	client->peer = ufd;
+	connlist[ufd].peer = fd;
+	client->wsent = 0;
+	client->pstate = PROXY_REQ_HEADER;
+	proxy_set_event(fd, 0);
+
+	if (proxy_step(fd) < 0) {
+		return -1;
+	}
+	return count;
+}
+
+int proxy_send_cb(int fd) {
+	proxy_timer_touch(fd);
+	return proxy_step(fd);
+}
+
+int proxy_accept_cb(int fd) {
+
+	int clientfd = accept_cb(fd);
+	if (clientfd < 0) {
+		return -1;
+	}
+	connlist[clientfd].recv_t.recv_callback = proxy_recv_cb;
+	connlist[clientfd].send_callback = proxy_send_cb;
+	connlist[clientfd].pevents = EPOLLIN;
+	proxy_timer_touch(clientfd);
+
+	return clientfd;
+}
+
+// 关闭超时的代理连接：后端迟迟不响应时回复 504，其余情况(客户端空闲或读写停滞、
+// 转发 body 时上游停滞)直接关闭两端，避免一个卡住的后端永久占住两条连接
+static void proxy_expire(void) {
+
+	while (proxy_timer_head >= 0) {
+		int fd = proxy_timer_head;
+		struct conn_item *client = &connlist[fd];
+		if (proxy_clock - client->tactive < (unsigned long long)proxy_timeout) {
+			break;
+		}
+		if (client->pstate == PROXY_REQ_HEADER || client->pstate == PROXY_RESP_HEADER) {
+			proxy_timer_touch(fd);  // 给 504 一个超时周期写出去
+			proxy_error(fd, "504 Gateway Timeout");
+		} else {
+			proxy_abort(fd);
+		}
+	}
+}
+
+// epoll_wait 最多等到表头的连接到期，-1 表示没有代理连接
+static int proxy_next_timeout(void) {
+
+	if (proxy_timer_head < 0) {
+		return -1;
+	}
+	unsigned long long deadline = connlist[proxy_timer_head].tactive + proxy_timeout;
+	return deadline > proxy_clock ? (int)(deadline - proxy_clock) : 0;
+}
+
+// ip:port
+static int upstream_add(const char *spec) {
+
+	char ip[64];
+	int port;
+	if (nbackends >= UPSTREAM_MAX || sscanf(spec, "%63[^:]:%d", ip, &port) != 2) {
+		return -1;
+	}
+	struct upstream *u = &backends[nbackends];
+	memset(u, 0, sizeof(struct upstream));
+	u->addr.sin_family = AF_INET;
+	u->addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &u->addr.sin_addr) != 1) {
+		return -1;
+	}
+	nbackends++;
+	return 0;
+}
+
+#endif
+
+
+int recv_cb(int fd) { // fd --> EPOLLIN
+
+	struct conn_item *conn = &connlist[fd];
+	char *buffer = conn->rbuffer;
+	int idx = conn->rlen;
+
+	int count = conn_read(conn, buffer+idx, BUFFER_LENGTH-idx-1);
+	if (count == -1) {
+		return 0;
+	}
+	if (count <= 0) {
+		//printf("disconnect\n");
+
+		conn_close(fd);
+
+		return -1;
+	}
+	conn->rlen += count;
+	buffer[conn->rlen] = '\0';
+
+#if ENABLE_RATE_LIMIT
+	// 超限的请求回固定的 429 / 503，不打开文件，连接保持
+	int status = rate_check_request(conn);
+	if (status) {
+		const char *resp = status == 429 ? rate_429 : rate_503;
+		conn->wlen = strlen(resp);
+		memcpy(conn->wbuffer, resp, conn->wlen);
+		conn->rlen = 0;
+		conn->wsent = 0;
+		set_event(fd, EPOLLOUT, 0);
+		return count;
+	}
+#endif
+
+#if ENABLE_WEBSOCKET
+	// Upgrade 请求在这里转入 WebSocket，之后的读写由 ws_recv_cb / ws_send_cb 处理
+	if (ws_upgrade(fd) == 0) {
+		return count;
+	}
+#endif
+
+#if 0 //echo: need to send
+	memcpy(connlist[fd].wbuffer, connlist[fd].rbuffer, connlist[fd].rlen);
+	connlist[fd].wlen = connlist[fd].rlen;
+#else
+
+	http_request(conn);
+	http_response(conn);
+
+#endif
+	conn->rlen = 0;
+	conn->wsent = 0;
+
+	set_event(fd, EPOLLOUT, 0);
+
+
+	return count;
+}
+
+int send_cb(int fd) {
+
+	struct conn_item *conn = &connlist[fd];
+
+	// 1. 响应头
+	while (conn->wsent < conn->wlen) {
+		int count = conn_write(conn, conn->wbuffer + conn->wsent, conn->wlen - conn->wsent);
+		if (count == -1) return 0;      // 发送缓冲区满，等下一次 EPOLLOUT
+		if (count < 0) {
+			conn_close(fd);
+			return -1;
+		}
+		conn->wsent += count;
+	}
+
+	// 2. 静态文件
+	while (conn->filefd >= 0 && conn->offset < conn->filesize) {
+		int count = conn_sendfile(conn);
+		if (count == -1) return 0;
+		if (count < 0) {
+			conn_close(fd);
+			return -1;
+		}
+	}
+	if (conn->filefd >= 0) {
+		close(conn->filefd);
+		conn->filefd = -1;
+	}
+
+	set_event(fd, EPOLLIN, 0);
+
+	return conn->wsent;
+}
+
+int init_server(unsigned short port) {
+
+	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+	int reuse = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in serveraddr;
+	memset(&serveraddr, 0, sizeof(struct sockaddr_in));
+
+	serveraddr.sin_family = AF_INET;
+	serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	serveraddr.sin_port = htons(port);
+
+	if (-1 == bind(sockfd, (struct sockaddr*)&serveraddr, sizeof(struct sockaddr))) {
+		perror("bind");
+		close(sockfd);
+		return -1;
+	}
+
+	listen(sockfd, 4096);
+
+	return sockfd;
+}
+
+// tcp
+int main(int argc, char **argv) {
+
+	unsigned short port = 2048;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:u:b:t:c:m:r:l:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+#if ENABLE_UPSTREAM
+		case 'u':
+			if (upstream_add(optarg) < 0) {
+				fprintf(stderr, "invalid upstream: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'b':
+			balance = strcmp(optarg, "lc") == 0 ? BALANCE_LEAST_CONN : BALANCE_ROUND_ROBIN;
+			break;
+		case 't':
+			proxy_timeout = atoi(optarg) * 1000;
+			if (proxy_timeout <= 0) {
+				fprintf(stderr, "invalid proxy timeout: %s\n", optarg);
+				return -1;
+			}
+			break;
+#endif
+#if ENABLE_RATE_LIMIT
+		case 'c':
+			ip_conn_max = atoi(optarg);
+			break;
+		case 'm':
+			conn_max = atoi(optarg);
+			break;
+		case 'r':
+			if (rate_parse(optarg, &conn_rate, &conn_burst) < 0) {
+				fprintf(stderr, "invalid rate: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'l':
+			if (rate_route_add(optarg) < 0) {
+				fprintf(stderr, "invalid route limit: %s\n", optarg);
+				return -1;
+			}
+			break;
+#endif
+		default:
+			printf("usage: %s [-p port] [-u ip:port]... [-b rr|lc] [-t proxy_timeout] [-c per_ip_conns] [-m max_conns]\n"
+				"          [-r rate[:burst]] [-l /prefix=rate[:burst]]... [root_dir]\n", argv[0]);
+			return -1;
+		}
+	}
+	if (optind < argc) {
+		root_dir = argv[optind];
+	}
+
+	// 对端关闭后继续写会收到 SIGPIPE
+	signal(SIGPIPE, SIG_IGN);
+
+	int sockfd = init_server(port);
+	if (sockfd < 0) {
+		return -1;
+	}
+
+	//
+	connlist[sockfd].fd = sockfd;
+	connlist[sockfd].recv_t.accept_callback = accept_cb;
+
+	epfd = epoll_create(1); // int size
+
+	set_event(sockfd, EPOLLIN, 1);
+
+#if ENABLE_TLS
+	ssl_ctx = tls_ctx_create(TLS_CERT_FILE, TLS_KEY_FILE);
+	if (ssl_ctx) {
+		int tlsfd = init_server(TLS_PORT);
+		if (tlsfd >= 0) {
+			connlist[tlsfd].fd = tlsfd;
+			connlist[tlsfd].recv_t.accept_callback = tls_accept_cb;
+			set_event(tlsfd, EPOLLIN, 1);
+		}
+	} else {
+		fprintf(stderr, "tls disabled: cannot load %s / %s\n", TLS_CERT_FILE, TLS_KEY_FILE);
+	}
+#endif
+
+#if ENABLE_UPSTREAM
+	if (nbackends > 0) {
+		int proxyfd = init_server(PROXY_PORT);
+		if (proxyfd >= 0) {
+			connlist[proxyfd].fd = proxyfd;
+			connlist[proxyfd].recv_t.accept_callback = proxy_accept_cb;
+			set_event(proxyfd, EPOLLIN, 1);
+		}
+	}
+#endif
+
+	struct epoll_event events[1024] = {0};
+
+	while (1) { // mainloop();
+
+		int timeout = -1;
+#if ENABLE_UPSTREAM
+		timeout = proxy_next_timeout();
+#endif
+		int nready = epoll_wait(epfd, events, 1024, timeout); //
+#if ENABLE_UPSTREAM
+		proxy_clock = proxy_now_ms();
+#endif
+
+		int i = 0;
+		for (i = 0;i < nready;i ++) {
+
+			int connfd = events[i].data.fd;
+			int count = 0;
+			// 只有 EPOLLERR / EPOLLHUP 时也交给读回调，由读返回 0 或出错关闭连接
+			if ((events[i].events & EPOLLIN) || !(events[i].events & EPOLLOUT)) { //
+
+				count = connlist[connfd].recv_t.recv_callback(connfd);
+				//printf("recv count: %d <-- buffer: %s\n", count, connlist[connfd].rbuffer);
+
+			}
+			// WebSocket 连接在写队列未发完时同时关注 EPOLLIN | EPOLLOUT，
+			// 两个事件都要处理，否则对端持续发送时写队列得不到发送；读回调已关闭连接时跳过
+			if ((events[i].events & EPOLLOUT) && count >= 0) {
+				//printf("send --> buffer: %s\n",  connlist[connfd].wbuffer);
+
+				count = connlist[connfd].send_callback(connfd);
+			}
+		}
+#if ENABLE_UPSTREAM
+		// 本轮事件处理完再检查超时，避免关闭的 fd 在同一轮里还有待处理的事件
+		proxy_expire();
+#endif
+	}
 
 
 	getchar();
@@ -267,6 +2142,8 @@ int main() {
 
 }
 
-// C1000K --> 
+// C1000K -->
+
+
 
 
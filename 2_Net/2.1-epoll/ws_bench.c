@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/**
+ * webserver.c 的 WebSocket 广播压测客户端
+ *
+ * 建立 -c 条连接并完成 WebSocket 握手，全部作为订阅者；第 0 条连接同时是发布者，
+ * 每轮发出一条 -s 字节的文本消息，服务器把它广播给所有连接(包括发布者自己)。
+ * 一轮在所有连接都收齐这一帧后结束，记录每条连接从发布到收齐的时延，
+ * 输出 p50/p99/最后一个订阅者的时延和每秒投递的消息数。
+ *
+ * 单个源地址只有约 28K 个临时端口，10 万连接需要 -b 4 以上。
+ *
+ * shell: gcc -O2 ws_bench.c -o ws_bench
+ * usage: ./ws_bench [-c conns] [-n rounds] [-s msgsize] [-b nsrc] ip port
+ */
+
+#define MAX_MSG         65535
+#define MAX_EVENTS      1024
+#define LAT_BUCKETS     1000000     // 时延直方图：1us 一格，最多 1s
+#define ROUND_TIMEOUT   10000       // 一轮超过 10s 没有收齐视为失败
+
+#define TIME_SUB_MS(tv1, tv2)  ((tv1.tv_sec - tv2.tv_sec) * 1000 + (tv1.tv_usec - tv2.tv_usec) / 1000)
+
+#define WS_UPGRADE_REQUEST \
+	"GET /ws HTTP/1.1\r\n" \
+	"Host: bench\r\n" \
+	"Upgrade: websocket\r\n" \
+	"Connection: Upgrade\r\n" \
+	"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+	"Sec-WebSocket-Version: 13\r\n\r\n"
+
+enum { CONN_CONNECTING, CONN_HANDSHAKE, CONN_OPEN, CONN_FAILED };
+
+struct bench_conn {
+	int fd;
+	int state;
+	int hlen;                   // 握手阶段已收到的响应头字节数
+	char header[256];
+	long long received;         // 握手之后收到的帧字节总数
+};
+
+static struct bench_conn *conns;
+static unsigned int latency_hist[LAT_BUCKETS + 1];
+
+static long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void latency_record(long long ns) {
+	long long us = ns / 1000;
+	latency_hist[us < LAT_BUCKETS ? us : LAT_BUCKETS]++;
+}
+
+static int latency_percentile(long long total, double pct) {
+	long long target = (long long)(total * pct / 100), seen = 0;
+	int i;
+	for (i = 0; i <= LAT_BUCKETS; i++) {
+		seen += latency_hist[i];
+		if (seen > target) return i;
+	}
+	return LAT_BUCKETS;
+}
+
+static int open_conn(struct sockaddr_in *addr, int src_index) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (src_index > 0) {
+		struct sockaddr_in src;
+		memset(&src, 0, sizeof(src));
+		src.sin_family = AF_INET;
+		src.sin_addr.s_addr = htonl(INADDR_LOOPBACK + src_index);
+#ifdef IP_BIND_ADDRESS_NO_PORT
+		setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+#endif
+		if (bind(fd, (struct sockaddr *)&src, sizeof(src)) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0 && errno != EINPROGRESS) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// 客户端发出的帧必须带掩码
+static int ws_frame_masked(unsigned char *frame, const char *payload, int len) {
+	unsigned char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+	int hlen = 2, i;
+
+	frame[0] = 0x81;    // FIN | text
+	if (len < 126) {
+		frame[1] = 0x80 | len;
+	} else {
+		frame[1] = 0x80 | 126;
+		frame[2] = len >> 8;
+		frame[3] = len & 0xFF;
+		hlen = 4;
+	}
+	memcpy(frame + hlen, mask, 4);
+	hlen += 4;
+	for (i = 0; i < len; i++) {
+		frame[hlen + i] = payload[i] ^ mask[i & 3];
+	}
+	return hlen + len;
+}
+
+static void conn_fail(int epfd, struct bench_conn *c) {
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	c->state = CONN_FAILED;
+}
+
+// 处理一个连接上的事件，返回本次新收到的帧字节数
+static int conn_event(int epfd, struct bench_conn *c, int events) {
+	struct epoll_event ev;
+
+	if (c->state == CONN_CONNECTING) {
+		int err = 0;
+		socklen_t elen = sizeof(err);
+		getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &elen);
+		if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+			conn_fail(epfd, c);
+			return 0;
+		}
+		send(c->fd, WS_UPGRADE_REQUEST, strlen(WS_UPGRADE_REQUEST), 0);
+		c->state = CONN_HANDSHAKE;
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+		return 0;
+	}
+
+	if (c->state == CONN_HANDSHAKE) {
+		// 逐段读响应头，不越过头部结束位置，之后的字节都是帧
+		int n = recv(c->fd, c->header + c->hlen, sizeof(c->header) - c->hlen - 1, MSG_PEEK);
+		if (n <= 0) {
+			if (n < 0 && errno == EAGAIN) return 0;
+			conn_fail(epfd, c);
+			return 0;
+		}
+		c->header[c->hlen + n] = '\0';
+		char *end = strstr(c->header, "\r\n\r\n");
+		int take = end ? (int)(end + 4 - c->header) - c->hlen : n;
+		recv(c->fd, c->header + c->hlen, take, 0);
+		c->hlen += take;
+		if (!end) {
+			if (c->hlen >= (int)sizeof(c->header) - 1) conn_fail(epfd, c);
+			return 0;
+		}
+		if (strncmp(c->header, "HTTP/1.1 101", 12) != 0 ||
+			!strstr(c->header, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=")) {
+			conn_fail(epfd, c);
+			return 0;
+		}
+		c->state = CONN_OPEN;
+		return 0;
+	}
+
+	char buf[16384];
+	int total = 0;
+	while (1) {
+		ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+		if (n > 0) {
+			total += n;
+			continue;
+		}
+		if (n == 0 || errno != EAGAIN) conn_fail(epfd, c);
+		break;
+	}
+	c->received += total;
+	return total;
+}
+
+int main(int argc, char **argv) {
+	int nconns = 1000, rounds = 20, msgsize = 1024, nsrc = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:n:s:b:")) != -1) {
+		switch (opt) {
+		case 'c': nconns = atoi(optarg); break;
+		case 'n': rounds = atoi(optarg); break;
+		case 's': msgsize = atoi(optarg); break;
+		case 'b': nsrc = atoi(optarg); break;
+		default: goto usage;
+		}
+	}
+	if (argc - optind < 2) goto usage;
+	if (nconns <= 0) nconns = 1;
+	if (msgsize <= 0 || msgsize > MAX_MSG) msgsize = 1024;
+	if (nsrc < 1) nsrc = 1;
+
+	struct rlimit rl = { nconns + 64, nconns + 64 };
+	setrlimit(RLIMIT_NOFILE, &rl);
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(argv[optind]);
+	addr.sin_port = htons(atoi(argv[optind + 1]));
+
+	int epfd = epoll_create(1);
+	conns = (struct bench_conn *)calloc(nconns, sizeof(struct bench_conn));
+	struct epoll_event ev, events[MAX_EVENTS];
+
+	// 1. 建连并完成握手，每发起 1000 个连接处理一次事件，避免 backlog 被打满
+	struct timeval tv_begin, tv_cur;
+	gettimeofday(&tv_begin, NULL);
+
+	int i, k, opened = 0, open = 0, failed = 0;
+	for (i = 0; i < nconns; i++) {
+		struct bench_conn *c = &conns[i];
+		c->fd = open_conn(&addr, nsrc > 1 ? i % nsrc : 0);
+		if (c->fd < 0) {
+			c->state = CONN_FAILED;
+			continue;
+		}
+		c->state = CONN_CONNECTING;
+		ev.events = EPOLLOUT;
+		ev.data.ptr = c;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+		opened++;
+
+		if ((opened % 1000) == 0 || i == nconns - 1) {
+			int idle = 0;
+			while (idle < 20) {
+				int nready = epoll_wait(epfd, events, MAX_EVENTS, 10);
+				for (k = 0; k < nready; k++) {
+					conn_event(epfd, events[k].data.ptr, events[k].events);
+				}
+				idle = nready == 0 ? idle + 1 : 0;
+				// 本批的连接都已握手完成或失败就继续发起下一批
+				open = failed = 0;
+				int j;
+				for (j = (i / 1000) * 1000; j <= i; j++) {
+					if (conns[j].state == CONN_OPEN) open++;
+					else if (conns[j].state == CONN_FAILED) failed++;
+				}
+				if (open + failed == i - (i / 1000) * 1000 + 1) break;
+			}
+		}
+	}
+
+	open = 0;
+	for (i = 0; i < nconns; i++) {
+		if (conns[i].state == CONN_OPEN) open++;
+	}
+	gettimeofday(&tv_cur, NULL);
+	printf("websocket connections: %d open, %d failed, connect time_used: %ldms\n",
+		open, nconns - open, TIME_SUB_MS(tv_cur, tv_begin));
+	if (open == 0 || conns[0].state != CONN_OPEN) return -1;
+
+	// 2. 广播轮次：第 0 条连接发布，所有连接收齐这一帧后进入下一轮
+	static char payload[MAX_MSG];
+	static unsigned char frame[MAX_MSG + 8];
+	memset(payload, 'w', sizeof(payload));
+	int framelen = ws_frame_masked(frame, payload, msgsize);
+	int server_framelen = msgsize + (msgsize < 126 ? 2 : 4);   // 服务器的帧不带掩码
+
+	long long deliveries = 0, lost = 0;
+	long long round_max_us = 0, round_sum_us = 0;
+	long long begin_ns = now_ns();
+	int r;
+
+	for (r = 1; r <= rounds; r++) {
+		long long expect = (long long)r * server_framelen;
+		long long sent_ns = now_ns();
+		send(conns[0].fd, frame, framelen, 0);
+
+		int pending = 0;
+		for (i = 0; i < nconns; i++) {
+			if (conns[i].state == CONN_OPEN) pending++;
+		}
+		long long last_ns = sent_ns;
+		while (pending > 0) {
+			int nready = epoll_wait(epfd, events, MAX_EVENTS, 100);
+			for (k = 0; k < nready; k++) {
+				struct bench_conn *c = events[k].data.ptr;
+				if (c->state != CONN_OPEN) continue;
+				long long before = c->received;
+				conn_event(epfd, c, events[k].events);
+				if (c->state != CONN_OPEN) {
+					if (before < expect) pending--;
+					continue;
+				}
+				if (before < expect && c->received >= expect) {
+					last_ns = now_ns();
+					latency_record(last_ns - sent_ns);
+					deliveries++;
+					pending--;
+				}
+			}
+			if ((now_ns() - sent_ns) / 1000000 > ROUND_TIMEOUT) break;
+		}
+		lost += pending;
+
+		long long us = (last_ns - sent_ns) / 1000;
+		round_sum_us += us;
+		if (us > round_max_us) round_max_us = us;
+		// 之后的轮次把这一轮没收齐的连接当作失败，避免永远等待
+		if (pending > 0) {
+			for (i = 0; i < nconns; i++) {
+				if (conns[i].state == CONN_OPEN && conns[i].received < expect) {
+					conn_fail(epfd, &conns[i]);
+				}
+			}
+			if (conns[0].state != CONN_OPEN) break;
+		}
+	}
+
+	long long elapsed_us = (now_ns() - begin_ns) / 1000;
+	if (elapsed_us <= 0) elapsed_us = 1;
+	int done = r > rounds ? rounds : r;
+
+	printf("rounds: %d, message: %d bytes, deliveries: %lld, lost: %lld, time_used: %lldms\n",
+		done, msgsize, deliveries, lost, elapsed_us / 1000);
+	printf("deliveries/sec: %.0f, avg round (last subscriber): %lldus, max round: %lldus\n",
+		(double)deliveries * 1000000 / elapsed_us, done ? round_sum_us / done : 0, round_max_us);
+	if (deliveries > 0) {
+		printf("delivery latency p50: %dus, p99: %dus, p999: %dus\n",
+			latency_percentile(deliveries, 50), latency_percentile(deliveries, 99),
+			latency_percentile(deliveries, 99.9));
+	}
+
+	for (i = 0; i < nconns; i++) {
+		if (conns[i].fd > 0) close(conns[i].fd);
+	}
+	free(conns);
+	close(epfd);
+	return 0;
+
+usage:
+	printf("Usage: %s [-c conns] [-n rounds] [-s msgsize] [-b nsrc] ip port\n", argv[0]);
+	return 0;
+}
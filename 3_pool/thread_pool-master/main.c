@@ -38,7 +38,11 @@ void test_thrdpool_basic() {
     while (thrdpool_post(pool, &do_task, pool) == 0) {
     }
 
-    thrdpool_waitdone(pool);
+    // 终止后还在排队的任务不会执行，waitdone 会把它们计入 cancelled
+    struct thrdpool_done result;
+    thrdpool_waitdone(pool, &result);
+    printf("completed %llu, cancelled %llu\n",
+           (unsigned long long)result.completed, (unsigned long long)result.cancelled);
     pthread_mutex_destroy(&lock);
 }
 
@@ -0,0 +1,371 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "thrd_dag.h"
+
+/**
+ * shell: gcc -O2 -c thrd_dag.c thrd_pool.c
+ * usage: include thrd_dag.h & link thrd_dag.o thrd_pool.o
+ */
+
+struct thrddag_node_s {
+    thrdpool_task_t task;           // 投递用，嵌在节点里
+    thrddag_t *dag;
+    handler_pt func;
+    void *arg;
+    thrddag_node_t **succ;
+    int nsucc;
+    int cap;
+    int indegree;
+    atomic_int remaining;           // 还没完成的前驱数
+    thrddag_node_t *ready_next;     // 当前线程待处理的就绪节点链，节点只会就绪一次
+    int64_t start_ns;
+    int64_t end_ns;
+    uint64_t path_ns;               // 以本节点结尾的最长路径，求关键路径用
+    thrddag_node_t *path_prev;
+    int path_nodes;
+};
+
+struct thrddag_s {
+    thrdpool_t *pool;
+    thrddag_node_t **nodes;
+    int nnodes;
+    int cap;
+    int nedges;
+    thrddag_node_t **order;         // 拓扑序，图有改动后的第一次 run 时计算
+    int sorted;                     // order 有效，增加节点或边时清零
+    int nroots;                     // 入度为 0 的节点数，是 order 的前 nroots 个
+    int nsinks;                     // 出度为 0 的节点数
+    atomic_int pending;             // 本次执行还没完成的出度为 0 的节点数
+    atomic_int failed;              // 有节点没能执行，剩下的都跳过
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int done;
+    struct thrddag_stats stats;
+};
+
+static void __dag_run_node(void *arg);
+static void __dag_cancel_node(void *arg);
+
+// 出度为 0 的节点完成时调用，最后一个唤醒 thrddag_run，之后不能再访问 dag。
+// 每个节点不管执行还是跳过都会处理后继，所以这些节点都完成时整张图就完成了
+static void
+__dag_finish_one(thrddag_t *dag) {
+    if (atomic_fetch_sub(&dag->pending, 1) == 1) {
+        pthread_mutex_lock(&dag->mutex);
+        dag->done = 1;
+        pthread_cond_signal(&dag->cond);
+        pthread_mutex_unlock(&dag->mutex);
+    }
+}
+
+static int
+__dag_post(thrddag_node_t *node) {
+    thrdpool_task_init(&node->task, __dag_run_node, node);
+    node->task.cancel = __dag_cancel_node;
+    return thrdpool_post_task(node->dag->pool, &node->task);
+}
+
+/**
+ * 执行一个节点，然后处理它的后继
+ *
+ * 第一个就绪的后继接着在本线程执行，其余的投递；投递失败(线程池已终止)或者图已经失败时，
+ * 节点放进本线程的就绪链，只做完成计数不执行
+ *
+ * @param node 就绪的节点
+ * @param skip 为 1 时不执行 func
+ */
+static void
+__dag_exec(thrddag_node_t *node, int skip) {
+    thrddag_t *dag = node->dag;
+    thrddag_node_t *list = NULL;
+    int64_t now = 0;
+    int i;
+
+    while (node) {
+        thrddag_node_t *next = NULL;
+
+        if (skip || atomic_load_explicit(&dag->failed, memory_order_relaxed)) {
+            atomic_store(&dag->failed, 1);
+            node->start_ns = node->end_ns = 0;
+        } else {
+            // 接着执行的后继沿用上一个节点的结束时间，每个节点只多一次 clock_gettime
+            node->start_ns = now ? now : thrdpool_now_ns();
+            node->func(node->arg);
+            now = node->end_ns = thrdpool_now_ns();
+        }
+
+        for (i = 0; i < node->nsucc; i++) {
+            thrddag_node_t *s = node->succ[i];
+            if (atomic_fetch_sub(&s->remaining, 1) != 1)
+                continue;
+            if (!next && !atomic_load_explicit(&dag->failed, memory_order_relaxed)) {
+                next = s;
+            } else if (atomic_load_explicit(&dag->failed, memory_order_relaxed) || __dag_post(s) != 0) {
+                atomic_store(&dag->failed, 1);
+                s->ready_next = list;
+                list = s;
+            }
+        }
+        // next 和 list 里的节点下游都还有没完成的出度为 0 的节点，这里不会是最后一个
+        if (node->nsucc == 0)
+            __dag_finish_one(dag);
+
+        if (next) {
+            node = next;
+        } else if (list) {
+            node = list;
+            list = list->ready_next;
+        } else {
+            node = NULL;
+        }
+        skip = 0;
+    }
+}
+
+static void
+__dag_run_node(void *arg) {
+    __dag_exec((thrddag_node_t *)arg, 0);
+}
+
+// 线程池终止时节点还在队列里
+static void
+__dag_cancel_node(void *arg) {
+    __dag_exec((thrddag_node_t *)arg, 1);
+}
+
+/**
+ * Kahn 算法求拓扑序
+ *
+ * @return 成功返回0，有环返回-1
+ */
+static int
+__dag_sort(thrddag_t *dag) {
+    int head = 0, tail = 0, i, j;
+
+    if (dag->sorted)
+        return 0;
+    dag->nsinks = 0;
+    for (i = 0; i < dag->nnodes; i++) {
+        thrddag_node_t *n = dag->nodes[i];
+        atomic_store_explicit(&n->remaining, n->indegree, memory_order_relaxed);
+        if (n->indegree == 0)
+            dag->order[tail++] = n;
+        if (n->nsucc == 0)
+            dag->nsinks++;
+    }
+    dag->nroots = tail;
+    while (head < tail) {
+        thrddag_node_t *n = dag->order[head++];
+        for (j = 0; j < n->nsucc; j++) {
+            thrddag_node_t *s = n->succ[j];
+            int left = atomic_load_explicit(&s->remaining, memory_order_relaxed) - 1;
+            atomic_store_explicit(&s->remaining, left, memory_order_relaxed);
+            if (left == 0)
+                dag->order[tail++] = s;
+        }
+    }
+    if (tail != dag->nnodes)
+        return -1;
+    dag->sorted = 1;
+    return 0;
+}
+
+// 按拓扑序求以每个节点结尾的最长路径
+static void
+__dag_critical_path(thrddag_t *dag) {
+    struct thrddag_stats *st = &dag->stats;
+    thrddag_node_t *last = NULL;
+    uint64_t work_ns = 0;
+    int i, j;
+
+    for (i = 0; i < dag->nnodes; i++) {
+        dag->nodes[i]->path_ns = 0;
+        dag->nodes[i]->path_prev = NULL;
+        dag->nodes[i]->path_nodes = 0;
+    }
+    for (i = 0; i < dag->nnodes; i++) {
+        thrddag_node_t *n = dag->order[i];
+        uint64_t cost = (uint64_t)(n->end_ns - n->start_ns);
+        // 进来时 path_ns 是前驱里最长的路径
+        n->path_ns += cost;
+        n->path_nodes++;
+        work_ns += cost;
+        if (!last || n->path_ns > last->path_ns)
+            last = n;
+        for (j = 0; j < n->nsucc; j++) {
+            thrddag_node_t *s = n->succ[j];
+            if (!s->path_prev || n->path_ns > s->path_ns) {
+                s->path_ns = n->path_ns;
+                s->path_prev = n;
+                s->path_nodes = n->path_nodes;
+            }
+        }
+    }
+    st->work_us = work_ns / 1000;
+    st->critical_us = last ? last->path_ns / 1000 : 0;
+    st->critical_nodes = last ? last->path_nodes : 0;
+}
+
+thrddag_t *
+thrddag_create(thrdpool_t *pool) {
+    thrddag_t *dag = (thrddag_t *)calloc(1, sizeof(*dag));
+    if (!dag) return NULL;
+    if (pthread_mutex_init(&dag->mutex, NULL) != 0) {
+        free(dag);
+        return NULL;
+    }
+    if (pthread_cond_init(&dag->cond, NULL) != 0) {
+        pthread_mutex_destroy(&dag->mutex);
+        free(dag);
+        return NULL;
+    }
+    dag->pool = pool;
+    return dag;
+}
+
+void
+thrddag_destroy(thrddag_t *dag) {
+    int i;
+    for (i = 0; i < dag->nnodes; i++) {
+        free(dag->nodes[i]->succ);
+        free(dag->nodes[i]);
+    }
+    free(dag->nodes);
+    free(dag->order);
+    pthread_cond_destroy(&dag->cond);
+    pthread_mutex_destroy(&dag->mutex);
+    free(dag);
+}
+
+thrddag_node_t *
+thrddag_node(thrddag_t *dag, handler_pt func, void *arg) {
+    if (dag->nnodes == dag->cap) {
+        int cap = dag->cap ? dag->cap * 2 : 64;
+        thrddag_node_t **nodes = (thrddag_node_t **)realloc(dag->nodes, sizeof(*nodes) * cap);
+        if (!nodes) return NULL;
+        dag->nodes = nodes;
+        thrddag_node_t **order = (thrddag_node_t **)realloc(dag->order, sizeof(*order) * cap);
+        if (!order) return NULL;
+        dag->order = order;
+        dag->cap = cap;
+    }
+    thrddag_node_t *node = (thrddag_node_t *)calloc(1, sizeof(*node));
+    if (!node) return NULL;
+    node->dag = dag;
+    node->func = func;
+    node->arg = arg;
+    dag->nodes[dag->nnodes++] = node;
+    dag->sorted = 0;
+    return node;
+}
+
+int
+thrddag_edge(thrddag_node_t *from, thrddag_node_t *to) {
+    if (from->dag != to->dag)
+        return -1;
+    if (from->nsucc == from->cap) {
+        int cap = from->cap ? from->cap * 2 : 4;
+        thrddag_node_t **succ = (thrddag_node_t **)realloc(from->succ, sizeof(*succ) * cap);
+        if (!succ) return -1;
+        from->succ = succ;
+        from->cap = cap;
+    }
+    from->succ[from->nsucc++] = to;
+    to->indegree++;
+    from->dag->nedges++;
+    from->dag->sorted = 0;
+    return 0;
+}
+
+/**
+ * 撤销刚创建的节点：去掉 deps[0] ~ deps[n-1] 指向它的边，然后释放
+ *
+ * 节点是 dag->nodes 的最后一个，它的入边分别是各前驱 succ 的最后一条，按相反顺序去掉
+ */
+static void
+__dag_undo_node(thrddag_t *dag, thrddag_node_t *node, thrddag_node_t **deps, int n) {
+    int i;
+    for (i = n - 1; i >= 0; i--) {
+        deps[i]->nsucc--;
+        dag->nedges--;
+    }
+    dag->nnodes--;
+    dag->sorted = 0;
+    free(node->succ);
+    free(node);
+}
+
+thrddag_node_t *
+thrddag_then(thrddag_node_t *prev, handler_pt func, void *arg) {
+    thrddag_node_t *node = thrddag_node(prev->dag, func, arg);
+    if (!node) return NULL;
+    if (thrddag_edge(prev, node) != 0) {
+        __dag_undo_node(prev->dag, node, NULL, 0);
+        return NULL;
+    }
+    return node;
+}
+
+thrddag_node_t *
+thrddag_when_all(thrddag_t *dag, thrddag_node_t **deps, int n, handler_pt func, void *arg) {
+    int i;
+    thrddag_node_t *node = thrddag_node(dag, func, arg);
+    if (!node) return NULL;
+    for (i = 0; i < n; i++) {
+        if (thrddag_edge(deps[i], node) != 0) {
+            __dag_undo_node(dag, node, deps, i);
+            return NULL;
+        }
+    }
+    return node;
+}
+
+/**
+ * 执行整张图
+ *
+ * 在非工作线程里调用：等待期间阻塞调用线程
+ *
+ * @return 全部节点执行完返回0，有环或者有节点没能执行返回-1
+ */
+int
+thrddag_run(thrddag_t *dag) {
+    int i;
+    int64_t start;
+
+    if (dag->nnodes == 0)
+        return 0;
+    if (__dag_sort(dag) != 0)
+        return -1;
+    for (i = 0; i < dag->nnodes; i++) {
+        thrddag_node_t *n = dag->nodes[i];
+        atomic_store_explicit(&n->remaining, n->indegree, memory_order_relaxed);
+    }
+    atomic_store(&dag->pending, dag->nsinks);
+    atomic_store(&dag->failed, 0);
+    dag->done = 0;
+
+    start = thrdpool_now_ns();
+    for (i = 0; i < dag->nroots; i++) {
+        thrddag_node_t *n = dag->order[i];
+        if (__dag_post(n) != 0)
+            __dag_cancel_node(n);
+    }
+
+    pthread_mutex_lock(&dag->mutex);
+    while (!dag->done)
+        pthread_cond_wait(&dag->cond, &dag->mutex);
+    pthread_mutex_unlock(&dag->mutex);
+
+    dag->stats.nodes = dag->nnodes;
+    dag->stats.edges = dag->nedges;
+    dag->stats.wall_us = (uint64_t)(thrdpool_now_ns() - start) / 1000;
+    __dag_critical_path(dag);
+    return atomic_load(&dag->failed) ? -1 : 0;
+}
+
+void
+thrddag_stats(thrddag_t *dag, struct thrddag_stats *st) {
+    *st = dag->stats;
+}
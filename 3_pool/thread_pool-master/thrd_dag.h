@@ -0,0 +1,65 @@
+#ifndef _THREAD_DAG_H
+#define _THREAD_DAG_H
+
+#include "thrd_pool.h"
+
+/**
+ * 任务依赖图：在 thrdpool 上按依赖关系执行一组任务
+ *
+ * - 先声明节点和边，thrddag_run 时入度为 0 的节点先投递，其余节点在所有前驱完成后自动投递
+ * - 每个节点一个依赖计数，前驱完成时减 1，减到 0 的后继就绪；第一个就绪的后继在当前工作线程上直接执行，
+ *   其余的投递到线程池，一条链不会每一步都经过一次队列
+ * - 节点的任务嵌在节点里，用 thrdpool_post_task 投递，执行期间不分配内存
+ * - 执行后记录每个节点的耗时，按拓扑序求关键路径：整张图最少要这么久，和实际耗时一比就知道并行度够不够
+ *
+ * 线程池终止或排空超时导致某个节点没能执行时，整张图标记失败，剩下的节点都不再执行，thrddag_run 返回 -1。
+ *
+ * shell: gcc -O2 -c thrd_dag.c thrd_pool.c
+ * usage: include thrd_dag.h & link thrd_dag.o thrd_pool.o
+ */
+
+typedef struct thrddag_s thrddag_t;
+typedef struct thrddag_node_s thrddag_node_t;
+
+struct thrddag_stats {
+    int nodes;
+    int edges;
+    int critical_nodes;         // 关键路径上的节点数
+    uint64_t wall_us;           // 最近一次 thrddag_run 的实际耗时
+    uint64_t work_us;           // 所有节点耗时之和
+    uint64_t critical_us;       // 关键路径上节点耗时之和，work_us / critical_us 是图本身的并行度上限
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+thrddag_t *thrddag_create(thrdpool_t *pool);
+
+void thrddag_destroy(thrddag_t *dag);
+
+// 声明一个节点，内存不足返回 NULL
+thrddag_node_t *thrddag_node(thrddag_t *dag, handler_pt func, void *arg);
+
+// to 在 from 完成后执行，成功返回 0
+int thrddag_edge(thrddag_node_t *from, thrddag_node_t *to);
+
+// 新节点在 prev 完成后执行；失败返回 NULL，图保持不变
+thrddag_node_t *thrddag_then(thrddag_node_t *prev, handler_pt func, void *arg);
+
+// 新节点在 deps[0] ~ deps[n-1] 都完成后执行；失败返回 NULL，已加的边撤销，图保持不变
+thrddag_node_t *thrddag_when_all(thrddag_t *dag, thrddag_node_t **deps, int n,
+                                 handler_pt func, void *arg);
+
+// 执行整张图并等待完成；有环或者有节点没能执行返回 -1。可以反复执行
+int thrddag_run(thrddag_t *dag);
+
+// 最近一次 thrddag_run 的统计
+void thrddag_stats(thrddag_t *dag, struct thrddag_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,7 +1,14 @@
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include "thrd_pool.h"
 #include "spinlock.h"
 
@@ -15,32 +22,265 @@
 
 typedef struct spinlock spinlock_t;
 
-typedef struct task_s {
-    void *next;
-    handler_pt func;
-    void *arg;
-} task_t;
+// owner 为分配它的 task_cache_t，侵入式任务为 NULL
+typedef thrdpool_task_t task_t;
 
-/*
-block = 1 (默认值): 工作线程尝试获取任务时，如果队列为空，会通过条件变量阻塞等待
-block = 0: 工作线程尝试获取任务时，如果队列为空，立即返回 NULL 而不阻塞
-*/
+// 队列本身只管存取，不负责等待；没有任务时工作线程在自己的休眠槽上休眠，见 __worker_park
 typedef struct task_queue_s {
     void *head;
     void **tail; 
-    int block;   // 0: nonblock, 1: block
     spinlock_t lock;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
+    long count;                     // 队列长度，锁内修改，统计时不加锁读
 } task_queue_t;
 
+/*
+工作窃取模式(THRDPOOL_WORK_STEALING)：
+- 每个工作线程一个 Chase-Lev 双端队列：自己在 bottom 端 push/take(LIFO)，其它线程在 top 端 steal(FIFO)，
+  只有争抢最后一个任务时才需要 CAS，平时没有锁
+- 外部线程的投递进入注入队列，注入队列按工作线程数分片，每个投递线程固定用一个分片，分散锁竞争
+- 工作线程从注入分片一次取一批，第一个自己执行，其余放进自己的双端队列，空闲的线程可以偷走
+- 工作线程里再投递的任务直接进自己的双端队列
+- 都没有任务时和全局队列模式一样，自旋一会儿再在自己的休眠槽上休眠
+*/
+#define WS_DEQUE_SIZE   4096        // 2 的幂；满了的话投递改走注入分片
+#define WS_MAX_SHARDS   64
+#define WS_BATCH        32          // 从注入分片一次取的任务数
+#define CACHELINE       64
+
+typedef struct ws_deque_s {
+    atomic_long top;
+    char pad0[CACHELINE - sizeof(atomic_long)];
+    atomic_long bottom;
+    char pad1[CACHELINE - sizeof(atomic_long)];
+    _Atomic(task_t *) *buf;
+} ws_deque_t;
+
+/*
+休眠与唤醒：
+- 没有任务时先自旋 spin 次检查队列，找到任务说明负载是突发的，下次自旋加倍；白转了一圈则减半。
+  单核机器上自旋只会占着唯一的 cpu，不自旋
+- 还是没有就把自己压入 idle 栈，parked 置 1，在 parked 上 futex 休眠，每个线程一个独立的休眠槽
+- 投递方放入任务后读 idle 计数，为 0 就什么都不做；否则从 idle 栈弹出线程，parked 清 0 后 futex 唤醒它，
+  唤醒是定向的，不会惊动其它线程
+- 单个投递同一时刻最多只有一个线程"在醒来的路上"(waking)：已经有线程被唤醒还没拿到任务时，
+  再投递不会重复唤醒；被唤醒的线程拿到任务后，如果队列里还有任务再唤醒下一个，逐个接力。
+  突发投递时不会为每个任务都唤醒一个线程，结果大多数线程醒来发现任务已经被别人拿走
+- 工作线程登记后、休眠前再检查一次队列；投递方放任务后、读 idle 前，两边各有一个 seq_cst 屏障，
+  两边至少有一方能看到对方，不会出现任务已放入而线程仍在休眠的情况
+*/
+#define SPIN_MIN        16
+#define SPIN_MAX        2048
+
+/*
+优先级与排队延迟统计：
+- 高优先级和后台各有一个全局队列，普通任务走原来的路径(全局队列或工作窃取)
+- 取任务时先看高优先级；普通任务连续取了 BG_WEIGHT 个之后先给后台一次机会
+- 开始执行前检查截止时间，过期的任务调用 cancel 而不执行 func
+- 排队延迟按微秒记录到每个工作线程自己的直方图里，只有所属线程写，读的时候汇总
+  直方图每个 2 的幂区间再分 4 格，百分位的误差在 25% 以内
+*/
+/*
+动态伸缩：
+- 常驻 min_threads 个线程，最多 max_threads 个；工作线程结构按 2 * max_threads 预先分配成槽位，
+  多出的一倍留给阻塞补偿
+- 取出任务时发现它的排队延迟超过 spawn_delay 并且没有空闲线程，就增加一个线程
+- 空闲线程在休眠槽上的等待带 keepalive 超时，超时后线程数多于 min_threads 就退出
+- 任务里调用 thrdpool_blocking_begin/end 标记阻塞区间，阻塞的线程不计入 max_threads，
+  进入阻塞时没有空闲线程就补一个
+- 槽位状态由 scale_mutex 保护：EMPTY -> RUNNING -> EXITED(自己退出，等下次复用时 join)
+  thrdpool_waitdone 把要 join 的槽位标成 JOINING，不会被复用，也不会被 join 两次
+*/
+#define SLOT_EMPTY      0
+#define SLOT_RUNNING    1
+#define SLOT_EXITED     2
+#define SLOT_JOINING    3
+
+#define DEFAULT_SPAWN_DELAY_US  1000
+#define DEFAULT_KEEPALIVE_MS    10000
+
+#define BG_WEIGHT       8
+#define HIST_BUCKETS    160         // 覆盖到 2^40 微秒
+
+typedef struct prio_hist_s {
+    uint64_t executed;
+    uint64_t expired;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} prio_hist_t;
+
+typedef struct worker_s {
+    ws_deque_t deque;
+    thrdpool_t *pool;
+    int id;
+    unsigned int seed;              // 选窃取对象用
+    int spin;                       // 本次休眠前的自旋次数
+    int waking;                     // 持有 pool->waking，由唤醒方设置
+    int normal_streak;              // 连续取到的普通任务数
+    atomic_int parked;              // 休眠槽：1 休眠中，唤醒方清 0
+    prio_hist_t hist[THRDPOOL_PRIO_COUNT];
+    // 以下只在 THRDPOOL_STATS 下统计，只由本线程写
+    uint64_t busy_ns;               // 执行任务的时间
+    uint64_t idle_ns;               // 自旋和休眠的时间
+    int64_t busy_since;             // 正在执行的任务的开始时间，0 表示没有；统计时加上进行中的部分
+    int64_t idle_since;             // 本次休眠的开始时间，0 表示没有休眠
+    int64_t last_ns;                // 上一个任务的结束时间，紧接着取到的任务用它作为开始时间，省一次取时间
+    uint64_t run_max;               // 单个任务最长执行时间，微秒
+    uint64_t run_buckets[HIST_BUCKETS];
+} __attribute__((aligned(CACHELINE))) worker_t;
+
 struct thrdpool_s {
-    task_queue_t *task_queue;
+    task_queue_t *task_queue;       // 普通优先级的全局队列
+    task_queue_t *prio_queues[THRDPOOL_PRIO_COUNT];     // [NORMAL] 就是 task_queue
     atomic_int quit;
-    int thrd_count;
+    int thrd_count;                 // 工作线程槽位数，2 * max_threads
     pthread_t *threads;
+
+    int flags;
+    worker_t *workers;
+    task_queue_t **shards;          // 注入队列分片，只在工作窃取模式下使用
+    int nshards;
+
+    int spin_max;                   // 单核为 0
+    spinlock_t idle_lock;           // 保护 idle_stack
+    int *idle_stack;                // 休眠的工作线程 id
+    int nidle;
+    atomic_int idle;                // nidle 的无锁副本，投递方先看它
+    atomic_int waking;              // 1 表示有线程被唤醒了还没拿到任务
+
+    int min_threads;
+    int max_threads;
+    int dynamic;                    // max_threads > min_threads
+    int timed;                      // 投递时记录入队时间(统计或动态伸缩需要)
+    int64_t spawn_delay_ns;
+    int64_t keepalive_ns;
+    pthread_mutex_t scale_mutex;    // 保护 slot_state 和 threads
+    int *slot_state;
+    atomic_int live;                // 运行中的工作线程数
+    atomic_int blocked;             // 处在阻塞区间的工作线程数
+    atomic_int spawning;            // 同一时刻只有一个线程在创建新线程
+
+    atomic_int draining;            // thrdpool_drain 之后为 1：只接受工作线程自己的投递，没有任务时线程退出
+    int64_t drain_deadline_ns;      // 排空的截止时间，0 表示一直等
+    _Atomic uint64_t cancelled;     // 终止或排空超时被取消的任务数
 };
 
+static __thread worker_t *tls_worker;       // 当前线程对应的工作线程，非工作线程为 NULL
+static __thread unsigned int tls_shard;     // 投递线程使用的分片 + 1，0 表示还没分配
+static atomic_uint shard_seq;
+
+static void __maybe_spawn(thrdpool_t *pool);
+
+/*
+任务内存：线程本地缓存 + slab
+- 每个线程一个 task_cache_t，任务从所在线程的缓存分配，缓存空了一次向系统要 TASK_SLAB_SIZE 个
+- 任务记住分配它的缓存(owner)。同一线程释放直接放回本地空闲链表；
+  其它线程(通常是执行任务的工作线程)释放时无锁压入 owner 的 remote 栈
+- remote 栈只有 owner 线程用 exchange 整个取走，没有 ABA 问题
+- 线程退出时缓存挂到 orphan 链表上，留给之后新建的线程接管，在途任务仍然可以还回来；slab 不还给系统
+*/
+#define TASK_SLAB_SIZE  256
+
+typedef struct task_cache_s {
+    task_t *free;                   // 只有所属线程访问
+    struct task_cache_s *next_orphan;
+    char pad[CACHELINE - 2 * sizeof(void *)];
+    _Atomic(task_t *) remote;       // 其它线程还回来的任务
+} task_cache_t;
+
+static __thread task_cache_t *tls_cache;
+static task_cache_t *orphan_caches;
+static pthread_mutex_t orphan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+static void
+__task_cache_orphan(void *arg) {
+    task_cache_t *cache = (task_cache_t *)arg;
+    pthread_mutex_lock(&orphan_mutex);
+    cache->next_orphan = orphan_caches;
+    orphan_caches = cache;
+    pthread_mutex_unlock(&orphan_mutex);
+    tls_cache = NULL;
+}
+
+static void
+__task_cache_key_create(void) {
+    pthread_key_create(&cache_key, __task_cache_orphan);
+}
+
+// 当前线程的缓存，第一次调用时接管一个孤儿缓存或者新建
+static task_cache_t *
+__task_cache_get(void) {
+    task_cache_t *cache = tls_cache;
+    if (cache)
+        return cache;
+
+    pthread_once(&cache_key_once, __task_cache_key_create);
+    pthread_mutex_lock(&orphan_mutex);
+    cache = orphan_caches;
+    if (cache)
+        orphan_caches = cache->next_orphan;
+    pthread_mutex_unlock(&orphan_mutex);
+    if (!cache) {
+        void *mem;
+        if (posix_memalign(&mem, CACHELINE, sizeof(task_cache_t)) != 0)
+            return NULL;
+        cache = (task_cache_t *)mem;
+        cache->free = NULL;
+        atomic_init(&cache->remote, NULL);
+    }
+    cache->next_orphan = NULL;
+    pthread_setspecific(cache_key, cache);
+    tls_cache = cache;
+    return cache;
+}
+
+static task_t *
+__task_alloc(void) {
+    task_cache_t *cache = __task_cache_get();
+    task_t *task;
+    if (!cache)
+        return NULL;
+
+    if (!cache->free) {
+        // 先收回其它线程还回来的，还没有再切一个新的 slab
+        cache->free = atomic_exchange_explicit(&cache->remote, NULL, memory_order_acquire);
+        if (!cache->free) {
+            task_t *slab = (task_t *)malloc(sizeof(task_t) * TASK_SLAB_SIZE);
+            int i;
+            if (!slab)
+                return NULL;
+            for (i = 0; i < TASK_SLAB_SIZE - 1; i++) {
+                slab[i].next = &slab[i + 1];
+                slab[i].owner = cache;
+            }
+            slab[i].next = NULL;
+            slab[i].owner = cache;
+            cache->free = slab;
+        }
+    }
+    task = cache->free;
+    cache->free = (task_t *)task->next;
+    return task;
+}
+
+static void
+__task_free(task_t *task) {
+    task_cache_t *owner = (task_cache_t *)task->owner;
+    if (!owner)
+        return;     // 侵入式任务，内存属于调用者
+    if (owner == tls_cache) {
+        task->next = owner->free;
+        owner->free = task;
+        return;
+    }
+    task_t *head = atomic_load_explicit(&owner->remote, memory_order_relaxed);
+    do {
+        task->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&owner->remote, &head, task,
+                memory_order_release, memory_order_relaxed));
+}
+
 // 对称
 // 资源的创建   回滚式编程
 // 业务逻辑     防御式编程
@@ -48,85 +288,62 @@ struct thrdpool_s {
 /**
  * 任务队列创建函数
  * 
- * 采用回滚式编程模式：如果在创建过程中的某步失败，则释放之前已分配的资源
  * 初始化流程：
  * 1. 分配内存
- * 2. 初始化互斥锁
- * 3. 初始化条件变量
- * 4. 初始化自旋锁
- * 5. 设置队列初始状态
+ * 2. 初始化自旋锁
+ * 3. 设置队列初始状态
  * 
  * @return 成功返回队列指针，失败返回NULL
  */
 static task_queue_t *
 __taskqueue_create() {
-    int ret;
     // 为任务队列分配内存
     task_queue_t *queue = (task_queue_t *)malloc(sizeof(task_queue_t));
     if (queue) {
-        // 初始化互斥锁，用于保护条件变量
-        ret = pthread_mutex_init(&queue->mutex, NULL);
-        if (ret == 0) {
-            // 初始化条件变量，用于线程间同步（等待/通知机制）
-            ret = pthread_cond_init(&queue->cond, NULL);
-            if (ret == 0) {
-                // 初始化自旋锁，用于保护队列数据结构
-                spinlock_init(&queue->lock);
-                // 初始化队列为空
-                queue->head = NULL;
-                // tail指向head指针的地址，这样可以统一处理空队列和非空队列的入队操作
-                queue->tail = &queue->head;
-                // 默认为阻塞模式
-                queue->block = 1;
-                return queue;
-            }
-            // 初始化条件变量失败，清理已初始化的互斥锁
-            pthread_mutex_destroy(&queue->mutex);
-        }
-        // 初始化失败，释放已分配的内存
-        free(queue);
+        // 初始化自旋锁，用于保护队列数据结构
+        spinlock_init(&queue->lock);
+        // 初始化队列为空
+        queue->head = NULL;
+        // tail指向head指针的地址，这样可以统一处理空队列和非空队列的入队操作
+        queue->tail = &queue->head;
+        queue->count = 0;
     }
-    return NULL;
-}
-
-/**
- * 将任务队列设置为非阻塞模式
- * 
- * 当线程池需要终止时，调用此函数通知所有等待的工作线程退出
- * 
- * @param queue 任务队列
- */
-static void
-__nonblock(task_queue_t *queue) {
-    // 获取互斥锁以保护block变量的修改
-    pthread_mutex_lock(&queue->mutex);
-    // 设置为非阻塞模式
-    queue->block = 0;
-    // 释放互斥锁
-    pthread_mutex_unlock(&queue->mutex);
-    // 广播通知所有等待在条件变量上的线程，使它们可以检查block状态并退出
-    pthread_cond_broadcast(&queue->cond);
+    return queue;
 }
 
 /**
  * 向任务队列添加一个任务
  * 
- * 将任务添加到队列尾部，并通过条件变量通知等待的工作线程
+ * 将任务添加到队列尾部，唤醒由调用者负责
  * 
  * @param queue 任务队列
  * @param task 待添加的任务，必须包含一个作为链表节点的指针
  */
 static inline void 
-__add_task(task_queue_t *queue, void *task) {
+__push_task(task_queue_t *queue, void *task) {
     // 不限定任务类型，只要该任务的结构起始内存是一个用于链接下一个节点的指针
     void **link = (void**)task;
     *link = NULL;
 
     spinlock_lock(&queue->lock);
-    *queue->tail /* 等价于 queue->tail->next */ = link;
+    // 工作线程休眠前会不加锁地读 head 判断队列是否为空，这里用原子写
+    __atomic_store_n(queue->tail /* 等价于 queue->tail->next */, link, __ATOMIC_RELEASE);
     queue->tail = link;
+    __atomic_store_n(&queue->count, queue->count + 1, __ATOMIC_RELAXED);
+    spinlock_unlock(&queue->lock);
+}
+
+/**
+ * 把 first ~ last 这条已经链好的任务链接到队尾，只加一次锁
+ */
+static inline void 
+__push_chain(task_queue_t *queue, task_t *first, task_t *last, int n) {
+    last->next = NULL;
+    spinlock_lock(&queue->lock);
+    __atomic_store_n(queue->tail, first, __ATOMIC_RELEASE);
+    queue->tail = &last->next;
+    __atomic_store_n(&queue->count, queue->count + n, __ATOMIC_RELAXED);
     spinlock_unlock(&queue->lock);
-    pthread_cond_signal(&queue->cond);
 }
 
 /**
@@ -150,7 +367,8 @@ __pop_task(task_queue_t *queue) {
 
     // queue->head = task->next; 常规写法，下面是避免出现next指针，更加通用
     void **link = (void**)task;
-    queue->head = *link;
+    __atomic_store_n(&queue->head, *link, __ATOMIC_RELAXED);
+    __atomic_store_n(&queue->count, queue->count - 1, __ATOMIC_RELAXED);
 
     if (queue->head == NULL) {
         queue->tail = &queue->head;
@@ -159,35 +377,6 @@ __pop_task(task_queue_t *queue) {
     return task;
 }
 
-/**
- * 获取任务（阻塞模式）
- * 
- * 从任务队列获取一个任务。如果队列为空，则阻塞等待直到有新任务或队列被设置为非阻塞
- * 
- * @param queue 任务队列
- * @return 任务指针，如果队列为非阻塞且为空，则返回NULL
- */
-static inline void * 
-__get_task(task_queue_t *queue) {
-    task_t *task;
-    // 虚假唤醒
-    while ((task = __pop_task(queue)) == NULL) {
-        pthread_mutex_lock(&queue->mutex);
-        if (queue->block == 0) {
-            pthread_mutex_unlock(&queue->mutex);
-            return NULL;
-        }
-        // 1. 先 unlock(&mtx)
-        // 2. 在 cond 休眠
-        // --- __add_task 时唤醒
-        // 3. 在 cond 唤醒
-        // 4. 加上 lock(&mtx);
-        pthread_cond_wait(&queue->cond, &queue->mutex);
-        pthread_mutex_unlock(&queue->mutex);
-    }
-    return task;
-}
-
 /**
  * 销毁任务队列
  * 
@@ -199,170 +388,1496 @@ static void
 __taskqueue_destroy(task_queue_t *queue) {
     task_t *task;
     while ((task = __pop_task(queue))) {
-        free(task);
+        __task_free(task);
     }
     spinlock_destroy(&queue->lock);
-    pthread_cond_destroy(&queue->cond);
-    pthread_mutex_destroy(&queue->mutex);
     free(queue);
 }
 
 /**
- * 工作线程函数
- * 
- * 线程池中每个工作线程的执行函数，循环获取任务并执行
- * 
- * @param arg 线程池指针
- * @return NULL
+ * 从注入分片一次取最多 max 个任务
+ *
+ * 先不加锁看一眼 head，空分片不去抢锁
+ *
+ * @return 取到的任务数
  */
-static void *
-__thrdpool_worker(void *arg) {
-    thrdpool_t *pool = (thrdpool_t*) arg;
-    task_t *task;
-    void *ctx;
+static int
+__pop_batch(task_queue_t *queue, task_t **tasks, int max) {
+    if (__atomic_load_n(&queue->head, __ATOMIC_RELAXED) == NULL)
+        return 0;
 
-    while (atomic_load(&pool->quit) == 0) {
-        task = (task_t*)__get_task(pool->task_queue);
-        if (!task) break;
-        handler_pt func = task->func;
-        ctx = task->arg;
-        free(task);
-        func(ctx);
+    int n = 0;
+    spinlock_lock(&queue->lock);
+    while (n < max && queue->head != NULL) {
+        void **link = (void**)queue->head;
+        tasks[n++] = (task_t *)link;
+        __atomic_store_n(&queue->head, *link, __ATOMIC_RELAXED);
     }
-    
-    return NULL;
+    if (queue->head == NULL) {
+        queue->tail = &queue->head;
+    }
+    __atomic_store_n(&queue->count, queue->count - n, __ATOMIC_RELAXED);
+    spinlock_unlock(&queue->lock);
+    return n;
 }
 
-/**
- * 终止线程池中的所有线程
- * 
- * 设置退出标志并等待所有线程结束
- * 
- * @param pool 线程池指针
- */
-static void 
-__threads_terminate(thrdpool_t * pool) {
-    atomic_store(&pool->quit, 1);
-    __nonblock(pool->task_queue);
-    int i;
-    for (i=0; i<pool->thrd_count; i++) {
-        pthread_join(pool->threads[i], NULL);
+/*
+Chase-Lev 双端队列，内存序按 Lê et al.《Correct and Efficient Work-Stealing for Weak Memory Models》
+容量固定为 WS_DEQUE_SIZE，不扩容
+*/
+
+// 只由所属线程调用，满了返回 -1
+static int
+__deque_push(ws_deque_t *q, task_t *task) {
+    long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&q->top, memory_order_acquire);
+    if (b - t >= WS_DEQUE_SIZE)
+        return -1;
+    atomic_store_explicit(&q->buf[b & (WS_DEQUE_SIZE - 1)], task, memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_release);
+    return 0;
+}
+
+// 只由所属线程调用，从 bottom 端取
+static task_t *
+__deque_take(ws_deque_t *q) {
+    long b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&q->top, memory_order_relaxed);
+    task_t *task = NULL;
+    if (t <= b) {
+        task = atomic_load_explicit(&q->buf[b & (WS_DEQUE_SIZE - 1)], memory_order_relaxed);
+        if (t == b) {
+            // 最后一个任务，和窃取者抢
+            if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                    memory_order_seq_cst, memory_order_relaxed))
+                task = NULL;
+            atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
     }
+    return task;
+}
+
+// 任意线程调用，从 top 端偷；为空或者没抢到都返回 NULL
+static task_t *
+__deque_steal(ws_deque_t *q) {
+    long t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    if (t >= b)
+        return NULL;
+    task_t *task = atomic_load_explicit(&q->buf[t & (WS_DEQUE_SIZE - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+    return task;
+}
+
+static inline int
+__deque_empty(ws_deque_t *q) {
+    long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    long t = atomic_load_explicit(&q->top, memory_order_acquire);
+    return t >= b;
 }
 
 /**
- * 创建线程池中的工作线程
- * 
- * 创建指定数量的工作线程，如果创建过程中失败，则回滚并释放资源
- * 
- * @param pool 线程池指针
- * @param thrd_count 要创建的线程数量
- * @return 成功返回0，失败返回-1
+ * 工作窃取模式下找一个任务
+ *
+ * 顺序：自己的双端队列 -> 注入分片(从自己对应的分片开始) -> 随机选其它工作线程偷
+ *
+ * @return 任务指针，全都为空返回NULL
  */
-static int 
-__threads_create(thrdpool_t *pool, size_t thrd_count) {
-    pthread_attr_t attr;   // 线程属性
-	int ret;
-
-    ret = pthread_attr_init(&attr);
-
-    if (ret == 0) {
-        pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * thrd_count);
-        if (pool->threads) {
-            int i = 0;
-            for (; i < thrd_count; i++) {
-                if (pthread_create(&pool->threads[i], &attr, __thrdpool_worker, pool) != 0) {
-                    break;
-                }
+static task_t *
+__ws_find_task(worker_t *w) {
+    thrdpool_t *pool = w->pool;
+    task_t *batch[WS_BATCH];
+    task_t *task;
+    int i, n;
+
+    task = __deque_take(&w->deque);
+    if (task) return task;
+
+    for (i = 0; i < pool->nshards; i++) {
+        n = __pop_batch(pool->shards[(w->id + i) % pool->nshards], batch, WS_BATCH);
+        if (n > 0) {
+            // 倒序放入，take 时先拿到先投递的；放不下的退回注入分片
+            while (--n > 0) {
+                if (__deque_push(&w->deque, batch[n]) != 0)
+                    __push_task(pool->shards[w->id % pool->nshards], batch[n]);
             }
-            pool->thrd_count = i;
-            pthread_attr_destroy(&attr);
-            if (i == thrd_count)
-                return 0;
-            __threads_terminate(pool);
-            free(pool->threads);
+            return batch[0];
         }
-        ret = -1;
     }
-    return ret; 
+
+    if (pool->thrd_count > 1) {
+        int start = rand_r(&w->seed) % pool->thrd_count;
+        for (i = 0; i < pool->thrd_count; i++) {
+            int victim = (start + i) % pool->thrd_count;
+            if (victim == w->id) continue;
+            task = __deque_steal(&pool->workers[victim].deque);
+            if (task) return task;
+        }
+    }
+    return NULL;
 }
 
-/**
- * 终止线程池
- * 
- * 设置退出标志并唤醒所有阻塞的工作线程，但不等待线程结束
- * 
- * @param pool 要终止的线程池
- */
-void
-thrdpool_terminate(thrdpool_t * pool) {
-    atomic_store(&pool->quit, 1);
-    __nonblock(pool->task_queue);
+// 是否还有任何任务，休眠前的最后检查
+static int
+__ws_has_work(thrdpool_t *pool) {
+    int i;
+    for (i = 0; i < pool->nshards; i++) {
+        if (__atomic_load_n(&pool->shards[i]->head, __ATOMIC_ACQUIRE) != NULL)
+            return 1;
+    }
+    for (i = 0; i < pool->thrd_count; i++) {
+        if (!__deque_empty(&pool->workers[i].deque))
+            return 1;
+    }
+    return 0;
+}
+
+static inline void
+__cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// timeout_ns <= 0 表示一直等；超时返回 -1
+static inline int
+__futex_wait(atomic_int *addr, int val, int64_t timeout_ns) {
+    struct timespec ts, *pts = NULL;
+    if (timeout_ns > 0) {
+        ts.tv_sec = timeout_ns / 1000000000;
+        ts.tv_nsec = timeout_ns % 1000000000;
+        pts = &ts;
+    }
+    return (int)syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, pts, NULL, 0);
+}
+
+static inline void
+__futex_wake(atomic_int *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+// 是否还有任何任务，不加锁，只用于自旋和休眠前的检查
+static int
+__has_work(thrdpool_t *pool) {
+    if (__atomic_load_n(&pool->prio_queues[THRDPOOL_PRIO_HIGH]->head, __ATOMIC_ACQUIRE) != NULL
+            || __atomic_load_n(&pool->prio_queues[THRDPOOL_PRIO_BACKGROUND]->head, __ATOMIC_ACQUIRE) != NULL)
+        return 1;
+    if (pool->flags & THRDPOOL_WORK_STEALING)
+        return __ws_has_work(pool);
+    return __atomic_load_n(&pool->task_queue->head, __ATOMIC_ACQUIRE) != NULL;
+}
+
+// 把还在 idle 栈里的 w 移除，调用者持有 idle_lock
+static void
+__idle_remove(thrdpool_t *pool, worker_t *w) {
+    int i;
+    for (i = 0; i < pool->nidle; i++) {
+        if (pool->idle_stack[i] == w->id) {
+            pool->idle_stack[i] = pool->idle_stack[--pool->nidle];
+            break;
+        }
+    }
+    atomic_fetch_sub(&pool->idle, 1);
+    atomic_store_explicit(&w->parked, 0, memory_order_relaxed);
+}
+
+// 空闲超时：线程数多于 min_threads 并且还没被唤醒时退出
+static int
+__worker_try_retire(worker_t *w) {
+    thrdpool_t *pool = w->pool;
+    int ret = 0;
+    spinlock_lock(&pool->idle_lock);
+    if (atomic_load_explicit(&w->parked, memory_order_relaxed)
+            && atomic_load(&pool->live) > pool->min_threads) {
+        __idle_remove(pool, w);
+        atomic_fetch_sub(&pool->live, 1);
+        ret = 1;
+    }
+    spinlock_unlock(&pool->idle_lock);
+    return ret;
 }
 
 /**
- * 创建线程池
- * 
- * 创建线程池并启动指定数量的工作线程
- * 
- * @param thrd_count 工作线程数量
- * @return 成功返回线程池指针，失败返回NULL
+ * 没有任务时自旋，然后休眠
+ *
+ * @return 线程池已终止返回 -1，空闲超时需要退出返回 -2，否则返回 0(可能有任务了)
  */
-thrdpool_t *
-thrdpool_create(int thrd_count) {
-    thrdpool_t *pool;
+static int
+__worker_park(worker_t *w) {
+    thrdpool_t *pool = w->pool;
+    int i;
 
-    pool = (thrdpool_t*)malloc(sizeof(*pool));
-    if (pool) {
-        task_queue_t *queue = __taskqueue_create();
-        if (queue) {
-            pool->task_queue = queue;
-            atomic_init(&pool->quit, 0);
-            if (__threads_create(pool, thrd_count) == 0)
-                return pool;
-            __taskqueue_destroy(queue);
+    if (w->waking) {
+        // 醒来却没找到任务，交还 waking，之后的投递可以唤醒别人
+        w->waking = 0;
+        atomic_store(&pool->waking, 0);
+    }
+    // 排空：没有任务了就退出
+    if (atomic_load(&pool->draining) && !__has_work(pool))
+        return -1;
+
+    for (i = 0; i < w->spin; i++) {
+        if (atomic_load_explicit(&pool->quit, memory_order_relaxed))
+            return -1;
+        if (__has_work(pool)) {
+            w->spin = w->spin * 2 < pool->spin_max ? w->spin * 2 : pool->spin_max;
+            return 0;
         }
-        free(pool);
+        __cpu_relax();
     }
-    return NULL;
+    if (w->spin > SPIN_MIN)
+        w->spin /= 2;
+
+    // 登记到 idle 栈
+    spinlock_lock(&pool->idle_lock);
+    pool->idle_stack[pool->nidle++] = w->id;
+    atomic_store_explicit(&w->parked, 1, memory_order_relaxed);
+    atomic_fetch_add(&pool->idle, 1);
+    spinlock_unlock(&pool->idle_lock);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (__has_work(pool) || atomic_load(&pool->quit) || atomic_load(&pool->draining)) {
+        // 登记之后来了任务：还没被唤醒方弹出的话自己撤销登记
+        spinlock_lock(&pool->idle_lock);
+        if (atomic_load_explicit(&w->parked, memory_order_relaxed))
+            __idle_remove(pool, w);
+        spinlock_unlock(&pool->idle_lock);
+    } else {
+        while (atomic_load_explicit(&w->parked, memory_order_acquire)) {
+            if (__futex_wait(&w->parked, 1, pool->keepalive_ns) < 0 && errno == ETIMEDOUT
+                    && __worker_try_retire(w))
+                return -2;
+        }
+    }
+    return atomic_load(&pool->quit) ? -1 : 0;
 }
 
 /**
- * 向线程池提交任务
- * 
- * 创建一个任务并添加到线程池的任务队列，由工作线程异步执行
- * 
- * @param pool 线程池
- * @param func 任务处理函数
- * @param arg 传递给任务处理函数的参数
- * @return 成功返回0，失败返回-1
+ * 新放入 n 个任务后唤醒最多 n 个休眠的线程
+ *
+ * 没有线程休眠时只有一次屏障和一次读，不加锁也不进内核
  */
-int
-thrdpool_post(thrdpool_t *pool, handler_pt func, void *arg) {
-    if (atomic_load(&pool->quit) == 1) 
-        return -1;
-    task_t *task = (task_t*) malloc(sizeof(task_t));
-    if (!task) return -1;
-    task->func = func;
-    task->arg = arg;
-    __add_task(pool->task_queue, task);
-    return 0;
+static void
+__wake_n(thrdpool_t *pool, int n) {
+    worker_t *wake[16];
+    int i, k;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    while (n > 0 && atomic_load_explicit(&pool->idle, memory_order_relaxed) > 0) {
+        // 每次最多弹出 16 个，futex 唤醒放在锁外
+        k = 0;
+        spinlock_lock(&pool->idle_lock);
+        while (k < n && k < 16 && pool->nidle > 0) {
+            wake[k] = &pool->workers[pool->idle_stack[--pool->nidle]];
+            atomic_fetch_sub(&pool->idle, 1);
+            atomic_store_explicit(&wake[k]->parked, 0, memory_order_release);
+            k++;
+        }
+        spinlock_unlock(&pool->idle_lock);
+        for (i = 0; i < k; i++)
+            __futex_wake(&wake[i]->parked);
+        if (k == 0)
+            break;
+        n -= k;
+    }
 }
 
 /**
- * 等待线程池中所有任务完成并销毁线程池
- * 
- * 阻塞调用线程直到所有工作线程结束，然后清理所有资源
- * 
- * @param pool 要销毁的线程池
+ * 单个任务投递后唤醒一个休眠的线程
+ *
+ * 已经有线程在醒来的路上就不再唤醒，由它拿到任务后接力
  */
-void
-thrdpool_waitdone(thrdpool_t *pool) {
-    int i;
-    for (i=0; i<pool->thrd_count; i++) {
-        pthread_join(pool->threads[i], NULL);
+static void
+__wake_one(thrdpool_t *pool) {
+    worker_t *w = NULL;
+    int expect = 0;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pool->idle, memory_order_relaxed) == 0)
+        return;
+    if (atomic_load_explicit(&pool->waking, memory_order_relaxed) != 0
+            || !atomic_compare_exchange_strong(&pool->waking, &expect, 1))
+        return;
+    spinlock_lock(&pool->idle_lock);
+    if (pool->nidle > 0) {
+        w = &pool->workers[pool->idle_stack[--pool->nidle]];
+        atomic_fetch_sub(&pool->idle, 1);
+        w->waking = 1;
+        atomic_store_explicit(&w->parked, 0, memory_order_release);
     }
-    __taskqueue_destroy(pool->task_queue);
-    free(pool->threads);
-    free(pool);
+    spinlock_unlock(&pool->idle_lock);
+    if (w)
+        __futex_wake(&w->parked);
+    else
+        atomic_store(&pool->waking, 0);
+}
+
+// 拿到任务后调用：醒来的线程交还 waking，还有任务的话接力唤醒下一个
+static inline void
+__worker_got_task(worker_t *w) {
+    if (w->waking) {
+        w->waking = 0;
+        atomic_store(&w->pool->waking, 0);
+        if (__has_work(w->pool))
+            __wake_one(w->pool);
+    }
+}
+
+// 唤醒所有休眠的线程，终止时使用
+static void
+__wake_all(thrdpool_t *pool) {
+    __wake_n(pool, pool->thrd_count);
+}
+
+// 当前投递线程使用的注入分片
+static inline task_queue_t *
+__ws_shard(thrdpool_t *pool) {
+    if (tls_shard == 0)
+        tls_shard = atomic_fetch_add(&shard_seq, 1) + 1;
+    return pool->shards[(tls_shard - 1) % pool->nshards];
+}
+
+static void
+__ws_post(thrdpool_t *pool, task_t *task) {
+    worker_t *w = tls_worker;
+    // 工作线程自己投递的任务进自己的双端队列
+    if (w == NULL || w->pool != pool || __deque_push(&w->deque, task) != 0) {
+        __push_task(__ws_shard(pool), task);
+    }
+    __wake_one(pool);
+}
+
+static void
+__ws_post_chain(thrdpool_t *pool, task_t *first, task_t *last, int n) {
+    worker_t *w = tls_worker;
+    int left = n;
+    if (w != NULL && w->pool == pool) {
+        // 工作线程里批量投递，能放进自己双端队列的都放进去，剩下的一次接到注入分片
+        while (first != NULL && __deque_push(&w->deque, first) == 0) {
+            first = first == last ? NULL : (task_t *)first->next;
+            left--;
+        }
+    }
+    if (first != NULL)
+        __push_chain(__ws_shard(pool), first, last, left);
+    __wake_n(pool, n);
+}
+
+int64_t
+thrdpool_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// 单写者的计数器，读的一方可能在别的线程，用原子读写避免撕裂
+static inline void
+__stat_add(uint64_t *counter, uint64_t v) {
+    __atomic_store_n(counter, *counter + v, __ATOMIC_RELAXED);
+}
+
+static inline int
+__hist_index(uint64_t v) {
+    if (v < 4)
+        return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int index = (msb - 1) * 4 + (int)((v >> (msb - 2)) & 3);
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+// 第 index 格的上界
+static inline uint64_t
+__hist_upper(int index) {
+    if (index < 4)
+        return (uint64_t)index;
+    int msb = index / 4 + 1;
+    return ((uint64_t)(4 + index % 4 + 1) << (msb - 2)) - 1;
+}
+
+static inline task_t *
+__pop_nonempty(task_queue_t *queue) {
+    if (__atomic_load_n(&queue->head, __ATOMIC_RELAXED) == NULL)
+        return NULL;
+    return (task_t *)__pop_task(queue);
+}
+
+/**
+ * 按优先级取下一个任务
+ *
+ * 高优先级严格优先；普通任务连续取了 BG_WEIGHT 个后先尝试一次后台队列
+ */
+static task_t *
+__next_task(worker_t *w) {
+    thrdpool_t *pool = w->pool;
+    task_t *task;
+
+    task = __pop_nonempty(pool->prio_queues[THRDPOOL_PRIO_HIGH]);
+    if (task) return task;
+
+    if (w->normal_streak >= BG_WEIGHT) {
+        w->normal_streak = 0;
+        task = __pop_nonempty(pool->prio_queues[THRDPOOL_PRIO_BACKGROUND]);
+        if (task) return task;
+    }
+
+    if (pool->flags & THRDPOOL_WORK_STEALING)
+        task = __ws_find_task(w);
+    else
+        task = (task_t *)__pop_task(pool->task_queue);
+    if (task) {
+        w->normal_streak++;
+        return task;
+    }
+
+    w->normal_streak = 0;
+    return __pop_nonempty(pool->prio_queues[THRDPOOL_PRIO_BACKGROUND]);
+}
+
+/**
+ * 执行一个任务
+ *
+ * 过了截止时间的任务调用 cancel；开启统计时记录排队延迟
+ */
+static void
+__run_task(worker_t *w, task_t *task) {
+    thrdpool_t *pool = w->pool;
+    handler_pt func = task->func;
+    void *ctx = task->arg;
+    prio_hist_t *hist = &w->hist[task->prio];
+    int64_t now = 0;
+
+    if (w->last_ns)
+        now = w->last_ns;
+    else if (task->deadline_ns || pool->timed)
+        now = thrdpool_now_ns();
+    if (task->deadline_ns && now > task->deadline_ns) {
+        func = task->cancel;
+        __stat_add(&hist->expired, 1);
+    } else {
+        __stat_add(&hist->executed, 1);
+        if (pool->timed) {
+            int64_t delay_ns = now > task->enqueue_ns ? now - task->enqueue_ns : 0;
+            if (pool->flags & THRDPOOL_STATS) {
+                uint64_t delay = (uint64_t)delay_ns / 1000;
+                __stat_add(&hist->buckets[__hist_index(delay)], 1);
+                if (delay > hist->max)
+                    __atomic_store_n(&hist->max, delay, __ATOMIC_RELAXED);
+            }
+            // 排队太久而且没有空闲线程，说明线程不够
+            if (pool->dynamic && delay_ns > pool->spawn_delay_ns && atomic_load(&pool->idle) == 0)
+                __maybe_spawn(pool);
+        }
+    }
+    __task_free(task);
+    if (pool->flags & THRDPOOL_STATS)
+        __atomic_store_n(&w->busy_since, now, __ATOMIC_RELAXED);
+    if (func)
+        func(ctx);
+    if (pool->flags & THRDPOOL_STATS) {
+        w->last_ns = thrdpool_now_ns();
+        uint64_t run_ns = (uint64_t)(w->last_ns - now);
+        uint64_t run = run_ns / 1000;
+        __atomic_store_n(&w->busy_since, 0, __ATOMIC_RELAXED);
+        __stat_add(&w->busy_ns, run_ns);
+        __stat_add(&w->run_buckets[__hist_index(run)], 1);
+        if (run > w->run_max)
+            __atomic_store_n(&w->run_max, run, __ATOMIC_RELAXED);
+    }
+}
+
+// 不执行 func，调用 cancel(arg) 让投递方回收参数
+static void
+__cancel_task(thrdpool_t *pool, task_t *task) {
+    handler_pt cancel = task->cancel;
+    void *ctx = task->arg;
+    __task_free(task);
+    atomic_fetch_add(&pool->cancelled, 1);
+    if (cancel)
+        cancel(ctx);
+}
+
+// 所有工作线程结束后取消还在队列里的任务
+static void
+__cancel_pending(thrdpool_t *pool) {
+    task_t *task;
+    int i;
+    for (i = 0; i < THRDPOOL_PRIO_COUNT; i++) {
+        while ((task = __pop_task(pool->prio_queues[i])))
+            __cancel_task(pool, task);
+    }
+    for (i = 0; i < pool->nshards; i++) {
+        while ((task = __pop_task(pool->shards[i])))
+            __cancel_task(pool, task);
+    }
+    for (i = 0; i < pool->thrd_count; i++) {
+        worker_t *w = &pool->workers[i];
+        if (!w->deque.buf) continue;
+        while ((task = __deque_take(&w->deque)))
+            __cancel_task(pool, task);
+    }
+}
+
+// 排空超时：不再开始新任务，改为立即终止，剩下的任务由 thrdpool_waitdone 取消
+static int
+__drain_timeout(thrdpool_t *pool) {
+    int64_t deadline;
+    if (!atomic_load_explicit(&pool->draining, memory_order_acquire))
+        return 0;
+    deadline = __atomic_load_n(&pool->drain_deadline_ns, __ATOMIC_RELAXED);
+    if (deadline == 0 || thrdpool_now_ns() < deadline)
+        return 0;
+    atomic_store(&pool->quit, 1);
+    __wake_all(pool);
+    return 1;
+}
+
+// 已终止，或者正在排空而投递方不是本线程池的工作线程
+static inline int
+__post_closed(thrdpool_t *pool) {
+    if (atomic_load(&pool->quit))
+        return 1;
+    return atomic_load(&pool->draining) && (!tls_worker || tls_worker->pool != pool);
+}
+
+/**
+ * 投递一个任务，按优先级放入对应的队列并唤醒一个线程
+ */
+static void
+__post(thrdpool_t *pool, task_t *task) {
+    if (pool->timed)
+        task->enqueue_ns = thrdpool_now_ns();
+    if (task->prio != THRDPOOL_PRIO_NORMAL) {
+        __push_task(pool->prio_queues[task->prio], task);
+        __wake_one(pool);
+    } else if (pool->flags & THRDPOOL_WORK_STEALING) {
+        __ws_post(pool, task);
+    } else {
+        __push_task(pool->task_queue, task);
+        __wake_one(pool);
+    }
+}
+
+// 创建注入分片，count 为 0 时不创建
+static int
+__shards_create(thrdpool_t *pool, int count) {
+    pool->shards = NULL;
+    pool->nshards = 0;
+    if (count <= 0)
+        return 0;
+    if (count > WS_MAX_SHARDS)
+        count = WS_MAX_SHARDS;
+    pool->shards = (task_queue_t **)calloc(count, sizeof(task_queue_t *));
+    if (!pool->shards)
+        return -1;
+    for (; pool->nshards < count; pool->nshards++) {
+        pool->shards[pool->nshards] = __taskqueue_create();
+        if (!pool->shards[pool->nshards]) {
+            while (pool->nshards > 0)
+                __taskqueue_destroy(pool->shards[--pool->nshards]);
+            free(pool->shards);
+            pool->shards = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+__shards_destroy(thrdpool_t *pool) {
+    int i;
+    for (i = 0; i < pool->nshards; i++)
+        __taskqueue_destroy(pool->shards[i]);
+    free(pool->shards);
+    pool->shards = NULL;
+    pool->nshards = 0;
+}
+
+/**
+ * 分配工作线程槽位，双端队列在线程第一次使用槽位时再分配
+ *
+ * @return 成功返回0，失败返回-1
+ */
+static int
+__workers_create(thrdpool_t *pool, int slots) {
+    void *mem;
+    int i;
+
+    pool->idle_stack = (int *)malloc(sizeof(int) * slots);
+    if (!pool->idle_stack)
+        return -1;
+    pool->slot_state = (int *)calloc(slots, sizeof(int));
+    if (!pool->slot_state) {
+        free(pool->idle_stack);
+        return -1;
+    }
+    if (posix_memalign(&mem, CACHELINE, sizeof(worker_t) * slots) != 0) {
+        free(pool->slot_state);
+        free(pool->idle_stack);
+        return -1;
+    }
+    pool->workers = (worker_t *)mem;
+    memset(pool->workers, 0, sizeof(worker_t) * slots);
+    for (i = 0; i < slots; i++) {
+        worker_t *w = &pool->workers[i];
+        w->pool = pool;
+        w->id = i;
+        w->seed = (unsigned int)(uintptr_t)w ^ (unsigned int)i * 2654435761u;
+        atomic_init(&w->parked, 0);
+        atomic_init(&w->deque.top, 0);
+        atomic_init(&w->deque.bottom, 0);
+    }
+    return 0;
+}
+
+// 释放工作线程结构和双端队列里没执行的任务
+static void
+__workers_destroy(thrdpool_t *pool, int slots) {
+    int i;
+    task_t *task;
+    for (i = 0; i < slots; i++) {
+        worker_t *w = &pool->workers[i];
+        if (!w->deque.buf) continue;
+        while ((task = __deque_take(&w->deque)))
+            __task_free(task);
+        free(w->deque.buf);
+    }
+    free(pool->workers);
+    free(pool->slot_state);
+    free(pool->idle_stack);
+}
+
+/**
+ * 工作线程函数
+ * 
+ * 线程池中每个工作线程的执行函数，循环获取任务并执行
+ * 
+ * @param arg 工作线程结构指针
+ * @return NULL
+ */
+static void *
+__thrdpool_worker(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    thrdpool_t *pool = w->pool;
+    task_t *task;
+    int ret;
+
+    tls_worker = w;
+    while (atomic_load(&pool->quit) == 0) {
+        task = __next_task(w);
+        if (!task) {
+            int64_t idle_start = (pool->flags & THRDPOOL_STATS) ? thrdpool_now_ns() : 0;
+            __atomic_store_n(&w->idle_since, idle_start, __ATOMIC_RELAXED);
+            ret = __worker_park(w);
+            w->last_ns = 0;
+            if (idle_start) {
+                __atomic_store_n(&w->idle_since, 0, __ATOMIC_RELAXED);
+                __stat_add(&w->idle_ns, (uint64_t)(thrdpool_now_ns() - idle_start));
+            }
+            if (ret == -2) {
+                // 空闲超时退出，槽位留给以后的线程，join 由复用槽位的一方或 thrdpool_waitdone 完成
+                pthread_mutex_lock(&pool->scale_mutex);
+                if (pool->slot_state[w->id] == SLOT_RUNNING)
+                    pool->slot_state[w->id] = SLOT_EXITED;
+                pthread_mutex_unlock(&pool->scale_mutex);
+                break;
+            }
+            if (ret < 0) break;
+            continue;
+        }
+        __worker_got_task(w);
+        if (__drain_timeout(pool)) {
+            __cancel_task(pool, task);
+            break;
+        }
+        __run_task(w, task);
+    }
+    tls_worker = NULL;
+    return NULL;
+}
+
+/**
+ * 在一个空槽位上启动工作线程
+ * 
+ * 阻塞的线程不计入 max_threads，总数不超过槽位数
+ * 
+ * @return 成功返回0，已终止、达到上限或创建失败返回-1
+ */
+static int
+__spawn_worker(thrdpool_t *pool) {
+    int i, slot = -1, ret = -1;
+
+    pthread_mutex_lock(&pool->scale_mutex);
+    if (atomic_load(&pool->quit)
+            || atomic_load(&pool->live) - atomic_load(&pool->blocked) >= pool->max_threads
+            || atomic_load(&pool->live) >= pool->thrd_count)
+        goto out;
+    for (i = 0; i < pool->thrd_count; i++) {
+        if (pool->slot_state[i] == SLOT_EMPTY) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && pool->slot_state[i] == SLOT_EXITED)
+            slot = i;
+    }
+    if (slot < 0)
+        goto out;
+    if (pool->slot_state[slot] == SLOT_EXITED) {
+        // 线程已经把状态改成 EXITED，马上就会返回
+        pthread_join(pool->threads[slot], NULL);
+        pool->slot_state[slot] = SLOT_EMPTY;
+    }
+
+    worker_t *w = &pool->workers[slot];
+    if ((pool->flags & THRDPOOL_WORK_STEALING) && !w->deque.buf) {
+        w->deque.buf = (_Atomic(task_t *) *)calloc(WS_DEQUE_SIZE, sizeof(*w->deque.buf));
+        if (!w->deque.buf)
+            goto out;
+    }
+    w->spin = pool->spin_max;
+    w->waking = 0;
+    w->normal_streak = 0;
+    w->last_ns = 0;
+    atomic_store(&w->parked, 0);
+
+    pool->slot_state[slot] = SLOT_RUNNING;
+    atomic_fetch_add(&pool->live, 1);
+    if (pthread_create(&pool->threads[slot], NULL, __thrdpool_worker, w) != 0) {
+        atomic_fetch_sub(&pool->live, 1);
+        pool->slot_state[slot] = SLOT_EMPTY;
+        goto out;
+    }
+    ret = 0;
+out:
+    pthread_mutex_unlock(&pool->scale_mutex);
+    return ret;
+}
+
+// 调度路径上的扩容：已经有线程在创建就跳过，不排队等锁
+static void
+__maybe_spawn(thrdpool_t *pool) {
+    int expect = 0;
+    if (atomic_load(&pool->live) - atomic_load(&pool->blocked) >= pool->max_threads)
+        return;
+    if (!atomic_compare_exchange_strong(&pool->spawning, &expect, 1))
+        return;
+    __spawn_worker(pool);
+    atomic_store(&pool->spawning, 0);
+}
+
+/**
+ * 等待所有工作线程结束
+ * 
+ * 线程可能在等待期间被创建或自己退出，每次在锁内挑一个未 join 的槽位标成 JOINING，
+ * 锁外 join，直到没有剩下的
+ * 
+ * @param pool 线程池指针
+ */
+static void
+__threads_join(thrdpool_t *pool) {
+    pthread_t tid;
+    int i, found;
+
+    for (;;) {
+        found = 0;
+        pthread_mutex_lock(&pool->scale_mutex);
+        for (i = 0; i < pool->thrd_count; i++) {
+            if (pool->slot_state[i] == SLOT_RUNNING || pool->slot_state[i] == SLOT_EXITED) {
+                pool->slot_state[i] = SLOT_JOINING;
+                tid = pool->threads[i];
+                found = 1;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&pool->scale_mutex);
+        if (!found)
+            break;
+        pthread_join(tid, NULL);
+    }
+}
+
+/**
+ * 终止线程池中的所有线程
+ * 
+ * 设置退出标志并等待所有线程结束
+ * 
+ * @param pool 线程池指针
+ */
+static void 
+__threads_terminate(thrdpool_t * pool) {
+    atomic_store(&pool->quit, 1);
+    __wake_all(pool);
+    __threads_join(pool);
+}
+
+/**
+ * 创建线程池中的工作线程
+ * 
+ * 分配 slots 个槽位并启动 min_threads 个常驻线程，如果创建过程中失败，则回滚并释放资源
+ * 
+ * @param pool 线程池指针
+ * @param slots 槽位数
+ * @return 成功返回0，失败返回-1
+ */
+static int 
+__threads_create(thrdpool_t *pool, int slots) {
+    int i;
+
+    pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * slots);
+    if (!pool->threads)
+        return -1;
+    if (pthread_mutex_init(&pool->scale_mutex, NULL) == 0) {
+        if (__workers_create(pool, slots) == 0) {
+            // 窃取时会遍历所有槽位，空槽位的双端队列总是空的
+            pool->thrd_count = slots;
+            for (i = 0; i < pool->min_threads; i++) {
+                if (__spawn_worker(pool) != 0)
+                    break;
+            }
+            if (i == pool->min_threads)
+                return 0;
+            __threads_terminate(pool);
+            __workers_destroy(pool, slots);
+        }
+        pthread_mutex_destroy(&pool->scale_mutex);
+    }
+    free(pool->threads);
+    return -1;
+}
+
+/**
+ * 终止线程池
+ * 
+ * 设置退出标志并唤醒所有阻塞的工作线程，但不等待线程结束；
+ * 正在执行的任务执行完，排队的任务不再执行，在 thrdpool_waitdone 里调用它们的 cancel
+ * 
+ * @param pool 要终止的线程池
+ */
+void
+thrdpool_terminate(thrdpool_t * pool) {
+    atomic_store(&pool->quit, 1);
+    __wake_all(pool);
+}
+
+/**
+ * 排空线程池
+ * 
+ * 不再接受外部投递(工作线程里的投递照常接受，嵌套的任务可以继续展开)，
+ * 工作线程执行完所有排队的任务后退出；不等待线程结束
+ * 
+ * @param pool 线程池
+ * @param timeout_ms 大于 0 时，超过这个时间后不再开始新任务，剩下的任务像 thrdpool_terminate 一样取消；
+ *                   只能限制开始新任务，已经在执行的任务仍要等它返回
+ */
+void
+thrdpool_drain(thrdpool_t *pool, int timeout_ms) {
+    if (timeout_ms > 0)
+        __atomic_store_n(&pool->drain_deadline_ns,
+                         thrdpool_now_ns() + (int64_t)timeout_ms * 1000000, __ATOMIC_RELAXED);
+    atomic_store(&pool->draining, 1);
+    __wake_all(pool);
+}
+
+/**
+ * 创建线程池
+ * 
+ * 创建线程池并启动指定数量的工作线程
+ * 
+ * @param thrd_count 工作线程数量
+ * @return 成功返回线程池指针，失败返回NULL
+ */
+thrdpool_t *
+thrdpool_create(int thrd_count) {
+    return thrdpool_create_ex(thrd_count, 0);
+}
+
+/**
+ * 创建线程池，可以选择调度方式
+ * 
+ * @param thrd_count 工作线程数量
+ * @param flags 0 为单一全局队列；THRDPOOL_WORK_STEALING 为每线程双端队列 + 分片注入队列
+ * @return 成功返回线程池指针，失败返回NULL
+ */
+thrdpool_t *
+thrdpool_create_ex(int thrd_count, int flags) {
+    struct thrdpool_opts opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.min_threads = thrd_count;
+    opts.max_threads = thrd_count;
+    opts.flags = flags;
+    return thrdpool_create_opts(&opts);
+}
+
+/**
+ * 创建可以动态伸缩的线程池
+ * 
+ * @param opts 线程数范围、扩容延迟、空闲超时和调度方式，字段为 0 时使用默认值
+ * @return 成功返回线程池指针，失败返回NULL
+ */
+thrdpool_t *
+thrdpool_create_opts(const struct thrdpool_opts *opts) {
+    thrdpool_t *pool;
+
+    if (opts->min_threads < 1)
+        return NULL;
+    pool = (thrdpool_t*)malloc(sizeof(*pool));
+    if (pool) {
+        task_queue_t *queue = __taskqueue_create();
+        if (queue) {
+            pool->task_queue = queue;
+            atomic_init(&pool->quit, 0);
+            atomic_init(&pool->idle, 0);
+            atomic_init(&pool->waking, 0);
+            spinlock_init(&pool->idle_lock);
+            pool->nidle = 0;
+            // 单核上自旋等不来别的线程投递，直接休眠
+            pool->spin_max = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_MAX : 0;
+            pool->flags = opts->flags;
+            pool->workers = NULL;
+            pool->min_threads = opts->min_threads;
+            pool->max_threads = opts->max_threads > opts->min_threads ? opts->max_threads : opts->min_threads;
+            pool->dynamic = pool->max_threads > pool->min_threads;
+            pool->timed = pool->dynamic || (opts->flags & THRDPOOL_STATS);
+            pool->spawn_delay_ns = (int64_t)(opts->spawn_delay_us > 0 ? opts->spawn_delay_us : DEFAULT_SPAWN_DELAY_US) * 1000;
+            pool->keepalive_ns = (int64_t)(opts->keepalive_ms > 0 ? opts->keepalive_ms : DEFAULT_KEEPALIVE_MS) * 1000000;
+            atomic_init(&pool->live, 0);
+            atomic_init(&pool->blocked, 0);
+            atomic_init(&pool->spawning, 0);
+            atomic_init(&pool->draining, 0);
+            atomic_init(&pool->cancelled, 0);
+            pool->drain_deadline_ns = 0;
+            pool->prio_queues[THRDPOOL_PRIO_NORMAL] = queue;
+            pool->prio_queues[THRDPOOL_PRIO_HIGH] = __taskqueue_create();
+            pool->prio_queues[THRDPOOL_PRIO_BACKGROUND] = __taskqueue_create();
+            if (pool->prio_queues[THRDPOOL_PRIO_HIGH] && pool->prio_queues[THRDPOOL_PRIO_BACKGROUND]) {
+                if (__shards_create(pool, (opts->flags & THRDPOOL_WORK_STEALING) ? pool->max_threads : 0) == 0) {
+                    // 多出的一倍槽位给阻塞补偿的线程
+                    if (__threads_create(pool, pool->max_threads * 2) == 0)
+                        return pool;
+                    __shards_destroy(pool);
+                }
+            }
+            if (pool->prio_queues[THRDPOOL_PRIO_HIGH])
+                __taskqueue_destroy(pool->prio_queues[THRDPOOL_PRIO_HIGH]);
+            if (pool->prio_queues[THRDPOOL_PRIO_BACKGROUND])
+                __taskqueue_destroy(pool->prio_queues[THRDPOOL_PRIO_BACKGROUND]);
+            __taskqueue_destroy(queue);
+        }
+        free(pool);
+    }
+    return NULL;
+}
+
+/**
+ * 向线程池提交任务
+ * 
+ * 创建一个任务并添加到线程池的任务队列，由工作线程异步执行
+ * 
+ * @param pool 线程池
+ * @param func 任务处理函数
+ * @param arg 传递给任务处理函数的参数
+ * @return 成功返回0，失败返回-1
+ */
+int
+thrdpool_post(thrdpool_t *pool, handler_pt func, void *arg) {
+    if (__post_closed(pool))
+        return -1;
+    task_t *task = __task_alloc();
+    if (!task) return -1;
+    task->func = func;
+    task->arg = arg;
+    task->cancel = NULL;
+    task->deadline_ns = 0;
+    task->prio = THRDPOOL_PRIO_NORMAL;
+    __post(pool, task);
+    return 0;
+}
+
+/**
+ * 指定优先级和截止时间投递任务
+ * 
+ * @param pool 线程池
+ * @param func 任务处理函数
+ * @param arg 传递给 func 或 cancel 的参数
+ * @param prio THRDPOOL_PRIO_*
+ * @param timeout_us 大于 0 时，从现在起超过这么久还没开始执行的任务不再执行
+ * @param cancel 过期时代替 func 调用，用来释放 arg，可为 NULL
+ * @return 成功返回0，失败返回-1
+ */
+int
+thrdpool_post_ex(thrdpool_t *pool, handler_pt func, void *arg,
+                 int prio, int64_t timeout_us, handler_pt cancel) {
+    if (__post_closed(pool))
+        return -1;
+    if (prio < 0 || prio >= THRDPOOL_PRIO_COUNT)
+        return -1;
+    task_t *task = __task_alloc();
+    if (!task) return -1;
+    task->func = func;
+    task->arg = arg;
+    task->cancel = cancel;
+    task->deadline_ns = timeout_us > 0 ? thrdpool_now_ns() + timeout_us * 1000 : 0;
+    task->prio = prio;
+    __post(pool, task);
+    return 0;
+}
+
+/**
+ * 投递侵入式任务
+ * 
+ * 任务内存由调用者提供，线程池只负责链接和执行，不分配也不释放
+ * 
+ * @param pool 线程池
+ * @param task 调用者的任务，func 和 arg 已设置好
+ * @return 成功返回0，线程池已终止返回-1
+ */
+int
+thrdpool_post_task(thrdpool_t *pool, thrdpool_task_t *task) {
+    if (__post_closed(pool))
+        return -1;
+    if (task->prio < 0 || task->prio >= THRDPOOL_PRIO_COUNT)
+        return -1;
+    task->owner = NULL;
+    __post(pool, task);
+    return 0;
+}
+
+/**
+ * 批量投递侵入式任务
+ * 
+ * 先在锁外把 tasks[0] ~ tasks[n-1] 链成一条链，再一次加锁接到队尾，
+ * 然后按等待线程数唤醒最多 n 个线程，代替 n 次加锁和 n 次 signal
+ * 
+ * @param pool 线程池
+ * @param tasks 调用者的任务数组，func 和 arg 已设置好，要求同 thrdpool_post_task
+ * @param n 任务个数
+ * @return 成功返回0，线程池已终止返回-1
+ */
+int
+thrdpool_post_batch(thrdpool_t *pool, thrdpool_task_t *tasks, int n) {
+    if (__post_closed(pool))
+        return -1;
+    if (n <= 0)
+        return 0;
+    int i, prio = tasks[0].prio;
+    if (prio < 0 || prio >= THRDPOOL_PRIO_COUNT)
+        return -1;
+    int64_t now = pool->timed ? thrdpool_now_ns() : 0;
+    for (i = 0; i < n; i++) {
+        tasks[i].next = &tasks[i + 1];
+        tasks[i].owner = NULL;
+        tasks[i].prio = prio;
+        tasks[i].enqueue_ns = now;
+    }
+    if (prio == THRDPOOL_PRIO_NORMAL && (pool->flags & THRDPOOL_WORK_STEALING)) {
+        __ws_post_chain(pool, &tasks[0], &tasks[n - 1], n);
+    } else {
+        __push_chain(pool->prio_queues[prio], &tasks[0], &tasks[n - 1], n);
+        __wake_n(pool, n);
+    }
+    return 0;
+}
+
+/**
+ * 等待线程池中所有任务完成并销毁线程池
+ * 
+ * 阻塞调用线程直到所有工作线程结束，然后取消还没执行的任务，清理所有资源
+ * 
+ * @param pool 要销毁的线程池
+ * @param done 输出整个生命周期的任务数，可为 NULL
+ */
+void
+thrdpool_waitdone(thrdpool_t *pool, struct thrdpool_done *done) {
+    int i, prio;
+
+    __threads_join(pool);
+    __cancel_pending(pool);
+    if (done) {
+        memset(done, 0, sizeof(*done));
+        for (i = 0; i < pool->thrd_count; i++) {
+            for (prio = 0; prio < THRDPOOL_PRIO_COUNT; prio++) {
+                done->completed += pool->workers[i].hist[prio].executed;
+                done->expired += pool->workers[i].hist[prio].expired;
+            }
+        }
+        done->cancelled = atomic_load(&pool->cancelled);
+    }
+    __workers_destroy(pool, pool->thrd_count);
+    pthread_mutex_destroy(&pool->scale_mutex);
+    __shards_destroy(pool);
+    __taskqueue_destroy(pool->prio_queues[THRDPOOL_PRIO_HIGH]);
+    __taskqueue_destroy(pool->prio_queues[THRDPOOL_PRIO_BACKGROUND]);
+    __taskqueue_destroy(pool->task_queue);
+    free(pool->threads);
+    free(pool);
+}
+
+// 由合并后的直方图求 p50 / p99，结果不超过 max
+static void
+__hist_percentiles(const uint64_t *buckets, uint64_t max, uint64_t *p50, uint64_t *p99) {
+    uint64_t total = 0, seen = 0;
+    int b, half = 0;
+
+    *p50 = *p99 = 0;
+    for (b = 0; b < HIST_BUCKETS; b++)
+        total += buckets[b];
+    if (total == 0)
+        return;
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        seen += buckets[b];
+        if (!half && seen * 2 >= total) {
+            *p50 = __hist_upper(b);
+            half = 1;
+        }
+        if (seen * 100 >= total * 99) {
+            *p99 = __hist_upper(b);
+            break;
+        }
+    }
+    if (*p99 > max)
+        *p99 = max;
+    if (*p50 > max)
+        *p50 = max;
+}
+
+/**
+ * 汇总各工作线程的统计
+ * 
+ * @param pool 线程池
+ * @param prio THRDPOOL_PRIO_*
+ * @param st 输出
+ * @return 成功返回0，prio 不合法返回-1
+ */
+int
+thrdpool_prio_stats(thrdpool_t *pool, int prio, struct thrdpool_prio_stats *st) {
+    uint64_t buckets[HIST_BUCKETS] = {0};
+    int i, b;
+
+    if (prio < 0 || prio >= THRDPOOL_PRIO_COUNT)
+        return -1;
+    memset(st, 0, sizeof(*st));
+    for (i = 0; i < pool->thrd_count; i++) {
+        prio_hist_t *hist = &pool->workers[i].hist[prio];
+        st->executed += __atomic_load_n(&hist->executed, __ATOMIC_RELAXED);
+        st->expired += __atomic_load_n(&hist->expired, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+        if (max > st->delay_max_us)
+            st->delay_max_us = max;
+        for (b = 0; b < HIST_BUCKETS; b++)
+            buckets[b] += __atomic_load_n(&hist->buckets[b], __ATOMIC_RELAXED);
+    }
+    __hist_percentiles(buckets, st->delay_max_us, &st->delay_p50_us, &st->delay_p99_us);
+    return 0;
+}
+
+// 当前排队的任务数，各队列分别读，不是一个精确的快照
+static uint64_t
+__queued(thrdpool_t *pool) {
+    long n = 0;
+    int i;
+    for (i = 0; i < THRDPOOL_PRIO_COUNT; i++)
+        n += __atomic_load_n(&pool->prio_queues[i]->count, __ATOMIC_RELAXED);
+    for (i = 0; i < pool->nshards; i++)
+        n += __atomic_load_n(&pool->shards[i]->count, __ATOMIC_RELAXED);
+    for (i = 0; i < pool->thrd_count; i++) {
+        ws_deque_t *q = &pool->workers[i].deque;
+        long d = atomic_load_explicit(&q->bottom, memory_order_relaxed)
+               - atomic_load_explicit(&q->top, memory_order_relaxed);
+        if (d > 0)
+            n += d;
+    }
+    return n > 0 ? (uint64_t)n : 0;
+}
+
+/**
+ * 线程池整体和每个工作线程的统计
+ * 
+ * 计数一直统计；排队延迟、执行时间、忙闲时间只在 THRDPOOL_STATS 下统计。
+ * 各计数由工作线程各自写在自己的缓存行里，这里不加锁地读，运行中读到的是近似值
+ * 
+ * @param pool 线程池
+ * @param st 输出整体统计
+ * @param workers 输出每个槽位的统计，下标为槽位号，可为 NULL
+ * @param nworkers workers 的长度，槽位多于它时只输出前 nworkers 个
+ * @return 槽位数
+ */
+int
+thrdpool_stats(thrdpool_t *pool, struct thrdpool_stats *st,
+               struct thrdpool_worker_stats *workers, int nworkers) {
+    uint64_t delay[HIST_BUCKETS] = {0};
+    uint64_t run[HIST_BUCKETS] = {0};
+    int64_t now = thrdpool_now_ns();
+    int i, b, prio;
+
+    memset(st, 0, sizeof(*st));
+    for (i = 0; i < pool->thrd_count; i++) {
+        worker_t *w = &pool->workers[i];
+        uint64_t executed = 0, max;
+        for (prio = 0; prio < THRDPOOL_PRIO_COUNT; prio++) {
+            prio_hist_t *hist = &w->hist[prio];
+            executed += __atomic_load_n(&hist->executed, __ATOMIC_RELAXED);
+            st->expired += __atomic_load_n(&hist->expired, __ATOMIC_RELAXED);
+            max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+            if (max > st->delay_max_us)
+                st->delay_max_us = max;
+            for (b = 0; b < HIST_BUCKETS; b++)
+                delay[b] += __atomic_load_n(&hist->buckets[b], __ATOMIC_RELAXED);
+        }
+        max = __atomic_load_n(&w->run_max, __ATOMIC_RELAXED);
+        if (max > st->run_max_us)
+            st->run_max_us = max;
+        for (b = 0; b < HIST_BUCKETS; b++)
+            run[b] += __atomic_load_n(&w->run_buckets[b], __ATOMIC_RELAXED);
+
+        // 加上正在进行的执行和休眠，采样间隔里长时间休眠的线程也算进空闲
+        uint64_t busy = __atomic_load_n(&w->busy_ns, __ATOMIC_RELAXED) / 1000;
+        uint64_t idle = __atomic_load_n(&w->idle_ns, __ATOMIC_RELAXED) / 1000;
+        int64_t since = __atomic_load_n(&w->busy_since, __ATOMIC_RELAXED);
+        if (since && now > since)
+            busy += (uint64_t)(now - since) / 1000;
+        since = __atomic_load_n(&w->idle_since, __ATOMIC_RELAXED);
+        if (since && now > since)
+            idle += (uint64_t)(now - since) / 1000;
+        st->executed += executed;
+        st->busy_us += busy;
+        st->idle_us += idle;
+        if (workers && i < nworkers) {
+            workers[i].executed = executed;
+            workers[i].busy_us = busy;
+            workers[i].idle_us = idle;
+        }
+    }
+    __hist_percentiles(delay, st->delay_max_us, &st->delay_p50_us, &st->delay_p99_us);
+    __hist_percentiles(run, st->run_max_us, &st->run_p50_us, &st->run_p99_us);
+    if (st->busy_us + st->idle_us > 0)
+        st->utilization = (double)st->busy_us / (double)(st->busy_us + st->idle_us);
+    st->cancelled = atomic_load(&pool->cancelled);
+    st->queued = __queued(pool);
+    st->threads = atomic_load(&pool->live);
+    return pool->thrd_count;
+}
+
+/**
+ * 当前运行中的工作线程数
+ * 
+ * @param pool 线程池
+ * @return 线程数，包括处在阻塞区间的线程
+ */
+int
+thrdpool_threads(thrdpool_t *pool) {
+    return atomic_load(&pool->live);
+}
+
+/**
+ * 标记当前任务进入阻塞调用(磁盘 IO、同步 RPC 等)
+ * 
+ * 阻塞的线程不计入 max_threads；没有空闲线程时立刻补一个，队列里的任务不用等阻塞结束。
+ * 只在线程池的任务里调用才有效果，要和 thrdpool_blocking_end 成对使用
+ */
+void
+thrdpool_blocking_begin(void) {
+    worker_t *w = tls_worker;
+    if (!w)
+        return;
+    atomic_fetch_add(&w->pool->blocked, 1);
+    if (atomic_load(&w->pool->idle) == 0)
+        __maybe_spawn(w->pool);
+}
+
+void
+thrdpool_blocking_end(void) {
+    worker_t *w = tls_worker;
+    if (!w)
+        return;
+    atomic_fetch_sub(&w->pool->blocked, 1);
+}
+
+/*
+串行执行体(strand)：同一个 strand 上的任务按投递顺序逐个执行，不同 strand 之间并行
+- 任务挂在一个无锁的多生产者单消费者队列上(Vyukov 侵入式队列，带一个 stub 节点)，
+  投递只有一次 exchange；节点用线程池的任务缓存分配
+- pending 计数：投递时 +1，从 0 变 1 的那次投递负责把 runner 投到线程池，所以同一时刻最多一个 runner；
+  runner 每执行完一个任务 -1，减到 0 就返回，执行满 STRAND_BATCH 个还有剩余就把自己重新投递，让出工作线程
+- runner 是嵌在 strand 里的侵入式任务，线程池终止时它的 cancel 取消 strand 里剩下的任务
+*/
+#define STRAND_BATCH    64
+
+struct thrdpool_strand_s {
+    thrdpool_t *pool;
+    thrdpool_task_t runner;
+    task_t *head;                   // 只由 runner 访问
+    task_t stub;
+    task_t fin;                     // thrdpool_strand_destroy 放入的结束标记，func 为 NULL
+    _Atomic(task_t *) tail __attribute__((aligned(CACHELINE)));
+    atomic_long pending;
+};
+
+static void
+__strand_push(thrdpool_strand_t *s, task_t *task) {
+    __atomic_store_n(&task->next, NULL, __ATOMIC_RELAXED);
+    task_t *prev = atomic_exchange_explicit(&s->tail, task, memory_order_acq_rel);
+    __atomic_store_n(&prev->next, task, __ATOMIC_RELEASE);
+}
+
+// 队列为空或者生产者交换了 tail 还没链上时返回 NULL
+static task_t *
+__strand_pop(thrdpool_strand_t *s) {
+    task_t *head = s->head;
+    task_t *next = (task_t *)__atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (head == &s->stub) {
+        if (!next)
+            return NULL;
+        s->head = head = next;
+        next = (task_t *)__atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        s->head = next;
+        return head;
+    }
+    if (atomic_load_explicit(&s->tail, memory_order_acquire) != head)
+        return NULL;
+    // head 是最后一个节点，放回 stub 才能把它取走
+    __strand_push(s, &s->stub);
+    next = (task_t *)__atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        s->head = next;
+        return head;
+    }
+    return NULL;
+}
+
+// pending > 0 时一定有节点，只是可能还没链上，等生产者完成
+static task_t *
+__strand_pop_wait(thrdpool_strand_t *s) {
+    task_t *task;
+    int spin = 0;
+    while (!(task = __strand_pop(s))) {
+        if (++spin < 64)
+            __cpu_relax();
+        else
+            sched_yield();
+    }
+    return task;
+}
+
+static void __strand_run(void *arg);
+static void __strand_cancel(void *arg);
+
+static void
+__strand_schedule(thrdpool_strand_t *s) {
+    thrdpool_task_init(&s->runner, __strand_run, s);
+    s->runner.cancel = __strand_cancel;
+    __post(s->pool, &s->runner);
+}
+
+static void
+__strand_run(void *arg) {
+    thrdpool_strand_t *s = (thrdpool_strand_t *)arg;
+    int n;
+
+    for (n = 0; n < STRAND_BATCH; n++) {
+        task_t *task = __strand_pop_wait(s);
+        handler_pt func = task->func;
+        void *ctx = task->arg;
+        if (!func) {
+            // 结束标记一定是最后一个
+            free(s);
+            return;
+        }
+        __task_free(task);
+        func(ctx);
+        if (atomic_fetch_sub(&s->pending, 1) == 1)
+            return;
+    }
+    __strand_schedule(s);
+}
+
+// runner 没能执行(线程池终止或排空超时)：剩下的任务调用 cancel
+static void
+__strand_cancel(void *arg) {
+    thrdpool_strand_t *s = (thrdpool_strand_t *)arg;
+
+    do {
+        task_t *task = __strand_pop_wait(s);
+        handler_pt cancel = task->cancel;
+        void *ctx = task->arg;
+        if (!task->func) {
+            free(s);
+            return;
+        }
+        __task_free(task);
+        atomic_fetch_add(&s->pool->cancelled, 1);
+        if (cancel)
+            cancel(ctx);
+    } while (atomic_fetch_sub(&s->pending, 1) != 1);
+}
+
+/**
+ * 创建串行执行体
+ * 
+ * @param pool 执行任务的线程池
+ * @return 成功返回指针，内存不足返回NULL
+ */
+thrdpool_strand_t *
+thrdpool_strand_create(thrdpool_t *pool) {
+    void *mem;
+    if (posix_memalign(&mem, CACHELINE, sizeof(thrdpool_strand_t)) != 0)
+        return NULL;
+    thrdpool_strand_t *s = (thrdpool_strand_t *)mem;
+    memset(s, 0, sizeof(*s));
+    s->pool = pool;
+    s->head = &s->stub;
+    atomic_init(&s->tail, &s->stub);
+    atomic_init(&s->pending, 0);
+    return s;
+}
+
+/**
+ * 向串行执行体投递任务
+ * 
+ * 同一个 strand 上的任务按投递顺序执行，前一个返回后才开始下一个；多个线程同时投递时以入队先后为准
+ * 
+ * @param strand 串行执行体
+ * @param func 任务处理函数，不能为 NULL
+ * @param arg 传递给 func 或 cancel 的参数
+ * @param cancel 线程池终止时任务还没执行，代替 func 调用，可为 NULL
+ * @return 成功返回0，线程池已终止返回-1
+ */
+int
+thrdpool_strand_post(thrdpool_strand_t *strand, handler_pt func, void *arg, handler_pt cancel) {
+    if (!func || __post_closed(strand->pool))
+        return -1;
+    task_t *task = __task_alloc();
+    if (!task) return -1;
+    task->func = func;
+    task->arg = arg;
+    task->cancel = cancel;
+    __strand_push(strand, task);
+    if (atomic_fetch_add(&strand->pending, 1) == 0)
+        __strand_schedule(strand);
+    return 0;
+}
+
+/**
+ * 销毁串行执行体
+ * 
+ * 在最后一次投递之后调用；还有任务没执行完时由 runner 执行完(或取消完)再释放
+ * 
+ * @param strand 串行执行体
+ */
+void
+thrdpool_strand_destroy(thrdpool_strand_t *strand) {
+    if (atomic_fetch_add(&strand->pending, 1) == 0) {
+        free(strand);
+        return;
+    }
+    strand->fin.func = NULL;
+    strand->fin.owner = NULL;
+    __strand_push(strand, &strand->fin);
 }
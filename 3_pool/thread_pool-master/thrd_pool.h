@@ -1,10 +1,90 @@
 #ifndef _THREAD_POOL_H
 #define _THREAD_POOL_H
 
+#include <stdint.h>
+
 typedef struct thrdpool_s thrdpool_t;
+// 串行执行体：投递到同一个 strand 的任务按顺序执行，不会并行
+typedef struct thrdpool_strand_s thrdpool_strand_t;
 // 任务执行的规范 ctx 上下文
 typedef void (*handler_pt)(void * /* ctx */);
 
+// 优先级：每个优先级一个队列，高优先级严格优先；普通和后台按 8:1 加权选取，后台任务不会饿死
+#define THRDPOOL_PRIO_NORMAL        0
+#define THRDPOOL_PRIO_HIGH          1
+#define THRDPOOL_PRIO_BACKGROUND    2
+#define THRDPOOL_PRIO_COUNT         3
+
+// 侵入式任务：调用者把它嵌在自己的结构里，用 thrdpool_post_task 投递，线程池不做任何分配。
+// 从投递到 func 开始执行之前不能修改或释放；func 开始执行后线程池不再访问它，可以在 func 里复用或释放。
+// 线程池终止时还没执行的任务调用 cancel(arg)，cancel 为 NULL 时直接丢弃，由调用者回收
+typedef struct thrdpool_task_s {
+    void *next;             // 线程池内部链表使用
+    handler_pt func;
+    void *arg;
+    void *owner;            // 线程池内部使用
+    handler_pt cancel;      // 过了截止时间或线程池终止时不再执行 func，改为调用 cancel(arg)；NULL 表示直接丢弃
+    int64_t deadline_ns;    // 截止时间，thrdpool_now_ns() 的时间基准，0 表示没有截止时间
+    int64_t enqueue_ns;     // 线程池内部使用
+    int prio;               // THRDPOOL_PRIO_*
+} thrdpool_task_t;
+
+// 各优先级的统计，排队延迟是从投递到开始执行，只在 THRDPOOL_STATS 下统计
+struct thrdpool_prio_stats {
+    uint64_t executed;      // 执行了 func 的任务数
+    uint64_t expired;       // 过了截止时间被取消的任务数
+    uint64_t delay_p50_us;
+    uint64_t delay_p99_us;
+    uint64_t delay_max_us;
+};
+
+// 线程池整体统计，计数一直统计，时间类只在 THRDPOOL_STATS 下统计
+struct thrdpool_stats {
+    int threads;            // 运行中的工作线程数
+    uint64_t queued;        // 当前排队的任务数(近似值)
+    uint64_t executed;      // 执行了 func 的任务数
+    uint64_t expired;
+    uint64_t cancelled;
+    uint64_t delay_p50_us;  // 从投递到开始执行，各优先级合计
+    uint64_t delay_p99_us;
+    uint64_t delay_max_us;
+    uint64_t run_p50_us;    // 任务执行时间
+    uint64_t run_p99_us;
+    uint64_t run_max_us;
+    uint64_t busy_us;       // 所有线程执行任务的时间之和
+    uint64_t idle_us;       // 所有线程等任务(自旋和休眠)的时间之和
+    double utilization;     // busy / (busy + idle)
+};
+
+// 单个工作线程槽位的统计，槽位被退出的线程和之后新建的线程先后使用时累计
+struct thrdpool_worker_stats {
+    uint64_t executed;
+    uint64_t busy_us;
+    uint64_t idle_us;
+};
+
+// thrdpool_waitdone 的输出
+struct thrdpool_done {
+    uint64_t completed;     // 执行了 func 的任务数
+    uint64_t expired;       // 过了截止时间被取消的任务数
+    uint64_t cancelled;     // 终止或排空超时时还在排队、被取消的任务数
+};
+
+// thrdpool_create_ex 的 flags
+// 工作窃取：每个工作线程一个 Chase-Lev 双端队列，外部投递进分片的注入队列，空闲线程随机窃取
+#define THRDPOOL_WORK_STEALING  0x1
+// 统计排队延迟、执行时间和线程忙闲时间，每个任务多两次 clock_gettime，每次休眠多两次
+#define THRDPOOL_STATS          0x2
+
+// 动态伸缩的参数，字段为 0 时使用默认值
+struct thrdpool_opts {
+    int min_threads;        // 常驻线程数，至少为 1
+    int max_threads;        // 线程数上限，小于 min_threads 时等于 min_threads(固定大小)；阻塞区间里的线程不计入
+    int spawn_delay_us;     // 任务排队超过这么久并且没有空闲线程时增加一个线程，默认 1000
+    int keepalive_ms;       // 多于 min_threads 的线程空闲这么久后退出，默认 10000
+    int flags;              // 同 thrdpool_create_ex
+};
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -13,14 +93,75 @@ extern "C"
 // 对称处理
 thrdpool_t *thrdpool_create(int thrd_count);
 
+thrdpool_t *thrdpool_create_ex(int thrd_count, int flags);
+
+// 线程数在 [min_threads, max_threads] 之间按排队延迟伸缩
+thrdpool_t *thrdpool_create_opts(const struct thrdpool_opts *opts);
+
+// 立即停止：正在执行的任务执行完，排队的任务在 thrdpool_waitdone 里取消
 void thrdpool_terminate(thrdpool_t * pool);
 
+// 排空：不再接受外部投递，排队的任务都执行完后线程退出；
+// timeout_ms > 0 时超时后不再开始新任务，剩下的任务取消
+void thrdpool_drain(thrdpool_t *pool, int timeout_ms);
+
 int thrdpool_post(thrdpool_t *pool, handler_pt func, void *arg);
 
-void thrdpool_waitdone(thrdpool_t *pool);
+// 指定优先级投递；timeout_us > 0 时超过这个时间还没开始执行就不再执行，改为调用 cancel(arg)
+int thrdpool_post_ex(thrdpool_t *pool, handler_pt func, void *arg,
+                     int prio, int64_t timeout_us, handler_pt cancel);
+
+// 投递调用者提供的任务，不分配内存；调用前用 thrdpool_task_init 初始化
+int thrdpool_post_task(thrdpool_t *pool, thrdpool_task_t *task);
+
+// 批量投递 tasks[0] ~ tasks[n-1]，一次加锁接入队列，最多唤醒 n 个空闲线程；
+// 整批使用 tasks[0] 的优先级
+int thrdpool_post_batch(thrdpool_t *pool, thrdpool_task_t *tasks, int n);
+
+// prio 不合法返回 -1
+int thrdpool_prio_stats(thrdpool_t *pool, int prio, struct thrdpool_prio_stats *st);
+
+// 整体统计写入 st，每个槽位的统计写入 workers[0 ~ nworkers-1](可为 NULL)；返回槽位数
+int thrdpool_stats(thrdpool_t *pool, struct thrdpool_stats *st,
+                   struct thrdpool_worker_stats *workers, int nworkers);
+
+// 截止时间使用的时钟(CLOCK_MONOTONIC)
+int64_t thrdpool_now_ns(void);
+
+// 在 thrdpool_terminate 或 thrdpool_drain 之后调用，等线程结束后销毁线程池；done 可为 NULL
+void thrdpool_waitdone(thrdpool_t *pool, struct thrdpool_done *done);
+
+// 串行执行体：同一个 strand 上的任务按投递顺序逐个执行，不同 strand 之间并行，代替按 key 加锁。
+// strand 里的任务在线程池统计中按 runner 计数，每个 runner 连续执行最多 64 个任务
+thrdpool_strand_t *thrdpool_strand_create(thrdpool_t *pool);
+
+// func 不能为 NULL；线程池终止时还没执行的任务调用 cancel(arg)
+int thrdpool_strand_post(thrdpool_strand_t *strand, handler_pt func, void *arg, handler_pt cancel);
+
+// 最后一次投递之后调用，剩下的任务执行完后释放
+void thrdpool_strand_destroy(thrdpool_strand_t *strand);
+
+// 当前运行中的工作线程数
+int thrdpool_threads(thrdpool_t *pool);
+
+// 在任务里包住阻塞调用：阻塞期间不计入 max_threads，没有空闲线程时补一个线程接着处理队列
+void thrdpool_blocking_begin(void);
+void thrdpool_blocking_end(void);
 
 #ifdef __cplusplus
 }
 #endif
 
+static inline void
+thrdpool_task_init(thrdpool_task_t *task, handler_pt func, void *arg) {
+    task->next = 0;
+    task->func = func;
+    task->arg = arg;
+    task->owner = 0;
+    task->cancel = 0;
+    task->deadline_ns = 0;
+    task->enqueue_ns = 0;
+    task->prio = THRDPOOL_PRIO_NORMAL;
+}
+
 #endif
\ No newline at end of file
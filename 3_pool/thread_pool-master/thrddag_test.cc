@@ -0,0 +1,223 @@
+#include "thrd_pool.h"
+#include "thrd_dag.h"
+#include <chrono>
+#include <cstdint>
+#include <atomic>
+#include <iostream>
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <pthread.h>
+
+/**
+ * 依赖图和手工协调的对比
+ *
+ * 图是 stages 层宽扇出/扇入：每层 width 个节点都依赖上一层的汇合节点，汇合节点依赖本层全部节点。
+ *   poll      每层投递 width 个任务，主线程 usleep 轮询计数，到齐后投递下一层(thrdpool_test.cc 的做法)
+ *   countdown 每层最后一个完成的任务投递下一层，全部结束后用条件变量通知主线程(手写的最好情况)
+ *   dag       同一张图用 thrddag 声明一次，反复 thrddag_run
+ * 另外跑一条 thrddag_then 串起来的长链，以及环检测。
+ *
+ * shell: gcc -O2 -c thrd_dag.c thrd_pool.c
+ * shell: g++ -O2 thrddag_test.cc thrd_dag.o thrd_pool.o -o thrddag_test -I./ -lpthread
+ * usage: ./thrddag_test [global|ws] [nconsumer] [stages] [width] [spin]
+ */
+
+static int g_spin = 2000;
+
+static int64_t NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+}
+
+// 每个节点做一点计算
+static void Work(void *ctx) {
+    volatile int x = 0;
+    for (int i = 0; i < g_spin; ++i) x += i;
+    if (ctx) static_cast<std::atomic<int64_t> *>(ctx)->fetch_add(1);
+}
+
+static void Nop(void *ctx) {
+    (void)ctx;
+}
+
+// ---- poll ----
+
+static int64_t run_poll(thrdpool_t *pool, int stages, int width) {
+    std::atomic<int64_t> done{0};
+    int64_t t1 = NowUs();
+    for (int s = 0; s < stages; ++s) {
+        done = 0;
+        for (int i = 0; i < width; ++i) {
+            thrdpool_post(pool, Work, &done);
+        }
+        while (done.load() != width) {
+            usleep(100);
+        }
+        Work(nullptr);          // 汇合节点
+    }
+    return NowUs() - t1;
+}
+
+// ---- countdown ----
+
+struct Countdown {
+    thrdpool_t *pool;
+    int stages;
+    int width;
+    int stage;
+    std::atomic<int> left;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool done;
+};
+
+static void CountdownTask(void *ctx);
+
+static void CountdownStage(Countdown *c) {
+    c->left.store(c->width);
+    for (int i = 0; i < c->width; ++i) {
+        thrdpool_post(c->pool, CountdownTask, c);
+    }
+}
+
+static void CountdownTask(void *ctx) {
+    Countdown *c = static_cast<Countdown *>(ctx);
+    Work(nullptr);
+    if (c->left.fetch_sub(1) != 1) return;
+    Work(nullptr);              // 汇合节点
+    if (++c->stage < c->stages) {
+        CountdownStage(c);
+        return;
+    }
+    pthread_mutex_lock(&c->mutex);
+    c->done = true;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->mutex);
+}
+
+static int64_t run_countdown(thrdpool_t *pool, int stages, int width) {
+    Countdown c;
+    c.pool = pool;
+    c.stages = stages;
+    c.width = width;
+    c.stage = 0;
+    c.done = false;
+    pthread_mutex_init(&c.mutex, NULL);
+    pthread_cond_init(&c.cond, NULL);
+
+    int64_t t1 = NowUs();
+    CountdownStage(&c);
+    pthread_mutex_lock(&c.mutex);
+    while (!c.done) pthread_cond_wait(&c.cond, &c.mutex);
+    pthread_mutex_unlock(&c.mutex);
+    int64_t used = NowUs() - t1;
+
+    pthread_cond_destroy(&c.cond);
+    pthread_mutex_destroy(&c.mutex);
+    return used;
+}
+
+// ---- dag ----
+
+static thrddag_t *build_fan(thrdpool_t *pool, int stages, int width, std::atomic<int64_t> *count) {
+    thrddag_t *dag = thrddag_create(pool);
+    std::vector<thrddag_node_t *> mids(width);
+    thrddag_node_t *join = nullptr;
+    for (int s = 0; s < stages; ++s) {
+        for (int i = 0; i < width; ++i) {
+            mids[i] = join ? thrddag_then(join, Work, count) : thrddag_node(dag, Work, count);
+        }
+        join = thrddag_when_all(dag, mids.data(), width, Work, count);
+    }
+    return dag;
+}
+
+static void print_stats(const char *name, thrddag_t *dag) {
+    struct thrddag_stats st;
+    thrddag_stats(dag, &st);
+    std::cout << name << " nodes:" << st.nodes << " edges:" << st.edges
+        << " wall_us:" << st.wall_us << " work_us:" << st.work_us
+        << " critical_us:" << st.critical_us << " critical_nodes:" << st.critical_nodes
+        << " parallelism:" << (st.critical_us ? (double)st.work_us / st.critical_us : 0)
+        << std::endl;
+}
+
+void test_fan(int nconsumer, int flags, int stages, int width) {
+    const int rounds = 5;
+    auto pool = thrdpool_create_ex(nconsumer, flags);
+    std::atomic<int64_t> count{0};
+    const char *mode = (flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ";
+
+    int64_t t1 = NowUs();
+    thrddag_t *dag = build_fan(pool, stages, width, &count);
+    int64_t build = NowUs() - t1;
+
+    int64_t poll = 0, countdown = 0, run = 0;
+    int failed = 0;
+    for (int r = 0; r < rounds; ++r) {
+        poll += run_poll(pool, stages, width);
+        countdown += run_countdown(pool, stages, width);
+        t1 = NowUs();
+        failed += thrddag_run(dag) != 0;
+        run += NowUs() - t1;
+    }
+    std::cout << mode << stages << "x" << width << " x" << nconsumer << " avg us"
+        << " poll:" << poll / rounds << " countdown:" << countdown / rounds
+        << " dag:" << run / rounds << " dag_build:" << build
+        << " dag_count:" << count.load() << "/" << (int64_t)rounds * stages * (width + 1)
+        << " failed:" << failed << std::endl;
+    print_stats(mode, dag);
+
+    thrddag_destroy(dag);
+    thrdpool_terminate(pool);
+    thrdpool_waitdone(pool, NULL);
+}
+
+// then 串起来的长链：后继在同一个工作线程上接着执行，不经过队列
+void test_chain(int nconsumer, int flags, int len) {
+    auto pool = thrdpool_create_ex(nconsumer, flags);
+    std::atomic<int64_t> count{0};
+    thrddag_t *dag = thrddag_create(pool);
+    thrddag_node_t *node = thrddag_node(dag, Nop, nullptr);
+    for (int i = 1; i < len; ++i) {
+        node = thrddag_then(node, Work, &count);
+    }
+    int ret = thrddag_run(dag);
+    std::cout << ((flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ")
+        << "chain " << len << " ret:" << ret << " count:" << count.load() << std::endl;
+    print_stats("chain  ", dag);
+    thrddag_destroy(dag);
+
+    // 有环时不执行
+    dag = thrddag_create(pool);
+    thrddag_node_t *a = thrddag_node(dag, Work, &count);
+    thrddag_node_t *b = thrddag_then(a, Work, &count);
+    thrddag_edge(b, a);
+    count = 0;
+    ret = thrddag_run(dag);
+    std::cout << "cycle ret:" << ret << " count:" << count.load() << std::endl;
+    thrddag_destroy(dag);
+
+    thrdpool_terminate(pool);
+    thrdpool_waitdone(pool, NULL);
+}
+
+int main(int argc, char **argv) {
+    int flags = argc > 1 && strcmp(argv[1], "ws") == 0 ? THRDPOOL_WORK_STEALING : 0;
+    int nconsumer = argc > 2 ? atoi(argv[2]) : 4;
+    int stages = argc > 3 ? atoi(argv[3]) : 64;
+    int width = argc > 4 ? atoi(argv[4]) : 64;
+    if (argc > 5) g_spin = atoi(argv[5]);
+    if (argc > 1) {
+        test_fan(nconsumer, flags, stages, width);
+        return 0;
+    }
+    test_fan(4, 0, 64, 64);
+    test_fan(4, THRDPOOL_WORK_STEALING, 64, 64);
+    test_fan(4, 0, 4, 1024);
+    test_chain(4, 0, 10000);
+    return 0;
+}
@@ -7,11 +7,26 @@
 #include <thread>
 #include <iostream>
 #include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <sys/resource.h>
+#include <pthread.h>
 
 /**
  * author: mark 
  * QQ: 2548898954
  * shell: g++ -Wl,-rpath=./ thrdpool_test.cc -o thrdpool_test -I./ -L./ -lthrdpool -lpthread
+ * usage: ./thrdpool_test [global|ws] [nproducer] [nconsumer] [alloc|intrusive]
+ *        ./thrdpool_test batch [global|ws] [nproducer] [nconsumer]
+ *        ./thrdpool_test burst [global|ws] [nconsumer] [burst]
+ *        ./thrdpool_test prio [global|ws] [nconsumer]
+ *        ./thrdpool_test scale [global|ws]
+ *        ./thrdpool_test shutdown [global|ws] [nconsumer]
+ *        ./thrdpool_test stats [global|ws] [nconsumer]
+ *        ./thrdpool_test strand [global|ws] [nconsumer] [nstrands]
+ *        不带参数时两种模式各跑 4x4 和 16x16，再各跑一次 4x4 的侵入式投递、批量投递、突发投递、优先级、伸缩、关闭、统计和 strand 测试
  */
 
 time_t GetTick() {
@@ -33,10 +48,590 @@ void producer(thrdpool_t *pool) {
     }
 }
 
-void test_thrdpool(int nproducer, int nconsumer) {
-    auto pool = thrdpool_create(nconsumer);
+// 侵入式投递：任务结构由调用者预先准备好，线程池不分配内存
+void producer_intrusive(thrdpool_t *pool, thrdpool_task_t *tasks) {
+    for(int64_t i=0; i < n; ++i) {
+        thrdpool_task_init(&tasks[i], JustTask, NULL);
+        thrdpool_post_task(pool, &tasks[i]);
+    }
+}
+
+// 批量投递：每次 thrdpool_post_batch 投递 batch 个
+void producer_batch(thrdpool_t *pool, thrdpool_task_t *tasks, int batch) {
+    for(int64_t i=0; i < n; i += batch) {
+        int cnt = (int)std::min<int64_t>(batch, n - i);
+        for (int j=0; j<cnt; ++j) {
+            thrdpool_task_init(&tasks[i + j], JustTask, NULL);
+        }
+        thrdpool_post_batch(pool, tasks + i, cnt);
+    }
+}
+
+// 分别统计投递速度(所有生产者投递完的时间)和执行速度(全部执行完的时间)
+void test_post_batch(int nproducer, int nconsumer, int flags, int batch) {
+    g_count = 0;
+    auto pool = thrdpool_create_ex(nconsumer, flags);
+    thrdpool_task_t *tasks = new thrdpool_task_t[n * nproducer]();
+    std::vector<std::thread> producers;
+
+    time_t t1 = GetTick();
     for (int i=0; i<nproducer; ++i) {
-        std::thread(&producer, pool).detach();
+        producers.emplace_back(&producer_batch, pool, tasks + n * i, batch);
+    }
+    for (auto &t : producers) {
+        t.join();
+    }
+    time_t t2 = GetTick();
+    while (g_count.load() != n*nproducer) {
+        usleep(1000);
+    }
+    time_t t3 = GetTick();
+
+    std::cout << ((flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ")
+        << "batch " << batch << " " << nproducer << "x" << nconsumer
+        << " post per sec:" << (double)n*nproducer*1000 / std::max<time_t>(t2-t1, 1)
+        << " exec per sec:" << (double)n*nproducer*1000 / std::max<time_t>(t3-t1, 1) << std::endl;
+
+    thrdpool_terminate(pool);
+    thrdpool_waitdone(pool, NULL);
+    delete[] tasks;
+}
+
+// 突发负载：每次投递 burst 个任务，等它们执行完再停 200us 让工作线程去休眠，
+// 统计从投递到任务开始执行的延迟，以及整个过程的上下文切换次数
+int64_t NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+}
+
+struct BurstTask {
+    thrdpool_task_t task;
+    int64_t post_us;
+    int64_t start_us;
+};
+
+std::atomic<int> g_burst_done{0};
+void BurstJob(void *ctx) {
+    BurstTask *t = (BurstTask *)ctx;
+    t->start_us = NowUs();
+    ++g_burst_done;
+}
+
+void test_burst(int nconsumer, int flags, int burst) {
+    constexpr int rounds = 5000;
+    auto pool = thrdpool_create_ex(nconsumer, flags);
+    std::vector<BurstTask> tasks(burst);
+    std::vector<int64_t> lat;
+    lat.reserve((size_t)rounds * burst);
+
+    struct rusage ru1, ru2;
+    getrusage(RUSAGE_SELF, &ru1);
+    time_t t1 = GetTick();
+    for (int r=0; r<rounds; ++r) {
+        g_burst_done = 0;
+        for (auto &t : tasks) {
+            thrdpool_task_init(&t.task, BurstJob, &t);
+            t.post_us = NowUs();
+            thrdpool_post_task(pool, &t.task);
+        }
+        while (g_burst_done.load() != burst) {
+            std::this_thread::yield();
+        }
+        for (auto &t : tasks) {
+            lat.push_back(t.start_us - t.post_us);
+        }
+        usleep(200);
+    }
+    time_t t2 = GetTick();
+    getrusage(RUSAGE_SELF, &ru2);
+
+    std::sort(lat.begin(), lat.end());
+    double avg = 0;
+    for (auto v : lat) avg += v;
+    avg /= lat.size();
+    std::cout << ((flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ")
+        << "burst " << burst << " x" << nconsumer << " used:" << t2-t1
+        << " wake latency avg:" << avg << "us p50:" << lat[lat.size() / 2]
+        << "us p99:" << lat[lat.size() * 99 / 100] << "us"
+        << " csw:" << (ru2.ru_nvcsw - ru1.ru_nvcsw) + (ru2.ru_nivcsw - ru1.ru_nivcsw) << std::endl;
+
+    thrdpool_terminate(pool);
+    thrdpool_waitdone(pool, NULL);
+}
+
+// 优先级：后台任务(每个忙 20us)把线程池压满，同时每 500us 投递一个延迟敏感的小任务，
+// 分别用 HIGH 和 NORMAL(相当于没有优先级)投递延迟敏感任务，比较它们的排队延迟。
+// 后台任务带 50ms 截止时间，积压过期的走 cancel
+std::atomic<int> g_pending{0};
+std::atomic<int64_t> g_cancelled{0};
+std::atomic<bool> g_stop{false};
+
+void BulkJob(void *ctx) {
+    (void)ctx;
+    int64_t end = NowUs() + 20;
+    while (NowUs() < end) {}
+    --g_pending;
+}
+
+void BulkCancel(void *ctx) {
+    (void)ctx;
+    ++g_cancelled;
+    --g_pending;
+}
+
+void bulk_producer(thrdpool_t *pool, int prio) {
+    while (!g_stop.load()) {
+        if (g_pending.load() > 20000) {
+            std::this_thread::yield();
+            continue;
+        }
+        ++g_pending;
+        if (thrdpool_post_ex(pool, BulkJob, NULL, prio, 50000, BulkCancel) != 0) {
+            --g_pending;
+        }
+    }
+}
+
+struct LatencyTask {
+    int64_t post_us;
+    int64_t delay_us;
+};
+
+void LatencyJob(void *ctx) {
+    LatencyTask *t = (LatencyTask *)ctx;
+    t->delay_us = NowUs() - t->post_us;
+}
+
+void test_prio(int nconsumer, int flags, bool use_prio) {
+    constexpr int count = 4000;
+    g_pending = 0;
+    g_cancelled = 0;
+    g_stop = false;
+    auto pool = thrdpool_create_ex(nconsumer, flags | THRDPOOL_STATS);
+    int bulk_prio = use_prio ? THRDPOOL_PRIO_BACKGROUND : THRDPOOL_PRIO_NORMAL;
+    int lat_prio = use_prio ? THRDPOOL_PRIO_HIGH : THRDPOOL_PRIO_NORMAL;
+
+    std::vector<std::thread> producers;
+    for (int i=0; i<2; ++i) {
+        producers.emplace_back(&bulk_producer, pool, bulk_prio);
+    }
+    usleep(100000);
+
+    std::vector<LatencyTask> tasks(count);
+    for (auto &t : tasks) {
+        t.delay_us = -1;
+        t.post_us = NowUs();
+        thrdpool_post_ex(pool, LatencyJob, &t, lat_prio, 0, NULL);
+        usleep(500);
+    }
+    usleep(100000);
+    g_stop = true;
+    for (auto &t : producers) {
+        t.join();
+    }
+
+    std::vector<int64_t> lat;
+    for (auto &t : tasks) {
+        if (t.delay_us >= 0) lat.push_back(t.delay_us);
+    }
+    std::sort(lat.begin(), lat.end());
+    std::cout << ((flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ")
+        << (use_prio ? "prio high/background " : "prio normal/normal    ")
+        << "latency tasks done:" << lat.size() << "/" << count;
+    if (!lat.empty()) {
+        std::cout << " p50:" << lat[lat.size() / 2] << "us p99:" << lat[lat.size() * 99 / 100]
+            << "us max:" << lat.back() << "us";
+    }
+    std::cout << " bulk cancelled:" << g_cancelled.load() << std::endl;
+
+    const char *names[THRDPOOL_PRIO_COUNT] = {"normal", "high", "background"};
+    for (int prio=0; prio<THRDPOOL_PRIO_COUNT; ++prio) {
+        struct thrdpool_prio_stats st;
+        thrdpool_prio_stats(pool, prio, &st);
+        if (st.executed + st.expired == 0) continue;
+        std::cout << "    " << names[prio] << " executed:" << st.executed << " expired:" << st.expired
+            << " delay p50:" << st.delay_p50_us << "us p99:" << st.delay_p99_us
+            << "us max:" << st.delay_max_us << "us" << std::endl;
+    }
+
+    thrdpool_terminate(pool);
+    thrdpool_waitdone(pool, NULL);
+}
+
+// 伸缩：
+// 1. 2000 个各阻塞 2ms 的任务，固定 2 线程和 2~16 线程对比总耗时，记录峰值线程数，空闲 keepalive 之后线程数回落
+// 2. 固定 2 线程，先投两个阻塞 300ms 的任务，再投 200 个小任务，比较阻塞调用包不包 thrdpool_blocking_begin/end 时
+//    小任务全部完成的时间
+// 3. 扩容进行中终止线程池
+std::atomic<int> g_scale_done{0};
+void SleepJob(void *ctx) {
+    (void)ctx;
+    usleep(2000);
+    ++g_scale_done;
+}
+
+void SmallJob(void *ctx) {
+    (void)ctx;
+    ++g_scale_done;
+}
+
+void BlockingJob(void *ctx) {
+    bool hint = ctx != NULL;
+    if (hint) thrdpool_blocking_begin();
+    usleep(300000);
+    if (hint) thrdpool_blocking_end();
+    ++g_scale_done;
+}
+
+void test_scale_grow(int flags, int max_threads) {
+    constexpr int count = 2000;
+    struct thrdpool_opts opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.min_threads = 2;
+    opts.max_threads = max_threads;
+    opts.keepalive_ms = 300;
+    opts.flags = flags;
+    auto pool = thrdpool_create_opts(&opts);
+    g_scale_done = 0;
+    int peak = 0;
+
+    time_t t1 = GetTick();
+    for (int i=0; i<count; ++i) {
+        thrdpool_post(pool, SleepJob, NULL);
+    }
+    while (g_scale_done.load() != count) {
+        peak = std::max(peak, thrdpool_threads(pool));
+        usleep(1000);
+    }
+    time_t t2 = GetTick();
+    usleep(1000000);
+    std::cout << ((flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ")
+        << "scale 2~" << max_threads << " used:" << t2-t1 << " peak threads:" << peak
+        << " after idle:" << thrdpool_threads(pool) << std::endl;
+
+    thrdpool_terminate(pool);
+    thrdpool_waitdone(pool, NULL);
+}
+
+void test_scale_blocking(int flags, bool hint) {
+    constexpr int count = 200;
+    auto pool = thrdpool_create_ex(2, flags);
+    g_scale_done = 0;
+
+    time_t t1 = GetTick();
+    for (int i=0; i<2; ++i) {
+        thrdpool_post(pool, BlockingJob, hint ? pool : NULL);
+    }
+    usleep(10000);
+    for (int i=0; i<count; ++i) {
+        thrdpool_post(pool, SmallJob, NULL);
+    }
+    while (g_scale_done.load() < count) {
+        usleep(1000);
+    }
+    time_t t2 = GetTick();
+    int threads = thrdpool_threads(pool);
+    while (g_scale_done.load() < count + 2) {
+        usleep(1000);
+    }
+    std::cout << ((flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ")
+        << (hint ? "blocking hint   " : "blocking no hint")
+        << " small tasks done after:" << t2-t1 << "ms threads:" << threads << std::endl;
+
+    thrdpool_terminate(pool);
+    thrdpool_waitdone(pool, NULL);
+}
+
+void test_scale_terminate(int flags) {
+    struct thrdpool_opts opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.min_threads = 1;
+    opts.max_threads = 32;
+    opts.spawn_delay_us = 100;
+    opts.flags = flags;
+    int max_seen = 0;
+    for (int r=0; r<20; ++r) {
+        auto pool = thrdpool_create_opts(&opts);
+        for (int i=0; i<500; ++i) {
+            thrdpool_post(pool, SleepJob, NULL);
+        }
+        usleep(5000 + r * 500);
+        max_seen = std::max(max_seen, thrdpool_threads(pool));
+        thrdpool_terminate(pool);
+        thrdpool_waitdone(pool, NULL);
+    }
+    std::cout << ((flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ")
+        << "terminate while scaling x20 ok, max threads seen:" << max_seen << std::endl;
+}
+
+void test_scale(int flags) {
+    test_scale_grow(flags, 2);
+    test_scale_grow(flags, 16);
+    test_scale_blocking(flags, false);
+    test_scale_blocking(flags, true);
+    test_scale_terminate(flags);
+}
+
+// 关闭：每个任务带一个 malloc 的上下文，由 func 或 cancel 释放；
+// 分别用 排空 / 立即终止 / 限时排空 关闭积压了 10000 个 100us 任务的线程池，
+// 检查 waitdone 返回的计数和没有被释放的上下文数。
+// 排空时任务里继续投递的子任务照常执行；立即终止时侵入式任务同样调用 cancel
+std::atomic<int64_t> g_live_ctx{0};
+
+struct ShutdownCtx {
+    thrdpool_t *pool;
+    int children;
+};
+
+void ShutdownCancel(void *ctx) {
+    free(ctx);
+    --g_live_ctx;
+}
+
+void ShutdownJob(void *ctx) {
+    ShutdownCtx *c = (ShutdownCtx *)ctx;
+    int64_t end = NowUs() + 100;
+    while (NowUs() < end) {}
+    for (int i=0; i<c->children; ++i) {
+        ShutdownCtx *child = (ShutdownCtx *)malloc(sizeof(ShutdownCtx));
+        child->pool = c->pool;
+        child->children = 0;
+        ++g_live_ctx;
+        if (thrdpool_post_ex(c->pool, ShutdownJob, child, THRDPOOL_PRIO_NORMAL, 0, ShutdownCancel) != 0) {
+            ShutdownCancel(child);
+        }
+    }
+    ShutdownCancel(ctx);
+}
+
+struct IntrusiveCtx {
+    thrdpool_task_t task;
+    std::atomic<int> *state;    // 1 执行，2 取消
+};
+
+void IntrusiveRun(void *ctx) {
+    IntrusiveCtx *c = (IntrusiveCtx *)ctx;
+    c->state->store(1);
+}
+
+void IntrusiveCancel(void *ctx) {
+    IntrusiveCtx *c = (IntrusiveCtx *)ctx;
+    c->state->store(2);
+}
+
+void test_shutdown(int nconsumer, int flags, const char *mode, int children) {
+    constexpr int count = 10000;
+    g_live_ctx = 0;
+    auto pool = thrdpool_create_ex(nconsumer, flags);
+    for (int i=0; i<count; ++i) {
+        ShutdownCtx *c = (ShutdownCtx *)malloc(sizeof(ShutdownCtx));
+        c->pool = pool;
+        c->children = children;
+        ++g_live_ctx;
+        if (thrdpool_post_ex(pool, ShutdownJob, c, THRDPOOL_PRIO_NORMAL, 0, ShutdownCancel) != 0) {
+            ShutdownCancel(c);
+        }
+    }
+    std::vector<IntrusiveCtx> intrusive(100);
+    std::vector<std::atomic<int>> state(intrusive.size());
+    for (size_t i=0; i<intrusive.size(); ++i) {
+        state[i] = 0;
+        intrusive[i].state = &state[i];
+        thrdpool_task_init(&intrusive[i].task, IntrusiveRun, &intrusive[i]);
+        intrusive[i].task.cancel = IntrusiveCancel;
+        thrdpool_post_task(pool, &intrusive[i].task);
+    }
+
+    time_t t1 = GetTick();
+    if (strcmp(mode, "drain") == 0) {
+        thrdpool_drain(pool, 0);
+    } else if (strcmp(mode, "timed") == 0) {
+        thrdpool_drain(pool, 200);
+    } else {
+        thrdpool_terminate(pool);
+    }
+    struct thrdpool_done done;
+    thrdpool_waitdone(pool, &done);
+    time_t t2 = GetTick();
+
+    int run = 0, cancelled = 0;
+    for (auto &st : state) {
+        if (st.load() == 1) ++run;
+        if (st.load() == 2) ++cancelled;
+    }
+    std::cout << ((flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ")
+        << "shutdown " << mode << (children ? " nested" : "       ")
+        << " waitdone used:" << t2-t1 << "ms completed:" << done.completed
+        << " cancelled:" << done.cancelled << " leaked ctx:" << g_live_ctx.load()
+        << " intrusive run/cancel/lost:" << run << "/" << cancelled << "/"
+        << (int)intrusive.size() - run - cancelled << std::endl;
+}
+
+// 统计：每 200ms 投递一批 1000 个 50us 的任务，每 100ms 用 thrdpool_stats 采样一次，
+// 打印排队数和这 100ms 内的利用率，最后打印延迟、执行时间和每个线程执行的任务数
+void BusyJob(void *ctx) {
+    int64_t end = NowUs() + (int64_t)(intptr_t)ctx;
+    while (NowUs() < end) {}
+}
+
+void test_stats(int nconsumer, int flags) {
+    auto pool = thrdpool_create_ex(nconsumer, flags | THRDPOOL_STATS);
+    struct thrdpool_stats st, last;
+    thrdpool_stats(pool, &last, NULL, 0);
+
+    const char *name = (flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ";
+    for (int tick=0; tick<10; ++tick) {
+        if (tick % 2 == 0) {
+            for (int i=0; i<1000; ++i) {
+                thrdpool_post(pool, BusyJob, (void *)(intptr_t)50);
+            }
+        }
+        usleep(100000);
+        thrdpool_stats(pool, &st, NULL, 0);
+        uint64_t busy = st.busy_us - last.busy_us, idle = st.idle_us - last.idle_us;
+        std::cout << name << "stats t:" << (tick + 1) * 100 << "ms threads:" << st.threads
+            << " queued:" << st.queued << " executed:" << st.executed
+            << " util:" << (busy + idle ? 100 * busy / (busy + idle) : 0) << "%" << std::endl;
+        last = st;
+    }
+
+    std::vector<struct thrdpool_worker_stats> workers(64);
+    int slots = thrdpool_stats(pool, &st, workers.data(), (int)workers.size());
+    std::cout << name << "stats total delay p50:" << st.delay_p50_us << "us p99:" << st.delay_p99_us
+        << "us max:" << st.delay_max_us << "us run p50:" << st.run_p50_us << "us p99:" << st.run_p99_us
+        << "us max:" << st.run_max_us << "us utilization:" << (int)(st.utilization * 100) << "%" << std::endl;
+    std::cout << name << "stats per worker executed:";
+    for (int i=0; i<slots && i<(int)workers.size(); ++i) {
+        if (workers[i].executed + workers[i].busy_us + workers[i].idle_us == 0) continue;
+        std::cout << " " << workers[i].executed;
+    }
+    std::cout << std::endl;
+
+    thrdpool_terminate(pool);
+    thrdpool_waitdone(pool, NULL);
+}
+
+// strand：4 个生产者各投递 200000 个任务，轮流发往 nstrands 个 key。
+// 每个任务检查同一个 key 上没有并行执行，并且同一个生产者的任务按投递顺序执行，key 上的计数不用原子操作。
+// 和 "thrdpool_post + 每个 key 一把互斥锁" 对比吞吐，后者不保证顺序，只检查互斥
+constexpr int kStrandProducers = 4;
+constexpr int kStrandPerProducer = 200000;
+
+struct StrandKey {
+    thrdpool_strand_t *strand;
+    pthread_mutex_t mutex;
+    std::atomic<int> running{0};
+    int last_seq[kStrandProducers];
+    int64_t count;
+};
+
+struct StrandItem {
+    StrandKey *key;
+    int producer;
+    int seq;
+};
+
+std::atomic<int64_t> g_strand_done{0};
+std::atomic<int64_t> g_strand_violations{0};
+
+void StrandBody(StrandItem *item, bool check_order) {
+    StrandKey *key = item->key;
+    if (key->running.fetch_add(1) != 0) ++g_strand_violations;
+    if (check_order) {
+        if (key->last_seq[item->producer] >= item->seq) ++g_strand_violations;
+        key->last_seq[item->producer] = item->seq;
+    }
+    ++key->count;
+    key->running.fetch_sub(1);
+    ++g_strand_done;
+}
+
+void StrandJob(void *ctx) {
+    StrandBody((StrandItem *)ctx, true);
+}
+
+void MutexJob(void *ctx) {
+    StrandItem *item = (StrandItem *)ctx;
+    pthread_mutex_lock(&item->key->mutex);
+    StrandBody(item, false);
+    pthread_mutex_unlock(&item->key->mutex);
+}
+
+void strand_producer(thrdpool_t *pool, StrandItem *items, bool use_strand) {
+    for (int i=0; i<kStrandPerProducer; ++i) {
+        if (use_strand) {
+            thrdpool_strand_post(items[i].key->strand, StrandJob, &items[i], NULL);
+        } else {
+            thrdpool_post(pool, MutexJob, &items[i]);
+        }
+    }
+}
+
+void test_strand(int nconsumer, int flags, int nstrands, bool use_strand) {
+    auto pool = thrdpool_create_ex(nconsumer, flags);
+    std::vector<StrandKey> keys(nstrands);
+    for (auto &k : keys) {
+        k.strand = thrdpool_strand_create(pool);
+        pthread_mutex_init(&k.mutex, NULL);
+        for (auto &seq : k.last_seq) seq = -1;
+        k.count = 0;
+    }
+    std::vector<StrandItem> items((size_t)kStrandProducers * kStrandPerProducer);
+    for (int p=0; p<kStrandProducers; ++p) {
+        for (int i=0; i<kStrandPerProducer; ++i) {
+            StrandItem &item = items[(size_t)p * kStrandPerProducer + i];
+            item.key = &keys[(i + p) % nstrands];
+            item.producer = p;
+            item.seq = i;
+        }
+    }
+    g_strand_done = 0;
+    g_strand_violations = 0;
+
+    time_t t1 = GetTick();
+    std::vector<std::thread> producers;
+    for (int p=0; p<kStrandProducers; ++p) {
+        producers.emplace_back(&strand_producer, pool, &items[(size_t)p * kStrandPerProducer], use_strand);
+    }
+    for (auto &t : producers) {
+        t.join();
+    }
+    while (g_strand_done.load() != (int64_t)items.size()) {
+        usleep(1000);
+    }
+    time_t t2 = GetTick();
+
+    int64_t total = 0;
+    for (auto &k : keys) total += k.count;
+    std::cout << ((flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ")
+        << (use_strand ? "strand " : "mutex  ") << nstrands << " keys x" << nconsumer
+        << " used:" << t2-t1 << " exec per sec:" << (double)items.size()*1000 / (t2-t1)
+        << " count:" << total << " violations:" << g_strand_violations.load() << std::endl;
+
+    // 最后一个任务计数之后还要解锁，先等工作线程结束再销毁锁
+    thrdpool_terminate(pool);
+    thrdpool_waitdone(pool, NULL);
+    for (auto &k : keys) {
+        thrdpool_strand_destroy(k.strand);
+        pthread_mutex_destroy(&k.mutex);
+    }
+}
+
+void test_thrdpool(int nproducer, int nconsumer, int flags = 0, bool intrusive = false) {
+    g_count = 0;
+    auto pool = thrdpool_create_ex(nconsumer, flags);
+    thrdpool_task_t *tasks = nullptr;
+    std::vector<std::thread> producers;
+    if (intrusive) {
+        tasks = new thrdpool_task_t[n * nproducer]();    // 先把页面碰一遍，缺页不计入测试时间
+        for (int i=0; i<nproducer; ++i) {
+            producers.emplace_back(&producer_intrusive, pool, tasks + n * i);
+        }
+    } else {
+        for (int i=0; i<nproducer; ++i) {
+            producers.emplace_back(&producer, pool);
+        }
     }
 
     time_t t1 = GetTick();
@@ -47,15 +642,106 @@ void test_thrdpool(int nproducer, int nconsumer) {
 
     time_t t2 = GetTick();
 
-    std::cout << t2 << " " << t1 << " " << "used:" << t2-t1 << " exec per sec:"
+    std::cout << ((flags & THRDPOOL_WORK_STEALING) ? "ws     " : "global ")
+        << ((flags & THRDPOOL_STATS) ? "stats " : "")
+        << (intrusive ? "intrusive " : "alloc     ")
+        << nproducer << "x" << nconsumer << " "
+        << t2 << " " << t1 << " " << "used:" << t2-t1 << " exec per sec:"
         << (double)g_count.load()*1000 / (t2-t1) << std::endl;
 
+    // 最后一个任务执行完时生产者可能还在 thrdpool_post 里，等它们返回再销毁线程池
+    for (auto &t : producers) {
+        t.join();
+    }
     thrdpool_terminate(pool);
-    thrdpool_waitdone(pool);
+    thrdpool_waitdone(pool, NULL);
+    delete[] tasks;
 }
 
-int main() {
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "batch") == 0) {
+        int flags = argc > 2 && strcmp(argv[2], "ws") == 0 ? THRDPOOL_WORK_STEALING : 0;
+        int nproducer = argc > 3 ? atoi(argv[3]) : 4;
+        int nconsumer = argc > 4 ? atoi(argv[4]) : nproducer;
+        for (int batch : {1, 16, 256}) {
+            test_post_batch(nproducer, nconsumer, flags, batch);
+        }
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "prio") == 0) {
+        int flags = argc > 2 && strcmp(argv[2], "ws") == 0 ? THRDPOOL_WORK_STEALING : 0;
+        int nconsumer = argc > 3 ? atoi(argv[3]) : 4;
+        test_prio(nconsumer, flags, false);
+        test_prio(nconsumer, flags, true);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "strand") == 0) {
+        int flags = argc > 2 && strcmp(argv[2], "ws") == 0 ? THRDPOOL_WORK_STEALING : 0;
+        int nconsumer = argc > 3 ? atoi(argv[3]) : 4;
+        int nstrands = argc > 4 ? atoi(argv[4]) : 16;
+        test_strand(nconsumer, flags, nstrands, false);
+        test_strand(nconsumer, flags, nstrands, true);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "stats") == 0) {
+        int flags = argc > 2 && strcmp(argv[2], "ws") == 0 ? THRDPOOL_WORK_STEALING : 0;
+        int nconsumer = argc > 3 ? atoi(argv[3]) : 4;
+        test_stats(nconsumer, flags);
+        test_thrdpool(4, nconsumer, flags);
+        test_thrdpool(4, nconsumer, flags | THRDPOOL_STATS);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "shutdown") == 0) {
+        int flags = argc > 2 && strcmp(argv[2], "ws") == 0 ? THRDPOOL_WORK_STEALING : 0;
+        int nconsumer = argc > 3 ? atoi(argv[3]) : 4;
+        test_shutdown(nconsumer, flags, "drain", 0);
+        test_shutdown(nconsumer, flags, "drain", 2);
+        test_shutdown(nconsumer, flags, "terminate", 0);
+        test_shutdown(nconsumer, flags, "timed", 0);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "scale") == 0) {
+        test_scale(argc > 2 && strcmp(argv[2], "ws") == 0 ? THRDPOOL_WORK_STEALING : 0);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "burst") == 0) {
+        int flags = argc > 2 && strcmp(argv[2], "ws") == 0 ? THRDPOOL_WORK_STEALING : 0;
+        int nconsumer = argc > 3 ? atoi(argv[3]) : 4;
+        int burst = argc > 4 ? atoi(argv[4]) : 8;
+        test_burst(nconsumer, flags, burst);
+        return 0;
+    }
+    if (argc > 1) {
+        int flags = strcmp(argv[1], "ws") == 0 ? THRDPOOL_WORK_STEALING : 0;
+        int nproducer = argc > 2 ? atoi(argv[2]) : 4;
+        int nconsumer = argc > 3 ? atoi(argv[3]) : nproducer;
+        bool intrusive = argc > 4 && strcmp(argv[4], "intrusive") == 0;
+        test_thrdpool(nproducer, nconsumer, flags, intrusive);
+        return 0;
+    }
     // test_thrdpool(1, 8);
     test_thrdpool(4, 4);
+    test_thrdpool(4, 4, THRDPOOL_WORK_STEALING);
+    test_thrdpool(16, 16);
+    test_thrdpool(16, 16, THRDPOOL_WORK_STEALING);
+    test_thrdpool(4, 4, 0, true);
+    test_thrdpool(4, 4, THRDPOOL_WORK_STEALING, true);
+    for (int batch : {1, 16, 256}) {
+        test_post_batch(4, 4, 0, batch);
+    }
+    for (int batch : {1, 16, 256}) {
+        test_post_batch(4, 4, THRDPOOL_WORK_STEALING, batch);
+    }
+    test_burst(4, 0, 8);
+    test_burst(4, THRDPOOL_WORK_STEALING, 8);
+    test_prio(4, 0, false);
+    test_prio(4, 0, true);
+    test_scale(0);
+    test_shutdown(4, 0, "drain", 0);
+    test_shutdown(4, 0, "terminate", 0);
+    test_shutdown(4, 0, "timed", 0);
+    test_stats(4, 0);
+    test_strand(4, 0, 16, false);
+    test_strand(4, 0, 16, true);
     return 0;
 }